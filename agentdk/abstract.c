@@ -54,6 +54,7 @@ SOFTWARE.
 #include "lwpmudrv_struct.h"
 #include "rise_errors.h"
 #include "abstract.h"
+#include "capture.h"
 #include "log.h"
 #include "./abstract_service.c"
 
@@ -66,12 +67,44 @@ static  READ_THREAD            samp_r               = NULL;
 static  READ_THREAD            uncsamp_r            = NULL;
 static  DRV_BOOL               unc_threads_spawn    = FALSE;
 static  READ_THREAD            sideband_r           = NULL;
+static  DRV_BOOL               emon_cpu_readers     = FALSE;
 static  S8                    *seed_name            = NULL;
 static  DRV_BOOL               counting_mode        = FALSE;
 static  U32                    abs_num_packages     = 0;
 static  U32                    agent_mode           = NATIVE_AGENT;
 static  U32                    sched_switch_enabled = FALSE;
 static  U32                    agent_osid           = 0;
+static  CAPTURE                abs_capture          = NULL;
+
+/*
+ *  Latest topology and TSC skew replies, written into each new capture.
+ *  The topology is read before the driver is initialised, so before the
+ *  capture of the collection exists.
+ */
+typedef struct HELD_METADATA_NODE_S  HELD_METADATA_NODE;
+typedef        HELD_METADATA_NODE   *HELD_METADATA;
+
+struct HELD_METADATA_NODE_S {
+    U32    cmd;
+    U32    section;
+    U32    source;
+    U32    size;
+    PVOID  buf;
+};
+
+#define HELD_METADATA_cmd(x)      (x)->cmd
+#define HELD_METADATA_section(x)  (x)->section
+#define HELD_METADATA_source(x)   (x)->source
+#define HELD_METADATA_size(x)     (x)->size
+#define HELD_METADATA_buf(x)      (x)->buf
+
+static  HELD_METADATA_NODE     abs_held_metadata[] = {
+    { DRV_OPERATION_SET_CPU_TOPOLOGY,      CAPTURE_SECTION_TOPOLOGY, DRV_OPERATION_SET_CPU_TOPOLOGY,      0, NULL },
+    { DRV_OPERATION_GET_PLATFORM_TOPOLOGY, CAPTURE_SECTION_TOPOLOGY, DRV_OPERATION_GET_PLATFORM_TOPOLOGY, 0, NULL },
+    { DRV_OPERATION_GET_UNCORE_TOPOLOGY,   CAPTURE_SECTION_TOPOLOGY, DRV_OPERATION_GET_UNCORE_TOPOLOGY,   0, NULL },
+    { DRV_OPERATION_TSC_SKEW_INFO,         CAPTURE_SECTION_SKEW,     CAPTURE_UNKNOWN_SOURCE,              0, NULL },
+};
+#define NUM_HELD_METADATA  (sizeof(abs_held_metadata) / sizeof(abs_held_metadata[0]))
 
 /* ------------------------------------------------------------------------- */
 /*!
@@ -79,47 +112,46 @@ static  U32                    agent_osid           = 0;
  *
  * @param       THREAD_ARG args - thread specific argument holding the arguments
  *
- * @brief       helper function to sends data form specified file to remote host
+ * @brief       helper function to send the data of the thread's device from the capture to remote host
  *
  * @return      DRV_STATUS - 0 for success, otherwise for failure
  *
+ * <I>Special Notes:</I>
+ *              The thread's conn_type is also its capture section, and its
+ *              conn_id the source. Each chunk is one read from the device,
+ *              sent in the order it was read.
  */
 static int
 abstract_Send_Data_To_Host(
     THREAD_ARG  args
 )
 {
-    DRV_STATUS   status         = VT_SUCCESS;
-    U64         *output_buffer  = NULL;
-    U64          out_buf_size   = 1 << OUT_BUF_SIZE;
-    S32          bytecount      = 0;
-    S32          total_sent     = 0;
-    S32          send_size      = 0;
-    U32          out_fd;
+    DRV_STATUS                status         = VT_SUCCESS;
+    U64                      *output_buffer  = NULL;
+    U64                       out_buf_size   = 1 << OUT_BUF_SIZE;
+    CAPTURE_INDEX_ENTRY_NODE  entry;
+    S64                       position;
 
+    if (!abs_capture) {
+        return VT_FILE_OPEN_FAILED;
+    }
     output_buffer   = (U64 *)calloc((size_t)out_buf_size, sizeof(U64));
     if (!output_buffer) {
         SEPAGENT_PRINT_ERROR("Could not allocate output buffer\n");
         return VT_NO_MEMORY;
     }
-    out_fd = open(THREAD_ARG_oname(args), O_RDONLY);
-    if (out_fd == -1) {
-        SEPAGENT_PRINT_ERROR("Could not open tmp file(%s)\n", THREAD_ARG_oname(args));
-        free(output_buffer);
-        return VT_FILE_OPEN_FAILED;
-    }
-    //read the tmp file and send to remote host
-    while (TRUE) {
-        memset(output_buffer, '\0', sizeof(output_buffer));
-        bytecount = read(out_fd, output_buffer, (out_buf_size*sizeof(U64)));
-        if (bytecount <= 0) {
+    //read the device's chunks and send them to remote host
+    position = CAPTURE_Next(abs_capture, THREAD_ARG_conn_type(args), THREAD_ARG_conn_id(args), -1, &entry);
+    while (position >= 0) {
+        status = CAPTURE_Read(abs_capture, &entry, output_buffer, (U32)(out_buf_size * sizeof(U64)));
+        if (status != VT_SUCCESS) {
             break;
         }
-        COMM_Send_Data_On_Target(THREAD_ARG_conn_id(args), THREAD_ARG_conn_type(args), output_buffer, bytecount);
+        COMM_Send_Data_On_Target(THREAD_ARG_conn_id(args), THREAD_ARG_conn_type(args), output_buffer, CAPTURE_INDEX_ENTRY_size(&entry));
+        position = CAPTURE_Next(abs_capture, THREAD_ARG_conn_type(args), THREAD_ARG_conn_id(args), position, &entry);
     }
     free(output_buffer);
-    close(out_fd);
-    return VT_SUCCESS;
+    return status;
 }
 
 /* ------------------------------------------------------------------------- */
@@ -139,16 +171,13 @@ abstract_Read_Records (
 )
 {
     int                  dev_fd = -1;
-    int                  out_fd = -1;;
     int                  status;
     U64                  out_buf_size     = 1 << OUT_BUF_SIZE;
     ssize_t              bytecount        = 0;
     S32                  bytecount_target = 0;
     int                  me;
     char                *device_name;
-    char                *output_name;
     U64                 *output_buffer    = NULL;
-    int                  write_return_int;
     U32                  conn_id          = 0;
     U32                  conn_type        = 0;
 
@@ -161,11 +190,10 @@ abstract_Read_Records (
     }
 
     device_name = THREAD_ARG_dname((THREAD_ARG)args);
-    output_name = THREAD_ARG_oname((THREAD_ARG)args);
     conn_id     = THREAD_ARG_conn_id((THREAD_ARG)args);
     conn_type   = THREAD_ARG_conn_type((THREAD_ARG)args);
 
-    SEPAGENT_PRINT_DEBUG("got device_name=%s, output_name=%s, me=%d, conn_id=%u\n", device_name, output_name, me, conn_id);
+    SEPAGENT_PRINT_DEBUG("got device_name=%s, me=%d, conn_id=%u\n", device_name, me, conn_id);
 
     dev_fd = open(device_name, O_RDONLY);
     if (dev_fd == -1) {
@@ -175,9 +203,8 @@ abstract_Read_Records (
 
     if (data_transfer_mode == DELAYED_TRANSFER) {
         pthread_cond_init(&stop_received, NULL);
-        out_fd = open(output_name, O_CREAT|O_TRUNC|O_WRONLY, 0644);
-        if (out_fd == -1) {
-            SEPAGENT_PRINT_ERROR("Could not open %s (tmp file) on target\n", output_name);
+        if (!abs_capture) {
+            SEPAGENT_PRINT_ERROR("No capture on target for %s\n", device_name);
             pthread_exit((PVOID)VT_FILE_OPEN_FAILED);
         }
     }
@@ -197,11 +224,9 @@ abstract_Read_Records (
                 }
             }
             else {
-                if (out_fd >= 0) {
-                    write_return_int = write(out_fd, output_buffer, bytecount);
-                    if (write_return_int <= 0) {
-                         SEPAGENT_PRINT_WARNING("couldn't write to file\n");
-                    }
+                status = CAPTURE_Append(abs_capture, conn_type, conn_id, output_buffer, (U32)bytecount);
+                if (status != VT_SUCCESS) {
+                    SEPAGENT_PRINT_WARNING("couldn't write to capture\n");
                 }
             }
         }
@@ -218,17 +243,10 @@ abstract_Read_Records (
 
     // In delayed mode, wait for stop command and send data to remote host
     if (data_transfer_mode == DELAYED_TRANSFER) {
-        status = close(out_fd);
-        if (status < 0) {
-            perror("closing out_fd");
-        }
-        else {
-            SEPAGENT_PRINT_DEBUG("Closed tmp file %s\n", output_name);
-            pthread_mutex_lock(&stop_lock);
-            pthread_cond_wait(&stop_received, &stop_lock);
-            pthread_mutex_unlock(&stop_lock);
-            status = abstract_Send_Data_To_Host(args);
-        }
+        pthread_mutex_lock(&stop_lock);
+        pthread_cond_wait(&stop_received, &stop_lock);
+        pthread_mutex_unlock(&stop_lock);
+        status = abstract_Send_Data_To_Host(args);
     }
     free(output_buffer);
     pthread_exit((PVOID)&status);
@@ -325,17 +343,6 @@ abstract_Spawn_Pthreads (
     if (num_chars < 0 || num_chars > THREAD_ARG_SIZE) {
         return VT_SAM_ERROR;
     }
-    if (data_transfer_mode == DELAYED_TRANSFER) {
-        num_chars = DRV_SNPRINTF(READ_THREAD_oname(&mod_r),
-                                THREAD_ARG_SIZE,
-                                THREAD_ARG_SIZE,
-                                "%so%u_user.mod",
-                                seed_name, agent_osid);
-        if (num_chars < 0 || num_chars > THREAD_ARG_SIZE) {
-            return VT_SAM_ERROR;
-        }
-    }
-
     READ_THREAD_me(&mod_r)       = 0;
     READ_THREAD_conn_id(&mod_r)    = COMM_MODULE_CONN_ID;
     READ_THREAD_conn_type(&mod_r)  = COMM_DATA_MODULE;
@@ -361,16 +368,6 @@ abstract_Spawn_Pthreads (
             if (num_chars < 0 || num_chars > THREAD_ARG_SIZE) {
                 return VT_SAM_ERROR;
             }
-            if (data_transfer_mode == DELAYED_TRANSFER) {
-                num_chars = DRV_SNPRINTF(READ_THREAD_oname(lt),
-                                         THREAD_ARG_SIZE,
-                                         THREAD_ARG_SIZE,
-                                         "%s%d.txt",
-                                         seed_name, i);
-                if (num_chars < 0 || num_chars > THREAD_ARG_SIZE) {
-                    return VT_SAM_ERROR;
-                }
-            }
             READ_THREAD_me(lt)      = i;
             READ_THREAD_conn_id(lt) = i;
             READ_THREAD_conn_type(lt) = COMM_DATA_CPU;
@@ -396,16 +393,6 @@ abstract_Spawn_Pthreads (
             if (num_chars < 0 || num_chars > THREAD_ARG_SIZE) {
                 return VT_SAM_ERROR;
             }
-            if (data_transfer_mode == DELAYED_TRANSFER) {
-                num_chars = DRV_SNPRINTF(READ_THREAD_oname(lt),
-                                        THREAD_ARG_SIZE,
-                                        THREAD_ARG_SIZE,
-                                        "%so%u_v%d_sideband.txt",
-                                        seed_name, agent_osid, i);
-                if (num_chars < 0 || num_chars > THREAD_ARG_SIZE) {
-                    return VT_SAM_ERROR;
-                }
-            }
             READ_THREAD_me(lt)      = i;
             READ_THREAD_conn_id(lt)   = i;
             READ_THREAD_conn_type(lt) = COMM_DATA_SIDEBAND;
@@ -421,6 +408,76 @@ abstract_Spawn_Pthreads (
 }
 
 
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          abstract_Spawn_Pthreads_EMON(num_cpus)
+ *
+ * @param       int        num_cpus - number of threads to spawn for reading EMON records
+ *
+ * @brief       Spawn a thread per cpu to read the per-CPU EMON records of a counting collection
+ *              Allocate and set up per-thread argument structures,
+ *              later used for joining in abstract_Join_Pthreads_EMON()
+ *
+ * @return      DRV_STATUS - 0 for success, otherwise for failure
+ *
+ * <I>Special Notes:</I>
+ *              With DRV_CONFIG_emon_per_cpu set, every CPU writes its EMON records
+ *              to its own sample device, which the driver waits on at stop.
+ *              No module reader is created: a counting collection has no module records.
+ */
+static DRV_STATUS
+abstract_Spawn_Pthreads_EMON (
+    int num_cpus
+)
+{
+    int  status;
+    int  num_chars;
+    int  i;
+    char *device_name = NULL;
+
+    if (agent_mode != NATIVE_AGENT && agent_mode != HOST_VM_AGENT) {
+        return VT_SUCCESS;
+    }
+
+    if (prev_driver_loaded) {
+        device_name = SEP_PREV_DEVICE_NAME;
+    }
+    else {
+        device_name = SEP_DEVICE_NAME;
+    }
+
+    samp_r = (READ_THREAD)calloc(num_cpus, sizeof(READ_THREAD_NODE));
+    if (!samp_r) {
+        printf("Error: Unable to allocate memory for threads.\n");
+        return -1;
+    }
+
+    for (i = 0; i < num_cpus; i++) {
+        READ_THREAD  lt = &samp_r[i];
+        num_chars = DRV_SNPRINTF(READ_THREAD_dname(lt),
+                                 THREAD_ARG_SIZE,
+                                 THREAD_ARG_SIZE,
+                                 "%s%ss%d",
+                                 device_name, DRV_DEVICE_DELIMITER, i);
+        if (num_chars < 0 || num_chars > THREAD_ARG_SIZE) {
+            return VT_SAM_ERROR;
+        }
+        READ_THREAD_me(lt)        = i;
+        READ_THREAD_conn_id(lt)   = i;
+        READ_THREAD_conn_type(lt) = COMM_DATA_CPU;
+        status = abstract_Initialize_Read_Thread(lt);
+        if (status) {
+            SEPAGENT_PRINT_ERROR("while creating EMON reader %d is %d\n", i, status);
+            exit(-1);
+        }
+        SEPAGENT_PRINT_DEBUG("Created EMON reader thread %s \n", READ_THREAD_dname(lt));
+    }
+    emon_cpu_readers = TRUE;
+
+    return VT_SUCCESS;
+}
+
+
 /* ------------------------------------------------------------------------- */
 /*!
  * @fn          abstract_Spawn_Pthreads_UNC(num_packages)
@@ -475,18 +532,8 @@ abstract_Spawn_Pthreads_UNC (
         if (num_chars < 0 || num_chars > THREAD_ARG_SIZE) {
             return VT_SAM_ERROR;
         }
-        if (data_transfer_mode == DELAYED_TRANSFER) {
-            num_chars = DRV_SNPRINTF(READ_THREAD_oname(lt),
-                                     THREAD_ARG_SIZE,
-                                     THREAD_ARG_SIZE,
-                                     "%s%d.unc",
-                                     seed_name, i);
-            if (num_chars < 0 || num_chars > THREAD_ARG_SIZE) {
-                return VT_SAM_ERROR;
-            }
-        }
         READ_THREAD_me(lt)       = i;
-        READ_THREAD_conn_id(lt)    = COMM_UNCORE_CONN_ID;
+        READ_THREAD_conn_id(lt)    = i;
         READ_THREAD_conn_type(lt)  = COMM_DATA_UNCORE;
         status = abstract_Initialize_Read_Thread(lt);
         if (status) {
@@ -516,8 +563,9 @@ abstract_Join_Pthreads (
     int num_cpus
 )
 {
-    int    i, status;
-    PVOID  join_status;
+    int         i, status;
+    PVOID       join_status;
+    DRV_STATUS  result = OS_SUCCESS;
 
     SEPAGENT_PRINT_DEBUG("Start joining the pthreads\n");
 
@@ -531,7 +579,8 @@ abstract_Join_Pthreads (
             status = pthread_join(READ_THREAD_thread(lt), &join_status);
             if (status) {
                 SEPAGENT_PRINT_ERROR("pthread_join()[%d] returns %d\n", i, status);
-                exit(-1);
+                result = VT_SAM_ERROR;
+                continue;
             }
             SEPAGENT_PRINT_DEBUG("Sample reading[%d] done\n", i);
         }
@@ -547,7 +596,8 @@ abstract_Join_Pthreads (
             status = pthread_join(READ_THREAD_thread(lt), &join_status);
             if (status) {
                 SEPAGENT_PRINT_ERROR("pthread_join()[%d] returns %d\n", i, status);
-                exit(-1);
+                result = VT_SAM_ERROR;
+                continue;
             }
             SEPAGENT_PRINT_DEBUG("Sideband info reading[%d] done\n", i);
         }
@@ -557,11 +607,55 @@ abstract_Join_Pthreads (
     status = pthread_join(READ_THREAD_thread(&mod_r), &join_status);
     if (status) {
         SEPAGENT_PRINT_ERROR("pthread_join() on module read returns %d\n", status);
-        exit(-1);
+        return VT_SAM_ERROR;
     }
     SEPAGENT_PRINT_DEBUG("Module thread done\n");
     SEPAGENT_PRINT_DEBUG("Completed join with status=%ld\n", (long)join_status);
-    return OS_SUCCESS;
+    return result;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          abstract_Join_Pthreads_EMON(num_cpus)
+ *
+ * @param       int num_cpus - number of EMON reader threads
+ *
+ * @brief       Wait for the EMON reader threads spawned above to finish
+ *              Free per-thread argument and pthread structures
+ *
+ * @return      DRV_STATUS   - 0 for success, otherwise for failure
+ *
+ */
+static DRV_STATUS
+abstract_Join_Pthreads_EMON (
+    int num_cpus
+)
+{
+    int         i, status;
+    PVOID       join_status;
+    DRV_STATUS  result = OS_SUCCESS;
+
+    SEPAGENT_PRINT_DEBUG("Start joining the EMON pthreads\n");
+
+    for (i = 0; i < num_cpus; i++) {
+        READ_THREAD lt = &samp_r[i];
+        if (READ_THREAD_thread(lt) == 0) {
+            continue;
+        }
+        pthread_attr_destroy(&READ_THREAD_attr(lt));
+        status = pthread_join(READ_THREAD_thread(lt), &join_status);
+        if (status) {
+            SEPAGENT_PRINT_ERROR("pthread_join()[%d] returns %d\n", i, status);
+            result = VT_SAM_ERROR;
+            continue;
+        }
+        SEPAGENT_PRINT_DEBUG("EMON reading[%d] done\n", i);
+    }
+    free(samp_r);
+    samp_r           = NULL;
+    emon_cpu_readers = FALSE;
+
+    return result;
 }
 
 /* ------------------------------------------------------------------------- */
@@ -581,8 +675,9 @@ abstract_Join_Pthreads_UNC (
     U32 num_packages
 )
 {
-    int    i, status;
-    PVOID  join_status = NULL;
+    int         i, status;
+    PVOID       join_status = NULL;
+    DRV_STATUS  result      = OS_SUCCESS;
 
     SEPAGENT_PRINT_DEBUG("Start joining the uncore pthreads\n");
 
@@ -595,14 +690,15 @@ abstract_Join_Pthreads_UNC (
         status = pthread_join(READ_THREAD_thread(lt), &join_status);
         if (status) {
             SEPAGENT_PRINT_ERROR("pthread_join()[%d] returns %d\n", i, status);
-            exit(-1);
+            result = VT_SAM_ERROR;
+            continue;
         }
         SEPAGENT_PRINT_DEBUG("Uncore sample reading[i] done\n");
     }
     if (join_status != NULL) {
         SEPAGENT_PRINT_DEBUG("Completed join with status=%ld\n", (long)join_status);
     }
-    return OS_SUCCESS;
+    return result;
 }
 
 /*
@@ -664,7 +760,12 @@ ABSTRACT_Stop_Sampling (
     if (abs_num_cpus == 0) {
         return VT_SUCCESS;
     }
-    abstract_Join_Pthreads(abs_num_cpus);
+    if (emon_cpu_readers) {
+        abstract_Join_Pthreads_EMON(abs_num_cpus);
+    }
+    else {
+        abstract_Join_Pthreads(abs_num_cpus);
+    }
     if (unc_threads_spawn) {
         abstract_Join_Pthreads_UNC(abs_num_packages);
     }
@@ -735,6 +836,10 @@ ABSTRACT_Prepare_For_Start (
         status = abstract_Spawn_Pthreads(*num_cpus, pcfg);
         abs_num_cpus = *num_cpus;
     }
+    else if (status == VT_SUCCESS && DRV_CONFIG_emon_per_cpu(pcfg) && DRV_CONFIG_emon_timer_interval(pcfg)) {
+        status = abstract_Spawn_Pthreads_EMON(*num_cpus);
+        abs_num_cpus = *num_cpus;
+    }
 
     if (status != VT_SUCCESS) {
         printf("Error: Unable to prepare the driver to start sampling\n");
@@ -819,7 +924,10 @@ abstract_Start_Threads (
     S8     *pcfg_buf
 )
 {
-    U32 status    = VT_SUCCESS;
+    U32            status    = VT_SUCCESS;
+    S8             capture_name[MAXNAMELEN];
+    HELD_METADATA  held;
+    U32            i;
 
     if (pcfg_buf == NULL) {
         SEPAGENT_PRINT_ERROR("got NULL pcfg_buf!\n");
@@ -840,10 +948,35 @@ abstract_Start_Threads (
         }
         DRV_SNPRINTF(seed_name, MAXNAMELEN, MAXNAMELEN, "/tmp/lwp%lu_", (unsigned long)(((DRV_CONFIG)pcfg_buf)->u1.seed_name));
         SEPAGENT_PRINT_DEBUG("seedname %s\n",seed_name);
+
+        // every stream and the collection metadata are spilled to one capture
+        if (abs_capture) {
+            CAPTURE_Close(abs_capture);
+            abs_capture = NULL;
+        }
+        if (DRV_SNPRINTF(capture_name, MAXNAMELEN, MAXNAMELEN, "%so%u.cap", seed_name, agent_osid) < 0) {
+            return VT_SAM_ERROR;
+        }
+        status = CAPTURE_Create(capture_name, abs_num_cpus, abs_num_uncore_packages, agent_osid, agent_mode, &abs_capture);
+        if (status != VT_SUCCESS) {
+            return status;
+        }
+        for (i = 0; i < NUM_HELD_METADATA; i++) {
+            held = &abs_held_metadata[i];
+            if (HELD_METADATA_buf(held)) {
+                CAPTURE_Append(abs_capture, HELD_METADATA_section(held), HELD_METADATA_source(held),
+                               HELD_METADATA_buf(held), HELD_METADATA_size(held));
+            }
+        }
+        SEPAGENT_PRINT_DEBUG("capture %s\n", capture_name);
     }
     if (!counting_mode) {
         status = abstract_Spawn_Pthreads(abs_num_cpus, NULL);
     }
+    else if (DRV_CONFIG_emon_per_cpu((DRV_CONFIG)pcfg_buf) &&
+             DRV_CONFIG_emon_timer_interval((DRV_CONFIG)pcfg_buf)) {
+        status = abstract_Spawn_Pthreads_EMON(abs_num_cpus);
+    }
 
     if (status != VT_SUCCESS) {
         SEPAGENT_PRINT_ERROR("Unable to prepare the driver to start sampling.\n");
@@ -897,17 +1030,110 @@ abstract_Stop_Threads (
 {
     U32 status   = VT_SUCCESS;
     U32 num_cpus = 0;
+    U64 last_byte_ns;
 
     if (!counting_mode) {
-        abstract_Join_Pthreads(abs_num_cpus);
+        if (abstract_Join_Pthreads(abs_num_cpus) != OS_SUCCESS) {
+            status = VT_SAM_ERROR;
+        }
+    }
+    else if (emon_cpu_readers) {
+        if (abstract_Join_Pthreads_EMON(abs_num_cpus) != OS_SUCCESS) {
+            status = VT_SAM_ERROR;
+        }
     }
     if (unc_threads_spawn) {
-        abstract_Join_Pthreads_UNC(abs_num_packages);
+        if (abstract_Join_Pthreads_UNC(abs_num_packages) != OS_SUCCESS) {
+            status = VT_SAM_ERROR;
+        }
+    }
+
+    // Every reader has delivered its last byte once the joins return
+    last_byte_ns = abstract_Monotonic_Ns();
+    if (abs_capture) {
+        CAPTURE_Close(abs_capture);
+        abs_capture = NULL;
+    }
+    if (abs_stop_request_ns != 0 && last_byte_ns >= abs_stop_request_ns) {
+        SEPAGENT_PRINT("Stop-to-last-byte latency: %.3f ms\n",
+            (double)(last_byte_ns - abs_stop_request_ns) / 1000000.0);
     }
 
     return status;
 }
 
+/******************************************************************************
+ * @fn          abstract_Capture_Metadata(cmd, arg)
+ *
+ * @brief       Keep the descriptors, topology, TSC skew and start time
+ *              of a collection in its capture
+ *
+ * @param       IN cmd - driver operation that succeeded
+ * @param       IN arg - its request and reply
+ *
+ * @return      None
+ *
+ * <I>Special Notes:</I>
+ *              Replies served from the reply cache come here too. Topology
+ *              and skew replies are also held, whether or not a capture is
+ *              open, and written into the next capture when it is created.
+ ******************************************************************************/
+static VOID
+abstract_Capture_Metadata(
+    U32         cmd,
+    IOCTL_ARGS  arg
+)
+{
+    HELD_METADATA  held = NULL;
+    PVOID          buf;
+    U32            size;
+    U32            i;
+
+    for (i = 0; i < NUM_HELD_METADATA; i++) {
+        if (HELD_METADATA_cmd(&abs_held_metadata[i]) == cmd) {
+            held = &abs_held_metadata[i];
+            break;
+        }
+    }
+    if (held) {
+        if (cmd == DRV_OPERATION_SET_CPU_TOPOLOGY) {
+            buf  = arg->buf_usr_to_drv;
+            size = (U32)arg->len_usr_to_drv;
+        }
+        else {
+            buf  = arg->buf_drv_to_usr;
+            size = (U32)arg->len_drv_to_usr;
+        }
+        if (!buf || !size) {
+            return;
+        }
+        if (HELD_METADATA_size(held) != size) {
+            free(HELD_METADATA_buf(held));
+            HELD_METADATA_buf(held)  = malloc(size);
+            HELD_METADATA_size(held) = HELD_METADATA_buf(held) ? size : 0;
+        }
+        if (HELD_METADATA_buf(held)) {
+            memcpy(HELD_METADATA_buf(held), buf, size);
+        }
+        if (abs_capture) {
+            CAPTURE_Append(abs_capture, HELD_METADATA_section(held), HELD_METADATA_source(held), buf, size);
+        }
+        return;
+    }
+    if (!abs_capture) {
+        return;
+    }
+    switch (cmd) {
+        case DRV_OPERATION_DESC_NEXT:
+            CAPTURE_Append(abs_capture, CAPTURE_SECTION_DESCRIPTOR, CAPTURE_UNKNOWN_SOURCE,
+                           arg->buf_usr_to_drv, (U32)arg->len_usr_to_drv);
+            break;
+        case DRV_OPERATION_START:
+            CAPTURE_Mark_Start(abs_capture);
+            break;
+    }
+}
+
 /******************************************************************************
  * @fn          abstract_Set_OSID(S8 *buf)
  *
@@ -961,6 +1187,41 @@ ABSTRACT_Num_CPUs (
     return status;
 }
 
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          ABSTRACT_Num_Packages (num_packages)
+ *
+ * @param       U32 *num_packages  - number of packages
+ *
+ * @brief       Retrieve the number of packages, which is also the number of
+ *              uncore sampling devices. Drivers without the query report a
+ *              single package.
+ *
+ * @return      DRV_STATUS         - VT_SUCCESS on success
+ */
+DRV_DLLEXPORT DRV_STATUS
+ABSTRACT_Num_Packages (
+    U32 *num_packages
+)
+{
+    DRV_STATUS status = VT_SUCCESS;
+
+    if (num_packages == NULL) {
+        SEPAGENT_PRINT_ERROR("got NULL num_packages!\n");
+        return VT_SAM_ERROR;
+    }
+
+    *num_packages = 0;
+    status = abstract_Do_IOCTL_R(DRV_OPERATION_GET_NUM_PACKAGES,
+                                 (VOID *)num_packages,
+                                 sizeof(U32));
+    if (status != VT_SUCCESS || *num_packages == 0) {
+        *num_packages = 1;
+    }
+    abs_num_uncore_packages = *num_packages;
+    return VT_SUCCESS;
+}
+
 /* ------------------------------------------------------------------------- */
 /*!
  * @fn          ABSTRACT_Version (void)
@@ -1085,3 +1346,158 @@ ABSTRACT_Get_Drv_Setup_Info(
     return status;
 }
 
+
+/* ------------------------------------------------------------------------- */
+/*
+ * @fn          abstract_Report_First_Sample(info)
+ *
+ * @brief       Prints the time from the first request of the session to the
+ *              first sample written by the driver.
+ *
+ * @param       DRV_OVERHEAD_INFO info - overhead statistics of the collection
+ *
+ * @return      None
+ *
+ * <I>Special Notes:</I>
+ *              The driver reports TSC values. They are converted with the
+ *              rate observed between the start and stop requests, which
+ *              bracket the driver's start and end TSC reads.
+ */
+static VOID
+abstract_Report_First_Sample (
+    DRV_OVERHEAD_INFO info
+)
+{
+    U64    start_tsc = DRV_OVERHEAD_INFO_start_tsc(info);
+    U64    end_tsc   = DRV_OVERHEAD_INFO_end_tsc(info);
+    U64    first_tsc = DRV_OVERHEAD_INFO_first_sample_tsc(info);
+    double ns_per_cycle;
+    double setup_ms;
+    double first_ms;
+
+    if (first_tsc == 0) {
+        SEPAGENT_PRINT_DEBUG("No sample was written during the collection\n");
+        return;
+    }
+    if (!abs_session_start_ns || !abs_start_ns || abs_stop_request_ns <= abs_start_ns ||
+        end_tsc <= start_tsc || first_tsc < start_tsc) {
+        return;
+    }
+
+    ns_per_cycle = (double)(abs_stop_request_ns - abs_start_ns) / (double)(end_tsc - start_tsc);
+    setup_ms     = (double)(abs_start_ns - abs_session_start_ns) / 1000000.0;
+    first_ms     = (double)(first_tsc - start_tsc) * ns_per_cycle / 1000000.0;
+
+    SEPAGENT_PRINT("Time to first sample: %.3f ms (setup %.3f ms, first sample %.3f ms after start)\n",
+        setup_ms + first_ms, setup_ms, first_ms);
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * @fn          ABSTRACT_Report_Driver_Overhead()
+ *
+ * @brief       Fetches the driver's self-overhead statistics and prints a summary.
+ *
+ * @param       None
+ *
+ * @return      Status
+ *
+ * <I>Special Notes:</I>
+ *              The header is read first to learn the number of CPUs, then the
+ *              whole DRV_OVERHEAD_INFO buffer is requested.
+ */
+DRV_DLLEXPORT DRV_STATUS
+ABSTRACT_Report_Driver_Overhead (
+    void
+)
+{
+    DRV_OVERHEAD_INFO_NODE header;
+    DRV_OVERHEAD_INFO      info;
+    DRV_OVERHEAD           stats;
+    DRV_OVERHEAD_PATH      path_stats;
+    DRV_STATUS             status;
+    U32                    size;
+    U32                    cpu;
+    U32                    path;
+    U64                    elapsed;
+    U64                    cpu_cycles;
+    U64                    all_cycles = 0;
+
+    memset(&header, 0, sizeof(header));
+    status = abstract_Do_IOCTL_R(DRV_OPERATION_GET_DRIVER_OVERHEAD,
+                                 (VOID*)&header,
+                                 sizeof(DRV_OVERHEAD_INFO_NODE));
+    if (status != VT_SUCCESS || DRV_OVERHEAD_INFO_num_cpus(&header) == 0) {
+        SEPAGENT_PRINT_DEBUG("Driver overhead statistics are not available\n");
+        return status;
+    }
+
+    size = sizeof(DRV_OVERHEAD_INFO_NODE) + DRV_OVERHEAD_INFO_num_cpus(&header) * sizeof(DRV_OVERHEAD_NODE);
+    info = (DRV_OVERHEAD_INFO)calloc(1, size);
+    if (!info) {
+        return VT_NO_MEMORY;
+    }
+
+    status = abstract_Do_IOCTL_R(DRV_OPERATION_GET_DRIVER_OVERHEAD, (VOID*)info, size);
+    if (status != VT_SUCCESS) {
+        free(info);
+        return status;
+    }
+
+    elapsed = DRV_OVERHEAD_INFO_end_tsc(info) > DRV_OVERHEAD_INFO_start_tsc(info) ?
+              DRV_OVERHEAD_INFO_end_tsc(info) - DRV_OVERHEAD_INFO_start_tsc(info) : 0;
+    if (elapsed == 0) {
+        SEPAGENT_PRINT_DEBUG("No collection interval recorded by the driver\n");
+        free(info);
+        return VT_SUCCESS;
+    }
+
+    for (cpu = 0; cpu < DRV_OVERHEAD_INFO_num_cpus(info); cpu++) {
+        stats      = &DRV_OVERHEAD_INFO_cpu_stats(info)[cpu];
+        cpu_cycles = 0;
+        for (path = 0; path < DRV_OVERHEAD_NB_PATHS; path++) {
+            path_stats  = DRV_OVERHEAD_path(stats, path);
+            cpu_cycles += DRV_OVERHEAD_PATH_total_cycles(path_stats);
+            if (DRV_OVERHEAD_PATH_count(path_stats)) {
+                SEPAGENT_PRINT_DEBUG("cpu%u path %u: %llu calls, avg %llu cycles, max %llu cycles\n",
+                    cpu, path,
+                    (unsigned long long)DRV_OVERHEAD_PATH_count(path_stats),
+                    (unsigned long long)(DRV_OVERHEAD_PATH_total_cycles(path_stats) / DRV_OVERHEAD_PATH_count(path_stats)),
+                    (unsigned long long)DRV_OVERHEAD_PATH_max_cycles(path_stats));
+            }
+        }
+        all_cycles += cpu_cycles;
+        SEPAGENT_PRINT("Driver overhead on cpu%u: %.3f%% (dropped records: %llu, wakeups: %llu, tasklets: %llu)\n",
+            cpu,
+            100.0 * (double)cpu_cycles / (double)elapsed,
+            (unsigned long long)DRV_OVERHEAD_events(stats)[DRV_OVERHEAD_EVENT_DROPPED_RECORDS],
+            (unsigned long long)DRV_OVERHEAD_events(stats)[DRV_OVERHEAD_EVENT_BUFFER_WAKEUPS],
+            (unsigned long long)DRV_OVERHEAD_events(stats)[DRV_OVERHEAD_EVENT_TASKLET_SCHEDULES]);
+        if (DRV_OVERHEAD_events(stats)[DRV_OVERHEAD_EVENT_GROUP_SWAPS]) {
+            U64 swaps   = DRV_OVERHEAD_events(stats)[DRV_OVERHEAD_EVENT_GROUP_SWAPS];
+            U64 writes  = DRV_OVERHEAD_events(stats)[DRV_OVERHEAD_EVENT_SWAP_MSR_WRITES];
+            U64 skipped = DRV_OVERHEAD_events(stats)[DRV_OVERHEAD_EVENT_SWAP_MSR_SKIPPED];
+            SEPAGENT_PRINT_DEBUG("cpu%u group swaps: %llu, MSR writes per swap: %.1f (%.1f without shadowing)\n",
+                cpu,
+                (unsigned long long)swaps,
+                (double)writes / (double)swaps,
+                (double)(writes + skipped) / (double)swaps);
+        }
+        if (DRV_OVERHEAD_events(stats)[DRV_OVERHEAD_EVENT_CALLSTACK_FRAMES]) {
+            U64 frames = DRV_OVERHEAD_events(stats)[DRV_OVERHEAD_EVENT_CALLSTACK_FRAMES];
+            U64 cycles = DRV_OVERHEAD_events(stats)[DRV_OVERHEAD_EVENT_CALLSTACK_CYCLES];
+            SEPAGENT_PRINT_DEBUG("cpu%u call stack frames: %llu, cycles per frame: %.1f (%.3f%% of the time)\n",
+                cpu,
+                (unsigned long long)frames,
+                (double)cycles / (double)frames,
+                100.0 * (double)cycles / (double)elapsed);
+        }
+    }
+    SEPAGENT_PRINT("Driver overhead (all CPUs): %.3f%%\n",
+        100.0 * (double)all_cycles / ((double)elapsed * DRV_OVERHEAD_INFO_num_cpus(info)));
+
+    abstract_Report_First_Sample(info);
+
+    free(info);
+    return VT_SUCCESS;
+}
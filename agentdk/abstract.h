@@ -155,6 +155,23 @@ static DRV_STATUS
 abstract_Stop_Threads (
 );
 
+/*
+ * @fn          abstract_Capture_Metadata(cmd, arg)
+ *
+ * @brief       Keep the descriptors, topology and TSC skew of a
+ *              collection in its capture.
+ *
+ * @param       IN cmd - driver operation that succeeded
+ * @param       IN arg - its request and reply
+ *
+ * @return      None
+ */
+static VOID
+abstract_Capture_Metadata(
+    U32         cmd,
+    IOCTL_ARGS  arg
+);
+
 /*
  * @fn          abstract_Set_OSID(S8 *buf)
  *
@@ -185,6 +202,21 @@ ABSTRACT_Num_CPUs (
 );
 
 
+/*
+ * @fn          ABSTRACT_Num_Packages (num_packages)
+ *
+ * @param       U32 *num_packages  - number of packages
+ *
+ * @brief       Retrieve number of packages (uncore sampling devices) in system
+ *
+ * @return      DRV_STATUS         - VT_SUCCESS on success
+ */
+DRV_DLLEXPORT DRV_STATUS
+ABSTRACT_Num_Packages (
+    U32 *num_packages
+);
+
+
 /*
  * @fn          ABSTRACT_Version (void)
  *
@@ -252,6 +284,25 @@ ABSTRACT_Get_Drv_Setup_Info (
     DRV_SETUP_INFO     drv_setup_info
 );
 
+
+/*
+ * @fn          ABSTRACT_Report_Driver_Overhead()
+ *
+ * @brief       Fetches the driver's self-overhead statistics and prints a summary.
+ *
+ * @param       None
+ *
+ * @return      Status
+ *
+ * <I>Special Notes:</I>
+ *              Overhead is reported per CPU as the share of the collection's
+ *              elapsed TSC time spent in the driver's instrumented paths.
+ */
+DRV_DLLEXPORT DRV_STATUS
+ABSTRACT_Report_Driver_Overhead (
+    void
+);
+
 #ifdef __cplusplus
 }
 
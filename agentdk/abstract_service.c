@@ -63,6 +63,8 @@ SOFTWARE.
 #include "log.h"
 #include "abstract_service.h"
 #include "communication.h"
+#include "metrics.h"
+#include "perf_backend.h"
 
 #if defined(DRV_SOFIA) || defined(DRV_BUTTER) || defined(DRV_OS_ANDROID) || defined(DRV_OS_OPENWRT)
 #define DRV_DEVICE_DELIMITER "_"
@@ -74,12 +76,68 @@ static U32            prev_driver_loaded = 0;
 static DRV_FILE_DESC  driver_handle = DRV_INVALID_FILE_DESC_VALUE;
 
 static S32            abs_num_cpus = 0;
+static U32            abs_num_uncore_packages = 1;
+static U64            abs_session_start_ns = 0;
+static U64            abs_start_ns = 0;
+static U64            abs_stop_request_ns = 0;
+static DRV_BOOL       abs_collecting = FALSE;
+static DRV_BOOL       abs_reply_cached = FALSE;
 extern U32            data_transfer_mode;
+extern U32            max_latency_ms;
 
 pthread_cond_t        stop_received;
 pthread_mutex_t       stop_lock;
 
 #define DRV_OPERATION_PAX 0x40086401
+
+/*
+ * Replies to the system configuration and topology requests only change when
+ * the driver's sys info generation does, so they are kept across collections.
+ */
+#define ABS_REPLY_CACHE_ENTRIES 8
+
+typedef struct ABS_REPLY_CACHE_NODE_S  ABS_REPLY_CACHE_NODE;
+typedef        ABS_REPLY_CACHE_NODE   *ABS_REPLY_CACHE;
+
+struct ABS_REPLY_CACHE_NODE_S {
+    U32    cmd;
+    U64    len_usr_to_drv;
+    U64    len_drv_to_usr;
+    char  *buf_usr_to_drv;
+    char  *buf_drv_to_usr;
+};
+
+static ABS_REPLY_CACHE_NODE  reply_cache[ABS_REPLY_CACHE_ENTRIES];
+static U32                   reply_cache_next       = 0;
+static U64                   reply_cache_generation = 0;
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          U64 abstract_Monotonic_Ns ()
+ *
+ * @param       None
+ *
+ * @brief       Read the monotonic clock
+ *
+ * @return      U64 - current CLOCK_MONOTONIC time in nanoseconds
+ *
+ * <I>Special Notes:</I>
+ *              Used to time the stop path, so it must not jump with wall clock
+ *              adjustments.
+ */
+static U64
+abstract_Monotonic_Ns (
+    VOID
+)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+        return 0;
+    }
+    return (U64)ts.tv_sec * 1000000000ULL + (U64)ts.tv_nsec;
+}
+
 /* ------------------------------------------------------------------------- */
 /*!
  * @fn          U32 abstract_Sleep (milliseconds)
@@ -168,6 +226,170 @@ abstract_Open_Device_Driver (
     return device_handle;
 }
 
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        abstract_Reply_Cacheable (cmd)
+ *
+ * @param     U32 cmd - ioctl operation
+ *
+ * @brief     Tell whether the reply to cmd only depends on the request and
+ *            on the driver's cached system configuration
+ *
+ * @return    DRV_BOOL
+ *
+ */
+static DRV_BOOL
+abstract_Reply_Cacheable (
+    U32  cmd
+)
+{
+    return (cmd == DRV_OPERATION_COLLECT_SYS_CONFIG   ||
+            cmd == DRV_OPERATION_GET_SYS_CONFIG       ||
+            cmd == DRV_OPERATION_GET_PLATFORM_TOPOLOGY ||
+            cmd == DRV_OPERATION_GET_UNCORE_TOPOLOGY);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        abstract_Reply_Cache_Clear ()
+ *
+ * @param     None
+ *
+ * @brief     Drop every cached reply
+ *
+ * @return    None
+ *
+ */
+static VOID
+abstract_Reply_Cache_Clear (
+    VOID
+)
+{
+    U32 i;
+
+    for (i = 0; i < ABS_REPLY_CACHE_ENTRIES; i++) {
+        free(reply_cache[i].buf_usr_to_drv);
+        free(reply_cache[i].buf_drv_to_usr);
+        memset(&reply_cache[i], 0, sizeof(ABS_REPLY_CACHE_NODE));
+    }
+    reply_cache_next = 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        abstract_Reply_Cache_Lookup (driver_handle, cmd, arg)
+ *
+ * @param     DRV_FILE_DESC driver_handle - open handle on the driver
+ * @param     U32           cmd           - ioctl operation
+ * @param     IOCTL_ARGS    arg           - request, filled in on a hit
+ *
+ * @brief     Serve a system configuration request from the cache when the
+ *            driver's sys info generation has not moved since it was stored
+ *
+ * @return    DRV_BOOL - TRUE if the reply was copied into arg
+ *
+ * <I>Special Notes:</I>
+ *            A driver without the generation ioctl reports 0 and disables
+ *            the cache.
+ */
+static DRV_BOOL
+abstract_Reply_Cache_Lookup (
+    DRV_FILE_DESC  driver_handle,
+    U32            cmd,
+    IOCTL_ARGS     arg
+)
+{
+    IOCTL_ARGS_NODE  gen_arg;
+    U64              generation = 0;
+    U32              i;
+
+    if (!abstract_Reply_Cacheable(cmd)) {
+        return FALSE;
+    }
+
+    memset(&gen_arg, 0, sizeof(IOCTL_ARGS_NODE));
+    gen_arg.len_drv_to_usr = sizeof(U64);
+    gen_arg.buf_drv_to_usr = (char *)&generation;
+    gen_arg.command        = DRV_OPERATION_GET_SYS_INFO_GENERATION;
+    if (ioctl(driver_handle, LWPMUDRV_IOCTL_IOR(DRV_OPERATION_GET_SYS_INFO_GENERATION), &gen_arg) < 0) {
+        generation = 0;
+    }
+    if (generation != reply_cache_generation) {
+        abstract_Reply_Cache_Clear();
+        reply_cache_generation = generation;
+    }
+    if (generation == 0) {
+        return FALSE;
+    }
+
+    for (i = 0; i < ABS_REPLY_CACHE_ENTRIES; i++) {
+        ABS_REPLY_CACHE entry = &reply_cache[i];
+        if (entry->buf_drv_to_usr == NULL                  ||
+            entry->cmd            != cmd                   ||
+            entry->len_usr_to_drv != arg->len_usr_to_drv   ||
+            entry->len_drv_to_usr != arg->len_drv_to_usr   ||
+            (arg->len_usr_to_drv &&
+             memcmp(entry->buf_usr_to_drv, arg->buf_usr_to_drv, arg->len_usr_to_drv))) {
+            continue;
+        }
+        memcpy(arg->buf_drv_to_usr, entry->buf_drv_to_usr, arg->len_drv_to_usr);
+        SEPAGENT_PRINT_DEBUG("Served operation %u from the sys config cache\n", cmd);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        abstract_Reply_Cache_Store (cmd, arg)
+ *
+ * @param     U32        cmd - ioctl operation
+ * @param     IOCTL_ARGS arg - request and the driver's reply
+ *
+ * @brief     Remember a successful system configuration reply
+ *
+ * @return    None
+ *
+ */
+static VOID
+abstract_Reply_Cache_Store (
+    U32         cmd,
+    IOCTL_ARGS  arg
+)
+{
+    ABS_REPLY_CACHE entry;
+
+    if (!abstract_Reply_Cacheable(cmd) || reply_cache_generation == 0 ||
+        arg->len_drv_to_usr == 0 || arg->buf_drv_to_usr == NULL) {
+        return;
+    }
+
+    entry = &reply_cache[reply_cache_next];
+    reply_cache_next = (reply_cache_next + 1) % ABS_REPLY_CACHE_ENTRIES;
+    free(entry->buf_usr_to_drv);
+    free(entry->buf_drv_to_usr);
+    memset(entry, 0, sizeof(ABS_REPLY_CACHE_NODE));
+
+    entry->buf_drv_to_usr = (char *)malloc(arg->len_drv_to_usr);
+    if (arg->len_usr_to_drv) {
+        entry->buf_usr_to_drv = (char *)malloc(arg->len_usr_to_drv);
+    }
+    if (!entry->buf_drv_to_usr || (arg->len_usr_to_drv && !entry->buf_usr_to_drv)) {
+        free(entry->buf_usr_to_drv);
+        free(entry->buf_drv_to_usr);
+        memset(entry, 0, sizeof(ABS_REPLY_CACHE_NODE));
+        return;
+    }
+    entry->cmd            = cmd;
+    entry->len_usr_to_drv = arg->len_usr_to_drv;
+    entry->len_drv_to_usr = arg->len_drv_to_usr;
+    if (arg->len_usr_to_drv) {
+        memcpy(entry->buf_usr_to_drv, arg->buf_usr_to_drv, arg->len_usr_to_drv);
+    }
+    memcpy(entry->buf_drv_to_usr, arg->buf_drv_to_usr, arg->len_drv_to_usr);
+}
+
 /* ------------------------------------------------------------------------- */
 /*!
  * @fn        abstract_Send_IOCTL_helper (cmd, ioctl_arg)
@@ -191,9 +413,9 @@ abstract_Send_IOCTL_helper(
         abstract_Start_Threads(arg->buf_usr_to_drv);
     }
 
-    // Create pthreads for uncore
+    // Create pthreads for uncore, one per package
     if (cmd == DRV_OPERATION_INIT_UNC) {
-        abstract_Start_Threads_UNC(1); // Default number of packages = 1
+        abstract_Start_Threads_UNC(abs_num_uncore_packages);
     }
 
     // Set OSID
@@ -201,13 +423,74 @@ abstract_Send_IOCTL_helper(
         abstract_Set_OSID(arg->buf_usr_to_drv);
     }
 
+    // The driver only fills READ_AND_RESET buffers between START and STOP
+    if (cmd == DRV_OPERATION_START) {
+        abs_collecting = TRUE;
+    }
+
     if (cmd == DRV_OPERATION_STOP) {
+        abs_collecting = FALSE;
         if (data_transfer_mode == DELAYED_TRANSFER) {
             pthread_mutex_lock(&stop_lock);
             pthread_cond_broadcast(&stop_received);
             pthread_mutex_unlock(&stop_lock);
         }
         abstract_Stop_Threads();
+        ABSTRACT_Report_Driver_Overhead();
+    }
+
+    if (cmd == DRV_OPERATION_TERMINATE) {
+        abs_session_start_ns = 0;
+        abs_start_ns         = 0;
+        abs_stop_request_ns  = 0;
+        abs_collecting       = FALSE;
+        METRICS_Clear();
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        abstract_Set_Max_Latency (driver_handle)
+ *
+ * @param     DRV_FILE_DESC driver_handle - open driver handle
+ *
+ * @brief     Bound the time a record may wait in the driver before it is
+ *            handed to the agent
+ *
+ * @return    None
+ *
+ * <I>Special Notes:</I>
+ *            Applies the -max-latency option to every class of output device
+ *            right before a collection starts. The watermarks are left unset.
+ *            A driver refusing the setting only costs latency, so the error
+ *            is reported and the start goes on.
+ */
+static VOID
+abstract_Set_Max_Latency (
+    DRV_FILE_DESC  driver_handle
+)
+{
+    DRV_WAKEUP_CONFIG_NODE  cfg;
+    IOCTL_ARGS_NODE         cfg_arg;
+    U32                     device;
+
+    if (max_latency_ms == 0) {
+        return;
+    }
+
+    for (device = 0; device < DRV_WAKEUP_NB_DEVICES; device++) {
+        memset(&cfg, 0, sizeof(DRV_WAKEUP_CONFIG_NODE));
+        DRV_WAKEUP_CONFIG_device_type(&cfg)    = device;
+        DRV_WAKEUP_CONFIG_max_latency_ms(&cfg) = max_latency_ms;
+
+        memset(&cfg_arg, 0, sizeof(IOCTL_ARGS_NODE));
+        cfg_arg.len_usr_to_drv = sizeof(DRV_WAKEUP_CONFIG_NODE);
+        cfg_arg.buf_usr_to_drv = (char *)&cfg;
+        cfg_arg.command        = DRV_OPERATION_SET_WAKEUP;
+        if (ioctl(driver_handle, LWPMUDRV_IOCTL_IOW(DRV_OPERATION_SET_WAKEUP), &cfg_arg) < 0) {
+            SEPAGENT_PRINT_ERROR("Could not set a %u ms latency bound on output device class %u\n",
+                                 max_latency_ms, device);
+        }
     }
 }
 
@@ -239,9 +522,20 @@ ABSTRACT_Send_IOCTL (
     DRV_FILE_DESC   driver_handle = DRV_INVALID_FILE_DESC_VALUE;
     U32             command;
 
+    abs_reply_cached = FALSE;
+
     if (cmd == DRV_OPERATION_SET_OSID || cmd == DRV_OPERATION_PAX) {
         return VT_SUCCESS;
     }
+    if (cmd == DRV_OPERATION_SET_METRICS) {
+        return METRICS_Set_Definitions(arg);
+    }
+    if (cmd == DRV_OPERATION_GET_METRICS) {
+        return METRICS_Get_Series(arg);
+    }
+    if (perf_backend) {
+        return PERF_BACKEND_Send_IOCTL(cmd, arg);
+    }
     driver_handle = abstract_Open_Device_Driver(SEP_DEVICE_NAME);
 
     if (driver_handle == DRV_INVALID_FILE_DESC_VALUE) {
@@ -252,6 +546,18 @@ ABSTRACT_Send_IOCTL (
         }
     }
 
+    // Time to first sample is counted from the first request of the session
+    if (abs_session_start_ns == 0) {
+        abs_session_start_ns = abstract_Monotonic_Ns();
+    }
+
+    if (abstract_Reply_Cache_Lookup(driver_handle, cmd, arg)) {
+        close(driver_handle);
+        abs_reply_cached = TRUE;
+        abstract_Capture_Metadata(cmd, arg);
+        return VT_SUCCESS;
+    }
+
     if (arg->len_drv_to_usr == 0 && arg->len_usr_to_drv == 0) {
         command = LWPMUDRV_IOCTL_IO(cmd);
     }
@@ -262,17 +568,56 @@ ABSTRACT_Send_IOCTL (
         command = LWPMUDRV_IOCTL_IOW(cmd);
     }
 
+    // The driver flushes every buffer inside the stop ioctl, so start the clock here
+    if (cmd == DRV_OPERATION_START) {
+        abstract_Set_Max_Latency(driver_handle);
+        abs_start_ns = abstract_Monotonic_Ns();
+    }
+    if (cmd == DRV_OPERATION_STOP) {
+        abs_stop_request_ns = abstract_Monotonic_Ns();
+    }
+
     bytes_ret = ioctl(driver_handle, command, arg);
     status = !(bytes_ret < 0) ? VT_SUCCESS : VT_DRIVER_COMM_FAILED;
     if (driver_handle != DRV_INVALID_FILE_DESC_VALUE) {
         close(driver_handle);
     }
 
+    if (status == VT_SUCCESS) {
+        abstract_Reply_Cache_Store(cmd, arg);
+        abstract_Capture_Metadata(cmd, arg);
+    }
+
+    // Derived metrics are computed on the interval counts passing through the agent
+    if (cmd == DRV_OPERATION_READ_AND_RESET && status == VT_SUCCESS && abs_collecting) {
+        METRICS_Evaluate((U64 *)arg->buf_drv_to_usr, arg->len_drv_to_usr, abs_num_cpus);
+    }
+
     abstract_Send_IOCTL_helper(cmd, arg);
 
     return status;
 }
 
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        ABSTRACT_Reply_Cached ()
+ *
+ * @param     None
+ *
+ * @brief     Tell whether the last ABSTRACT_Send_IOCTL was answered from the
+ *            sys config reply cache rather than by the driver
+ *
+ * @return    DRV_BOOL
+ *
+ */
+DRV_DLLEXPORT DRV_BOOL
+ABSTRACT_Reply_Cached (
+    VOID
+)
+{
+    return abs_reply_cached;
+}
+
 /* ------------------------------------------------------------------------- */
 /*!
  * @fn        abstract_Do_IOCTL_RW (command, in_buf, in_buf_len, out_buf, out_buf_len)
@@ -413,6 +758,18 @@ abstract_Do_IOCTL_R (
     if (!arg) {
         return VT_NO_MEMORY;
     }
+    arg->len_drv_to_usr = len_drv_to_usr;
+    arg->buf_drv_to_usr = buf_drv_to_usr;
+    arg->len_usr_to_drv = 0;
+    arg->buf_usr_to_drv = NULL;
+    arg->command = command;
+
+    if (perf_backend) {
+        status = PERF_BACKEND_Send_IOCTL(command, arg);
+        free(arg);
+        return status;
+    }
+
     driver_handle = abstract_Open_Device_Driver(SEP_DEVICE_NAME);
 
     if (driver_handle == DRV_INVALID_FILE_DESC_VALUE) {
@@ -423,12 +780,6 @@ abstract_Do_IOCTL_R (
        }
     }
 
-    arg->len_drv_to_usr = len_drv_to_usr;
-    arg->buf_drv_to_usr = buf_drv_to_usr;
-    arg->len_usr_to_drv = 0;
-    arg->buf_usr_to_drv = NULL;
-    arg->command = command;
-
     result = ioctl(driver_handle, LWPMUDRV_IOCTL_IOR(command), arg);
     status = (result == 0) ? VT_SUCCESS : VT_DRIVER_COMM_FAILED;
     if (driver_handle != DRV_INVALID_FILE_DESC_VALUE) {
@@ -91,6 +91,22 @@ ABSTRACT_Send_IOCTL (
     IOCTL_ARGS         arg
 );
 
+/*
+ * @fn        ABSTRACT_Reply_Cached ()
+ *
+ * @param     None
+ *
+ * @brief     Tell whether the last ABSTRACT_Send_IOCTL was answered from the
+ *            sys config reply cache rather than by the driver
+ *
+ * @return    DRV_BOOL
+ *
+ */
+DRV_DLLEXPORT DRV_BOOL
+ABSTRACT_Reply_Cached (
+    VOID
+);
+
 
 /*
  * ABSTRACT_Open_Driver
@@ -0,0 +1,1032 @@
+/****
+    Copyright (C) 2019-2020 Intel Corporation.  All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+
+
+
+
+
+****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "lwpmudrv_defines.h"
+#include "lwpmudrv_types.h"
+#include "rise_errors.h"
+#include "lwpmudrv_ioctl.h"
+#include "lwpmudrv_ecb.h"
+#include "lwpmudrv_struct.h"
+#include "lwpmudrv_version.h"
+#include "communication.h"
+#include "capture.h"
+#include "log.h"
+
+#define CAPTURE_MAX_DESCRIPTORS     256
+#define CAPTURE_PADDING(size)       ((CAPTURE_ALIGN - ((size) % CAPTURE_ALIGN)) % CAPTURE_ALIGN)
+
+struct CAPTURE_NODE_S {
+    int                   fd;
+    DRV_BOOL              writable;
+    pthread_mutex_t       lock;
+    CAPTURE_HEADER_NODE   header;
+    U64                   end;              // offset of the next chunk
+    S8                   *map;              // whole file, for a capture opened to read
+    U64                   map_size;
+    U64                   start_tsc;        // TSC of the last CAPTURE_SECTION_START chunk, 0 if none
+    CAPTURE_INDEX_ENTRY   entries;          // in the order the chunks were added, only ever grows
+    U32                   num_entries;
+    U32                   capacity;
+    CAPTURE_INDEX_ENTRY   sorted_entries;   // copy of entries by section, source and TSC
+    U64                  *reach;            // highest last_tsc of the source up to each sorted entry
+    U32                   num_sorted;
+    U32                   sorted_capacity;
+    DRV_BOOL              sorted;
+    U32                   desc_size[CAPTURE_MAX_DESCRIPTORS];
+    U32                   num_desc;
+};
+
+#define CAPTURE_fd(x)             (x)->fd
+#define CAPTURE_writable(x)       (x)->writable
+#define CAPTURE_lock(x)           (x)->lock
+#define CAPTURE_header(x)         (x)->header
+#define CAPTURE_end(x)            (x)->end
+#define CAPTURE_map(x)            (x)->map
+#define CAPTURE_map_size(x)       (x)->map_size
+#define CAPTURE_start_tsc(x)      (x)->start_tsc
+#define CAPTURE_entries(x)        (x)->entries
+#define CAPTURE_num_entries(x)    (x)->num_entries
+#define CAPTURE_capacity(x)       (x)->capacity
+#define CAPTURE_sorted_entries(x) (x)->sorted_entries
+#define CAPTURE_reach(x)          (x)->reach
+#define CAPTURE_num_sorted(x)     (x)->num_sorted
+#define CAPTURE_sorted_capacity(x) (x)->sorted_capacity
+#define CAPTURE_sorted(x)         (x)->sorted
+#define CAPTURE_desc_size(x, i)   (x)->desc_size[(i)]
+#define CAPTURE_num_desc(x)       (x)->num_desc
+
+static U64  capture_tsc_freq = 0;
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        capture_Read_TSC (void)
+ *
+ * @brief     Read the time stamp counter of the current CPU
+ *
+ * @return    U64 - TSC value
+ *
+ */
+static U64
+capture_Read_TSC (
+    void
+)
+{
+#if defined(DRV_IA32) || defined(DRV_EM64T)
+    U32 low;
+    U32 high;
+
+    __asm__ __volatile__("rdtsc" : "=a"(low), "=d"(high));
+    return ((U64)high << 32) | low;
+#else
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (U64)ts.tv_sec * 1000000000ULL + (U64)ts.tv_nsec;
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        capture_Tsc_Range (capture, section, buffer, size, first_tsc, last_tsc)
+ *
+ * @param     buffer    - records read from one output device
+ * @param     size      - bytes in buffer
+ * @param     first_tsc - receives the lowest TSC of the records
+ * @param     last_tsc  - receives the highest TSC of the records
+ *
+ * @brief     Find the time range covered by a buffer of records
+ *
+ * @return    None
+ *
+ * <I>Special Notes:</I>
+ *            Sample record sizes come from the descriptors written to the
+ *            capture, those of the driver records from DRV_RECORD_Size.
+ *            A record without a TSC leaves the range as it is. A buffer
+ *            that cannot be walked (unknown descriptor)
+ *            is given the range from 0 to now: its records are all older
+ *            than the read that produced it.
+ */
+static VOID
+capture_Tsc_Range (
+    CAPTURE  capture,
+    U32      section,
+    S8      *buffer,
+    U32      size,
+    U64     *first_tsc,
+    U64     *last_tsc
+)
+{
+    U32       offset = 0;
+    U32       record_size;
+    U32       id;
+    U64       tsc;
+    DRV_BOOL  timed;
+
+    *first_tsc = ~0ULL;
+    *last_tsc  = 0;
+
+    while (offset < size) {
+        record_size = 0;
+        tsc         = 0;
+        timed       = TRUE;
+        switch (section) {
+            case CAPTURE_SECTION_CORE:
+            case CAPTURE_SECTION_UNCORE:
+                id = *(U32 *)(buffer + offset);
+                if (section == CAPTURE_SECTION_CORE && DRV_RECORD_Size(buffer + offset, size - offset)) {
+                    record_size = DRV_RECORD_Size(buffer + offset, size - offset);
+                    tsc         = DRV_RECORD_Tsc(buffer + offset);
+                    timed       = tsc != 0;
+                    break;
+                }
+                if (id < CAPTURE_num_desc(capture)) {
+                    record_size = CAPTURE_desc_size(capture, id);
+                }
+                if (section == CAPTURE_SECTION_CORE) {
+                    record_size = record_size >= sizeof(SampleRecordPC) ? record_size : 0;
+                    tsc         = record_size ? SAMPLE_RECORD_tsc((SampleRecordPC *)(buffer + offset)) : 0;
+                }
+                else {
+                    record_size = record_size >= sizeof(UncoreSampleRecordPC) ? record_size : 0;
+                    tsc         = record_size ? UNCORE_SAMPLE_RECORD_tsc((UncoreSampleRecordPC *)(buffer + offset)) : 0;
+                }
+                break;
+            case CAPTURE_SECTION_MODULE:
+                record_size = MODULE_RECORD_rec_length((ModuleRecord *)(buffer + offset));
+                if (record_size < sizeof(ModuleRecord)) {
+                    record_size = 0;
+                    break;
+                }
+                tsc = MODULE_RECORD_tsc((ModuleRecord *)(buffer + offset));
+                break;
+            case CAPTURE_SECTION_SIDEBAND:
+                record_size = sizeof(SIDEBAND_INFO_NODE);
+                tsc         = SIDEBAND_INFO_tsc((SIDEBAND_INFO)(buffer + offset));
+                break;
+        }
+        if (!record_size || record_size > size - offset) {
+            *first_tsc = 0;
+            *last_tsc  = capture_Read_TSC();
+            return;
+        }
+        if (timed) {
+            *first_tsc = tsc < *first_tsc ? tsc : *first_tsc;
+            *last_tsc  = tsc > *last_tsc  ? tsc : *last_tsc;
+        }
+        offset += record_size;
+    }
+    if (*first_tsc > *last_tsc) {
+        *first_tsc = 0;
+        *last_tsc  = 0;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        capture_Add_Entry (capture, entry)
+ *
+ * @param     entry - index entry of a chunk now in the file
+ *
+ * @brief     Add a chunk to the in-memory index, with the lock held
+ *
+ * @return    DRV_STATUS
+ *
+ */
+static DRV_STATUS
+capture_Add_Entry (
+    CAPTURE              capture,
+    CAPTURE_INDEX_ENTRY  entry
+)
+{
+    CAPTURE_INDEX_ENTRY  entries;
+    U32                  capacity;
+
+    if (CAPTURE_num_entries(capture) == CAPTURE_capacity(capture)) {
+        capacity = CAPTURE_capacity(capture) ? CAPTURE_capacity(capture) * 2 : 1024;
+        entries  = (CAPTURE_INDEX_ENTRY)realloc(CAPTURE_entries(capture), capacity * sizeof(CAPTURE_INDEX_ENTRY_NODE));
+        if (!entries) {
+            return VT_NO_MEMORY;
+        }
+        CAPTURE_entries(capture)  = entries;
+        CAPTURE_capacity(capture) = capacity;
+    }
+    CAPTURE_entries(capture)[CAPTURE_num_entries(capture)++] = *entry;
+    CAPTURE_sorted(capture) = FALSE;
+
+    return VT_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        capture_Write_Chunk (capture, section, source, buffer, size, first_tsc, last_tsc, entry)
+ *
+ * @param     entry - receives the index entry of the chunk
+ *
+ * @brief     Append a chunk to the file
+ *
+ * @return    DRV_STATUS
+ *
+ * <I>Special Notes:</I>
+ *            The space is reserved under the lock and written outside it,
+ *            so readers of different devices do not wait on each other's
+ *            writes.
+ */
+static DRV_STATUS
+capture_Write_Chunk (
+    CAPTURE              capture,
+    U32                  section,
+    U32                  source,
+    PVOID                buffer,
+    U32                  size,
+    U64                  first_tsc,
+    U64                  last_tsc,
+    CAPTURE_INDEX_ENTRY  entry
+)
+{
+    CAPTURE_CHUNK_NODE  chunk;
+    U64                 padding = 0;
+    struct iovec        iov[3];
+    U64                 offset;
+    U64                 total;
+    ssize_t             written;
+
+    memset(&chunk, 0, sizeof(chunk));
+    CAPTURE_CHUNK_magic(&chunk)     = CAPTURE_CHUNK_MAGIC;
+    CAPTURE_CHUNK_section(&chunk)   = (U16)section;
+    CAPTURE_CHUNK_source(&chunk)    = (U16)source;
+    CAPTURE_CHUNK_size(&chunk)      = size;
+    CAPTURE_CHUNK_first_tsc(&chunk) = first_tsc;
+    CAPTURE_CHUNK_last_tsc(&chunk)  = last_tsc;
+
+    iov[0].iov_base = &chunk;
+    iov[0].iov_len  = sizeof(chunk);
+    iov[1].iov_base = buffer;
+    iov[1].iov_len  = size;
+    iov[2].iov_base = &padding;
+    iov[2].iov_len  = CAPTURE_PADDING(size);
+    total           = sizeof(chunk) + size + CAPTURE_PADDING(size);
+
+    pthread_mutex_lock(&CAPTURE_lock(capture));
+    offset               = CAPTURE_end(capture);
+    CAPTURE_end(capture) += total;
+    pthread_mutex_unlock(&CAPTURE_lock(capture));
+
+    written = pwritev(CAPTURE_fd(capture), iov, 3, (off_t)offset);
+    if (written != (ssize_t)total) {
+        SEPAGENT_PRINT_ERROR("Could not write %u bytes to the capture: %s\n", size, strerror(errno));
+        return VT_FILE_OPEN_FAILED;
+    }
+
+    CAPTURE_INDEX_ENTRY_offset(entry)    = offset + sizeof(chunk);
+    CAPTURE_INDEX_ENTRY_first_tsc(entry) = first_tsc;
+    CAPTURE_INDEX_ENTRY_last_tsc(entry)  = last_tsc;
+    CAPTURE_INDEX_ENTRY_size(entry)      = size;
+    CAPTURE_INDEX_ENTRY_section(entry)   = (U16)section;
+    CAPTURE_INDEX_ENTRY_source(entry)    = (U16)source;
+
+    return VT_SUCCESS;
+}
+
+static int
+capture_Compare_Entries (
+    const void *a,
+    const void *b
+)
+{
+    CAPTURE_INDEX_ENTRY  x = (CAPTURE_INDEX_ENTRY)a;
+    CAPTURE_INDEX_ENTRY  y = (CAPTURE_INDEX_ENTRY)b;
+
+    if (x->section != y->section) {
+        return x->section < y->section ? -1 : 1;
+    }
+    if (x->source != y->source) {
+        return x->source < y->source ? -1 : 1;
+    }
+    if (x->first_tsc != y->first_tsc) {
+        return x->first_tsc < y->first_tsc ? -1 : 1;
+    }
+    return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+static int
+capture_Compare_Offsets (
+    const void *a,
+    const void *b
+)
+{
+    CAPTURE_INDEX_ENTRY  x = (CAPTURE_INDEX_ENTRY)a;
+    CAPTURE_INDEX_ENTRY  y = (CAPTURE_INDEX_ENTRY)b;
+
+    return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        capture_Sort (capture)
+ *
+ * @brief     Build the copy of the index ordered by section, source and TSC,
+ *            with the lock held
+ *
+ * @return    DRV_STATUS
+ *
+ * <I>Special Notes:</I>
+ *            reach[i] is the highest last_tsc among the entries of the same
+ *            source up to i. It never decreases within a source, which lets
+ *            a lookup binary search for the first chunk ending in a window.
+ */
+static DRV_STATUS
+capture_Sort (
+    CAPTURE  capture
+)
+{
+    CAPTURE_INDEX_ENTRY  entries;
+    U64                 *reach;
+    U32                  i;
+
+    if (CAPTURE_sorted(capture)) {
+        return VT_SUCCESS;
+    }
+    if (CAPTURE_sorted_capacity(capture) < CAPTURE_num_entries(capture)) {
+        entries = (CAPTURE_INDEX_ENTRY)realloc(CAPTURE_sorted_entries(capture),
+                                               CAPTURE_capacity(capture) * sizeof(CAPTURE_INDEX_ENTRY_NODE));
+        if (!entries) {
+            return VT_NO_MEMORY;
+        }
+        CAPTURE_sorted_entries(capture) = entries;
+        reach = (U64 *)realloc(CAPTURE_reach(capture), CAPTURE_capacity(capture) * sizeof(U64));
+        if (!reach) {
+            return VT_NO_MEMORY;
+        }
+        CAPTURE_reach(capture)           = reach;
+        CAPTURE_sorted_capacity(capture) = CAPTURE_capacity(capture);
+    }
+    entries = CAPTURE_sorted_entries(capture);
+    memcpy(entries, CAPTURE_entries(capture), CAPTURE_num_entries(capture) * sizeof(CAPTURE_INDEX_ENTRY_NODE));
+    CAPTURE_num_sorted(capture) = CAPTURE_num_entries(capture);
+    qsort(entries, CAPTURE_num_sorted(capture), sizeof(CAPTURE_INDEX_ENTRY_NODE), capture_Compare_Entries);
+    for (i = 0; i < CAPTURE_num_sorted(capture); i++) {
+        CAPTURE_reach(capture)[i] = entries[i].last_tsc;
+        if (i && entries[i].section == entries[i - 1].section && entries[i].source == entries[i - 1].source &&
+            CAPTURE_reach(capture)[i - 1] > entries[i].last_tsc) {
+            CAPTURE_reach(capture)[i] = CAPTURE_reach(capture)[i - 1];
+        }
+    }
+    CAPTURE_sorted(capture) = TRUE;
+
+    return VT_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        CAPTURE_Set_Tsc_Frequency (tsc_freq)
+ *
+ * @param     tsc_freq - TSC ticks per second on this target
+ *
+ * @brief     Set the TSC rate recorded in the header of new captures
+ *
+ * @return    None
+ *
+ */
+VOID
+CAPTURE_Set_Tsc_Frequency (
+    U64  tsc_freq
+)
+{
+    capture_tsc_freq = tsc_freq;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        CAPTURE_Create (path, num_cpus, num_packages, osid, agent_mode, capture)
+ *
+ * @param     path    - file to create, replaced if it exists
+ * @param     capture - receives the new capture
+ *
+ * @brief     Create a capture and write its header
+ *
+ * @return    DRV_STATUS
+ *
+ */
+DRV_STATUS
+CAPTURE_Create (
+    char     *path,
+    U32       num_cpus,
+    U32       num_packages,
+    U32       osid,
+    U32       agent_mode,
+    CAPTURE  *capture
+)
+{
+    CAPTURE         new_capture;
+    CAPTURE_HEADER  header;
+
+    new_capture = (CAPTURE)calloc(1, sizeof(CAPTURE_NODE));
+    if (!new_capture) {
+        return VT_NO_MEMORY;
+    }
+    CAPTURE_fd(new_capture) = open(path, O_CREAT|O_TRUNC|O_RDWR, 0644);
+    if (CAPTURE_fd(new_capture) == -1) {
+        SEPAGENT_PRINT_ERROR("Could not create the capture %s: %s\n", path, strerror(errno));
+        free(new_capture);
+        return VT_FILE_OPEN_FAILED;
+    }
+    pthread_mutex_init(&CAPTURE_lock(new_capture), NULL);
+    CAPTURE_writable(new_capture) = TRUE;
+
+    header = &CAPTURE_header(new_capture);
+    memcpy(CAPTURE_HEADER_magic(header), CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+    CAPTURE_HEADER_version(header)      = CAPTURE_VERSION;
+    CAPTURE_HEADER_header_size(header)  = sizeof(CAPTURE_HEADER_NODE);
+    CAPTURE_HEADER_tsc_freq(header)     = capture_tsc_freq;
+    CAPTURE_HEADER_create_tsc(header)   = capture_Read_TSC();
+    CAPTURE_HEADER_num_cpus(header)     = num_cpus;
+    CAPTURE_HEADER_num_packages(header) = num_packages;
+    CAPTURE_HEADER_osid(header)         = osid;
+    CAPTURE_HEADER_agent_mode(header)   = agent_mode;
+
+    if (pwrite(CAPTURE_fd(new_capture), header, sizeof(CAPTURE_HEADER_NODE), 0) != sizeof(CAPTURE_HEADER_NODE)) {
+        SEPAGENT_PRINT_ERROR("Could not write the capture header: %s\n", strerror(errno));
+        close(CAPTURE_fd(new_capture));
+        free(new_capture);
+        return VT_FILE_OPEN_FAILED;
+    }
+    CAPTURE_end(new_capture) = sizeof(CAPTURE_HEADER_NODE);
+    *capture = new_capture;
+
+    return VT_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        CAPTURE_Append (capture, section, source, buffer, size)
+ *
+ * @param     section - CAPTURE_SECTION_* of the data
+ * @param     source  - cpu or package the data comes from
+ * @param     buffer  - whole records, or one piece of metadata
+ * @param     size    - bytes in buffer
+ *
+ * @brief     Append data to the capture as one chunk
+ *
+ * @return    DRV_STATUS
+ *
+ * <I>Special Notes:</I>
+ *            Safe to call from every reader thread at once. Descriptors
+ *            must be appended in id order before any sample record, as the
+ *            driver receives them.
+ */
+DRV_STATUS
+CAPTURE_Append (
+    CAPTURE  capture,
+    U32      section,
+    U32      source,
+    PVOID    buffer,
+    U32      size
+)
+{
+    CAPTURE_INDEX_ENTRY_NODE  entry;
+    DRV_STATUS                status;
+    U64                       first_tsc = 0;
+    U64                       last_tsc  = ~0ULL;
+
+    if (!capture || !CAPTURE_writable(capture) || !buffer || !size) {
+        return VT_BAD_PARAMETER;
+    }
+    if (section <= CAPTURE_SECTION_SIDEBAND) {
+        capture_Tsc_Range(capture, section, (S8 *)buffer, size, &first_tsc, &last_tsc);
+    }
+
+    status = capture_Write_Chunk(capture, section, source, buffer, size, first_tsc, last_tsc, &entry);
+    if (status != VT_SUCCESS) {
+        return status;
+    }
+
+    pthread_mutex_lock(&CAPTURE_lock(capture));
+    if (section == CAPTURE_SECTION_DESCRIPTOR && CAPTURE_num_desc(capture) < CAPTURE_MAX_DESCRIPTORS &&
+        size >= sizeof(EVENT_DESC_NODE)) {
+        CAPTURE_desc_size(capture, CAPTURE_num_desc(capture)++) = EVENT_DESC_sample_size((EVENT_DESC)buffer);
+    }
+    if (section == CAPTURE_SECTION_START && size >= sizeof(U64)) {
+        CAPTURE_start_tsc(capture) = *(U64 *)buffer;
+    }
+    status = capture_Add_Entry(capture, &entry);
+    pthread_mutex_unlock(&CAPTURE_lock(capture));
+
+    return status;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        CAPTURE_Mark_Start (capture)
+ *
+ * @brief     Record that the collection has just started
+ *
+ * @return    DRV_STATUS
+ *
+ * <I>Special Notes:</I>
+ *            Collection times given to CAPTURE_Seconds_To_Tsc count from
+ *            here, not from the creation of the capture, which happens
+ *            before the collection is set up.
+ */
+DRV_STATUS
+CAPTURE_Mark_Start (
+    CAPTURE  capture
+)
+{
+    U64 tsc = capture_Read_TSC();
+
+    return CAPTURE_Append(capture, CAPTURE_SECTION_START, CAPTURE_UNKNOWN_SOURCE, &tsc, sizeof(tsc));
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        capture_Scan (capture)
+ *
+ * @brief     Rebuild the index of a capture that was never closed
+ *
+ * @return    DRV_STATUS
+ *
+ * <I>Special Notes:</I>
+ *            Chunks are read until the end of the file or the first torn
+ *            one; the data of a chunk still being written when the agent
+ *            stopped is lost, nothing before it is.
+ */
+static DRV_STATUS
+capture_Scan (
+    CAPTURE  capture
+)
+{
+    CAPTURE_CHUNK             chunk;
+    CAPTURE_INDEX_ENTRY_NODE  entry;
+    DRV_STATUS                status;
+    U64                       offset = CAPTURE_HEADER_header_size(&CAPTURE_header(capture));
+    U64                       total;
+
+    while (offset + sizeof(CAPTURE_CHUNK_NODE) <= CAPTURE_map_size(capture)) {
+        chunk = (CAPTURE_CHUNK)(CAPTURE_map(capture) + offset);
+        total = sizeof(CAPTURE_CHUNK_NODE) + CAPTURE_CHUNK_size(chunk) + CAPTURE_PADDING(CAPTURE_CHUNK_size(chunk));
+        if (CAPTURE_CHUNK_magic(chunk) != CAPTURE_CHUNK_MAGIC || offset + total > CAPTURE_map_size(capture)) {
+            break;
+        }
+        if (CAPTURE_CHUNK_section(chunk) != CAPTURE_SECTION_INDEX) {
+            CAPTURE_INDEX_ENTRY_offset(&entry)    = offset + sizeof(CAPTURE_CHUNK_NODE);
+            CAPTURE_INDEX_ENTRY_first_tsc(&entry) = CAPTURE_CHUNK_first_tsc(chunk);
+            CAPTURE_INDEX_ENTRY_last_tsc(&entry)  = CAPTURE_CHUNK_last_tsc(chunk);
+            CAPTURE_INDEX_ENTRY_size(&entry)      = CAPTURE_CHUNK_size(chunk);
+            CAPTURE_INDEX_ENTRY_section(&entry)   = CAPTURE_CHUNK_section(chunk);
+            CAPTURE_INDEX_ENTRY_source(&entry)    = CAPTURE_CHUNK_source(chunk);
+            status = capture_Add_Entry(capture, &entry);
+            if (status != VT_SUCCESS) {
+                return status;
+            }
+        }
+        offset += total;
+    }
+    if (offset != CAPTURE_map_size(capture)) {
+        SEPAGENT_PRINT_WARNING("Capture is torn at offset %llu, the rest is ignored\n", (unsigned long long)offset);
+    }
+
+    return VT_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        capture_Load_Index (capture)
+ *
+ * @brief     Load the index written when the capture was closed
+ *
+ * @return    TRUE if the capture has a valid index
+ *
+ */
+static DRV_BOOL
+capture_Load_Index (
+    CAPTURE  capture
+)
+{
+    CAPTURE_TRAILER  trailer;
+    CAPTURE_CHUNK    chunk;
+    U64              offset;
+    U32              i;
+
+    if (CAPTURE_map_size(capture) < CAPTURE_HEADER_header_size(&CAPTURE_header(capture)) + sizeof(CAPTURE_TRAILER_NODE)) {
+        return FALSE;
+    }
+    trailer = (CAPTURE_TRAILER)(CAPTURE_map(capture) + CAPTURE_map_size(capture) - sizeof(CAPTURE_TRAILER_NODE));
+    offset  = CAPTURE_TRAILER_index_offset(trailer);
+    if (CAPTURE_TRAILER_magic(trailer) != CAPTURE_TRAILER_MAGIC ||
+        offset % CAPTURE_ALIGN || offset + sizeof(CAPTURE_CHUNK_NODE) > CAPTURE_map_size(capture)) {
+        return FALSE;
+    }
+    chunk = (CAPTURE_CHUNK)(CAPTURE_map(capture) + offset);
+    if (CAPTURE_CHUNK_magic(chunk) != CAPTURE_CHUNK_MAGIC || CAPTURE_CHUNK_section(chunk) != CAPTURE_SECTION_INDEX ||
+        CAPTURE_CHUNK_size(chunk) != CAPTURE_TRAILER_num_entries(trailer) * sizeof(CAPTURE_INDEX_ENTRY_NODE) ||
+        offset + sizeof(CAPTURE_CHUNK_NODE) + CAPTURE_CHUNK_size(chunk) > CAPTURE_map_size(capture)) {
+        return FALSE;
+    }
+    for (i = 0; i < CAPTURE_TRAILER_num_entries(trailer); i++) {
+        if (capture_Add_Entry(capture, (CAPTURE_INDEX_ENTRY)(chunk + 1) + i) != VT_SUCCESS) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        CAPTURE_Open (path, capture)
+ *
+ * @param     path    - capture file
+ * @param     capture - receives the capture, mapped read-only
+ *
+ * @brief     Open an existing capture for random access
+ *
+ * @return    DRV_STATUS
+ *
+ */
+DRV_STATUS
+CAPTURE_Open (
+    char     *path,
+    CAPTURE  *capture
+)
+{
+    CAPTURE              new_capture;
+    CAPTURE_INDEX_ENTRY  entry;
+    struct stat          st;
+    DRV_STATUS           status = VT_SUCCESS;
+    U32                  i;
+
+    new_capture = (CAPTURE)calloc(1, sizeof(CAPTURE_NODE));
+    if (!new_capture) {
+        return VT_NO_MEMORY;
+    }
+    CAPTURE_fd(new_capture) = open(path, O_RDONLY);
+    if (CAPTURE_fd(new_capture) == -1 || fstat(CAPTURE_fd(new_capture), &st) != 0) {
+        SEPAGENT_PRINT_ERROR("Could not open the capture %s: %s\n", path, strerror(errno));
+        if (CAPTURE_fd(new_capture) != -1) {
+            close(CAPTURE_fd(new_capture));
+        }
+        free(new_capture);
+        return VT_FILE_OPEN_FAILED;
+    }
+    pthread_mutex_init(&CAPTURE_lock(new_capture), NULL);
+
+    if ((U64)st.st_size < sizeof(CAPTURE_HEADER_NODE)) {
+        status = VT_INVALID_SAMPLE_FILE;
+    }
+    else {
+        CAPTURE_map_size(new_capture) = (U64)st.st_size;
+        CAPTURE_map(new_capture)      = (S8 *)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, CAPTURE_fd(new_capture), 0);
+        if (CAPTURE_map(new_capture) == MAP_FAILED) {
+            CAPTURE_map(new_capture) = NULL;
+            status = VT_SAMPLE_FILE_MAPPING_ERROR;
+        }
+    }
+    if (status == VT_SUCCESS) {
+        memcpy(&CAPTURE_header(new_capture), CAPTURE_map(new_capture), sizeof(CAPTURE_HEADER_NODE));
+        if (memcmp(CAPTURE_HEADER_magic(&CAPTURE_header(new_capture)), CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) ||
+            CAPTURE_HEADER_version(&CAPTURE_header(new_capture)) != CAPTURE_VERSION ||
+            CAPTURE_HEADER_header_size(&CAPTURE_header(new_capture)) < sizeof(CAPTURE_HEADER_NODE) ||
+            CAPTURE_HEADER_header_size(&CAPTURE_header(new_capture)) % CAPTURE_ALIGN) {
+            status = VT_INVALID_SAMPLE_FILE;
+        }
+    }
+    if (status == VT_SUCCESS && !capture_Load_Index(new_capture)) {
+        CAPTURE_num_entries(new_capture) = 0;
+        status = capture_Scan(new_capture);
+    }
+    if (status == VT_SUCCESS) {
+        // the index on file is in TSC order, CAPTURE_Next walks the file order
+        qsort(CAPTURE_entries(new_capture), CAPTURE_num_entries(new_capture),
+              sizeof(CAPTURE_INDEX_ENTRY_NODE), capture_Compare_Offsets);
+        for (i = 0; i < CAPTURE_num_entries(new_capture); i++) {
+            entry = &CAPTURE_entries(new_capture)[i];
+            if (CAPTURE_INDEX_ENTRY_section(entry) == CAPTURE_SECTION_START &&
+                CAPTURE_INDEX_ENTRY_size(entry) >= sizeof(U64)) {
+                memcpy(&CAPTURE_start_tsc(new_capture), CAPTURE_map(new_capture) + CAPTURE_INDEX_ENTRY_offset(entry), sizeof(U64));
+            }
+        }
+    }
+    if (status != VT_SUCCESS) {
+        CAPTURE_Close(new_capture);
+        return status;
+    }
+    *capture = new_capture;
+
+    return VT_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        CAPTURE_Header (capture)
+ *
+ * @brief     Platform description stored at the start of the capture
+ *
+ * @return    CAPTURE_HEADER
+ *
+ */
+CAPTURE_HEADER
+CAPTURE_Header (
+    CAPTURE  capture
+)
+{
+    return &CAPTURE_header(capture);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        CAPTURE_Seconds_To_Tsc (capture, seconds)
+ *
+ * @param     seconds - time since the collection was started
+ *
+ * @brief     Convert a collection time to the TSC of the records
+ *
+ * @return    U64 - TSC value
+ *
+ * <I>Special Notes:</I>
+ *            A capture without a start chunk (collection never started)
+ *            counts from its creation.
+ */
+U64
+CAPTURE_Seconds_To_Tsc (
+    CAPTURE  capture,
+    double   seconds
+)
+{
+    U64 start_tsc = CAPTURE_start_tsc(capture);
+
+    if (!start_tsc) {
+        start_tsc = CAPTURE_HEADER_create_tsc(&CAPTURE_header(capture));
+    }
+    return start_tsc + (U64)(seconds * (double)CAPTURE_HEADER_tsc_freq(&CAPTURE_header(capture)));
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        CAPTURE_Find (capture, section, source, first_tsc, last_tsc, after, entry)
+ *
+ * @param     section   - CAPTURE_SECTION_* to look in
+ * @param     source    - cpu or package
+ * @param     first_tsc - start of the time window
+ * @param     last_tsc  - end of the time window, included
+ * @param     after     - position returned by the previous call, -1 to start
+ * @param     entry     - receives the index entry of the chunk found
+ *
+ * @brief     Find the next chunk of a source overlapping a time window
+ *
+ * @return    position of the chunk in the index, -1 when there are no more
+ *
+ * <I>Special Notes:</I>
+ *            Chunks are returned in TSC order. The first one is found by
+ *            binary search; the file is not read. Positions are only valid
+ *            while nothing is appended: use CAPTURE_Next to walk a capture
+ *            being written.
+ */
+S64
+CAPTURE_Find (
+    CAPTURE              capture,
+    U32                  section,
+    U32                  source,
+    U64                  first_tsc,
+    U64                  last_tsc,
+    S64                  after,
+    CAPTURE_INDEX_ENTRY  entry
+)
+{
+    CAPTURE_INDEX_ENTRY  entries;
+    U32                  low, high, middle;
+    S64                  found = -1;
+
+    pthread_mutex_lock(&CAPTURE_lock(capture));
+    if (capture_Sort(capture) != VT_SUCCESS) {
+        pthread_mutex_unlock(&CAPTURE_lock(capture));
+        return -1;
+    }
+    entries = CAPTURE_sorted_entries(capture);
+
+    if (after < 0) {
+        // first entry of the source whose records reach the window
+        low  = 0;
+        high = CAPTURE_num_sorted(capture);
+        while (low < high) {
+            middle = low + (high - low) / 2;
+            if (entries[middle].section < section ||
+                (entries[middle].section == section && entries[middle].source < source) ||
+                (entries[middle].section == section && entries[middle].source == source &&
+                 CAPTURE_reach(capture)[middle] < first_tsc)) {
+                low = middle + 1;
+            }
+            else {
+                high = middle;
+            }
+        }
+    }
+    else {
+        low = (U32)after + 1;
+    }
+
+    for (; low < CAPTURE_num_sorted(capture); low++) {
+        if (entries[low].section != section || entries[low].source != source ||
+            entries[low].first_tsc > last_tsc) {
+            break;
+        }
+        if (entries[low].last_tsc >= first_tsc) {
+            *entry = entries[low];
+            found  = low;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&CAPTURE_lock(capture));
+
+    return found;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        CAPTURE_Next (capture, section, source, after, entry)
+ *
+ * @param     section - CAPTURE_SECTION_* to look in
+ * @param     source  - cpu or package
+ * @param     after   - position returned by the previous call, -1 to start
+ * @param     entry   - receives the index entry of the chunk found
+ *
+ * @brief     Find the next chunk of a source in file order
+ *
+ * @return    position of the chunk, -1 when there are no more
+ *
+ * <I>Special Notes:</I>
+ *            The chunks of a source come back in the order its device was
+ *            read. Positions stay valid while other sources are appended,
+ *            so a stream can be sent while the others are still written.
+ */
+S64
+CAPTURE_Next (
+    CAPTURE              capture,
+    U32                  section,
+    U32                  source,
+    S64                  after,
+    CAPTURE_INDEX_ENTRY  entry
+)
+{
+    CAPTURE_INDEX_ENTRY  entries;
+    U32                  i;
+    S64                  found = -1;
+
+    pthread_mutex_lock(&CAPTURE_lock(capture));
+    entries = CAPTURE_entries(capture);
+    for (i = (U32)(after + 1); i < CAPTURE_num_entries(capture); i++) {
+        if (entries[i].section == section && entries[i].source == source) {
+            *entry = entries[i];
+            found  = i;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&CAPTURE_lock(capture));
+
+    return found;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        CAPTURE_Read (capture, entry, buffer, size)
+ *
+ * @param     entry  - chunk returned by CAPTURE_Find
+ * @param     buffer - receives the payload
+ * @param     size   - bytes available in buffer
+ *
+ * @brief     Copy the payload of a chunk
+ *
+ * @return    DRV_STATUS
+ *
+ */
+DRV_STATUS
+CAPTURE_Read (
+    CAPTURE              capture,
+    CAPTURE_INDEX_ENTRY  entry,
+    PVOID                buffer,
+    U32                  size
+)
+{
+    if (size < CAPTURE_INDEX_ENTRY_size(entry)) {
+        return VT_BAD_PARAMETER;
+    }
+    if (pread(CAPTURE_fd(capture), buffer, CAPTURE_INDEX_ENTRY_size(entry),
+              (off_t)CAPTURE_INDEX_ENTRY_offset(entry)) != (ssize_t)CAPTURE_INDEX_ENTRY_size(entry)) {
+        SEPAGENT_PRINT_ERROR("Could not read the capture: %s\n", strerror(errno));
+        return VT_INVALID_SAMPLE_FILE;
+    }
+
+    return VT_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        CAPTURE_Payload (capture, entry)
+ *
+ * @param     entry - chunk returned by CAPTURE_Find
+ *
+ * @brief     Payload of a chunk in the mapping of an opened capture
+ *
+ * @return    pointer to the payload, NULL for a capture being written
+ *
+ */
+PVOID
+CAPTURE_Payload (
+    CAPTURE              capture,
+    CAPTURE_INDEX_ENTRY  entry
+)
+{
+    if (!CAPTURE_map(capture)) {
+        return NULL;
+    }
+    return CAPTURE_map(capture) + CAPTURE_INDEX_ENTRY_offset(entry);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        CAPTURE_Close (capture)
+ *
+ * @brief     Write the index of a capture being written, and release it
+ *
+ * @return    DRV_STATUS
+ *
+ * <I>Special Notes:</I>
+ *            No chunk may be appended once this is called.
+ */
+DRV_STATUS
+CAPTURE_Close (
+    CAPTURE  capture
+)
+{
+    CAPTURE_INDEX_ENTRY_NODE  entry;
+    CAPTURE_TRAILER_NODE      trailer;
+    DRV_STATUS                status = VT_SUCCESS;
+
+    if (!capture) {
+        return VT_BAD_PARAMETER;
+    }
+    if (CAPTURE_writable(capture)) {
+        // without an index the capture is still read back by scanning its chunks
+        status = capture_Sort(capture);
+        CAPTURE_TRAILER_magic(&trailer)        = CAPTURE_TRAILER_MAGIC;
+        CAPTURE_TRAILER_num_entries(&trailer)  = CAPTURE_num_sorted(capture);
+        CAPTURE_TRAILER_index_offset(&trailer) = CAPTURE_end(capture);
+        if (status == VT_SUCCESS) {
+            status = capture_Write_Chunk(capture, CAPTURE_SECTION_INDEX, CAPTURE_UNKNOWN_SOURCE, CAPTURE_sorted_entries(capture),
+                                         CAPTURE_num_sorted(capture) * sizeof(CAPTURE_INDEX_ENTRY_NODE), 0, 0, &entry);
+        }
+        if (status == VT_SUCCESS &&
+            pwrite(CAPTURE_fd(capture), &trailer, sizeof(trailer), (off_t)CAPTURE_end(capture)) != sizeof(trailer)) {
+            SEPAGENT_PRINT_ERROR("Could not write the capture trailer: %s\n", strerror(errno));
+            status = VT_FILE_OPEN_FAILED;
+        }
+    }
+    if (CAPTURE_map(capture)) {
+        munmap(CAPTURE_map(capture), (size_t)CAPTURE_map_size(capture));
+    }
+    close(CAPTURE_fd(capture));
+    pthread_mutex_destroy(&CAPTURE_lock(capture));
+    free(CAPTURE_entries(capture));
+    free(CAPTURE_sorted_entries(capture));
+    free(CAPTURE_reach(capture));
+    free(capture);
+
+    return status;
+}
@@ -0,0 +1,171 @@
+/****
+    Copyright (C) 2019-2020 Intel Corporation.  All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+
+
+
+
+
+****/
+
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/*
+ * On-target capture container, the spill file of delayed data transfer.
+ *
+ * The file starts with a CAPTURE_HEADER and is then only appended to. Every
+ * record stream buffer and every piece of metadata is written as a chunk: a
+ * CAPTURE_CHUNK header followed by the payload, padded to 8 bytes. A chunk
+ * of a record stream carries the TSC range of its records, so a reader can
+ * pick the chunks of one CPU over one time window from the index alone.
+ * Closing the capture appends the index, sorted by section, source and TSC,
+ * and a CAPTURE_TRAILER. A capture without a trailer (agent killed during
+ * a collection) is indexed again from the chunk headers.
+ *
+ * The chunks of one source are, in file order, the buffers as they were read
+ * from its device: CAPTURE_Next walks them in that order, to replay a
+ * stream. CAPTURE_Find walks them in TSC order, for random access; the TSC
+ * range of a chunk that could not be walked is only a bound.
+ */
+#define CAPTURE_MAGIC               "SEPCAPT"
+#define CAPTURE_VERSION             2
+#define CAPTURE_CHUNK_MAGIC         0x4b4e4843      // "CHNK"
+#define CAPTURE_TRAILER_MAGIC       0x444e4543      // "CEND"
+#define CAPTURE_ALIGN               8
+#define CAPTURE_UNKNOWN_SOURCE      0xffff
+
+/*
+ * Chunk sections. The record streams use the numbering of the data channels.
+ */
+#define CAPTURE_SECTION_CORE        0
+#define CAPTURE_SECTION_MODULE      1
+#define CAPTURE_SECTION_UNCORE      2
+#define CAPTURE_SECTION_SIDEBAND    3
+#define CAPTURE_SECTION_DESCRIPTOR  4               // one EVENT_DESC_NODE, descriptor ids in file order
+#define CAPTURE_SECTION_TOPOLOGY    5               // reply of a topology operation, source is the operation
+#define CAPTURE_SECTION_SKEW        6               // reply of TSC_SKEW_INFO
+#define CAPTURE_SECTION_INDEX       7               // CAPTURE_INDEX_ENTRY_NODE array written on close
+#define CAPTURE_SECTION_START       8               // U64 TSC read when the collection was started
+
+typedef struct CAPTURE_HEADER_NODE_S  CAPTURE_HEADER_NODE;
+typedef        CAPTURE_HEADER_NODE   *CAPTURE_HEADER;
+
+struct CAPTURE_HEADER_NODE_S {
+    char  magic[8];
+    U32   version;
+    U32   header_size;
+    U64   tsc_freq;                 // TSC ticks per second
+    U64   create_tsc;               // TSC when the capture was created, before the collection started
+    U32   num_cpus;
+    U32   num_packages;
+    U32   osid;
+    U32   agent_mode;
+    U64   reserved[2];
+};
+
+#define CAPTURE_HEADER_magic(x)          (x)->magic
+#define CAPTURE_HEADER_version(x)        (x)->version
+#define CAPTURE_HEADER_header_size(x)    (x)->header_size
+#define CAPTURE_HEADER_tsc_freq(x)       (x)->tsc_freq
+#define CAPTURE_HEADER_create_tsc(x)     (x)->create_tsc
+#define CAPTURE_HEADER_num_cpus(x)       (x)->num_cpus
+#define CAPTURE_HEADER_num_packages(x)   (x)->num_packages
+#define CAPTURE_HEADER_osid(x)           (x)->osid
+#define CAPTURE_HEADER_agent_mode(x)     (x)->agent_mode
+
+typedef struct CAPTURE_CHUNK_NODE_S  CAPTURE_CHUNK_NODE;
+typedef        CAPTURE_CHUNK_NODE   *CAPTURE_CHUNK;
+
+struct CAPTURE_CHUNK_NODE_S {
+    U32   magic;
+    U16   section;
+    U16   source;                   // cpu or package of a record stream
+    U32   size;                     // payload bytes, without the padding
+    U32   reserved;
+    U64   first_tsc;                // TSC range of the records, 0 and ~0 when unknown
+    U64   last_tsc;
+};
+
+#define CAPTURE_CHUNK_magic(x)       (x)->magic
+#define CAPTURE_CHUNK_section(x)     (x)->section
+#define CAPTURE_CHUNK_source(x)      (x)->source
+#define CAPTURE_CHUNK_size(x)        (x)->size
+#define CAPTURE_CHUNK_first_tsc(x)   (x)->first_tsc
+#define CAPTURE_CHUNK_last_tsc(x)    (x)->last_tsc
+
+typedef struct CAPTURE_INDEX_ENTRY_NODE_S  CAPTURE_INDEX_ENTRY_NODE;
+typedef        CAPTURE_INDEX_ENTRY_NODE   *CAPTURE_INDEX_ENTRY;
+
+struct CAPTURE_INDEX_ENTRY_NODE_S {
+    U64   offset;                   // file offset of the payload
+    U64   first_tsc;
+    U64   last_tsc;
+    U32   size;
+    U16   section;
+    U16   source;
+};
+
+#define CAPTURE_INDEX_ENTRY_offset(x)      (x)->offset
+#define CAPTURE_INDEX_ENTRY_first_tsc(x)   (x)->first_tsc
+#define CAPTURE_INDEX_ENTRY_last_tsc(x)    (x)->last_tsc
+#define CAPTURE_INDEX_ENTRY_size(x)        (x)->size
+#define CAPTURE_INDEX_ENTRY_section(x)     (x)->section
+#define CAPTURE_INDEX_ENTRY_source(x)      (x)->source
+
+typedef struct CAPTURE_TRAILER_NODE_S  CAPTURE_TRAILER_NODE;
+typedef        CAPTURE_TRAILER_NODE   *CAPTURE_TRAILER;
+
+struct CAPTURE_TRAILER_NODE_S {
+    U32   magic;
+    U32   num_entries;
+    U64   index_offset;             // file offset of the index chunk header
+};
+
+#define CAPTURE_TRAILER_magic(x)          (x)->magic
+#define CAPTURE_TRAILER_num_entries(x)    (x)->num_entries
+#define CAPTURE_TRAILER_index_offset(x)   (x)->index_offset
+
+typedef struct CAPTURE_NODE_S  CAPTURE_NODE;
+typedef        CAPTURE_NODE   *CAPTURE;
+
+extern VOID       CAPTURE_Set_Tsc_Frequency(U64 tsc_freq);
+extern DRV_STATUS CAPTURE_Create(char *path, U32 num_cpus, U32 num_packages, U32 osid, U32 agent_mode, CAPTURE *capture);
+extern DRV_STATUS CAPTURE_Append(CAPTURE capture, U32 section, U32 source, PVOID buffer, U32 size);
+extern DRV_STATUS CAPTURE_Mark_Start(CAPTURE capture);
+extern DRV_STATUS CAPTURE_Open(char *path, CAPTURE *capture);
+extern CAPTURE_HEADER CAPTURE_Header(CAPTURE capture);
+extern U64        CAPTURE_Seconds_To_Tsc(CAPTURE capture, double seconds);
+extern S64        CAPTURE_Find(CAPTURE capture, U32 section, U32 source, U64 first_tsc, U64 last_tsc, S64 after, CAPTURE_INDEX_ENTRY entry);
+extern S64        CAPTURE_Next(CAPTURE capture, U32 section, U32 source, S64 after, CAPTURE_INDEX_ENTRY entry);
+extern DRV_STATUS CAPTURE_Read(CAPTURE capture, CAPTURE_INDEX_ENTRY entry, PVOID buffer, U32 size);
+extern PVOID      CAPTURE_Payload(CAPTURE capture, CAPTURE_INDEX_ENTRY entry);
+extern DRV_STATUS CAPTURE_Close(CAPTURE capture);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
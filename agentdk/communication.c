@@ -36,7 +36,11 @@ SOFTWARE.
 #include <stdlib.h>
 #include <errno.h>
 #include <sys/utsname.h>
+#include <sys/time.h>
 #include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "lwpmudrv_defines.h"
 #include "lwpmudrv_types.h"
@@ -47,6 +51,7 @@ SOFTWARE.
 #include "lwpmudrv_version.h"
 #include "communication.h"
 #include "collection_traces.h"
+#include "perf_backend.h"
 #include "log.h"
 
 static int                 control_socket, server_socket;
@@ -55,9 +60,49 @@ static struct              sockaddr_in  server_socket_info, control_socket_info;
 static CONTROL_FIRST_MSG   first_control_msg = NULL;
 static struct              utsname sysinfo;
 static S32                 num_cpus = 0;
+static U32                 num_packages = 1;
 static U32                 num_of_data_connections = 0;
 static U32                 num_of_total_connections = 0;
 
+/*
+ * Per data channel state of a resumable session. Every chunk sent on the channel is also
+ * appended to a byte ring of comm_replay_size, the channel's share of the replay budget;
+ * the oldest chunks are evicted when it fills.
+ * The lock serializes senders with the suspend and resume of the channel.
+ */
+typedef struct COMM_CHANNEL_NODE_S  COMM_CHANNEL_NODE;
+typedef        COMM_CHANNEL_NODE   *COMM_CHANNEL;
+
+struct COMM_CHANNEL_NODE_S {
+    pthread_mutex_t  lock;
+    DRV_BOOL         connected;
+    U64              next_seq;
+    S8              *replay;
+    U32              replay_head;
+    U32              replay_used;
+    U64              replay_first_seq;
+    U64              evicted;
+};
+
+#define COMM_CHANNEL_lock(ch)              (ch)->lock
+#define COMM_CHANNEL_connected(ch)         (ch)->connected
+#define COMM_CHANNEL_next_seq(ch)          (ch)->next_seq
+#define COMM_CHANNEL_replay(ch)            (ch)->replay
+#define COMM_CHANNEL_replay_head(ch)       (ch)->replay_head
+#define COMM_CHANNEL_replay_used(ch)       (ch)->replay_used
+#define COMM_CHANNEL_replay_first_seq(ch)  (ch)->replay_first_seq
+#define COMM_CHANNEL_evicted(ch)           (ch)->evicted
+
+static COMM_CHANNEL        comm_channels     = NULL;
+static U32                 session_flags     = 0;
+static U64                 session_id        = 0;
+static U32                 session_count     = 0;
+static DRV_BOOL            session_suspended = FALSE;
+// a host that connected while a session was suspended without resuming it, kept for the next open
+static DRV_BOOL            control_pending   = FALSE;
+static U32                 comm_replay_size  = 0;
+extern U32                 replay_budget_mb;
+
 S32
 comm_Get_Data_Socket_Array_Index (
     U32 conn_id,
@@ -75,7 +120,8 @@ comm_Get_Data_Socket_Array_Index (
             idx = num_cpus;
             break;
         case COMM_DATA_UNCORE:
-            idx = num_cpus + 1;
+            // package 0 keeps its historical slot, the others follow the sideband slots
+            idx = (conn_id == 0) ? num_cpus + 1 : num_cpus * 2 + NUM_NONCORE_DATA_CONNECTIONS + conn_id - 1;
             break;
         case COMM_DATA_SIDEBAND:
             idx = num_cpus + 2 + conn_id;
@@ -92,6 +138,208 @@ comm_Get_Data_Socket_Array_Index (
     return idx;
 }
 
+static S32
+comm_Send_All (
+    int   sock,
+    void *buffer,
+    U32   size
+)
+{
+    U32 sent = 0;
+    S32 ret;
+
+    while (sent < size) {
+        ret = send(sock, (S8*)buffer + sent, size - sent, MSG_NOSIGNAL);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return VT_COMM_SEND_ERROR;
+        }
+        sent += ret;
+    }
+
+    return VT_SUCCESS;
+}
+
+static S32
+comm_Recv_All (
+    int   sock,
+    void *buffer,
+    U32   size
+)
+{
+    U32 received = 0;
+    S32 ret;
+
+    while (received < size) {
+        ret = recv(sock, (S8*)buffer + received, size - received, 0);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret < 0) {
+            return VT_COMM_RECV_ERROR;
+        }
+        if (!ret) {
+            return VT_COMM_CONNECTION_CLOSED_BY_REMOTE;
+        }
+        received += ret;
+    }
+
+    return VT_SUCCESS;
+}
+
+/*
+ * Ring accessors; offsets are relative to the start of the replay buffer and wrap around it
+ */
+static void
+comm_Replay_Write (
+    COMM_CHANNEL  ch,
+    U32           offset,
+    void         *src,
+    U32           size
+)
+{
+    U32 first = (size < comm_replay_size - offset) ? size : comm_replay_size - offset;
+
+    memcpy(COMM_CHANNEL_replay(ch) + offset, src, first);
+    memcpy(COMM_CHANNEL_replay(ch), (S8*)src + first, size - first);
+}
+
+static void
+comm_Replay_Read (
+    COMM_CHANNEL  ch,
+    U32           offset,
+    void         *dst,
+    U32           size
+)
+{
+    U32 first = (size < comm_replay_size - offset) ? size : comm_replay_size - offset;
+
+    memcpy(dst, COMM_CHANNEL_replay(ch) + offset, first);
+    memcpy((S8*)dst + first, COMM_CHANNEL_replay(ch), size - first);
+}
+
+static void
+comm_Replay_Store (
+    COMM_CHANNEL            ch,
+    COMM_DATA_CHUNK_HEADER  header,
+    void                   *buffer
+)
+{
+    COMM_DATA_CHUNK_HEADER_NODE  oldest;
+    U32                          size = sizeof(COMM_DATA_CHUNK_HEADER_NODE) + COMM_DATA_CHUNK_HEADER_size(header);
+
+    if (!comm_replay_size) {
+        COMM_CHANNEL_replay_first_seq(ch) = COMM_DATA_CHUNK_HEADER_seq(header) + 1;
+        return;
+    }
+    if (!COMM_CHANNEL_replay(ch)) {
+        COMM_CHANNEL_replay(ch) = (S8*)malloc(comm_replay_size);
+        if (!COMM_CHANNEL_replay(ch)) {
+            SEPAGENT_PRINT_ERROR("Couldn't allocate the replay buffer, data sent before a disconnect will be lost\n");
+            COMM_CHANNEL_replay_first_seq(ch) = COMM_DATA_CHUNK_HEADER_seq(header) + 1;
+            return;
+        }
+    }
+    if (size > comm_replay_size) {
+        COMM_CHANNEL_evicted(ch)         += COMM_DATA_CHUNK_HEADER_seq(header) - COMM_CHANNEL_replay_first_seq(ch) + 1;
+        COMM_CHANNEL_replay_head(ch)      = 0;
+        COMM_CHANNEL_replay_used(ch)      = 0;
+        COMM_CHANNEL_replay_first_seq(ch) = COMM_DATA_CHUNK_HEADER_seq(header) + 1;
+        return;
+    }
+
+    while (COMM_CHANNEL_replay_used(ch) + size > comm_replay_size) {
+        comm_Replay_Read(ch, COMM_CHANNEL_replay_head(ch), &oldest, sizeof(oldest));
+        COMM_CHANNEL_replay_head(ch)  = (COMM_CHANNEL_replay_head(ch) + sizeof(oldest) + oldest.size) % comm_replay_size;
+        COMM_CHANNEL_replay_used(ch) -= sizeof(oldest) + oldest.size;
+        COMM_CHANNEL_replay_first_seq(ch)++;
+        COMM_CHANNEL_evicted(ch)++;
+    }
+
+    comm_Replay_Write(ch, (COMM_CHANNEL_replay_head(ch) + COMM_CHANNEL_replay_used(ch)) % comm_replay_size,
+                      header, sizeof(COMM_DATA_CHUNK_HEADER_NODE));
+    comm_Replay_Write(ch, (COMM_CHANNEL_replay_head(ch) + COMM_CHANNEL_replay_used(ch) + sizeof(COMM_DATA_CHUNK_HEADER_NODE)) % comm_replay_size,
+                      buffer, COMM_DATA_CHUNK_HEADER_size(header));
+    COMM_CHANNEL_replay_used(ch) += size;
+}
+
+static S32
+comm_Replay_Send (
+    COMM_CHANNEL  ch,
+    int           sock,
+    U64           last_seq
+)
+{
+    COMM_DATA_CHUNK_HEADER_NODE  header;
+    U32                          offset = COMM_CHANNEL_replay_head(ch);
+    U32                          done   = 0;
+    U64                          seq    = COMM_CHANNEL_replay_first_seq(ch);
+    U32                          payload, first;
+
+    if (seq > last_seq + 1) {
+        SEPAGENT_PRINT("%llu chunks after sequence %llu no longer fit the replay buffer and are lost\n", seq - last_seq - 1, last_seq);
+    }
+
+    while (done < COMM_CHANNEL_replay_used(ch)) {
+        comm_Replay_Read(ch, offset, &header, sizeof(header));
+        if (seq > last_seq) {
+            // a payload that wraps around the end of the ring goes out in two sends
+            payload = (offset + sizeof(header)) % comm_replay_size;
+            first   = (header.size < comm_replay_size - payload) ? header.size : comm_replay_size - payload;
+            if (comm_Send_All(sock, &header, sizeof(header)) != VT_SUCCESS ||
+                comm_Send_All(sock, COMM_CHANNEL_replay(ch) + payload, first) != VT_SUCCESS ||
+                comm_Send_All(sock, COMM_CHANNEL_replay(ch), header.size - first) != VT_SUCCESS) {
+                return VT_COMM_SEND_ERROR;
+            }
+        }
+        offset = (offset + sizeof(header) + header.size) % comm_replay_size;
+        done  += sizeof(header) + header.size;
+        seq++;
+    }
+
+    return VT_SUCCESS;
+}
+
+static void
+comm_Reset_Channel (
+    COMM_CHANNEL ch
+)
+{
+    if (COMM_CHANNEL_replay(ch)) {
+        free(COMM_CHANNEL_replay(ch));
+    }
+    COMM_CHANNEL_connected(ch)        = FALSE;
+    COMM_CHANNEL_next_seq(ch)         = 0;
+    COMM_CHANNEL_replay(ch)           = NULL;
+    COMM_CHANNEL_replay_head(ch)      = 0;
+    COMM_CHANNEL_replay_used(ch)      = 0;
+    COMM_CHANNEL_replay_first_seq(ch) = 1;
+    COMM_CHANNEL_evicted(ch)          = 0;
+}
+
+static void
+comm_Release_Session ()
+{
+    U32 i;
+
+    if (comm_channels) {
+        for (i = 0; i < num_of_data_connections; i++) {
+            comm_Reset_Channel(&comm_channels[i]);
+            pthread_mutex_destroy(&COMM_CHANNEL_lock(&comm_channels[i]));
+        }
+        free(comm_channels);
+        comm_channels = NULL;
+    }
+    if (data_socket) {
+        free(data_socket);
+        data_socket = NULL;
+    }
+    session_flags     = 0;
+    session_suspended = FALSE;
+}
+
 S32
 COMM_Open_Control_On_Target (
     U32 mode,
@@ -99,7 +347,8 @@ COMM_Open_Control_On_Target (
     U64 tsc_freq,
     U32 agent_mode,
     U32 transfer_mode,
-    U32 num_of_cpus
+    U32 num_of_cpus,
+    U32 num_of_packages
 )
 {
     S32                     data_size        = 0;
@@ -114,9 +363,12 @@ COMM_Open_Control_On_Target (
     S32                     sendbuff_size    = DATA_SOCKET_SEND_BUF_SIZE;
     S32                     retcode          = VT_SUCCESS;
     U32                     offset;
+    U32                     i;
+    DRV_BOOL                resumed          = FALSE;
 
     num_cpus                = num_of_cpus;
-    num_of_data_connections = num_cpus * 2 + NUM_NONCORE_DATA_CONNECTIONS;
+    num_packages            = num_of_packages ? num_of_packages : 1;
+    num_of_data_connections = num_cpus * 2 + NUM_NONCORE_DATA_CONNECTIONS + num_packages - 1;
     num_of_total_connections = num_of_data_connections + 1;
 
     if (server_socket == 0) {
@@ -169,61 +421,106 @@ COMM_Open_Control_On_Target (
         return VT_COMM_LISTEN_ERROR;
     }
 
-    socket_size = sizeof(control_socket_info);
-    SEPAGENT_PRINT("Waiting for control connection from host on port %d...\n", DEFAULT_CONTROL_PORT);
-    if ((control_socket = accept(server_socket,
-                            (struct sockaddr*)&control_socket_info,
-                &socket_size)) < 0) {
-        SEPAGENT_PRINT_ERROR("Couldn't accept on socket");
-        return VT_COMM_ACCEPT_ERROR;
-    }
-    addr_ptr = (struct sockaddr_in*)&control_socket_info;
-    inet_ntop(AF_INET, &addr_ptr, ip_addr_str, INET_ADDRSTRLEN);
-    SEPAGENT_PRINT("Received control connection request from host (%s)\n", ip_addr_str);
-    if (!(first_control_msg = (CONTROL_FIRST_MSG) malloc(sizeof(CONTROL_FIRST_MSG_NODE)))) {
-        SEPAGENT_PRINT_ERROR("Couldn't allocate buffer for the first msg\n");
-        return VT_NO_MEMORY;
-    }
+    // A host kept pending by the previous call has been accepted and read already
+    if (!control_pending) {
+        socket_size = sizeof(control_socket_info);
+        SEPAGENT_PRINT("Waiting for control connection from host on port %d...\n", DEFAULT_CONTROL_PORT);
+        if ((control_socket = accept(server_socket,
+                                (struct sockaddr*)&control_socket_info,
+                    &socket_size)) < 0) {
+            SEPAGENT_PRINT_ERROR("Couldn't accept on socket");
+            return VT_COMM_ACCEPT_ERROR;
+        }
+        addr_ptr = (struct sockaddr_in*)&control_socket_info;
+        inet_ntop(AF_INET, &addr_ptr, ip_addr_str, INET_ADDRSTRLEN);
+        SEPAGENT_PRINT("Received control connection request from host (%s)\n", ip_addr_str);
+        if (!(first_control_msg = (CONTROL_FIRST_MSG) malloc(sizeof(CONTROL_FIRST_MSG_NODE)))) {
+            SEPAGENT_PRINT_ERROR("Couldn't allocate buffer for the first msg\n");
+            return VT_NO_MEMORY;
+        }
 
-    // Read the header data at first msg
-    while(data_transferred < sizeof(CONTROL_FIRST_MSG_NODE)) {
-        if ((data_size = recv(control_socket, (S8*)first_control_msg+data_transferred, sizeof(CONTROL_FIRST_MSG_NODE)-data_transferred, 0)) < 0) {
-            SEPAGENT_PRINT_ERROR("Couldn't receive the first msg\n");
-            return VT_COMM_RECV_ERROR;
-        } else if (!data_size) {
-            SEPAGENT_PRINT_ERROR("Connection closed by remote\n");
-            return VT_COMM_CONNECTION_CLOSED_BY_REMOTE;
-        } else {
-            data_transferred += data_size;
+        // Read the header data at first msg
+        while(data_transferred < sizeof(CONTROL_FIRST_MSG_NODE)) {
+            if ((data_size = recv(control_socket, (S8*)first_control_msg+data_transferred, sizeof(CONTROL_FIRST_MSG_NODE)-data_transferred, 0)) < 0) {
+                SEPAGENT_PRINT_ERROR("Couldn't receive the first msg\n");
+                return VT_COMM_RECV_ERROR;
+            } else if (!data_size) {
+                SEPAGENT_PRINT_ERROR("Connection closed by remote\n");
+                return VT_COMM_CONNECTION_CLOSED_BY_REMOTE;
+            } else {
+                data_transferred += data_size;
+            }
         }
     }
+    control_pending = FALSE;
 
     SEPAGENT_PRINT_DEBUG("msg size %u\n", CONTROL_FIRST_MSG_msg_size(first_control_msg));
     SEPAGENT_PRINT_DEBUG("interface version %u\n", CONTROL_FIRST_MSG_proto_version(first_control_msg));
     SEPAGENT_PRINT_DEBUG("per_cpu_buffer_size %u\n", CONTROL_FIRST_MSG_per_cpu_buffer_size(first_control_msg));
+    SEPAGENT_PRINT_DEBUG("flags 0x%x\n", CONTROL_FIRST_MSG_flags(first_control_msg));
 
     if (CONTROL_FIRST_MSG_msg_size(first_control_msg) != sizeof(CONTROL_FIRST_MSG_NODE)) {
         retcode = VT_COMM_NOT_COMPATIBLE;
     }
 
-    if (data_socket) {
-        SEPAGENT_PRINT_ERROR("Data sockets are already established. Can't set up data channels\n");
-        retcode = VT_COMM_DATA_CHANNEL_UNAVAILABLE;
+    if (session_suspended) {
+        if ((CONTROL_FIRST_MSG_flags(first_control_msg) & COMM_FLAG_RESUME) &&
+            CONTROL_FIRST_MSG_resume_id(first_control_msg) == session_id) {
+            SEPAGENT_PRINT("Host resumed session %llx\n", session_id);
+            session_suspended = FALSE;
+            resumed           = TRUE;
+        }
+        else {
+            // The caller has to end the interrupted collection before this host gets its own session
+            SEPAGENT_PRINT("Host did not resume session %llx, it will be ended\n", session_id);
+            control_pending = TRUE;
+            return VT_SUCCESS;
+        }
     }
+    else {
+        if (data_socket) {
+            SEPAGENT_PRINT_ERROR("Data sockets are already established. Can't set up data channels\n");
+            retcode = VT_COMM_DATA_CHANNEL_UNAVAILABLE;
+        }
 
-    data_socket = (int *)malloc(sizeof(int) * num_of_data_connections);
-    if (!data_socket) {
-        SEPAGENT_PRINT_ERROR("Couldn't allocate buffer for data sockets\n");
-        return VT_NO_MEMORY;
+        data_socket = (int *)malloc(sizeof(int) * num_of_data_connections);
+        if (!data_socket) {
+            SEPAGENT_PRINT_ERROR("Couldn't allocate buffer for data sockets\n");
+            return VT_NO_MEMORY;
+
+        }
+        memset(data_socket, 0, sizeof(int) * num_of_data_connections);
 
+        if (CONTROL_FIRST_MSG_flags(first_control_msg) & COMM_FLAG_RESUMABLE) {
+            comm_channels = (COMM_CHANNEL)calloc(num_of_data_connections, sizeof(COMM_CHANNEL_NODE));
+            if (!comm_channels) {
+                SEPAGENT_PRINT_ERROR("Couldn't allocate the data channel states\n");
+                return VT_NO_MEMORY;
+            }
+            for (i = 0; i < num_of_data_connections; i++) {
+                pthread_mutex_init(&COMM_CHANNEL_lock(&comm_channels[i]), NULL);
+                comm_Reset_Channel(&comm_channels[i]);
+            }
+            comm_replay_size = (U32)(((U64)replay_budget_mb << 20) / num_of_data_connections);
+            if (comm_replay_size > COMM_REPLAY_MAX_CHANNEL_SIZE) {
+                comm_replay_size = COMM_REPLAY_MAX_CHANNEL_SIZE;
+            }
+            session_flags = COMM_FLAG_RESUMABLE;
+            session_id    = ((U64)getpid() << 32) | (U32)(time(NULL) + session_count++);
+            SEPAGENT_PRINT("Host opened resumable session %llx, %u KB of replay per data channel\n",
+                           session_id, comm_replay_size >> 10);
+        }
     }
-    memset(data_socket, 0, sizeof(int) * num_of_data_connections);
 
     // Need to utilize the buffer size and return error code if any
     memset(&status_msg, 0, sizeof(TARGET_STATUS_MSG_NODE));
 
     TARGET_STATUS_MSG_msg_size(&status_msg) = sizeof(status_msg);
     TARGET_STATUS_MSG_proto_version(&status_msg) = PROTOCOL_VERSION;
+    if (session_flags) {
+        TARGET_STATUS_MSG_flags(&status_msg)      = session_flags | (resumed ? COMM_FLAG_RESUMED : 0);
+        TARGET_STATUS_MSG_session_id(&status_msg) = session_id;
+    }
 
     if (uname(&sysinfo) == -1) {
         SEPAGENT_PRINT_ERROR("Failed to collect system info via uname\n");
@@ -250,7 +547,7 @@ COMM_Open_Control_On_Target (
     }
     REMOTE_SWITCH_agent_mode(TARGET_STATUS_MSG_collect_switch(&status_msg))         = (U32)agent_mode;
     REMOTE_SWITCH_data_transfer_mode(TARGET_STATUS_MSG_collect_switch(&status_msg)) = (U32)transfer_mode;
-    if (agent_mode == HOST_VM_AGENT || agent_mode == GUEST_VM_AGENT) {
+    if (agent_mode == HOST_VM_AGENT || agent_mode == GUEST_VM_AGENT || perf_sideband) {
         REMOTE_SWITCH_sched_switch_enabled(TARGET_STATUS_MSG_collect_switch(&status_msg)) = 1;
     }
     if (agent_mode != GUEST_VM_AGENT) {
@@ -258,6 +555,7 @@ COMM_Open_Control_On_Target (
     }
 
     REMOTE_HARDWARE_INFO_num_cpus(TARGET_STATUS_MSG_hardware_info(&status_msg))  = num_cpus;
+    REMOTE_HARDWARE_INFO_num_packages(TARGET_STATUS_MSG_hardware_info(&status_msg)) = num_packages;
     REMOTE_HARDWARE_INFO_family(TARGET_STATUS_MSG_hardware_info(&status_msg))    = (U32)(cpuid_rax >>  8 & 0x0f);
     REMOTE_HARDWARE_INFO_model(TARGET_STATUS_MSG_hardware_info(&status_msg))     = (U32)(cpuid_rax >> 12 & 0xf0);
     REMOTE_HARDWARE_INFO_model(TARGET_STATUS_MSG_hardware_info(&status_msg))    |= (U32)(cpuid_rax >>  4 & 0x0f);
@@ -275,7 +573,7 @@ COMM_Open_Control_On_Target (
     TARGET_STATUS_MSG_hardware_info_offset(&status_msg) = offset;
     TARGET_STATUS_MSG_status(&status_msg) = retcode;
 
-    sent_bytes = send(control_socket, (void*)&status_msg, sizeof(TARGET_STATUS_MSG_NODE), 0);
+    sent_bytes = send(control_socket, (void*)&status_msg, sizeof(TARGET_STATUS_MSG_NODE), MSG_NOSIGNAL);
     if (sent_bytes < 0 || sent_bytes != sizeof(TARGET_STATUS_MSG_NODE)) {
         SEPAGENT_PRINT_ERROR("Couldn't send the target status message\n");
         return VT_COMM_SEND_ERROR;
@@ -309,6 +607,22 @@ COMM_Receive_Control_Request_On_Target (
     }
     memset(header_msg, 0, sizeof(CONTROL_MSG_HEADER_NODE));
 
+    if (trace_idx == -1 && session_flags) {
+        // A host that reconnects to resume finds this side still waiting on the old connection
+        struct pollfd fds[2];
+
+        fds[0].fd     = control_socket;
+        fds[0].events = POLLIN;
+        fds[1].fd     = server_socket;
+        fds[1].events = POLLIN;
+        while (poll(fds, 2, -1) < 0 && errno == EINTR);
+        if (!(fds[0].revents & (POLLIN | POLLHUP | POLLERR)) && (fds[1].revents & POLLIN)) {
+            SEPAGENT_PRINT("Host connected again, dropping the previous control connection\n");
+            free(header_msg);
+            return VT_COMM_CONNECTION_CLOSED_BY_REMOTE;
+        }
+    }
+
     if (trace_idx == -1) {
         // Read the header data at first
         while (data_transferred < sizeof(CONTROL_MSG_HEADER_NODE)) {
@@ -406,6 +720,7 @@ COMM_Send_Control_Response_On_Target (
     U32        cmd,
     IOCTL_ARGS ioctl_arg,
     S32        status,
+    U64        flags,
     DRV_BOOL   record_mode,
     S32        trace_idx
 )
@@ -428,6 +743,7 @@ COMM_Send_Control_Response_On_Target (
     CONTROL_MSG_HEADER_proto_version(header_msg) = PROTOCOL_VERSION;
     CONTROL_MSG_HEADER_command_id(header_msg) = cmd;
     CONTROL_MSG_HEADER_status(header_msg) = status;
+    CONTROL_MSG_HEADER_flags(header_msg) = flags;
     if (ioctl_arg->len_drv_to_usr && ioctl_arg->buf_drv_to_usr) {
         if (status == VT_SUCCESS) {
             CONTROL_MSG_HEADER_from_target_data_size(header_msg) = ioctl_arg->len_drv_to_usr;
@@ -435,7 +751,7 @@ COMM_Send_Control_Response_On_Target (
     }
 
     if (!record_mode) {
-        sent_bytes = send(control_socket, (void*)header_msg, sizeof(CONTROL_MSG_HEADER_NODE), 0);
+        sent_bytes = send(control_socket, (void*)header_msg, sizeof(CONTROL_MSG_HEADER_NODE), MSG_NOSIGNAL);
         if (sent_bytes < 0 || sent_bytes != sizeof(CONTROL_MSG_HEADER_NODE)) {
             SEPAGENT_PRINT_ERROR("Couldn't send the command response header for cmd=%d\n", cmd);
             free(header_msg);
@@ -451,9 +767,9 @@ COMM_Send_Control_Response_On_Target (
     if (ioctl_arg->len_drv_to_usr && ioctl_arg->buf_drv_to_usr) {
         if (!record_mode) {
             if (trace_idx == -1) {
-                sent_bytes = send(control_socket, (void*)ioctl_arg->buf_drv_to_usr, ioctl_arg->len_drv_to_usr, 0);
+                sent_bytes = send(control_socket, (void*)ioctl_arg->buf_drv_to_usr, ioctl_arg->len_drv_to_usr, MSG_NOSIGNAL);
             } else {
-                sent_bytes = send(control_socket, ret_traces[trace_idx], ioctl_arg->len_drv_to_usr, 0);
+                sent_bytes = send(control_socket, ret_traces[trace_idx], ioctl_arg->len_drv_to_usr, MSG_NOSIGNAL);
             }
             if (sent_bytes < 0 || sent_bytes != ioctl_arg->len_drv_to_usr) {
                 SEPAGENT_PRINT_ERROR("Couldn't send the command response data for cmd=%d\n", cmd);
@@ -492,9 +808,9 @@ COMM_Send_Control_Response_On_Target (
 S32
 COMM_Close_Control_On_Target ()
 {
-    if (data_socket) {
-        free(data_socket);
-        data_socket = NULL;
+    // A suspended session keeps its data channels for the host to resume
+    if (!session_suspended) {
+        comm_Release_Session();
     }
 
     close(control_socket);
@@ -503,6 +819,7 @@ COMM_Close_Control_On_Target ()
 
     if (first_control_msg) {
         free(first_control_msg);
+        first_control_msg = NULL;
     }
 
     return VT_SUCCESS;
@@ -519,6 +836,11 @@ COMM_Open_Data_On_Target (
     S32             socket_size      = 0;
     DATA_FIRST_MSG  first_msg        = NULL;
     S32             socket_idx;
+    int             sock;
+    COMM_CHANNEL    ch               = NULL;
+    CONTROL_FIRST_MSG_NODE host_msg;
+    U64             last_seq         = 0;
+    struct timeval  send_timeout     = {COMM_RECV_MAX_TIME_ALLOWED, 0};
 
     if (!first_control_msg) {
         SEPAGENT_PRINT_ERROR("first control msg is NULL\n");
@@ -539,7 +861,7 @@ COMM_Open_Data_On_Target (
 
     socket_size = sizeof(control_socket_info);
     SEPAGENT_PRINT("Waiting for data connection from host ...\n");
-    if ((data_socket[socket_idx] = accept(server_socket,
+    if ((sock = accept(server_socket,
                             (struct sockaddr*)&control_socket_info,
                 &socket_size)) < 0) {
         SEPAGENT_PRINT_ERROR("Couldn't accept on socket");
@@ -547,8 +869,29 @@ COMM_Open_Data_On_Target (
     }
     SEPAGENT_PRINT("Received a data connection request from host with idx=%d, conn_id=%u, conn_type=%u\n", socket_idx, conn_id, conn_type);
 
+    if (session_flags) {
+        // The host tells which chunks it has; a stalled send is treated as a lost connection
+        if (comm_Recv_All(sock, &host_msg, sizeof(host_msg)) != VT_SUCCESS) {
+            SEPAGENT_PRINT_ERROR("Couldn't receive the first data message\n");
+            close(sock);
+            return VT_COMM_RECV_ERROR;
+        }
+        if (CONTROL_FIRST_MSG_flags(&host_msg) & COMM_FLAG_RESUME) {
+            last_seq = CONTROL_FIRST_MSG_resume_id(&host_msg);
+        }
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+        ch = &comm_channels[socket_idx];
+        pthread_mutex_lock(&COMM_CHANNEL_lock(ch));
+    }
+    data_socket[socket_idx] = sock;
+
     if (!(first_msg = (DATA_FIRST_MSG)malloc(sizeof(DATA_FIRST_MSG_NODE)))) {
         SEPAGENT_PRINT_ERROR("Couldn't allocate message first msg buffer\n");
+        if (ch) {
+            pthread_mutex_unlock(&COMM_CHANNEL_lock(ch));
+        }
+        data_socket[socket_idx] = 0;
+        close(sock);
         return VT_NO_MEMORY;
     }
     memset(first_msg, 0, sizeof(DATA_FIRST_MSG_NODE));
@@ -561,13 +904,30 @@ COMM_Open_Data_On_Target (
     SEPAGENT_PRINT_DEBUG("data_type %u\n", DATA_FIRST_MSG_data_type(first_msg));
     SEPAGENT_PRINT_DEBUG("data_id %u\n", DATA_FIRST_MSG_data_id(first_msg));
 
-    sent_bytes = send(data_socket[socket_idx], (void*)first_msg, sizeof(DATA_FIRST_MSG_NODE), 0);
+    sent_bytes = send(data_socket[socket_idx], (void*)first_msg, sizeof(DATA_FIRST_MSG_NODE), MSG_NOSIGNAL);
     free(first_msg);
     if (sent_bytes < 0 || sent_bytes != sizeof(DATA_FIRST_MSG_NODE)) {
         SEPAGENT_PRINT_ERROR("Couldn't send the first data message\n");
+        if (ch) {
+            pthread_mutex_unlock(&COMM_CHANNEL_lock(ch));
+        }
         return VT_COMM_SEND_ERROR;
     }
 
+    if (ch) {
+        // Chunks sent from now on queue behind the replay under the channel lock
+        if (COMM_CHANNEL_next_seq(ch) > last_seq) {
+            SEPAGENT_PRINT("Replaying chunks %llu-%llu on idx=%d\n", last_seq + 1, COMM_CHANNEL_next_seq(ch), socket_idx);
+        }
+        if (comm_Replay_Send(ch, sock, last_seq) != VT_SUCCESS) {
+            SEPAGENT_PRINT_ERROR("Couldn't replay the data for idx=%d\n", socket_idx);
+            pthread_mutex_unlock(&COMM_CHANNEL_lock(ch));
+            return VT_COMM_SEND_ERROR;
+        }
+        COMM_CHANNEL_connected(ch) = TRUE;
+        pthread_mutex_unlock(&COMM_CHANNEL_lock(ch));
+    }
+
     return VT_SUCCESS;
 }
 
@@ -606,9 +966,32 @@ COMM_Send_Data_On_Target (
         return VT_UNEXPECTED_NULL_PTR;
     }
 
+    if (session_flags) {
+        // Resumable session: frame the buffer, keep it for replay and never fail the sender
+        COMM_CHANNEL                 ch = &comm_channels[socket_idx];
+        COMM_DATA_CHUNK_HEADER_NODE  header;
+
+        memset(&header, 0, sizeof(header));
+        pthread_mutex_lock(&COMM_CHANNEL_lock(ch));
+        COMM_DATA_CHUNK_HEADER_size(&header) = buffer_size;
+        COMM_DATA_CHUNK_HEADER_seq(&header)  = ++COMM_CHANNEL_next_seq(ch);
+        comm_Replay_Store(ch, &header, buffer);
+        if (COMM_CHANNEL_connected(ch)) {
+            if (comm_Send_All(data_socket[socket_idx], &header, sizeof(header)) != VT_SUCCESS ||
+                comm_Send_All(data_socket[socket_idx], buffer, buffer_size) != VT_SUCCESS) {
+                SEPAGENT_PRINT("Lost the data connection idx=%d at chunk %llu, buffering until the host resumes\n",
+                               socket_idx, COMM_DATA_CHUNK_HEADER_seq(&header));
+                COMM_CHANNEL_connected(ch) = FALSE;
+                shutdown(data_socket[socket_idx], SHUT_RDWR);
+            }
+        }
+        pthread_mutex_unlock(&COMM_CHANNEL_lock(ch));
+        return VT_SUCCESS;
+    }
+
     while (total_sent_bytes < buffer_size) {
         SEPAGENT_PRINT_DEBUG("Sending %d bytes, total_sent %d bytes\n", send_size, total_sent_bytes);
-        sent_bytes = send(data_socket[socket_idx], (char *)buffer+total_sent_bytes, send_size, 0);
+        sent_bytes = send(data_socket[socket_idx], (char *)buffer+total_sent_bytes, send_size, MSG_NOSIGNAL);
 
         if (sent_bytes < 0 || sent_bytes != send_size) {
             failed_attempts++;
@@ -651,8 +1034,80 @@ COMM_Close_Data_On_Target (
         SEPAGENT_PRINT_ERROR("could not create data connection id %d\n", socket_idx);
         return VT_INTERNAL_ERROR;
     }
-    close(data_socket[socket_idx]);
+    if (session_flags) {
+        pthread_mutex_lock(&COMM_CHANNEL_lock(&comm_channels[socket_idx]));
+        if (COMM_CHANNEL_evicted(&comm_channels[socket_idx])) {
+            SEPAGENT_PRINT("%llu chunks of idx=%d were evicted from the replay buffer\n",
+                           COMM_CHANNEL_evicted(&comm_channels[socket_idx]), socket_idx);
+        }
+        comm_Reset_Channel(&comm_channels[socket_idx]);
+    }
+    if (data_socket[socket_idx] > 0) {
+        close(data_socket[socket_idx]);
+    }
     data_socket[socket_idx] = 0;
+    if (session_flags) {
+        pthread_mutex_unlock(&COMM_CHANNEL_lock(&comm_channels[socket_idx]));
+    }
+
+    return VT_SUCCESS;
+}
+
+
+DRV_BOOL
+COMM_Session_Resumable ()
+{
+    return session_flags & COMM_FLAG_RESUMABLE ? TRUE : FALSE;
+}
+
+
+DRV_BOOL
+COMM_Session_Suspended ()
+{
+    return session_suspended;
+}
+
+
+/*
+ * Drop the data connections of a resumable session but keep the channels sampling into their
+ * replay buffers, for a host that lost the connection mid-collection
+ */
+S32
+COMM_Suspend_Data_On_Target ()
+{
+    U32 i;
+
+    if (!session_flags || !data_socket) {
+        return VT_INTERNAL_ERROR;
+    }
+
+    for (i = 0; i < num_of_data_connections; i++) {
+        pthread_mutex_lock(&COMM_CHANNEL_lock(&comm_channels[i]));
+        COMM_CHANNEL_connected(&comm_channels[i]) = FALSE;
+        if (data_socket[i] > 0) {
+            close(data_socket[i]);
+        }
+        data_socket[i] = 0;
+        pthread_mutex_unlock(&COMM_CHANNEL_lock(&comm_channels[i]));
+    }
+    session_suspended = TRUE;
+    SEPAGENT_PRINT("Suspended session %llx, waiting for the host to resume it\n", session_id);
+
+    return VT_SUCCESS;
+}
+
+
+/*
+ * Release a suspended session once nothing sends on its channels any more
+ */
+S32
+COMM_End_Suspended_Session ()
+{
+    if (!session_suspended) {
+        return VT_SUCCESS;
+    }
+    SEPAGENT_PRINT("Ended session %llx\n", session_id);
+    comm_Release_Session();
 
     return VT_SUCCESS;
 }
@@ -34,7 +34,7 @@ extern "C" {
 #endif
 
 
-#define  PROTOCOL_VERSION             6
+#define  PROTOCOL_VERSION             7
 #define  DEFAULT_CONTROL_PORT         9321
 #define  DEFAULT_MSG_BUFFER_SIZE      4096
 #define  DEFAULT_CONNECTION_TIMEOUT   60
@@ -42,7 +42,8 @@ extern "C" {
 #define  MAX_NUM_CPUS                 64
 
 /* Maximum number of data connections = MAX_NUM_CPUS (1 per CPU for core data) +
-   NUM_NONCORE_DATA_CONNECTIONS ( 1 for module and 1 for uncore data) + MAX_NUM_CPUS (1 per CPU for sideband data) */
+   NUM_NONCORE_DATA_CONNECTIONS ( 1 for module and 1 for uncore data) + MAX_NUM_CPUS (1 per CPU for sideband data)
+   Uncore data of packages other than 0 uses extra connections after the sideband ones */
 #define  MAX_DATA_CONNECTION          (2*MAX_NUM_CPUS+NUM_NONCORE_DATA_CONNECTIONS)
 #define  MODULE_DATA_CONNECTION       MAX_NUM_CPUS
 #define  UNCORE_DATA_CONNECTION       (MAX_NUM_CPUS+1)
@@ -55,6 +56,27 @@ extern "C" {
 // to send large data without significant wait/hang on send(), increase the socket send buf size by setting SO_SNDBUF to 1MB
 #define  DATA_SOCKET_SEND_BUF_SIZE    (1 << 20)
 
+/*
+ * Memory kept for retransmission after a reconnect in resumable sessions. The budget, in MB
+ * (-rb option), is shared evenly by the data channels, up to COMM_REPLAY_MAX_CHANNEL_SIZE each.
+ * Every chunk sent is also copied into its channel's ring, even while connected; a budget of 0
+ * turns the copies off, and chunks in flight at a disconnect are then lost.
+ */
+#define  COMM_REPLAY_DEFAULT_BUDGET_MB 256
+#define  COMM_REPLAY_MAX_CHANNEL_SIZE  (4 << 20)
+
+/*
+ * Session flags exchanged in the first control message and the target status.
+ * A host that asks for COMM_FLAG_RESUMABLE gets framed data channels: every send is one
+ * chunk prefixed with COMM_DATA_CHUNK_HEADER and numbered per channel from 1.
+ * After losing the connection, the host reconnects with COMM_FLAG_RESUME and the session id
+ * from the target status, then presents the last sequence it got in the first message of
+ * each data channel. The agent keeps sampling in between and retransmits the later chunks.
+ */
+#define  COMM_FLAG_RESUMABLE          0x1
+#define  COMM_FLAG_RESUME             0x2
+#define  COMM_FLAG_RESUMED            0x4
+
 /*
  * Print macros for messages
  */
@@ -72,13 +94,15 @@ struct CONTROL_FIRST_MSG_NODE_S {
     U32  msg_size;
     U32  proto_version;
     U32  per_cpu_buffer_size;
-    U32  reserved1;
-    U64  reserved2;
+    U32  flags;
+    U64  resume_id;     // session id on the control channel, last received sequence on a data channel
 };
 
 #define CONTROL_FIRST_MSG_msg_size(msg)            (msg)->msg_size
 #define CONTROL_FIRST_MSG_proto_version(msg)       (msg)->proto_version
 #define CONTROL_FIRST_MSG_per_cpu_buffer_size(msg) (msg)->per_cpu_buffer_size
+#define CONTROL_FIRST_MSG_flags(msg)               (msg)->flags
+#define CONTROL_FIRST_MSG_resume_id(msg)           (msg)->resume_id
 
 typedef struct TARGET_STATUS_MSG_NODE_S   TARGET_STATUS_MSG_NODE;
 typedef        TARGET_STATUS_MSG_NODE    *TARGET_STATUS_MSG;
@@ -88,8 +112,8 @@ struct TARGET_STATUS_MSG_NODE_S {
         U32                    msg_size;
         U32                    proto_version;
         S32                    status;
-        U32                    reserved1;
-        U64                    reserved2;
+        U32                    flags;
+        U64                    session_id;
         U32                    os_info_offset;
         U32                    os_info_size;
         U32                    collect_switch_offset;
@@ -105,6 +129,8 @@ struct TARGET_STATUS_MSG_NODE_S {
 #define TARGET_STATUS_MSG_msg_size(msg)              (msg)->s1.msg_size
 #define TARGET_STATUS_MSG_proto_version(msg)         (msg)->s1.proto_version
 #define TARGET_STATUS_MSG_status(msg)                (msg)->s1.status
+#define TARGET_STATUS_MSG_flags(msg)                 (msg)->s1.flags
+#define TARGET_STATUS_MSG_session_id(msg)            (msg)->s1.session_id
 #define TARGET_STATUS_MSG_os_info_offset(msg)        (msg)->s1.os_info_offset
 #define TARGET_STATUS_MSG_collect_switch_offset(msg) (msg)->s1.collect_switch_offset
 #define TARGET_STATUS_MSG_hardware_info_offset(msg)  (msg)->s1.hardware_info_offset
@@ -126,7 +152,7 @@ struct CONTROL_MSG_HEADER_NODE_S {
     S32  status;
     U64  to_target_data_size;
     U64  from_target_data_size;
-    U64  reserved1;
+    U64  flags;                 // CONTROL_MSG_FLAG_*, set in responses only
     U64  reserved2;
 };
 
@@ -136,6 +162,9 @@ struct CONTROL_MSG_HEADER_NODE_S {
 #define CONTROL_MSG_HEADER_status(msg)                 (msg)->status
 #define CONTROL_MSG_HEADER_to_target_data_size(msg)    (msg)->to_target_data_size
 #define CONTROL_MSG_HEADER_from_target_data_size(msg)  (msg)->from_target_data_size
+#define CONTROL_MSG_HEADER_flags(msg)                  (msg)->flags
+
+#define CONTROL_MSG_FLAG_CACHED_REPLY                  0x1   // answered from the agent's sys config cache
 
 
 typedef enum {
@@ -158,13 +187,29 @@ struct DATA_FIRST_MSG_NODE_S {
 #define DATA_FIRST_MSG_data_type(msg)            (msg)->data_type
 #define DATA_FIRST_MSG_data_id(msg)              (msg)->data_id
 
-S32 COMM_Open_Control_On_Target(DRV_BOOL mode, U64 cpuid_rax, U64 tsc_freq, U32 agent_mode, U32 transfer_mode, U32 num_cpus);
+typedef struct COMM_DATA_CHUNK_HEADER_NODE_S   COMM_DATA_CHUNK_HEADER_NODE;
+typedef        COMM_DATA_CHUNK_HEADER_NODE    *COMM_DATA_CHUNK_HEADER;
+
+struct COMM_DATA_CHUNK_HEADER_NODE_S {
+    U32  size;          // payload bytes following the header
+    U32  reserved;
+    U64  seq;
+};
+
+#define COMM_DATA_CHUNK_HEADER_size(hdr)         (hdr)->size
+#define COMM_DATA_CHUNK_HEADER_seq(hdr)          (hdr)->seq
+
+S32 COMM_Open_Control_On_Target(DRV_BOOL mode, U64 cpuid_rax, U64 tsc_freq, U32 agent_mode, U32 transfer_mode, U32 num_cpus, U32 num_packages);
 S32 COMM_Receive_Control_Request_On_Target(U32 *cmd, IOCTL_ARGS ioctl_arg, S32 trace_idx);
-S32 COMM_Send_Control_Response_On_Target(U32 cmd, IOCTL_ARGS ioctl_arg, S32 status, DRV_BOOL record_mode, S32 trace_idx);
+S32 COMM_Send_Control_Response_On_Target(U32 cmd, IOCTL_ARGS ioctl_arg, S32 status, U64 flags, DRV_BOOL record_mode, S32 trace_idx);
 S32 COMM_Close_Control_On_Target();
 S32 COMM_Open_Data_On_Target(U32 conn_id, U32 conn_type);
 S32 COMM_Send_Data_On_Target(U32 conn_id, U32 conn_type, void *buffer, S32 buffer_size);
 S32 COMM_Close_Data_On_Target(U32 conn_id, U32 conn_type);
+DRV_BOOL COMM_Session_Resumable();
+DRV_BOOL COMM_Session_Suspended();
+S32 COMM_Suspend_Data_On_Target();
+S32 COMM_End_Suspended_Session();
 
 #if defined(__cplusplus)
 }
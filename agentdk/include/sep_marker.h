@@ -0,0 +1,162 @@
+/****
+    Copyright (C) 2019-2020 Intel Corporation.  All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+
+
+
+
+
+****/
+
+/*
+ * Region markers for instrumented applications.
+ *
+ * A marker is a TSC stamp, an id and a 64-bit payload. Markers are batched
+ * per thread and handed to the driver with a single write() on the marker
+ * device, which merges them into the per-CPU sample stream of the CPU the
+ * flush ran on. Recording a marker costs one rdtscp and a few stores; the
+ * system call is paid once per SEP_MARKER_BATCH markers. rdtscp also yields
+ * the CPU the marker was taken on, which the record keeps.
+ *
+ *     SEP_Marker_Open();
+ *     SEP_Marker(REGION_BEGIN, iteration);
+ *     ...
+ *     SEP_Marker(REGION_END, iteration);
+ *     SEP_Marker_Close();
+ *
+ * Markers written while no collection is running are discarded by the driver.
+ */
+
+#ifndef _SEP_MARKER_H_
+#define _SEP_MARKER_H_
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "lwpmudrv_defines.h"
+#include "lwpmudrv_types.h"
+#include "lwpmudrv_version.h"
+#include "lwpmudrv_ecb.h"
+#include "lwpmudrv_struct.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#if !defined(SEP_MARKER_BATCH)
+#define SEP_MARKER_BATCH        64
+#endif
+
+#define SEP_MARKER_DEVICE       SEP_DEVICE_NAME "/" DRV_USER_MARKER_DEVICE_SUFFIX
+#define SEP_PREV_MARKER_DEVICE  SEP_PREV_DEVICE_NAME "/" DRV_USER_MARKER_DEVICE_SUFFIX
+
+static int                      sep_marker_fd = -1;
+static __thread U32             sep_marker_count;
+static __thread DRV_USER_MARKER_NODE sep_marker_batch[SEP_MARKER_BATCH];
+
+/*
+ * Read the TSC and the current CPU in one instruction. Linux keeps
+ * (node << 12) | cpu in TSC_AUX.
+ */
+static inline U64
+sep_marker_rdtscp (
+    U32 *cpu
+)
+{
+    U32 lo, hi, aux;
+
+    __asm__ __volatile__ ("rdtscp" : "=a" (lo), "=d" (hi), "=c" (aux));
+    *cpu = aux & 0xfff;
+    return ((U64)hi << 32) | lo;
+}
+
+/*
+ * Open the marker device. Returns 0 on success, -1 when no driver is loaded.
+ */
+static inline int
+SEP_Marker_Open (
+    void
+)
+{
+    if (sep_marker_fd < 0) {
+        sep_marker_fd = open(SEP_MARKER_DEVICE, O_WRONLY | O_CLOEXEC);
+    }
+    if (sep_marker_fd < 0) {
+        sep_marker_fd = open(SEP_PREV_MARKER_DEVICE, O_WRONLY | O_CLOEXEC);
+    }
+    return (sep_marker_fd < 0) ? -1 : 0;
+}
+
+/*
+ * Hand the markers batched by the calling thread to the driver.
+ */
+static inline void
+SEP_Marker_Flush (
+    void
+)
+{
+    if (sep_marker_count && sep_marker_fd >= 0) {
+        ssize_t ret = write(sep_marker_fd, sep_marker_batch, sep_marker_count * sizeof(DRV_USER_MARKER_NODE));
+        (void)ret;
+    }
+    sep_marker_count = 0;
+}
+
+/*
+ * Record a marker for the calling thread.
+ */
+static inline void
+SEP_Marker (
+    U32 marker_id,
+    U64 payload
+)
+{
+    DRV_USER_MARKER marker = &sep_marker_batch[sep_marker_count];
+
+    DRV_USER_MARKER_tsc(marker)       = sep_marker_rdtscp(&DRV_USER_MARKER_cpu_num(marker));
+    DRV_USER_MARKER_marker_id(marker) = marker_id;
+    DRV_USER_MARKER_payload(marker)   = payload;
+    if (++sep_marker_count == SEP_MARKER_BATCH) {
+        SEP_Marker_Flush();
+    }
+}
+
+/*
+ * Flush the calling thread's markers and close the device. Other threads
+ * must call SEP_Marker_Flush before exiting or their last batch is lost.
+ */
+static inline void
+SEP_Marker_Close (
+    void
+)
+{
+    SEP_Marker_Flush();
+    if (sep_marker_fd >= 0) {
+        close(sep_marker_fd);
+        sep_marker_fd = -1;
+    }
+}
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,331 @@
+/****
+    Copyright (C) 2019-2020 Intel Corporation.  All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+
+
+
+
+
+****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lwpmudrv_defines.h"
+#include "lwpmudrv_types.h"
+#include "rise_errors.h"
+#include "lwpmudrv_ioctl.h"
+#include "lwpmudrv_ecb.h"
+#include "lwpmudrv_struct.h"
+#include "lwpmudrv_version.h"
+#include "communication.h"
+#include "metrics.h"
+#include "log.h"
+
+static DRV_METRIC_DEF_NODE  metric_defs[DRV_METRIC_MAX_METRICS];
+static U32                  num_metrics     = 0;
+static float                metric_samples[DRV_METRIC_MAX_SAMPLES][DRV_METRIC_MAX_METRICS];
+static U64                  num_intervals   = 0;
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        metrics_Check_Definition (def)
+ *
+ * @param     DRV_METRIC_DEF def - metric definition received from the host
+ *
+ * @brief     Make sure the formula only uses known tokens and leaves exactly
+ *            one value on the evaluation stack, so evaluation never has to
+ *            check the stack depth.
+ *
+ * @return    DRV_STATUS - VT_SUCCESS or VT_BAD_PARAMETER
+ *
+ */
+static DRV_STATUS
+metrics_Check_Definition (
+    DRV_METRIC_DEF  def
+)
+{
+    DRV_METRIC_TOKEN  token;
+    U32               i;
+    U32               depth = 0;
+
+    if (DRV_METRIC_DEF_num_tokens(def) == 0 ||
+        DRV_METRIC_DEF_num_tokens(def) > DRV_METRIC_MAX_TOKENS) {
+        return VT_BAD_PARAMETER;
+    }
+
+    for (i = 0; i < DRV_METRIC_DEF_num_tokens(def); i++) {
+        token = &DRV_METRIC_DEF_tokens(def)[i];
+        switch (DRV_METRIC_TOKEN_type(token)) {
+            case DRV_METRIC_TOKEN_EVENT:
+            case DRV_METRIC_TOKEN_TSC:
+            case DRV_METRIC_TOKEN_INTERVAL:
+            case DRV_METRIC_TOKEN_CONST:
+                depth++;
+                break;
+            case DRV_METRIC_TOKEN_OP:
+                if (depth < 2 || DRV_METRIC_TOKEN_arg(token) > DRV_METRIC_OP_DIV) {
+                    return VT_BAD_PARAMETER;
+                }
+                depth--;
+                break;
+            default:
+                return VT_BAD_PARAMETER;
+        }
+    }
+
+    return (depth == 1) ? VT_SUCCESS : VT_BAD_PARAMETER;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        METRICS_Set_Definitions (arg)
+ *
+ * @param     IOCTL_ARGS arg - buf_usr_to_drv holds an array of DRV_METRIC_DEF_NODE
+ *
+ * @brief     Replace the metric definitions and drop the series collected so far.
+ *            An empty buffer disables metric evaluation.
+ *
+ * @return    DRV_STATUS
+ *
+ */
+DRV_STATUS
+METRICS_Set_Definitions (
+    IOCTL_ARGS  arg
+)
+{
+    DRV_METRIC_DEF  defs;
+    U32             count;
+    U32             i;
+    DRV_STATUS      status;
+
+    METRICS_Clear();
+
+    if (arg->len_usr_to_drv == 0) {
+        return VT_SUCCESS;
+    }
+    if (arg->buf_usr_to_drv == NULL ||
+        arg->len_usr_to_drv % sizeof(DRV_METRIC_DEF_NODE) != 0) {
+        SEPAGENT_PRINT_ERROR("Invalid metric definition buffer\n");
+        return VT_BAD_PARAMETER;
+    }
+
+    count = (U32)(arg->len_usr_to_drv / sizeof(DRV_METRIC_DEF_NODE));
+    if (count > DRV_METRIC_MAX_METRICS) {
+        SEPAGENT_PRINT_ERROR("Too many metrics: %u (max %u)\n", count, DRV_METRIC_MAX_METRICS);
+        return VT_BAD_PARAMETER;
+    }
+
+    defs = (DRV_METRIC_DEF)arg->buf_usr_to_drv;
+    for (i = 0; i < count; i++) {
+        status = metrics_Check_Definition(&defs[i]);
+        if (status != VT_SUCCESS) {
+            SEPAGENT_PRINT_ERROR("Invalid formula for metric %u\n", i);
+            return status;
+        }
+    }
+
+    memcpy(metric_defs, defs, count * sizeof(DRV_METRIC_DEF_NODE));
+    for (i = 0; i < count; i++) {
+        DRV_METRIC_DEF_name(&metric_defs[i])[DRV_METRIC_NAME_SIZE - 1] = '\0';
+        SEPAGENT_PRINT_DEBUG("metric %u: %s (%u tokens)\n", i,
+                             DRV_METRIC_DEF_name(&metric_defs[i]),
+                             DRV_METRIC_DEF_num_tokens(&metric_defs[i]));
+    }
+    num_metrics = count;
+
+    return VT_SUCCESS;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        METRICS_Evaluate (buffer, buffer_len, num_cpus)
+ *
+ * @param     U64 *buffer     - DRV_OPERATION_READ_AND_RESET output
+ * @param     U64 buffer_len  - length of the buffer in bytes
+ * @param     U32 num_cpus    - number of per-CPU TSC deltas heading the buffer
+ *
+ * @brief     Evaluate every metric on one counting interval and append the
+ *            results to the series. Event indexes beyond the buffer read as 0.
+ *
+ * @return    None
+ *
+ */
+VOID
+METRICS_Evaluate (
+    U64    *buffer,
+    U64     buffer_len,
+    U32     num_cpus
+)
+{
+    DRV_METRIC_DEF    def;
+    DRV_METRIC_TOKEN  token;
+    U64              *counts;
+    U64               num_counts;
+    double            stack[DRV_METRIC_MAX_TOKENS];
+    float            *row;
+    U32               m;
+    U32               i;
+    U32               sp;
+
+    if (!num_metrics || buffer == NULL || buffer_len < num_cpus * sizeof(U64)) {
+        return;
+    }
+
+    counts     = buffer + num_cpus;
+    num_counts = buffer_len / sizeof(U64) - num_cpus;
+    row        = metric_samples[num_intervals % DRV_METRIC_MAX_SAMPLES];
+
+    for (m = 0; m < num_metrics; m++) {
+        def = &metric_defs[m];
+        sp  = 0;
+        for (i = 0; i < DRV_METRIC_DEF_num_tokens(def); i++) {
+            token = &DRV_METRIC_DEF_tokens(def)[i];
+            switch (DRV_METRIC_TOKEN_type(token)) {
+                case DRV_METRIC_TOKEN_EVENT:
+                    stack[sp++] = (DRV_METRIC_TOKEN_arg(token) < num_counts) ?
+                                  (double)counts[DRV_METRIC_TOKEN_arg(token)] : 0;
+                    break;
+                case DRV_METRIC_TOKEN_TSC:
+                    stack[sp++] = (double)buffer[0];
+                    break;
+                case DRV_METRIC_TOKEN_INTERVAL:
+                    stack[sp++] = (double)num_intervals;
+                    break;
+                case DRV_METRIC_TOKEN_CONST:
+                    stack[sp++] = (double)DRV_METRIC_TOKEN_value(token);
+                    break;
+                case DRV_METRIC_TOKEN_OP:
+                    sp--;
+                    switch (DRV_METRIC_TOKEN_arg(token)) {
+                        case DRV_METRIC_OP_ADD:
+                            stack[sp - 1] += stack[sp];
+                            break;
+                        case DRV_METRIC_OP_SUB:
+                            stack[sp - 1] -= stack[sp];
+                            break;
+                        case DRV_METRIC_OP_MUL:
+                            stack[sp - 1] *= stack[sp];
+                            break;
+                        case DRV_METRIC_OP_DIV:
+                            stack[sp - 1] = (stack[sp] != 0) ? stack[sp - 1] / stack[sp] : 0;
+                            break;
+                    }
+                    break;
+            }
+        }
+        row[m] = (float)stack[0];
+    }
+
+    num_intervals++;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        METRICS_Get_Series (arg)
+ *
+ * @param     IOCTL_ARGS arg - buf_usr_to_drv optionally holds the U64 interval
+ *                             number to start from, buf_drv_to_usr receives
+ *                             the DRV_METRIC_SERIES header and the rows
+ *
+ * @brief     Serve the metric values kept in the ring, oldest first. As many
+ *            rows as fit in the output buffer are returned, so the host can
+ *            poll incrementally by passing first_interval + num_samples back.
+ *
+ * @return    DRV_STATUS
+ *
+ */
+DRV_STATUS
+METRICS_Get_Series (
+    IOCTL_ARGS  arg
+)
+{
+    DRV_METRIC_SERIES  series;
+    float             *rows;
+    U64                first;
+    U64                count;
+    U64                max_rows;
+    U64                i;
+
+    if (arg->buf_drv_to_usr == NULL || arg->len_drv_to_usr < sizeof(DRV_METRIC_SERIES_NODE)) {
+        return VT_BUFFER_TOO_SMALL;
+    }
+
+    first = (num_intervals > DRV_METRIC_MAX_SAMPLES) ? num_intervals - DRV_METRIC_MAX_SAMPLES : 0;
+    if (arg->buf_usr_to_drv != NULL && arg->len_usr_to_drv >= sizeof(U64)) {
+        U64 since = *(U64 *)arg->buf_usr_to_drv;
+        if (since > first) {
+            first = (since < num_intervals) ? since : num_intervals;
+        }
+    }
+
+    count = num_intervals - first;
+    if (num_metrics) {
+        max_rows = (arg->len_drv_to_usr - sizeof(DRV_METRIC_SERIES_NODE)) /
+                   (num_metrics * sizeof(float));
+        if (count > max_rows) {
+            count = max_rows;
+        }
+    }
+    else {
+        count = 0;
+    }
+
+    series = (DRV_METRIC_SERIES)arg->buf_drv_to_usr;
+    memset(series, 0, sizeof(DRV_METRIC_SERIES_NODE));
+    DRV_METRIC_SERIES_num_metrics(series)    = num_metrics;
+    DRV_METRIC_SERIES_num_samples(series)    = (U32)count;
+    DRV_METRIC_SERIES_first_interval(series) = first;
+    DRV_METRIC_SERIES_num_intervals(series)  = num_intervals;
+
+    rows = (float *)(series + 1);
+    for (i = 0; i < count; i++) {
+        memcpy(rows + i * num_metrics,
+               metric_samples[(first + i) % DRV_METRIC_MAX_SAMPLES],
+               num_metrics * sizeof(float));
+    }
+
+    return VT_SUCCESS;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        METRICS_Clear ()
+ *
+ * @brief     Drop the metric definitions and the collected series.
+ *
+ * @return    None
+ *
+ */
+VOID
+METRICS_Clear (
+    VOID
+)
+{
+    num_metrics   = 0;
+    num_intervals = 0;
+}
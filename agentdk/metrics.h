@@ -0,0 +1,50 @@
+/****
+    Copyright (C) 2019-2020 Intel Corporation.  All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+
+
+
+
+
+****/
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/*
+ * On-target derived metrics: evaluated by the agent on every counting
+ * interval read through it, so the host can poll a compact time series
+ * instead of pulling the raw counts.
+ */
+extern DRV_STATUS METRICS_Set_Definitions(IOCTL_ARGS arg);
+extern DRV_STATUS METRICS_Get_Series(IOCTL_ARGS arg);
+extern VOID       METRICS_Evaluate(U64 *buffer, U64 buffer_len, U32 num_cpus);
+extern VOID       METRICS_Clear(VOID);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
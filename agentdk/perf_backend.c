@@ -0,0 +1,1263 @@
+/****
+    Copyright (C) 2019-2020 Intel Corporation.  All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+
+
+
+
+
+****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "lwpmudrv_defines.h"
+#include "lwpmudrv_types.h"
+#include "rise_errors.h"
+#include "lwpmudrv_ioctl.h"
+#include "lwpmudrv_ecb.h"
+#include "lwpmudrv_struct.h"
+#include "lwpmudrv_version.h"
+#include "communication.h"
+#include "perf_backend.h"
+#include "log.h"
+
+#define PERF_BACKEND_SAMPLE_FREQ     1000          // samples per second on each CPU
+#define PERF_BACKEND_RING_PAGES      64            // data pages of each ring, power of two
+#define PERF_BACKEND_POLL_MS         100           // longest wait between two ring drains
+#define PERF_BACKEND_OUT_BUF_SIZE    (64 * 1024)   // sample records sent in one packet
+#define PERF_BACKEND_SB_BUF_SIZE     (16 * 1024)   // sideband records sent in one packet
+#define PERF_BACKEND_MAX_RECORD      (64 * 1024)   // perf records carry a U16 size
+#define PERF_BACKEND_KERNEL_CS       0x10
+#define PERF_BACKEND_USER_CS         0x33
+
+extern U32       max_latency_ms;
+
+/*
+ * Record bodies for the sample_type and sample_id_all settings used below
+ */
+typedef struct PERF_REC_ID_NODE_S  PERF_REC_ID_NODE;
+typedef        PERF_REC_ID_NODE   *PERF_REC_ID;
+
+struct PERF_REC_ID_NODE_S {
+    U32  pid;
+    U32  tid;
+    U64  time;
+    U32  cpu;
+    U32  reserved;
+};
+
+typedef struct PERF_REC_SAMPLE_NODE_S  PERF_REC_SAMPLE_NODE;
+typedef        PERF_REC_SAMPLE_NODE   *PERF_REC_SAMPLE;
+
+struct PERF_REC_SAMPLE_NODE_S {
+    struct perf_event_header  header;
+    U64                       ip;
+    PERF_REC_ID_NODE       id;
+};
+
+typedef struct PERF_REC_MMAP2_NODE_S  PERF_REC_MMAP2_NODE;
+typedef        PERF_REC_MMAP2_NODE   *PERF_REC_MMAP2;
+
+struct PERF_REC_MMAP2_NODE_S {
+    struct perf_event_header  header;
+    U32                       pid;
+    U32                       tid;
+    U64                       addr;
+    U64                       len;
+    U64                       pgoff;
+    U32                       maj;
+    U32                       min;
+    U64                       ino;
+    U64                       ino_generation;
+    U32                       prot;
+    U32                       flags;
+    char                      filename[];
+};
+
+typedef struct PERF_REC_SWITCH_NODE_S  PERF_REC_SWITCH_NODE;
+typedef        PERF_REC_SWITCH_NODE   *PERF_REC_SWITCH;
+
+struct PERF_REC_SWITCH_NODE_S {
+    struct perf_event_header  header;
+    U32                       next_prev_pid;
+    U32                       next_prev_tid;
+    PERF_REC_ID_NODE          id;
+};
+
+typedef struct PERF_REC_LOST_NODE_S  PERF_REC_LOST_NODE;
+typedef        PERF_REC_LOST_NODE   *PERF_REC_LOST;
+
+struct PERF_REC_LOST_NODE_S {
+    struct perf_event_header  header;
+    U64                       id;
+    U64                       lost;
+};
+
+/*
+ * One reader per CPU: the event, its ring and the records on their way out
+ */
+typedef struct PERF_READER_NODE_S  PERF_READER_NODE;
+typedef        PERF_READER_NODE   *PERF_READER;
+
+struct PERF_READER_NODE_S {
+    S32                           fd;
+    U32                           cpu;
+    struct perf_event_mmap_page  *ring;
+    U8                           *out_buf;
+    U32                           out_len;
+    U8                           *rec_buf;
+    U8                           *sb_buf;
+    U32                           sb_len;
+    pthread_t                     thread;
+    DRV_BOOL                      started;
+    U64                           samples;
+    U64                           switches;
+    U64                           lost;
+    U64                           cpu_ns;
+};
+
+#define PERF_READER_fd(x)        (x)->fd
+#define PERF_READER_cpu(x)       (x)->cpu
+#define PERF_READER_ring(x)      (x)->ring
+#define PERF_READER_out_buf(x)   (x)->out_buf
+#define PERF_READER_out_len(x)   (x)->out_len
+#define PERF_READER_rec_buf(x)   (x)->rec_buf
+#define PERF_READER_sb_buf(x)    (x)->sb_buf
+#define PERF_READER_sb_len(x)    (x)->sb_len
+#define PERF_READER_thread(x)    (x)->thread
+#define PERF_READER_started(x)   (x)->started
+#define PERF_READER_samples(x)   (x)->samples
+#define PERF_READER_switches(x)  (x)->switches
+#define PERF_READER_lost(x)      (x)->lost
+#define PERF_READER_cpu_ns(x)    (x)->cpu_ns
+
+DRV_BOOL                        perf_backend        = FALSE;
+DRV_BOOL                        perf_sideband       = FALSE;
+
+static struct perf_event_attr   perf_attr;
+static const char              *perf_event_name     = NULL;
+static PERF_READER              perf_readers        = NULL;
+static U32                      perf_num_cpus       = 0;
+static U64                      perf_page_size      = 0;
+static U32                      perf_sample_size    = sizeof(SampleRecordPC);
+static U32                      perf_num_desc       = 0;
+static U64                      perf_num_samples    = 0;   // samples of the last stopped collection
+static volatile DRV_BOOL        perf_stopping       = FALSE;
+static DRV_BOOL                 perf_running        = FALSE;
+static pthread_mutex_t          perf_module_lock    = PTHREAD_MUTEX_INITIALIZER;
+static U64                      perf_start_ns       = 0;
+static U64                      perf_ref_ns         = 0;
+static U64                      perf_ref_tsc        = 0;
+static double                   perf_tsc_per_ns     = 0.0;
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        perf_backend_Monotonic_Ns (void)
+ *
+ * @brief     Read CLOCK_MONOTONIC, the clock the events time stamp with
+ *
+ * @return    U64 - nanoseconds
+ *
+ */
+static U64
+perf_backend_Monotonic_Ns (
+    void
+)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (U64)ts.tv_sec * 1000000000ULL + (U64)ts.tv_nsec;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        perf_backend_Read_TSC (void)
+ *
+ * @brief     Read the time stamp counter of the current CPU
+ *
+ * @return    U64 - TSC value
+ *
+ */
+static U64
+perf_backend_Read_TSC (
+    void
+)
+{
+#if defined(DRV_IA32) || defined(DRV_EM64T)
+    U32 low;
+    U32 high;
+
+    __asm__ __volatile__("rdtsc" : "=a"(low), "=d"(high));
+    return ((U64)high << 32) | low;
+#else
+    return perf_backend_Monotonic_Ns();
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        perf_backend_Calibrate (void)
+ *
+ * @brief     Measure the TSC rate against CLOCK_MONOTONIC
+ *
+ * @return    None
+ *
+ * <I>Special Notes:</I>
+ *            The host places samples in time with their TSC and the TSC
+ *            frequency of the target, so event times are converted to TSC
+ *            values with this rate.
+ */
+static VOID
+perf_backend_Calibrate (
+    void
+)
+{
+    struct timespec  wait = { 0, 20000000 };
+    U64              ns0;
+    U64              tsc0;
+
+    ns0  = perf_backend_Monotonic_Ns();
+    tsc0 = perf_backend_Read_TSC();
+    nanosleep(&wait, NULL);
+    perf_ref_ns  = perf_backend_Monotonic_Ns();
+    perf_ref_tsc = perf_backend_Read_TSC();
+
+    perf_tsc_per_ns = (perf_ref_ns > ns0) ?
+                      (double)(perf_ref_tsc - tsc0) / (double)(perf_ref_ns - ns0) : 1.0;
+    SEPAGENT_PRINT_DEBUG("TSC rate: %.3f cycles per ns\n", perf_tsc_per_ns);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        perf_backend_Ns_To_Tsc (ns)
+ *
+ * @param     U64 ns - event time
+ *
+ * @brief     Convert an event time to the TSC domain of the driver's records
+ *
+ * @return    U64 - TSC value
+ *
+ */
+static U64
+perf_backend_Ns_To_Tsc (
+    U64  ns
+)
+{
+    return perf_ref_tsc + (U64)(S64)((double)(S64)(ns - perf_ref_ns) * perf_tsc_per_ns);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        perf_backend_Init_Attr (type, config)
+ *
+ * @param     U32 type   - PERF_TYPE_HARDWARE or PERF_TYPE_SOFTWARE
+ * @param     U64 config - event of that type
+ *
+ * @brief     Set up the attributes shared by the events of every CPU
+ *
+ * @return    None
+ *
+ */
+static VOID
+perf_backend_Init_Attr (
+    U32  type,
+    U64  config
+)
+{
+    memset(&perf_attr, 0, sizeof(struct perf_event_attr));
+    perf_attr.size             = sizeof(struct perf_event_attr);
+    perf_attr.type             = type;
+    perf_attr.config           = config;
+    perf_attr.freq             = 1;
+    perf_attr.sample_freq      = PERF_BACKEND_SAMPLE_FREQ;
+    perf_attr.sample_type      = PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_CPU;
+    perf_attr.disabled         = 1;
+    perf_attr.mmap             = 1;
+    perf_attr.mmap2            = 1;
+    perf_attr.sample_id_all    = 1;
+    perf_attr.context_switch   = 1;
+    perf_attr.use_clockid      = 1;
+    perf_attr.clockid          = CLOCK_MONOTONIC;
+    perf_attr.watermark        = 1;
+    perf_attr.wakeup_watermark = (U32)(PERF_BACKEND_RING_PAGES * perf_page_size / 4);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        perf_backend_Event_Open (cpu)
+ *
+ * @param     U32 cpu - CPU to sample
+ *
+ * @brief     Open the system-wide event of one CPU
+ *
+ * @return    S32 - file descriptor, -1 on failure
+ *
+ */
+static S32
+perf_backend_Event_Open (
+    U32  cpu
+)
+{
+    return (S32)syscall(__NR_perf_event_open, &perf_attr, -1, (int)cpu, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        perf_backend_Probe (type, config)
+ *
+ * @param     U32 type   - PERF_TYPE_HARDWARE or PERF_TYPE_SOFTWARE
+ * @param     U64 config - event of that type
+ *
+ * @brief     Tell whether the event can sample system-wide on CPU 0
+ *
+ * @return    DRV_BOOL
+ *
+ * <I>Special Notes:</I>
+ *            Kernels before 4.3 have no context switch records; the event
+ *            is kept without them and no sideband is sent. Kernels without
+ *            use_clockid time stamp with the scheduler clock, which also
+ *            counts nanoseconds from boot, so the event is kept without it.
+ */
+static DRV_BOOL
+perf_backend_Probe (
+    U32  type,
+    U64  config
+)
+{
+    S32 fd;
+
+    perf_backend_Init_Attr(type, config);
+    fd = perf_backend_Event_Open(0);
+    if (fd < 0 && errno == EINVAL) {
+        perf_attr.context_switch = 0;
+        fd = perf_backend_Event_Open(0);
+    }
+    if (fd < 0 && errno == EINVAL) {
+        perf_attr.use_clockid = 0;
+        fd = perf_backend_Event_Open(0);
+    }
+    if (fd < 0) {
+        SEPAGENT_PRINT_DEBUG("perf_event_open(type %u, config %llu) failed: %s\n",
+                             type, (unsigned long long)config, strerror(errno));
+        return FALSE;
+    }
+    close(fd);
+    perf_sideband = perf_attr.context_switch;
+    return TRUE;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        PERF_BACKEND_Open (void)
+ *
+ * @brief     Select the sampling event and prepare the backend
+ *
+ * @return    DRV_STATUS - VT_DRIVER_OPEN_FAILED when no event can sample
+ *
+ * <I>Special Notes:</I>
+ *            Core cycles are used when the PMU is reachable. Virtual
+ *            machines and restricted kernels often hide it, in which case
+ *            the cpu-clock software event samples on the timer instead.
+ */
+DRV_STATUS
+PERF_BACKEND_Open (
+    VOID
+)
+{
+    perf_page_size = (U64)sysconf(_SC_PAGESIZE);
+    perf_num_cpus  = (U32)sysconf(_SC_NPROCESSORS_CONF);
+
+    if (perf_backend_Probe(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES)) {
+        perf_event_name = "cycles";
+    }
+    else if (perf_backend_Probe(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_CLOCK)) {
+        perf_event_name = "cpu-clock";
+    }
+    else {
+        SEPAGENT_PRINT_ERROR("perf_event_open cannot sample system-wide (see /proc/sys/kernel/perf_event_paranoid)\n");
+        return VT_DRIVER_OPEN_FAILED;
+    }
+
+    perf_backend_Calibrate();
+    SEPAGENT_PRINT("Sampling with perf_event_open on %s at %u Hz\n", perf_event_name, PERF_BACKEND_SAMPLE_FREQ);
+    if (!perf_sideband) {
+        SEPAGENT_PRINT("This kernel has no context switch records, no sideband will be sent\n");
+    }
+
+    return VT_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        perf_backend_Send_Module (pid, addr, len, pgoff, name, tsc, exe)
+ *
+ * @param     U32       pid   - process, 0 for the kernel
+ * @param     U64       addr  - load address
+ * @param     U64       len   - length of the mapping
+ * @param     U64       pgoff - file offset of the mapping
+ * @param     char     *name  - path of the module
+ * @param     U64       tsc   - time of the load
+ * @param     DRV_BOOL  exe   - the module is the executable of the process
+ *
+ * @brief     Send a module load record, filled like the driver's
+ *
+ * @return    None
+ *
+ */
+static VOID
+perf_backend_Send_Module (
+    U32       pid,
+    U64       addr,
+    U64       len,
+    U64       pgoff,
+    char     *name,
+    U64       tsc,
+    DRV_BOOL  exe
+)
+{
+    char          buf[sizeof(ModuleRecord) + MAXNAMELEN + 32];
+    ModuleRecord *mra      = (ModuleRecord *)buf;
+    char         *raw_path = buf + sizeof(ModuleRecord);
+
+    memset(buf, 0, sizeof(buf));
+    MR_page_offset_Set(mra, pgoff);
+    MODULE_RECORD_segment_type(mra)      = MODE_64BIT;
+    MODULE_RECORD_load_addr64(mra)       = addr;
+    MODULE_RECORD_length64(mra)          = len;
+    MODULE_RECORD_tsc_used(mra)          = 1;
+    MODULE_RECORD_tsc(mra)               = tsc;
+    MODULE_RECORD_exe(mra)               = exe ? 1 : 0;
+    MODULE_RECORD_global_module(mra)     = (pid == 0) ? 1 : 0;
+    MODULE_RECORD_global_module_tb5(mra) = (pid == 0) ? 1 : 0;
+    MODULE_RECORD_osid(mra)              = OS_ID_NATIVE;
+    MODULE_RECORD_pid_rec_index(mra)     = pid;
+    MODULE_RECORD_pid_rec_index_raw(mra) = 1;
+    MODULE_RECORD_selector(mra)          = (pid == 0) ? PERF_BACKEND_KERNEL_CS : PERF_BACKEND_USER_CS;
+    MR_unloadTscSet(mra, (U64)(-1));
+
+    strncpy(raw_path, name, MAXNAMELEN);
+    raw_path[MAXNAMELEN]              = 0;
+    MODULE_RECORD_path_length(mra)    = (U16)strlen(raw_path) + 1;
+    MODULE_RECORD_rec_length(mra)     = (U16)ALIGN_8(sizeof(ModuleRecord) + MODULE_RECORD_path_length(mra));
+
+    pthread_mutex_lock(&perf_module_lock);
+    COMM_Send_Data_On_Target(COMM_MODULE_CONN_ID, COMM_DATA_MODULE, buf, MODULE_RECORD_rec_length(mra));
+    pthread_mutex_unlock(&perf_module_lock);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        perf_backend_Is_Exe (pid, name)
+ *
+ * @param     U32   pid  - process
+ * @param     char *name - path of a module of the process
+ *
+ * @brief     Tell whether the module is the executable of the process
+ *
+ * @return    DRV_BOOL
+ *
+ */
+static DRV_BOOL
+perf_backend_Is_Exe (
+    U32   pid,
+    char *name
+)
+{
+    char     link[64];
+    char     path[MAXNAMELEN + 1];
+    ssize_t  len;
+
+    snprintf(link, sizeof(link), "/proc/%u/exe", pid);
+    len = readlink(link, path, MAXNAMELEN);
+    if (len <= 0) {
+        return FALSE;
+    }
+    path[len] = '\0';
+    return strcmp(path, name) == 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        perf_backend_Send_Loaded_Modules (void)
+ *
+ * @brief     Send the modules mapped before the collection started
+ *
+ * @return    None
+ *
+ * <I>Special Notes:</I>
+ *            The events only report new mappings. The kernel text comes
+ *            from /proc/kallsyms, which reads as zeros without privilege,
+ *            and the executable mappings of running processes from their
+ *            maps. A mapping made while the scan runs may be sent twice.
+ */
+static VOID
+perf_backend_Send_Loaded_Modules (
+    void
+)
+{
+    FILE               *file;
+    DIR                *proc;
+    struct dirent      *entry;
+    char                line[MAXNAMELEN + 128];
+    char                maps[64];
+    char                perms[8];
+    char                sym[MAXNAMELEN];
+    char                type;
+    unsigned long long  start;
+    unsigned long long  end;
+    unsigned long long  pgoff;
+    unsigned long long  text_start = 0;
+    unsigned long long  text_end   = 0;
+    U64                 tsc        = perf_backend_Read_TSC();
+    U32                 pid;
+    int                 path_pos;
+
+    file = fopen("/proc/kallsyms", "r");
+    if (file) {
+        while (fgets(line, sizeof(line), file) && !(text_start && text_end)) {
+            if (sscanf(line, "%llx %c %255s", &start, &type, sym) != 3) {
+                continue;
+            }
+            if (strcmp(sym, "_stext") == 0) {
+                text_start = start;
+            }
+            else if (strcmp(sym, "_etext") == 0) {
+                text_end = start;
+            }
+        }
+        fclose(file);
+    }
+    if (text_start && text_end > text_start) {
+        perf_backend_Send_Module(0, text_start, text_end - text_start, 0, "vmlinux", 0, FALSE);
+    }
+
+    proc = opendir("/proc");
+    if (!proc) {
+        return;
+    }
+    while ((entry = readdir(proc)) != NULL) {
+        if (entry->d_name[0] < '1' || entry->d_name[0] > '9') {
+            continue;
+        }
+        pid = (U32)strtoul(entry->d_name, NULL, 10);
+        snprintf(maps, sizeof(maps), "/proc/%u/maps", pid);
+        file = fopen(maps, "r");
+        if (!file) {
+            continue;
+        }
+        while (fgets(line, sizeof(line), file)) {
+            path_pos = 0;
+            if (sscanf(line, "%llx-%llx %7s %llx %*s %*u %n", &start, &end, perms, &pgoff, &path_pos) < 4 ||
+                path_pos == 0 || perms[2] != 'x' || line[path_pos] != '/') {
+                continue;
+            }
+            line[strcspn(line, "\n")] = '\0';
+            perf_backend_Send_Module(pid, start, end - start, pgoff, &line[path_pos], tsc,
+                                     perf_backend_Is_Exe(pid, &line[path_pos]));
+        }
+        fclose(file);
+    }
+    closedir(proc);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        perf_backend_Flush (rd)
+ *
+ * @param     PERF_READER rd - reader of one CPU
+ *
+ * @brief     Send the sample and sideband records gathered by the reader
+ *
+ * @return    None
+ *
+ */
+static VOID
+perf_backend_Flush (
+    PERF_READER  rd
+)
+{
+    if (PERF_READER_out_len(rd) != 0) {
+        if (COMM_Send_Data_On_Target(PERF_READER_cpu(rd), COMM_DATA_CPU,
+                                     PERF_READER_out_buf(rd), PERF_READER_out_len(rd)) != VT_SUCCESS) {
+            SEPAGENT_PRINT_WARNING("couldn't send data to host, conn_id=%u, conn_type=%u\n",
+                                   PERF_READER_cpu(rd), COMM_DATA_CPU);
+        }
+        PERF_READER_out_len(rd) = 0;
+    }
+    if (PERF_READER_sb_len(rd) != 0) {
+        if (COMM_Send_Data_On_Target(PERF_READER_cpu(rd), COMM_DATA_SIDEBAND,
+                                     PERF_READER_sb_buf(rd), PERF_READER_sb_len(rd)) != VT_SUCCESS) {
+            SEPAGENT_PRINT_WARNING("couldn't send data to host, conn_id=%u, conn_type=%u\n",
+                                   PERF_READER_cpu(rd), COMM_DATA_SIDEBAND);
+        }
+        PERF_READER_sb_len(rd) = 0;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        perf_backend_Add_Sample (rd, sample)
+ *
+ * @param     PERF_READER rd     - reader of one CPU
+ * @param     PERF_REC_SAMPLE sample - sample read from the ring
+ *
+ * @brief     Translate a sample into the driver's sample record
+ *
+ * @return    None
+ *
+ * <I>Special Notes:</I>
+ *            Records take the size of descriptor 0 when the host set one
+ *            up, with everything past the SampleRecordPC left at zero.
+ */
+static VOID
+perf_backend_Add_Sample (
+    PERF_READER  rd,
+    PERF_REC_SAMPLE  sample
+)
+{
+    SampleRecordPC *psamp;
+    DRV_BOOL        kernel;
+
+    if (PERF_READER_out_len(rd) + perf_sample_size > PERF_BACKEND_OUT_BUF_SIZE) {
+        perf_backend_Flush(rd);
+    }
+    psamp  = (SampleRecordPC *)(PERF_READER_out_buf(rd) + PERF_READER_out_len(rd));
+    kernel = (sample->header.misc & PERF_RECORD_MISC_CPUMODE_MASK) == PERF_RECORD_MISC_KERNEL;
+    memset(psamp, 0, perf_sample_size);
+
+    SAMPLE_RECORD_descriptor_id(psamp)          = 0;
+    SAMPLE_RECORD_osid(psamp)                   = OS_ID_NATIVE;
+    SAMPLE_RECORD_tsc(psamp)                    = perf_backend_Ns_To_Tsc(sample->id.time);
+    SAMPLE_RECORD_pid_rec_index_raw(psamp)      = 1;
+    SAMPLE_RECORD_pid_rec_index(psamp)          = sample->id.pid;
+    SAMPLE_RECORD_tid(psamp)                    = sample->id.tid;
+    SAMPLE_RECORD_cpu_num(psamp)                = (U16)PERF_READER_cpu(rd);
+    SAMPLE_RECORD_cs(psamp)                     = kernel ? PERF_BACKEND_KERNEL_CS : PERF_BACKEND_USER_CS;
+    SAMPLE_RECORD_csd(psamp).u2.s2.dpl          = kernel ? 0 : 3;
+    SAMPLE_RECORD_csd(psamp).u2.s2.reserved_0   = 1;
+    SAMPLE_RECORD_iip(psamp)                    = sample->ip;
+    SAMPLE_RECORD_ipsr(psamp)                   = ((U64)SAMPLE_RECORD_csd(psamp).u2.s2.dpl) << 32;
+    SAMPLE_RECORD_ia64_pc(psamp)                = TRUE;
+    SAMPLE_RECORD_event_index(psamp)            = 0;
+
+    PERF_READER_out_len(rd) += perf_sample_size;
+    PERF_READER_samples(rd)++;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        perf_backend_Add_Switch (rd, sw)
+ *
+ * @param     PERF_READER     rd - reader of one CPU
+ * @param     PERF_REC_SWITCH sw - context switch read from the ring
+ *
+ * @brief     Translate a context switch into the driver's sideband record
+ *
+ * @return    None
+ *
+ * <I>Special Notes:</I>
+ *            Each switch is reported twice, by the task leaving the CPU and
+ *            by the one entering it. The switch-out record names the next
+ *            task, which is what the driver's sched_switch hook records.
+ */
+static VOID
+perf_backend_Add_Switch (
+    PERF_READER      rd,
+    PERF_REC_SWITCH  sw
+)
+{
+    SIDEBAND_INFO sideband_info;
+
+    if (!(sw->header.misc & PERF_RECORD_MISC_SWITCH_OUT)) {
+        return;
+    }
+    if (PERF_READER_sb_len(rd) + sizeof(SIDEBAND_INFO_NODE) > PERF_BACKEND_SB_BUF_SIZE) {
+        perf_backend_Flush(rd);
+    }
+    sideband_info = (SIDEBAND_INFO)(PERF_READER_sb_buf(rd) + PERF_READER_sb_len(rd));
+
+    SIDEBAND_INFO_pid(sideband_info) = sw->next_prev_pid;
+    SIDEBAND_INFO_tid(sideband_info) = sw->next_prev_tid;
+    SIDEBAND_INFO_tsc(sideband_info) = perf_backend_Ns_To_Tsc(sw->id.time);
+
+    PERF_READER_sb_len(rd) += sizeof(SIDEBAND_INFO_NODE);
+    PERF_READER_switches(rd)++;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        perf_backend_Handle_Record (rd, header)
+ *
+ * @param     PERF_READER               rd     - reader of one CPU
+ * @param     struct perf_event_header *header - contiguous copy of a record
+ *
+ * @brief     Translate one record of the ring
+ *
+ * @return    None
+ *
+ */
+static VOID
+perf_backend_Handle_Record (
+    PERF_READER                rd,
+    struct perf_event_header  *header
+)
+{
+    PERF_REC_MMAP2      mmap2;
+    PERF_REC_ID  id;
+
+    switch (header->type) {
+        case PERF_RECORD_SAMPLE:
+            if (header->size >= sizeof(PERF_REC_SAMPLE_NODE)) {
+                perf_backend_Add_Sample(rd, (PERF_REC_SAMPLE)header);
+            }
+            break;
+
+        case PERF_RECORD_MMAP2:
+            mmap2 = (PERF_REC_MMAP2)header;
+            if (header->size < sizeof(PERF_REC_MMAP2_NODE) + sizeof(PERF_REC_ID_NODE) ||
+                mmap2->filename[0] != '/') {
+                break;
+            }
+            // sample_id_all puts the time after the file name
+            id = (PERF_REC_ID)((U8 *)header + header->size - sizeof(PERF_REC_ID_NODE));
+            perf_backend_Send_Module(mmap2->pid, mmap2->addr, mmap2->len, mmap2->pgoff,
+                                     mmap2->filename, perf_backend_Ns_To_Tsc(id->time),
+                                     perf_backend_Is_Exe(mmap2->pid, mmap2->filename));
+            break;
+
+        case PERF_RECORD_SWITCH_CPU_WIDE:
+            if (header->size >= sizeof(PERF_REC_SWITCH_NODE)) {
+                perf_backend_Add_Switch(rd, (PERF_REC_SWITCH)header);
+            }
+            break;
+
+        case PERF_RECORD_LOST:
+            PERF_READER_lost(rd) += ((PERF_REC_LOST)header)->lost;
+            break;
+
+        default:
+            break;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        perf_backend_Drain (rd)
+ *
+ * @param     PERF_READER rd - reader of one CPU
+ *
+ * @brief     Translate every record of the ring and send the samples
+ *            and sideband records
+ *
+ * @return    None
+ *
+ * <I>Special Notes:</I>
+ *            Records are 8-byte aligned, so only a record body can wrap
+ *            around the end of the ring; such a record is copied out first.
+ *            The space is handed back to the kernel once all is read.
+ */
+static VOID
+perf_backend_Drain (
+    PERF_READER  rd
+)
+{
+    struct perf_event_mmap_page  *ring = PERF_READER_ring(rd);
+    struct perf_event_header     *header;
+    U8                           *data = (U8 *)ring + perf_page_size;
+    U64                           size = PERF_BACKEND_RING_PAGES * perf_page_size;
+    U64                           head;
+    U64                           tail;
+    U64                           offset;
+
+    head = ring->data_head;
+    __sync_synchronize();
+    tail = ring->data_tail;
+
+    while (tail < head) {
+        offset = tail & (size - 1);
+        header = (struct perf_event_header *)(data + offset);
+        if (header->size == 0) {
+            break;
+        }
+        if (offset + header->size > size) {
+            memcpy(PERF_READER_rec_buf(rd), data + offset, size - offset);
+            memcpy(PERF_READER_rec_buf(rd) + size - offset, data, header->size - (size - offset));
+            header = (struct perf_event_header *)PERF_READER_rec_buf(rd);
+        }
+        perf_backend_Handle_Record(rd, header);
+        tail += header->size;
+    }
+
+    __sync_synchronize();
+    ring->data_tail = tail;
+
+    perf_backend_Flush(rd);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        perf_backend_Read_Records (arg)
+ *
+ * @param     PVOID arg - reader of one CPU
+ *
+ * @brief     Reader thread: drain the ring whenever it crosses its watermark,
+ *            and at least every PERF_BACKEND_POLL_MS or -max-latency ms
+ *
+ * @return    NULL
+ *
+ */
+static PVOID
+perf_backend_Read_Records (
+    PVOID  arg
+)
+{
+    PERF_READER      rd      = (PERF_READER)arg;
+    struct pollfd    pfd;
+    struct timespec  cpu_time;
+    int              timeout = PERF_BACKEND_POLL_MS;
+
+    if (max_latency_ms && max_latency_ms < PERF_BACKEND_POLL_MS) {
+        timeout = (int)max_latency_ms;
+    }
+    pfd.fd     = PERF_READER_fd(rd);
+    pfd.events = POLLIN;
+
+    while (!perf_stopping) {
+        poll(&pfd, 1, timeout);
+        perf_backend_Drain(rd);
+    }
+    perf_backend_Drain(rd);
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_time);
+    PERF_READER_cpu_ns(rd) = (U64)cpu_time.tv_sec * 1000000000ULL + (U64)cpu_time.tv_nsec;
+
+    return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        perf_backend_Release (void)
+ *
+ * @brief     Close the events and free the readers
+ *
+ * @return    None
+ *
+ */
+static VOID
+perf_backend_Release (
+    void
+)
+{
+    U32 cpu;
+
+    if (!perf_readers) {
+        return;
+    }
+    for (cpu = 0; cpu < perf_num_cpus; cpu++) {
+        PERF_READER rd = &perf_readers[cpu];
+
+        if (PERF_READER_ring(rd)) {
+            munmap(PERF_READER_ring(rd), (PERF_BACKEND_RING_PAGES + 1) * perf_page_size);
+        }
+        if (PERF_READER_fd(rd) >= 0) {
+            close(PERF_READER_fd(rd));
+        }
+        free(PERF_READER_out_buf(rd));
+        free(PERF_READER_rec_buf(rd));
+        free(PERF_READER_sb_buf(rd));
+    }
+    free(perf_readers);
+    perf_readers = NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        perf_backend_Enable (enable)
+ *
+ * @param     DRV_BOOL enable - TRUE to sample, FALSE to pause
+ *
+ * @brief     Enable or disable the event of every CPU
+ *
+ * @return    None
+ *
+ */
+static VOID
+perf_backend_Enable (
+    DRV_BOOL  enable
+)
+{
+    U32 cpu;
+
+    for (cpu = 0; perf_readers && cpu < perf_num_cpus; cpu++) {
+        if (PERF_READER_fd(&perf_readers[cpu]) >= 0) {
+            ioctl(PERF_READER_fd(&perf_readers[cpu]),
+                  enable ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        perf_backend_Start (void)
+ *
+ * @brief     Open the event and ring of every CPU, send the loaded modules,
+ *            then start the readers and the events
+ *
+ * @return    DRV_STATUS
+ *
+ * <I>Special Notes:</I>
+ *            A CPU whose event cannot be opened (e.g. offline) is skipped.
+ *            The events are opened disabled, so the module scan cannot miss
+ *            a mapping made between the scan and the first sample.
+ */
+static DRV_STATUS
+perf_backend_Start (
+    void
+)
+{
+    U32         cpu;
+    U32         num_open = 0;
+    PERF_READER rd;
+
+    if (perf_running) {
+        return VT_SUCCESS;
+    }
+    perf_readers = (PERF_READER)calloc(perf_num_cpus, sizeof(PERF_READER_NODE));
+    if (!perf_readers) {
+        return VT_NO_MEMORY;
+    }
+    perf_stopping    = FALSE;
+    perf_num_samples = 0;
+
+    for (cpu = 0; cpu < perf_num_cpus; cpu++) {
+        rd                  = &perf_readers[cpu];
+        PERF_READER_cpu(rd) = cpu;
+        PERF_READER_fd(rd)  = perf_backend_Event_Open(cpu);
+        if (PERF_READER_fd(rd) < 0) {
+            SEPAGENT_PRINT_WARNING("cpu%u is not sampled: %s\n", cpu, strerror(errno));
+            continue;
+        }
+        PERF_READER_ring(rd) = mmap(NULL, (PERF_BACKEND_RING_PAGES + 1) * perf_page_size,
+                                    PROT_READ | PROT_WRITE, MAP_SHARED, PERF_READER_fd(rd), 0);
+        if (PERF_READER_ring(rd) == MAP_FAILED) {
+            SEPAGENT_PRINT_ERROR("Could not map the ring of cpu%u: %s\n", cpu, strerror(errno));
+            PERF_READER_ring(rd) = NULL;
+            perf_backend_Release();
+            return VT_NO_MEMORY;
+        }
+        PERF_READER_out_buf(rd) = (U8 *)malloc(PERF_BACKEND_OUT_BUF_SIZE);
+        PERF_READER_rec_buf(rd) = (U8 *)malloc(PERF_BACKEND_MAX_RECORD);
+        PERF_READER_sb_buf(rd)  = (U8 *)malloc(PERF_BACKEND_SB_BUF_SIZE);
+        if (!PERF_READER_out_buf(rd) || !PERF_READER_rec_buf(rd) || !PERF_READER_sb_buf(rd)) {
+            perf_backend_Release();
+            return VT_NO_MEMORY;
+        }
+        num_open++;
+    }
+    if (num_open == 0) {
+        perf_backend_Release();
+        return VT_SAM_ERROR;
+    }
+
+    perf_backend_Send_Loaded_Modules();
+
+    for (cpu = 0; cpu < perf_num_cpus; cpu++) {
+        rd = &perf_readers[cpu];
+        if (PERF_READER_fd(rd) < 0) {
+            continue;
+        }
+        if (pthread_create(&PERF_READER_thread(rd), NULL, perf_backend_Read_Records, rd) != 0) {
+            SEPAGENT_PRINT_ERROR("Could not create the reader of cpu%u\n", cpu);
+            continue;
+        }
+        PERF_READER_started(rd) = TRUE;
+    }
+
+    perf_start_ns = perf_backend_Monotonic_Ns();
+    perf_backend_Enable(TRUE);
+    perf_running  = TRUE;
+
+    return VT_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        perf_backend_Report_Overhead (elapsed_ns)
+ *
+ * @param     U64 elapsed_ns - length of the collection
+ *
+ * @brief     Print the throughput of the collection and the time spent by
+ *            the readers, in the format of the driver overhead summary
+ *
+ * @return    None
+ *
+ * <I>Special Notes:</I>
+ *            The readers' share is the user-space cost of the backend. The
+ *            kernel's cost of taking each sample is not visible from here.
+ */
+static VOID
+perf_backend_Report_Overhead (
+    U64  elapsed_ns
+)
+{
+    U32 cpu;
+    U64 samples = 0;
+    U64 lost    = 0;
+    U64 cpu_ns  = 0;
+
+    if (elapsed_ns == 0) {
+        return;
+    }
+    for (cpu = 0; cpu < perf_num_cpus; cpu++) {
+        PERF_READER rd = &perf_readers[cpu];
+
+        if (!PERF_READER_started(rd)) {
+            continue;
+        }
+        SEPAGENT_PRINT_DEBUG("cpu%u: %llu samples, %llu context switches, %llu lost records, reader %.3f%%\n",
+            cpu,
+            (unsigned long long)PERF_READER_samples(rd),
+            (unsigned long long)PERF_READER_switches(rd),
+            (unsigned long long)PERF_READER_lost(rd),
+            100.0 * (double)PERF_READER_cpu_ns(rd) / (double)elapsed_ns);
+        samples += PERF_READER_samples(rd);
+        lost    += PERF_READER_lost(rd);
+        cpu_ns  += PERF_READER_cpu_ns(rd);
+    }
+    SEPAGENT_PRINT("perf_event_open backend: %llu samples (%.1f per second), %llu lost records\n",
+        (unsigned long long)samples,
+        (double)samples * 1000000000.0 / (double)elapsed_ns,
+        (unsigned long long)lost);
+    SEPAGENT_PRINT("perf_event_open backend reader overhead (all CPUs): %.3f%%\n",
+        100.0 * (double)cpu_ns / ((double)elapsed_ns * perf_num_cpus));
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        perf_backend_Stop (void)
+ *
+ * @brief     Stop the events, let the readers send what is left and
+ *            release everything
+ *
+ * @return    DRV_STATUS
+ *
+ */
+static DRV_STATUS
+perf_backend_Stop (
+    void
+)
+{
+    U32 cpu;
+    U64 elapsed_ns;
+
+    if (!perf_running) {
+        return VT_SUCCESS;
+    }
+    perf_backend_Enable(FALSE);
+    elapsed_ns    = perf_backend_Monotonic_Ns() - perf_start_ns;
+    perf_stopping = TRUE;
+
+    for (cpu = 0; cpu < perf_num_cpus; cpu++) {
+        if (PERF_READER_started(&perf_readers[cpu])) {
+            pthread_join(PERF_READER_thread(&perf_readers[cpu]), NULL);
+        }
+        perf_num_samples += PERF_READER_samples(&perf_readers[cpu]);
+    }
+
+    perf_backend_Report_Overhead(elapsed_ns);
+    perf_backend_Release();
+    perf_running = FALSE;
+
+    return VT_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        perf_backend_Reply (arg, value, size)
+ *
+ * @param     IOCTL_ARGS arg   - request
+ * @param     PVOID      value - reply
+ * @param     U32        size  - size of the reply
+ *
+ * @brief     Copy a fixed-size reply, checking the size the host expects
+ *
+ * @return    DRV_STATUS
+ *
+ */
+static DRV_STATUS
+perf_backend_Reply (
+    IOCTL_ARGS  arg,
+    PVOID       value,
+    U32         size
+)
+{
+    if (arg->buf_drv_to_usr == NULL || arg->len_drv_to_usr != size) {
+        return VT_BAD_PARAMETER;
+    }
+    memcpy(arg->buf_drv_to_usr, value, size);
+    return VT_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        PERF_BACKEND_Send_IOCTL (cmd, arg)
+ *
+ * @param     U32        cmd - driver operation
+ * @param     IOCTL_ARGS arg - request and reply buffers
+ *
+ * @brief     Serve a driver operation with the perf_event_open backend
+ *
+ * @return    DRV_STATUS - VT_DRIVER_COMM_FAILED for unsupported operations,
+ *                         as from a driver without them
+ *
+ * <I>Special Notes:</I>
+ *            The event configuration sent by the host is accepted but not
+ *            used: the backend always samples the event picked by
+ *            PERF_BACKEND_Open at PERF_BACKEND_SAMPLE_FREQ. Counting mode
+ *            is not supported.
+ */
+DRV_STATUS
+PERF_BACKEND_Send_IOCTL (
+    U32         cmd,
+    IOCTL_ARGS  arg
+)
+{
+    SEP_VERSION_NODE  version;
+    DRV_SETUP_INFO    setup;
+    EVENT_DESC        desc;
+    U64               value   = 0;
+    U32               mode    = NATIVE_AGENT;
+    S32               busy    = 0;
+    U32               cpu;
+
+    switch (cmd) {
+        case DRV_OPERATION_VERSION:
+            memset(&version, 0, sizeof(SEP_VERSION_NODE));
+            SEP_VERSION_NODE_major(&version) = SEP_MAJOR_VERSION;
+            SEP_VERSION_NODE_minor(&version) = SEP_MINOR_VERSION;
+            SEP_VERSION_NODE_api(&version)   = SEP_API_VERSION;
+            return perf_backend_Reply(arg, &SEP_VERSION_NODE_sep_version(&version), sizeof(U32));
+
+        case DRV_OPERATION_NUM_CORES:
+            return perf_backend_Reply(arg, &perf_num_cpus, sizeof(S32));
+
+        case DRV_OPERATION_GET_AGENT_MODE:
+            return perf_backend_Reply(arg, &mode, sizeof(U32));
+
+        case DRV_OPERATION_RESERVE:
+            return perf_backend_Reply(arg, &busy, sizeof(S32));
+
+        case DRV_OPERATION_GET_DRV_SETUP_INFO:
+            if (arg->buf_drv_to_usr == NULL || arg->len_drv_to_usr != sizeof(DRV_SETUP_INFO_NODE)) {
+                return VT_BAD_PARAMETER;
+            }
+            setup = (DRV_SETUP_INFO)arg->buf_drv_to_usr;
+            memset(setup, 0, sizeof(DRV_SETUP_INFO_NODE));
+            return VT_SUCCESS;
+
+        case DRV_OPERATION_GET_NORMALIZED_TSC:
+            value = perf_backend_Read_TSC();
+            return perf_backend_Reply(arg, &value, sizeof(U64));
+
+        case DRV_OPERATION_GET_NUM_SAMPLES:
+            value = perf_num_samples;
+            for (cpu = 0; perf_readers && cpu < perf_num_cpus; cpu++) {
+                value += PERF_READER_samples(&perf_readers[cpu]);
+            }
+            return perf_backend_Reply(arg, &value, sizeof(U64));
+
+        case DRV_OPERATION_INIT_DRIVER:
+            if (arg->buf_usr_to_drv == NULL) {
+                return VT_BAD_PARAMETER;
+            }
+            if (DRV_CONFIG_emon_mode((DRV_CONFIG)arg->buf_usr_to_drv)) {
+                SEPAGENT_PRINT_ERROR("Counting mode is not supported by the perf_event_open backend\n");
+                return VT_SAM_ERROR;
+            }
+            perf_sample_size = sizeof(SampleRecordPC);
+            perf_num_desc    = 0;
+            return VT_SUCCESS;
+
+        case DRV_OPERATION_DESC_NEXT:
+            desc = (EVENT_DESC)arg->buf_usr_to_drv;
+            if (desc == NULL || arg->len_usr_to_drv < sizeof(U32)) {
+                return VT_BAD_PARAMETER;
+            }
+            if (perf_num_desc++ == 0 &&
+                EVENT_DESC_sample_size(desc) >= sizeof(SampleRecordPC) &&
+                EVENT_DESC_sample_size(desc) <= PERF_BACKEND_OUT_BUF_SIZE) {
+                perf_sample_size = EVENT_DESC_sample_size(desc);
+            }
+            return VT_SUCCESS;
+
+        case DRV_OPERATION_START:
+            return perf_backend_Start();
+
+        case DRV_OPERATION_STOP:
+            return perf_backend_Stop();
+
+        case DRV_OPERATION_PAUSE:
+        case DRV_OPERATION_RESUME:
+            perf_backend_Enable(cmd == DRV_OPERATION_RESUME);
+            return VT_SUCCESS;
+
+        case DRV_OPERATION_TERMINATE:
+            perf_backend_Stop();
+            perf_sample_size = sizeof(SampleRecordPC);
+            perf_num_desc    = 0;
+            return VT_SUCCESS;
+
+        // Configuration the backend has no use for
+        case DRV_OPERATION_INIT:
+        case DRV_OPERATION_INIT_PMU:
+        case DRV_OPERATION_INIT_NUM_DEV:
+        case DRV_OPERATION_EM_GROUPS:
+        case DRV_OPERATION_EM_CONFIG_NEXT:
+        case DRV_OPERATION_NUM_DESCRIPTOR:
+        case DRV_OPERATION_SET_CPU_TOPOLOGY:
+        case DRV_OPERATION_SET_DEVICE_NUM_UNITS:
+        case DRV_OPERATION_CONTROL_DRIVER_LOG:
+        case DRV_OPERATION_SET_WAKEUP:
+        case DRV_OPERATION_SET_THROTTLE:
+            return VT_SUCCESS;
+
+        default:
+            SEPAGENT_PRINT_DEBUG("operation %u is not supported by the perf_event_open backend\n", cmd);
+            if (arg->buf_drv_to_usr && arg->len_drv_to_usr) {
+                memset(arg->buf_drv_to_usr, 0, arg->len_drv_to_usr);
+            }
+            return VT_DRIVER_COMM_FAILED;
+    }
+}
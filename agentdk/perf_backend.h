@@ -0,0 +1,52 @@
+/****
+    Copyright (C) 2019-2020 Intel Corporation.  All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+
+
+
+
+
+****/
+
+#ifndef _PERF_BACKEND_H_
+#define _PERF_BACKEND_H_
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/*
+ * Fallback sampling backend: serves the driver operations used by a
+ * sampling session with perf_event_open, so the agent keeps working on a
+ * target where the sep driver cannot be loaded. The records sent on the
+ * data channels have the same layout as the driver's.
+ */
+extern DRV_BOOL   perf_backend;
+extern DRV_BOOL   perf_sideband;   // context switches are sent on the sideband channels
+
+extern DRV_STATUS PERF_BACKEND_Open(VOID);
+extern DRV_STATUS PERF_BACKEND_Send_IOCTL(U32 cmd, IOCTL_ARGS arg);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -45,9 +45,12 @@ SOFTWARE.
 #include "communication.h"
 #include "collection_traces.h"
 #include "sepagent_parser.h"
+#include "perf_backend.h"
+#include "capture.h"
 #include "log.h"
 
 static int  num_cpus           = 0;
+static U32  num_packages       = 1;
 S8         *sepagent_debug_var = NULL;
 FILE       *fptr = NULL;
 U32         data_transfer_mode = IMMEDIATE_TRANSFER; // default transfer mode
@@ -236,6 +239,8 @@ int sepagent_Print_Version(
 
     ABSTRACT_Num_CPUs(&num_cpus);
     fprintf(stdout, "Processors configured (Driver)...... %d\n", num_cpus);
+    ABSTRACT_Num_Packages(&num_packages);
+    fprintf(stdout, "Packages (Driver)................... %u\n", num_packages);
 
     tsc_freq = sepagent_Get_Tsc_Frequency();
     fprintf(stdout, "TSC Freq .................. %.2f MHz\n", (double)tsc_freq/MILLION);
@@ -316,16 +321,18 @@ sepagent_Open_Data_Channels(
                 return ret;
             }
         }
-        ret = COMM_Open_Data_On_Target(COMM_UNCORE_CONN_ID, COMM_DATA_UNCORE);
-        if (ret != VT_SUCCESS) {
-            return ret;
+        for (i = 0; i < num_packages; i++) {
+            ret = COMM_Open_Data_On_Target(i, COMM_DATA_UNCORE);
+            if (ret != VT_SUCCESS) {
+                return ret;
+            }
         }
     }
     ret = COMM_Open_Data_On_Target(COMM_MODULE_CONN_ID, COMM_DATA_MODULE);
     if (ret != VT_SUCCESS) {
         return ret;
     }
-    if (agent_mode == HOST_VM_AGENT || agent_mode == GUEST_VM_AGENT) {
+    if (agent_mode == HOST_VM_AGENT || agent_mode == GUEST_VM_AGENT || perf_sideband) {
         for (i = 0; i < num_cpus; i++) {
             ret = COMM_Open_Data_On_Target(i, COMM_DATA_SIDEBAND);
             if (ret != VT_SUCCESS) {
@@ -367,16 +374,18 @@ sepagent_Close_Data_Channels(
                 status = ret;
             }
         }
-        ret = COMM_Close_Data_On_Target(COMM_UNCORE_CONN_ID, COMM_DATA_UNCORE);
-        if (status == VT_SUCCESS) {
-            status = ret;
+        for (i = 0; i < num_packages; i++) {
+            ret = COMM_Close_Data_On_Target(i, COMM_DATA_UNCORE);
+            if (status == VT_SUCCESS) {
+                status = ret;
+            }
         }
     }
     ret = COMM_Close_Data_On_Target(COMM_MODULE_CONN_ID, COMM_DATA_MODULE);
     if (status == VT_SUCCESS) {
         status = ret;
     }
-    if (agent_mode == HOST_VM_AGENT || agent_mode == GUEST_VM_AGENT) {
+    if (agent_mode == HOST_VM_AGENT || agent_mode == GUEST_VM_AGENT || perf_sideband) {
         for (i = 0; i < num_cpus; i++) {
             ret = COMM_Close_Data_On_Target(i, COMM_DATA_SIDEBAND);
             if (status == VT_SUCCESS) {
@@ -389,6 +398,60 @@ sepagent_Close_Data_Channels(
 }
 
 
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          S32  sepagent_Release_Host ( agent_mode, collecting )
+ *
+ * @brief       Release the data channels of a host whose control connection was lost
+ *
+ * @param       IN agent_mode  - agent mode
+ * @param       IN collecting  - a collection is running
+ *
+ * @return      Status
+ *
+ * <I>Special Notes:</I>
+ *              A running collection of a resumable session keeps sampling into the
+ *              replay buffers until the host comes back for it.
+ */
+static S32
+sepagent_Release_Host(
+    U32      agent_mode,
+    DRV_BOOL collecting
+)
+{
+    if (collecting && COMM_Session_Resumable()) {
+        return COMM_Suspend_Data_On_Target();
+    }
+
+    return sepagent_Close_Data_Channels(agent_mode);
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          VOID  sepagent_End_Collection ( VOID )
+ *
+ * @brief       Stop a collection whose host is not coming back for it
+ *
+ * @return      NONE
+ *
+ * <I>Special Notes:</I>
+ *              <NONE>
+ */
+static VOID
+sepagent_End_Collection(
+    VOID
+)
+{
+    IOCTL_ARGS_NODE ioctl_arg;
+
+    memset(&ioctl_arg, 0, sizeof(IOCTL_ARGS_NODE));
+    ABSTRACT_Send_IOCTL(DRV_OPERATION_STOP, &ioctl_arg);
+    memset(&ioctl_arg, 0, sizeof(IOCTL_ARGS_NODE));
+    ABSTRACT_Send_IOCTL(DRV_OPERATION_TERMINATE, &ioctl_arg);
+}
+
+
 int main(int argc, char* argv[])
 {
     IOCTL_ARGS_NODE ioctl_arg;
@@ -400,6 +463,9 @@ int main(int argc, char* argv[])
     S32             size               = MAX_STRING_LENGTH;
     U64             tsc_freq           = 0;
     U32             agent_mode         = NATIVE_AGENT;
+    DRV_BOOL        collecting         = FALSE;
+    DRV_BOOL        host_lost;
+    U64             reply_flags;
 
     DRV_GETENV(sepagent_debug_var, size, "SEPAGENT_DEBUG");
     if (sepagent_debug_var  != NULL){
@@ -418,7 +484,24 @@ int main(int argc, char* argv[])
         sepagent_version_info();
     }
 
-    status = ABSTRACT_Num_CPUs(&num_cpus);
+    if (!perf_backend) {
+        status = ABSTRACT_Num_CPUs(&num_cpus);
+        if (status != VT_SUCCESS) {
+            SEPAGENT_PRINT("The sep driver is not available, falling back to perf_event_open\n");
+            perf_backend = TRUE;
+        }
+    }
+    if (perf_backend) {
+        status = PERF_BACKEND_Open();
+        if (status == VT_SUCCESS) {
+            status = ABSTRACT_Num_CPUs(&num_cpus);
+        }
+        // Records go straight to the host; there is no driver buffer to hold them until stop
+        if (data_transfer_mode == DELAYED_TRANSFER) {
+            SEPAGENT_PRINT("The perf_event_open backend only supports immediate data transfer\n");
+            data_transfer_mode = IMMEDIATE_TRANSFER;
+        }
+    }
     if (status != VT_SUCCESS) {
         SEPAGENT_PRINT_ERROR("Check if sep driver is loaded with appropriate permissions \n");
         exit(-1);
@@ -449,17 +532,29 @@ int main(int argc, char* argv[])
 
     fprintf(stdout, "Number of cpus ..... %d \n", num_cpus);
 
+    ABSTRACT_Num_Packages(&num_packages);
+    fprintf(stdout, "Number of packages . %u \n", num_packages);
+
     tsc_freq = sepagent_Get_Tsc_Frequency();
+    CAPTURE_Set_Tsc_Frequency(tsc_freq);
     sepagent_Read_Cpuid(1, &rax, &rbx, &rcx, &rdx);
 
     while (ret == VT_SUCCESS) {  // Make the connection ready for next collection
         cmd = 0;
-        ret = COMM_Open_Control_On_Target(0, rax, tsc_freq, agent_mode, data_transfer_mode, num_cpus);
+        ret = COMM_Open_Control_On_Target(0, rax, tsc_freq, agent_mode, data_transfer_mode, num_cpus, num_packages);
         if (ret != VT_SUCCESS) {
             COMM_Close_Control_On_Target();
             break;
         }
 
+        // A new host instead of the one that left a collection running
+        if (COMM_Session_Suspended()) {
+            sepagent_End_Collection();
+            collecting = FALSE;
+            COMM_End_Suspended_Session();
+            continue;
+        }
+
         ret = sepagent_Open_Data_Channels(agent_mode);
         if (ret != VT_SUCCESS) {
             ret = sepagent_Close_Data_Channels(agent_mode);
@@ -468,6 +563,8 @@ int main(int argc, char* argv[])
 
         while (1) {
             cmd = 0;
+            reply_flags = 0;
+            host_lost = FALSE;
             ret = COMM_Receive_Control_Request_On_Target(&cmd, &ioctl_arg, -1);
 
             if (ret == VT_SUCCESS) {
@@ -486,9 +583,25 @@ int main(int argc, char* argv[])
                 }
 
                 ret = ABSTRACT_Send_IOCTL(cmd, &ioctl_arg);
+                if (ret == VT_SUCCESS && ABSTRACT_Reply_Cached()) {
+                    reply_flags = CONTROL_MSG_FLAG_CACHED_REPLY;
+                }
+                if (ret == VT_SUCCESS && cmd == DRV_OPERATION_START) {
+                    collecting = TRUE;
+                }
+                if (cmd == DRV_OPERATION_STOP || cmd == DRV_OPERATION_TERMINATE) {
+                    collecting = FALSE;
+                }
+            }
+            else if (ret == VT_COMM_RECV_ERROR || ret == VT_COMM_CONNECTION_CLOSED_BY_REMOTE) {
+                // Nobody is left to take the response
+                host_lost = TRUE;
             }
 
-            ret = COMM_Send_Control_Response_On_Target(cmd, &ioctl_arg, ret, FALSE, -1);
+            if (!host_lost) {
+                ret = COMM_Send_Control_Response_On_Target(cmd, &ioctl_arg, ret, reply_flags, FALSE, -1);
+                host_lost = (ret != VT_SUCCESS);
+            }
 
             if (ioctl_arg.len_drv_to_usr > 0 && ioctl_arg.buf_drv_to_usr) {
                 free(ioctl_arg.buf_drv_to_usr);
@@ -501,8 +614,8 @@ int main(int argc, char* argv[])
                 ioctl_arg.len_usr_to_drv = 0;
             }
 
-            if (ret != VT_SUCCESS) {
-                ret = sepagent_Close_Data_Channels(agent_mode);
+            if (host_lost) {
+                ret = sepagent_Release_Host(agent_mode, collecting);
                 break;
             }
 
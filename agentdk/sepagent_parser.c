@@ -39,9 +39,13 @@ SOFTWARE.
 #include <ctype.h>
 
 #include "sepagent_parser.h"
+#include "communication.h"
+#include "perf_backend.h"
 #include "log.h"
 
 DRV_BOOL verbose = FALSE;
+U32      max_latency_ms = 0;
+U32      replay_budget_mb = COMM_REPLAY_DEFAULT_BUDGET_MB;
 extern int sepagent_Print_Version();
 
 // Macros to parse command line args
@@ -51,11 +55,13 @@ extern int sepagent_Print_Version();
 #define CHECK_END_OF_OPTION_AND_EXIT(a,b,c)       \
     if ((a) == (b)) { fprintf(stderr, (c)); return VT_SEP_OPTIONS_ERROR; }
 
-#define NUM_FIELDS_RUN_INFO      1
+#define NUM_FIELDS_RUN_INFO      3
 static U32 is_dup_run_info[NUM_FIELDS_RUN_INFO];
 /*******************************************
 / is_dup_run_info: what each index represents
 / [0] transfer mode
+/ [1] maximum latency
+/ [2] replay budget
 *******************************************/
 
 /* ------------------------------------------------------------------------- */
@@ -106,6 +112,10 @@ void SEPAGENT_Print_Help(
     fprintf(stdout, "Options:\n");
     fprintf(stdout, "\t-start \t\t\t Start the collection\n");
     fprintf(stdout, "\t [-tm \t Specify type of transfer [IMMEDIATE_TRANSFER/DELAYED_TRANSFER]}\n");
+    fprintf(stdout, "\t [-ml \t Hand records to the agent at most this many ms after they are written]\n");
+    fprintf(stdout, "\t [-rb \t MB kept to replay data to a host that reconnects, shared by all data channels (default %u, 0 disables)]\n",
+            COMM_REPLAY_DEFAULT_BUDGET_MB);
+    fprintf(stdout, "\t [-pb \t Sample with perf_event_open instead of the sep driver]\n");
     fprintf(stdout, "\t-version \t\t Display sepagent version info\n");
     fprintf(stdout, "\t-v \t Verbose mode \n");
 }
@@ -164,6 +174,103 @@ sep_parser_transfer_mode (
     return VT_SUCCESS;
 }
 
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          U32 sep_parser_max_latency (INOUT U32         *i,
+ *                                          IN    const U32    num_args,
+ *                                          IN    STCHAR      *options_arr[]
+ *                                          )
+ * @brief       helper function used by parser to parse the maximum latency
+ *
+ * @param       IN i: index into options_arr
+ * @param       IN num_args: size of options_arr
+ * @param       IN options_arr: character array filled out with options
+ *
+ * @return      VT_SUCCESS on success, otherwise on failure
+ *
+ * <I>Special Notes:</I>
+ *              The value, in milliseconds, is stored in max_latency_ms and
+ *              applied to every collection started by the agent.
+ * ------------------------------------------------------------------------- */
+static int
+sep_parser_max_latency (
+    int    *i,
+    int    num_args,
+    char  *options_arr[]
+)
+{
+    char           *token;
+    char           *end;
+    unsigned long   value;
+
+    (*i)++;
+    CHECK_END_OF_OPTION_AND_EXIT(*i, num_args, "Error: Invalid maximum latency value!\n");
+    token = options_arr[*i];
+    value = strtoul(token, &end, 10);
+    if (token[0] == '-' || *end != '\0' || value == 0 || value > 0xFFFFFFFF) {
+        fprintf (stderr, "Error: invalid maximum latency value!\n");
+        return VT_SEP_OPTIONS_ERROR;
+    }
+
+    if (is_dup_run_info[1] == 1) {
+        fprintf(stderr, "\nWarning: duplicate values for maximum latency are given!");
+    }
+    else {
+        max_latency_ms     = (U32)value;
+        is_dup_run_info[1] = 1;
+    }
+    return VT_SUCCESS;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          U32 sep_parser_replay_budget (INOUT U32         *i,
+ *                                            IN    const U32    num_args,
+ *                                            IN    STCHAR      *options_arr[]
+ *                                            )
+ * @brief       helper function used by parser to parse the replay budget
+ *
+ * @param       IN i: index into options_arr
+ * @param       IN num_args: size of options_arr
+ * @param       IN options_arr: character array filled out with options
+ *
+ * @return      VT_SUCCESS on success, otherwise on failure
+ *
+ * <I>Special Notes:</I>
+ *              The value, in MB, is stored in replay_budget_mb and split
+ *              over the data channels of each resumable session.
+ * ------------------------------------------------------------------------- */
+static int
+sep_parser_replay_budget (
+    int    *i,
+    int    num_args,
+    char  *options_arr[]
+)
+{
+    char           *token;
+    char           *end;
+    unsigned long   value;
+
+    (*i)++;
+    CHECK_END_OF_OPTION_AND_EXIT(*i, num_args, "Error: Invalid replay budget value!\n");
+    token = options_arr[*i];
+    value = strtoul(token, &end, 10);
+    if (token[0] == '-' || token[0] == '\0' || *end != '\0' || value > 0xFFFFF) {
+        fprintf (stderr, "Error: invalid replay budget value!\n");
+        return VT_SEP_OPTIONS_ERROR;
+    }
+
+    if (is_dup_run_info[2] == 1) {
+        fprintf(stderr, "\nWarning: duplicate values for replay budget are given!");
+    }
+    else {
+        replay_budget_mb   = (U32)value;
+        is_dup_run_info[2] = 1;
+    }
+    return VT_SUCCESS;
+}
+
 
 /* ------------------------------------------------------------------------- */
 /*!
@@ -200,6 +307,15 @@ int SEPAGENT_Parser(
                 if (IS_EITHER_OPTION(token, "-tm", "-transfer-mode")) {
                     status = sep_parser_transfer_mode(&i, num_args, options_arr, data_transfer_mode);
                 }
+                else if (IS_EITHER_OPTION(token, "-ml", "-max-latency")) {
+                    status = sep_parser_max_latency(&i, num_args, options_arr);
+                }
+                else if (IS_EITHER_OPTION(token, "-rb", "-replay-budget")) {
+                    status = sep_parser_replay_budget(&i, num_args, options_arr);
+                }
+                else if (IS_EITHER_OPTION(token, "-pb", "-perf-backend")) {
+                    perf_backend = TRUE;
+                }
                 else if (IS_OPTION(token, "-v")) {
                     verbose = TRUE;
                 }
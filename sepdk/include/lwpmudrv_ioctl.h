@@ -118,6 +118,18 @@ extern "C" {
 #define DRV_OPERATION_GET_NUM_VM                        96
 #define DRV_OPERATION_GET_VCPU_MAP                      97
 #define DRV_OPERATION_GET_PERF_CAPAB                    98
+#define DRV_OPERATION_GET_DRIVER_OVERHEAD               99
+#define DRV_OPERATION_SET_THROTTLE                      100
+#define DRV_OPERATION_SET_WAKEUP                        101
+#define DRV_OPERATION_SET_EM_TIMING                     102
+#define DRV_OPERATION_SET_EMON_DELTA                    103
+#define DRV_OPERATION_SET_METRICS                       104      // handled by the agent
+#define DRV_OPERATION_GET_METRICS                       105      // handled by the agent
+#define DRV_OPERATION_GET_NUM_PACKAGES                  106
+#define DRV_OPERATION_SET_TASK_FILTER                   107
+#define DRV_OPERATION_SET_TIME_SYNC                     108
+#define DRV_OPERATION_GET_SYS_INFO_GENERATION           109
+#define DRV_OPERATION_RECONFIGURE                       110
 // Only used by MAC OS
 #define DRV_OPERATION_GET_ASLR_OFFSET                   997      // this may not need
 #define DRV_OPERATION_SET_OSX_VERSION                   998
@@ -124,7 +124,8 @@ struct DRV_CONFIG_NODE_S {
             U64 per_cpu_tsc                : 1;
             U64 mixed_ebc_available        : 1;
             U64 hetero_supported           : 1;
-            U64 reserved_field1            : 46;
+            U64 emon_per_cpu               : 1;
+            U64 reserved_field1            : 45;
         } s1;
     } u3;
     U64          target_pid;
@@ -167,6 +168,7 @@ struct DRV_CONFIG_NODE_S {
 #define DRV_CONFIG_per_cpu_tsc(cfg)               (cfg)->u3.s1.per_cpu_tsc
 #define DRV_CONFIG_mixed_ebc_available(cfg)       (cfg)->u3.s1.mixed_ebc_available
 #define DRV_CONFIG_hetero_supported(cfg)          (cfg)->u3.s1.hetero_supported
+#define DRV_CONFIG_emon_per_cpu(cfg)              (cfg)->u3.s1.emon_per_cpu
 #define DRV_CONFIG_target_pid(cfg)                (cfg)->target_pid
 #define DRV_CONFIG_os_of_interest(cfg)            (cfg)->os_of_interest
 #define DRV_CONFIG_unc_timer_interval(cfg)        (cfg)->unc_timer_interval
@@ -1547,7 +1549,8 @@ struct REMOTE_HARDWARE_INFO_NODE_S {
     U32  model;
     U32  stepping;
     U64  tsc_freq;
-    U64  reserved2;
+    U32  num_packages;   // 0 from agents that predate per-package uncore channels
+    U32  reserved2;
     U64  reserved3;
 };
 
@@ -1556,6 +1559,7 @@ struct REMOTE_HARDWARE_INFO_NODE_S {
 #define REMOTE_HARDWARE_INFO_model(x)           (x).model
 #define REMOTE_HARDWARE_INFO_stepping(x)        (x).stepping
 #define REMOTE_HARDWARE_INFO_tsc_frequency(x)   (x).tsc_freq
+#define REMOTE_HARDWARE_INFO_num_packages(x)    (x).num_packages
 
 /*
   Type: SEP_AGENT_MODE
@@ -1837,13 +1841,29 @@ struct EMON_BUFFER_DRIVER_HELPER_NODE_S {
 
 #define DRV_LOG_MESSAGE_LENGTH       64
 #define DRV_LOG_FUNCTION_NAME_LENGTH 32
+#define DRV_LOG_BINARY_MAX_NB_ARGS    9     // fills the text area: 3 + 9 U64 words = 96 bytes
+
+#define DRV_LOG_ENTRY_FORMAT_TEXT     0     // function name and message are stored as strings
+#define DRV_LOG_ENTRY_FORMAT_BINARY   2     // format string pointer and raw argument words are stored instead
+                                            // (not 1, which is DRV_LOG_FILLER_BYTE in never-written entries)
 
 typedef struct DRV_LOG_ENTRY_NODE_S  DRV_LOG_ENTRY_NODE;
 typedef        DRV_LOG_ENTRY_NODE   *DRV_LOG_ENTRY;
 struct DRV_LOG_ENTRY_NODE_S {
 
-    char function_name[DRV_LOG_FUNCTION_NAME_LENGTH];
-    char message      [DRV_LOG_MESSAGE_LENGTH];
+    union {
+        struct {
+            char function_name[DRV_LOG_FUNCTION_NAME_LENGTH];
+            char message      [DRV_LOG_MESSAGE_LENGTH];
+        } text;
+        struct {
+            U64  function_name;   // driver address of the calling function's name
+            U64  format_string;   // driver address of the format string (formatting is deferred to the reader)
+            U32  nb_args;
+            U32  reserved;
+            U64  args[DRV_LOG_BINARY_MAX_NB_ARGS];
+        } binary;
+    } u;
 
     U16  temporal_tag;
     U16  integrity_tag;
@@ -1864,7 +1884,10 @@ struct DRV_LOG_ENTRY_NODE_S {
 
     U16  nb_active_notifications;
 
-    U64  reserved;               // need padding to reach 128 bytes
+    U8   entry_format;            // DRV_LOG_ENTRY_FORMAT_TEXT or DRV_LOG_ENTRY_FORMAT_BINARY
+    U8   reserved1;
+    U16  reserved2;
+    U32  reserved3;               // need padding to reach 128 bytes
 }; // this structure should be exactly 128-byte long
 
 #define DRV_LOG_ENTRY_temporal_tag(ent)            (ent)->temporal_tag
@@ -1878,8 +1901,13 @@ struct DRV_LOG_ENTRY_NODE_S {
 #define DRV_LOG_ENTRY_nb_active_interrupts(ent)    (ent)->nb_active_interrupts
 #define DRV_LOG_ENTRY_nb_active_notifications(ent) (ent)->nb_active_notifications
 #define DRV_LOG_ENTRY_line_number(ent)             (ent)->line_number
-#define DRV_LOG_ENTRY_message(ent)                 (ent)->message
-#define DRV_LOG_ENTRY_function_name(ent)           (ent)->function_name
+#define DRV_LOG_ENTRY_message(ent)                 (ent)->u.text.message
+#define DRV_LOG_ENTRY_function_name(ent)           (ent)->u.text.function_name
+#define DRV_LOG_ENTRY_entry_format(ent)            (ent)->entry_format
+#define DRV_LOG_ENTRY_bin_function_name(ent)       (ent)->u.binary.function_name
+#define DRV_LOG_ENTRY_bin_format_string(ent)       (ent)->u.binary.format_string
+#define DRV_LOG_ENTRY_bin_nb_args(ent)             (ent)->u.binary.nb_args
+#define DRV_LOG_ENTRY_bin_args(ent)                (ent)->u.binary.args
 
 
 /*
@@ -1899,7 +1927,7 @@ struct DRV_LOG_ENTRY_NODE_S {
 #define DRV_LOG_SIGNATURE_7          '\0'
 // The signature is "SePdRv4"; not declared as string on purpose to avoid false positives when trying to identify the log buffer in a crash dump
 
-#define DRV_LOG_VERSION               1
+#define DRV_LOG_VERSION               2                    // 2: entries may hold binary (deferred-format) payloads
 #define DRV_LOG_FILLER_BYTE           1
 
 #define DRV_LOG_DRIVER_VERSION_SIZE   64                   // Must be a multiple of 8
@@ -1944,7 +1972,7 @@ struct DRV_LOG_BUFFER_NODE_S {
     U32       nb_driver_state_transitions;
 
     U8        contiguous_physical_memory;
-    U8        reserved3;
+    U8        binary_mode;                             // when set, memory log entries defer formatting (see DRV_LOG_ENTRY_FORMAT_BINARY)
     U16       reserved4;
     U32       reserved5;
 
@@ -1977,6 +2005,7 @@ struct DRV_LOG_BUFFER_NODE_S {
 #define DRV_LOG_BUFFER_entries(log)                     (log)->entries
 #define DRV_LOG_BUFFER_contiguous_physical_memory(log)  (log)->contiguous_physical_memory
 #define DRV_LOG_BUFFER_verbosities(log)                 (log)->verbosities
+#define DRV_LOG_BUFFER_binary_mode(log)                 (log)->binary_mode
 
 
 #define DRV_LOG_CONTROL_MAX_DATA_SIZE   DRV_MAX_NB_LOG_CATEGORIES   // Must be a multiple of 8
@@ -2000,12 +2029,14 @@ struct DRV_LOG_CONTROL_NODE_S {
 #define DRV_LOG_CONTROL_verbosities(x)          (x)->data
 #define DRV_LOG_CONTROL_message(x)              (x)->data   // Userland 'MARK' messages use the 'data' field too.
 #define DRV_LOG_CONTROL_log_size(x)             (*((U32*)((x)->data)))
+#define DRV_LOG_CONTROL_binary_mode(x)          ((x)->data[0])
 
 #define DRV_LOG_CONTROL_COMMAND_NONE             0
 #define DRV_LOG_CONTROL_COMMAND_ADJUST_VERBOSITY 1
 #define DRV_LOG_CONTROL_COMMAND_MARK             2
 #define DRV_LOG_CONTROL_COMMAND_QUERY_SIZE       3
 #define DRV_LOG_CONTROL_COMMAND_BENCHMARK        4
+#define DRV_LOG_CONTROL_COMMAND_SET_BINARY_MODE  5     // data[0]: 0 = text, 1 = binary, LOG_VERBOSITY_UNSET = query only
 
 
 typedef struct DRV_IOCTL_STATUS_NODE_S   DRV_IOCTL_STATUS_NODE;
@@ -2043,6 +2074,710 @@ struct DRV_IOCTL_STATUS_NODE_S {
 #define DRV_IOCTL_STATUS_reg_key2(x)        (x)->reg_key2
 
 
+/*
+ * @macro DRV_OVERHEAD_NODE_S
+ * @brief
+ * Per-CPU self-overhead statistics of the driver, returned by DRV_OPERATION_GET_DRIVER_OVERHEAD
+ * as a DRV_OVERHEAD_INFO_NODE header followed by num_cpus DRV_OVERHEAD_NODE elements.
+ * Latencies are in TSC cycles. Histogram bucket b counts the calls that took [2^(b-1), 2^b) cycles
+ * (bucket 0: zero cycles, last bucket: anything longer).
+ */
+
+#define DRV_OVERHEAD_NB_BUCKETS               32
+
+#define DRV_OVERHEAD_PATH_PMI                 0     // PMI_Interrupt_Handler
+#define DRV_OVERHEAD_PATH_PEBS_FLUSH          1     // PEBS_Flush_Buffer
+#define DRV_OVERHEAD_PATH_SCHED_SWITCH        2     // sched_switch tracepoint callback (PEBS sideband)
+#define DRV_OVERHEAD_PATH_MODULE_NOTIFY       3     // munmap and task exit notifiers
+#define DRV_OVERHEAD_PATH_EMON_TIMER          4     // EMON read timer callback
+#define DRV_OVERHEAD_PATH_UNC_TIMER           5     // uncore read timer callback
+#define DRV_OVERHEAD_PATH_EMON_SNAPSHOT       6     // per-CPU counter snapshot of an EMON read (nested in EMON_TIMER on the timer CPU)
+#define DRV_OVERHEAD_PATH_TIME_SYNC           7     // per-CPU time synchronisation timer
+#define DRV_OVERHEAD_NB_PATHS                 8     // room for future paths
+
+#define DRV_OVERHEAD_EVENT_DROPPED_RECORDS    0     // OUTPUT_Reserve_Buffer_Space could not find room
+#define DRV_OVERHEAD_EVENT_BUFFER_WAKEUPS     1     // consumer wakeups on full buffers
+#define DRV_OVERHEAD_EVENT_TASKLET_SCHEDULES  2     // deferred wakeups through the NMI tasklet
+#define DRV_OVERHEAD_EVENT_GROUP_SWAPS        3     // core event group swaps (event multiplexing)
+#define DRV_OVERHEAD_EVENT_SWAP_MSR_WRITES    4     // MSRs written by the group swaps
+#define DRV_OVERHEAD_EVENT_SWAP_MSR_SKIPPED   5     // group swap MSR writes skipped as the value was already set
+#define DRV_OVERHEAD_EVENT_CALLSTACK_FRAMES   6     // return addresses stored by the call stack walks
+#define DRV_OVERHEAD_EVENT_CALLSTACK_CYCLES   7     // TSC cycles spent walking call stacks (included in the PMI path)
+#define DRV_OVERHEAD_NB_EVENTS                8
+
+typedef struct DRV_OVERHEAD_PATH_NODE_S  DRV_OVERHEAD_PATH_NODE;
+typedef        DRV_OVERHEAD_PATH_NODE   *DRV_OVERHEAD_PATH;
+
+struct DRV_OVERHEAD_PATH_NODE_S {
+    U64   count;
+    U64   total_cycles;
+    U64   max_cycles;
+    U32   histogram[DRV_OVERHEAD_NB_BUCKETS];
+};
+
+#define DRV_OVERHEAD_PATH_count(x)          (x)->count
+#define DRV_OVERHEAD_PATH_total_cycles(x)   (x)->total_cycles
+#define DRV_OVERHEAD_PATH_max_cycles(x)     (x)->max_cycles
+#define DRV_OVERHEAD_PATH_histogram(x)      (x)->histogram
+
+typedef struct DRV_OVERHEAD_NODE_S  DRV_OVERHEAD_NODE;
+typedef        DRV_OVERHEAD_NODE   *DRV_OVERHEAD;
+
+struct DRV_OVERHEAD_NODE_S {
+    DRV_OVERHEAD_PATH_NODE paths[DRV_OVERHEAD_NB_PATHS];
+    U64                    events[DRV_OVERHEAD_NB_EVENTS];
+};
+
+#define DRV_OVERHEAD_path(x, path)          (&((x)->paths[path]))
+#define DRV_OVERHEAD_events(x)              (x)->events
+
+typedef struct DRV_OVERHEAD_INFO_NODE_S  DRV_OVERHEAD_INFO_NODE;
+typedef        DRV_OVERHEAD_INFO_NODE   *DRV_OVERHEAD_INFO;
+
+struct DRV_OVERHEAD_INFO_NODE_S {
+    U32   num_cpus;
+    U32   nb_paths;
+    U64   start_tsc;                  // TSC when the collection was started
+    U64   end_tsc;                    // TSC when the collection was stopped (or of the request, if still running)
+    U64   first_sample_tsc;           // TSC of the first sample written since the start, 0 if none
+    U64   reserved2;
+};
+
+#define DRV_OVERHEAD_INFO_num_cpus(x)         (x)->num_cpus
+#define DRV_OVERHEAD_INFO_nb_paths(x)         (x)->nb_paths
+#define DRV_OVERHEAD_INFO_start_tsc(x)        (x)->start_tsc
+#define DRV_OVERHEAD_INFO_end_tsc(x)          (x)->end_tsc
+#define DRV_OVERHEAD_INFO_first_sample_tsc(x) (x)->first_sample_tsc
+#define DRV_OVERHEAD_INFO_cpu_stats(x)      ((DRV_OVERHEAD)((x) + 1))
+
+/*
+ * Adaptive sampling-rate throttling
+ *
+ * The governor periodically compares each CPU's PMI rate, PMI handler
+ * overhead and output buffer fill level against the configured ceilings and
+ * scales the sample-after values of the core sampling events by a power of
+ * two factor. Each time a CPU picks up a new factor, a DRV_THROTTLE_RECORD
+ * is emitted in its sample stream so counts can be re-weighted by the host.
+ */
+#define DRV_THROTTLE_DESCRIPTOR_ID          0xFFFFFFF0
+#define DRV_THROTTLE_DEFAULT_INTERVAL_MS    100
+#define DRV_THROTTLE_DEFAULT_MAX_FACTOR     64
+
+typedef struct DRV_THROTTLE_CONFIG_NODE_S  DRV_THROTTLE_CONFIG_NODE;
+typedef        DRV_THROTTLE_CONFIG_NODE   *DRV_THROTTLE_CONFIG;
+
+struct DRV_THROTTLE_CONFIG_NODE_S {
+    U32   enabled;
+    U32   interval_ms;                // governor period, 0 selects the default
+    U64   max_samples_per_sec;        // per-CPU PMI rate ceiling, 0 for none
+    U32   max_overhead_ppm;           // PMI handler cycles per million TSC cycles, 0 for none
+    U32   max_buffer_fill_pct;        // output buffer fill ceiling in percent, 0 for none
+    U32   max_factor;                 // largest scaling factor applied, 0 selects the default
+    U32   reserved1;
+    U64   reserved2;
+    U64   reserved3;
+};
+
+#define DRV_THROTTLE_CONFIG_enabled(x)              (x)->enabled
+#define DRV_THROTTLE_CONFIG_interval_ms(x)          (x)->interval_ms
+#define DRV_THROTTLE_CONFIG_max_samples_per_sec(x)  (x)->max_samples_per_sec
+#define DRV_THROTTLE_CONFIG_max_overhead_ppm(x)     (x)->max_overhead_ppm
+#define DRV_THROTTLE_CONFIG_max_buffer_fill_pct(x)  (x)->max_buffer_fill_pct
+#define DRV_THROTTLE_CONFIG_max_factor(x)           (x)->max_factor
+
+typedef struct DRV_THROTTLE_RECORD_NODE_S  DRV_THROTTLE_RECORD_NODE;
+typedef        DRV_THROTTLE_RECORD_NODE   *DRV_THROTTLE_RECORD;
+
+struct DRV_THROTTLE_RECORD_NODE_S {
+    U32   descriptor_id;              // always DRV_THROTTLE_DESCRIPTOR_ID
+    U32   osid;
+    U32   cpu_num;
+    U32   factor;                     // sample-after values are multiplied by factor from tsc on
+    U64   epoch;                      // incremented on each factor change
+    U64   tsc;
+};
+
+#define DRV_THROTTLE_RECORD_descriptor_id(x)        (x)->descriptor_id
+#define DRV_THROTTLE_RECORD_osid(x)                 (x)->osid
+#define DRV_THROTTLE_RECORD_cpu_num(x)              (x)->cpu_num
+#define DRV_THROTTLE_RECORD_factor(x)               (x)->factor
+#define DRV_THROTTLE_RECORD_epoch(x)                (x)->epoch
+#define DRV_THROTTLE_RECORD_tsc(x)                  (x)->tsc
+
+/*
+ * Reader wakeup policy of the sample, sideband, uncore and module devices
+ *
+ * By default a buffer is handed to its reader only when it is full. A
+ * watermark hands it over once it holds the given number of bytes or records,
+ * and a maximum latency bounds how long data may sit in a buffer that is
+ * still being written to.
+ */
+#define DRV_WAKEUP_DEVICE_SAMPLE            0
+#define DRV_WAKEUP_DEVICE_SIDEBAND          1
+#define DRV_WAKEUP_DEVICE_UNCORE            2
+#define DRV_WAKEUP_DEVICE_MODULE            3
+#define DRV_WAKEUP_NB_DEVICES               4
+
+typedef struct DRV_WAKEUP_CONFIG_NODE_S  DRV_WAKEUP_CONFIG_NODE;
+typedef        DRV_WAKEUP_CONFIG_NODE   *DRV_WAKEUP_CONFIG;
+
+struct DRV_WAKEUP_CONFIG_NODE_S {
+    U32   device_type;                // DRV_WAKEUP_DEVICE_*
+    U32   watermark_bytes;            // hand over the buffer once it holds this many bytes, 0 for none
+    U32   watermark_records;          // hand over the buffer once it holds this many records, 0 for none
+    U32   max_latency_ms;             // hand over a non-empty buffer at most this late, 0 for none
+    U64   reserved1;
+    U64   reserved2;
+};
+
+#define DRV_WAKEUP_CONFIG_device_type(x)            (x)->device_type
+#define DRV_WAKEUP_CONFIG_watermark_bytes(x)        (x)->watermark_bytes
+#define DRV_WAKEUP_CONFIG_watermark_records(x)      (x)->watermark_records
+#define DRV_WAKEUP_CONFIG_max_latency_ms(x)         (x)->max_latency_ms
+
+/*
+ * Timer-based event multiplexing
+ *
+ * Each group is loaded for period_us * weights[group] microseconds in turn.
+ * Whenever a CPU moves to another group, a DRV_EM_TIME_RECORD is emitted in
+ * its sample stream with the time the outgoing group has been enabled and
+ * running, so the host can scale the counts of each group as
+ * count * time_enabled / time_running.
+ */
+#define DRV_EM_TIME_DESCRIPTOR_ID           0xFFFFFFEF
+#define DRV_EM_MAX_WEIGHTED_GROUPS          32
+#define DRV_EM_MIN_PERIOD_US                50
+
+typedef struct DRV_EM_TIMING_NODE_S  DRV_EM_TIMING_NODE;
+typedef        DRV_EM_TIMING_NODE   *DRV_EM_TIMING;
+
+struct DRV_EM_TIMING_NODE_S {
+    U32   period_us;                  // base time slice, 0 keeps the em_factor slice in ms
+    U32   num_weights;                // valid entries in weights
+    U64   reserved1;
+    U16   weights[DRV_EM_MAX_WEIGHTED_GROUPS];  // slice multiplier of each group, 0 counts as 1
+};
+
+#define DRV_EM_TIMING_period_us(x)                  (x)->period_us
+#define DRV_EM_TIMING_num_weights(x)                (x)->num_weights
+#define DRV_EM_TIMING_weights(x)                    (x)->weights
+
+typedef struct DRV_EM_TIME_RECORD_NODE_S  DRV_EM_TIME_RECORD_NODE;
+typedef        DRV_EM_TIME_RECORD_NODE   *DRV_EM_TIME_RECORD;
+
+struct DRV_EM_TIME_RECORD_NODE_S {
+    U32   descriptor_id;              // always DRV_EM_TIME_DESCRIPTOR_ID
+    U32   osid;
+    U32   cpu_num;
+    U32   group_id;
+    U64   time_enabled;               // TSC ticks since multiplexing started on cpu_num
+    U64   time_running;               // TSC ticks group_id has been loaded on cpu_num
+    U64   tsc;
+};
+
+#define DRV_EM_TIME_RECORD_descriptor_id(x)         (x)->descriptor_id
+#define DRV_EM_TIME_RECORD_osid(x)                  (x)->osid
+#define DRV_EM_TIME_RECORD_cpu_num(x)               (x)->cpu_num
+#define DRV_EM_TIME_RECORD_group_id(x)              (x)->group_id
+#define DRV_EM_TIME_RECORD_time_enabled(x)          (x)->time_enabled
+#define DRV_EM_TIME_RECORD_time_running(x)          (x)->time_running
+#define DRV_EM_TIME_RECORD_tsc(x)                   (x)->tsc
+
+/*
+ * Per-CPU EMON records
+ *
+ * With DRV_CONFIG_emon_per_cpu set, every CPU reads its own counters from a
+ * pinned timer and writes a DRV_EMON_CPU_RECORD in its sample buffer instead
+ * of all CPUs filling one shared record in the EMON buffer. All timers expire
+ * on the same interval boundaries, so records of different CPUs with the same
+ * interval_id belong to the same EMON interval.
+ *
+ * A record is followed by num_windows windows. Each window is a
+ * DRV_EMON_CPU_WINDOW_NODE followed by count U64 counts, which belong at
+ * offset (in U64 entries) in the data part of the shared EMON record, i.e.
+ * after its 2 * num_cpus header entries. A socket master adds the package
+ * window of its package. To rebuild a shared record, copy the package
+ * windows of an interval first, then the thread windows.
+ */
+#define DRV_EMON_CPU_DESCRIPTOR_ID          0xFFFFFFEE
+#define DRV_EMON_CPU_WINDOW_THREAD          0
+#define DRV_EMON_CPU_WINDOW_PACKAGE         1
+
+typedef struct DRV_EMON_CPU_RECORD_NODE_S  DRV_EMON_CPU_RECORD_NODE;
+typedef        DRV_EMON_CPU_RECORD_NODE   *DRV_EMON_CPU_RECORD;
+
+struct DRV_EMON_CPU_RECORD_NODE_S {
+    U32   descriptor_id;              // always DRV_EMON_CPU_DESCRIPTOR_ID
+    U32   cpu_num;
+    U64   interval_id;                // EMON interval index, shared by all CPUs
+    U64   tsc;                        // TSC of the snapshot on cpu_num
+    U64   tsc_delta;                  // TSC ticks since the previous snapshot on cpu_num
+    U64   time_sec;                   // wall clock, as in the shared record header
+    U64   time_usec;
+    U32   group_id;                   // core event group the counts belong to
+    U32   num_windows;
+    U32   size;                       // record size in bytes, windows included
+    U32   reserved1;
+};
+
+#define DRV_EMON_CPU_RECORD_descriptor_id(x)        (x)->descriptor_id
+#define DRV_EMON_CPU_RECORD_cpu_num(x)              (x)->cpu_num
+#define DRV_EMON_CPU_RECORD_interval_id(x)          (x)->interval_id
+#define DRV_EMON_CPU_RECORD_tsc(x)                  (x)->tsc
+#define DRV_EMON_CPU_RECORD_tsc_delta(x)            (x)->tsc_delta
+#define DRV_EMON_CPU_RECORD_time_sec(x)             (x)->time_sec
+#define DRV_EMON_CPU_RECORD_time_usec(x)            (x)->time_usec
+#define DRV_EMON_CPU_RECORD_group_id(x)             (x)->group_id
+#define DRV_EMON_CPU_RECORD_num_windows(x)          (x)->num_windows
+#define DRV_EMON_CPU_RECORD_size(x)                 (x)->size
+
+typedef struct DRV_EMON_CPU_WINDOW_NODE_S  DRV_EMON_CPU_WINDOW_NODE;
+typedef        DRV_EMON_CPU_WINDOW_NODE   *DRV_EMON_CPU_WINDOW;
+
+struct DRV_EMON_CPU_WINDOW_NODE_S {
+    U32   window_type;                // DRV_EMON_CPU_WINDOW_*
+    U32   count;                      // number of U64 counts following
+    U64   offset;                     // first entry in the data part of the shared record
+};
+
+#define DRV_EMON_CPU_WINDOW_window_type(x)          (x)->window_type
+#define DRV_EMON_CPU_WINDOW_count(x)                (x)->count
+#define DRV_EMON_CPU_WINDOW_offset(x)               (x)->offset
+
+/*
+ * Delta-encoded EMON output
+ *
+ * When enabled, each record of the EMON device is a DRV_EMON_DELTA_RECORD
+ * instead of a full snapshot. The record is followed by num_entries
+ * variable-length integers, one per U64 entry of the classic EMON record
+ * (header entries included), and zero padding up to size. Each integer is
+ * LEB128-encoded (7 bits per byte, least significant group first, high bit
+ * set on all but the last byte) and holds the zigzag form of the difference
+ * with the same entry of the previous record, modulo 2^64:
+ *     z = (d << 1) ^ (d >> 63),  d = (S64)(value - previous)
+ * Keyframes are encoded against zero, so decoding can start at any keyframe.
+ * With a downsampling factor N, one record covers N EMON intervals: the TSC
+ * and counter entries are summed over the intervals and the time header
+ * entries are those of the last one.
+ */
+#define DRV_EMON_DELTA_DESCRIPTOR_ID        0xFFFFFFED
+#define DRV_EMON_DELTA_DEFAULT_KEYFRAME     64
+#define DRV_EMON_DELTA_FLAG_KEYFRAME        0x1
+
+typedef struct DRV_EMON_DELTA_CONFIG_NODE_S  DRV_EMON_DELTA_CONFIG_NODE;
+typedef        DRV_EMON_DELTA_CONFIG_NODE   *DRV_EMON_DELTA_CONFIG;
+
+struct DRV_EMON_DELTA_CONFIG_NODE_S {
+    U32   enabled;
+    U32   keyframe_interval;          // records between keyframes, 0 selects the default
+    U32   downsample_factor;          // EMON intervals per record, 0 or 1 for none
+    U32   reserved1;
+    U64   reserved2;
+};
+
+#define DRV_EMON_DELTA_CONFIG_enabled(x)            (x)->enabled
+#define DRV_EMON_DELTA_CONFIG_keyframe_interval(x)  (x)->keyframe_interval
+#define DRV_EMON_DELTA_CONFIG_downsample_factor(x)  (x)->downsample_factor
+
+typedef struct DRV_EMON_DELTA_RECORD_NODE_S  DRV_EMON_DELTA_RECORD_NODE;
+typedef        DRV_EMON_DELTA_RECORD_NODE   *DRV_EMON_DELTA_RECORD;
+
+struct DRV_EMON_DELTA_RECORD_NODE_S {
+    U32   descriptor_id;              // always DRV_EMON_DELTA_DESCRIPTOR_ID
+    U32   flags;                      // DRV_EMON_DELTA_FLAG_*
+    U64   interval_id;                // first EMON interval covered by the record
+    U32   num_intervals;              // EMON intervals summed in the record
+    U32   num_entries;                // U64 entries of the decoded record
+    U32   size;                       // record size in bytes, payload and padding included
+    U32   reserved1;
+};
+
+#define DRV_EMON_DELTA_RECORD_descriptor_id(x)      (x)->descriptor_id
+#define DRV_EMON_DELTA_RECORD_flags(x)              (x)->flags
+#define DRV_EMON_DELTA_RECORD_interval_id(x)        (x)->interval_id
+#define DRV_EMON_DELTA_RECORD_num_intervals(x)      (x)->num_intervals
+#define DRV_EMON_DELTA_RECORD_num_entries(x)        (x)->num_entries
+#define DRV_EMON_DELTA_RECORD_size(x)               (x)->size
+
+/*
+ * On-target derived metrics
+ *
+ * Metric definitions are handed to the agent at collection start and are not
+ * forwarded to the driver. Each metric is a formula in reverse Polish notation
+ * evaluated once per counting interval over the DRV_OPERATION_READ_AND_RESET
+ * buffer: EVENT tokens push the count at the given index of the data part
+ * (after the per-CPU TSC deltas), TSC pushes the TSC delta of CPU 0, INTERVAL
+ * pushes the interval number and CONST pushes the token value. OP tokens pop
+ * two values and push the result; a division by zero yields zero.
+ * The agent keeps the last DRV_METRIC_MAX_SAMPLES results of each metric and
+ * serves them through DRV_OPERATION_GET_METRICS as a DRV_METRIC_SERIES header
+ * followed by num_samples rows of num_metrics float values, oldest first.
+ */
+#define DRV_METRIC_MAX_METRICS              32
+#define DRV_METRIC_MAX_TOKENS               16
+#define DRV_METRIC_MAX_SAMPLES              1024
+#define DRV_METRIC_NAME_SIZE                32
+
+#define DRV_METRIC_TOKEN_EVENT              0
+#define DRV_METRIC_TOKEN_TSC                1
+#define DRV_METRIC_TOKEN_INTERVAL           2
+#define DRV_METRIC_TOKEN_CONST              3
+#define DRV_METRIC_TOKEN_OP                 4
+
+#define DRV_METRIC_OP_ADD                   0
+#define DRV_METRIC_OP_SUB                   1
+#define DRV_METRIC_OP_MUL                   2
+#define DRV_METRIC_OP_DIV                   3
+
+typedef struct DRV_METRIC_TOKEN_NODE_S  DRV_METRIC_TOKEN_NODE;
+typedef        DRV_METRIC_TOKEN_NODE   *DRV_METRIC_TOKEN;
+
+struct DRV_METRIC_TOKEN_NODE_S {
+    U32   type;                       // DRV_METRIC_TOKEN_*
+    U32   arg;                        // event index or DRV_METRIC_OP_*
+    U64   value;                      // DRV_METRIC_TOKEN_CONST only
+};
+
+#define DRV_METRIC_TOKEN_type(x)                    (x)->type
+#define DRV_METRIC_TOKEN_arg(x)                     (x)->arg
+#define DRV_METRIC_TOKEN_value(x)                   (x)->value
+
+typedef struct DRV_METRIC_DEF_NODE_S  DRV_METRIC_DEF_NODE;
+typedef        DRV_METRIC_DEF_NODE   *DRV_METRIC_DEF;
+
+struct DRV_METRIC_DEF_NODE_S {
+    char                    name[DRV_METRIC_NAME_SIZE];
+    U32                     num_tokens;
+    U32                     reserved1;
+    DRV_METRIC_TOKEN_NODE   tokens[DRV_METRIC_MAX_TOKENS];
+};
+
+#define DRV_METRIC_DEF_name(x)                      (x)->name
+#define DRV_METRIC_DEF_num_tokens(x)                (x)->num_tokens
+#define DRV_METRIC_DEF_tokens(x)                    (x)->tokens
+
+typedef struct DRV_METRIC_SERIES_NODE_S  DRV_METRIC_SERIES_NODE;
+typedef        DRV_METRIC_SERIES_NODE   *DRV_METRIC_SERIES;
+
+struct DRV_METRIC_SERIES_NODE_S {
+    U32   num_metrics;
+    U32   num_samples;                // rows following the header
+    U64   first_interval;             // interval number of the first row
+    U64   num_intervals;              // intervals evaluated since the definitions were set
+};
+
+#define DRV_METRIC_SERIES_num_metrics(x)            (x)->num_metrics
+#define DRV_METRIC_SERIES_num_samples(x)            (x)->num_samples
+#define DRV_METRIC_SERIES_first_interval(x)         (x)->first_interval
+#define DRV_METRIC_SERIES_num_intervals(x)          (x)->num_intervals
+
+/*
+ * User-space region markers
+ *
+ * Applications write arrays of DRV_USER_MARKER_NODE to the marker device
+ * (<driver>/k, see sep_marker.h). The driver stamps each marker with the
+ * writer's process and thread ids and emits it as a DRV_USER_MARKER_RECORD
+ * into the sample stream of the CPU that handled the write. Writes made while
+ * no sampling collection is running are accepted and discarded, so markers
+ * can stay compiled in. The tsc and cpu_num are read together with rdtscp
+ * when the marker is recorded, so a batch flushed after a migration keeps
+ * the CPU each marker was taken on. The tsc is passed through raw, like the
+ * tsc of samples; skew is corrected by the consumer for both alike.
+ */
+#define DRV_USER_MARKER_DESCRIPTOR_ID       0xFFFFFFEC
+#define DRV_USER_MARKER_DEVICE_SUFFIX       "k"
+
+typedef struct DRV_USER_MARKER_NODE_S  DRV_USER_MARKER_NODE;
+typedef        DRV_USER_MARKER_NODE   *DRV_USER_MARKER;
+
+struct DRV_USER_MARKER_NODE_S {
+    U64   tsc;
+    U32   marker_id;
+    U32   cpu_num;                    // CPU the tsc was read on
+    U64   payload;
+};
+
+#define DRV_USER_MARKER_tsc(x)                      (x)->tsc
+#define DRV_USER_MARKER_marker_id(x)                (x)->marker_id
+#define DRV_USER_MARKER_cpu_num(x)                  (x)->cpu_num
+#define DRV_USER_MARKER_payload(x)                  (x)->payload
+
+typedef struct DRV_USER_MARKER_RECORD_NODE_S  DRV_USER_MARKER_RECORD_NODE;
+typedef        DRV_USER_MARKER_RECORD_NODE   *DRV_USER_MARKER_RECORD;
+
+struct DRV_USER_MARKER_RECORD_NODE_S {
+    U32   descriptor_id;              // always DRV_USER_MARKER_DESCRIPTOR_ID
+    U32   osid;
+    U32   cpu_num;
+    U32   marker_id;
+    U32   pid;
+    U32   tid;
+    U64   tsc;
+    U64   payload;
+};
+
+#define DRV_USER_MARKER_RECORD_descriptor_id(x)     (x)->descriptor_id
+#define DRV_USER_MARKER_RECORD_osid(x)              (x)->osid
+#define DRV_USER_MARKER_RECORD_cpu_num(x)           (x)->cpu_num
+#define DRV_USER_MARKER_RECORD_marker_id(x)         (x)->marker_id
+#define DRV_USER_MARKER_RECORD_pid(x)               (x)->pid
+#define DRV_USER_MARKER_RECORD_tid(x)               (x)->tid
+#define DRV_USER_MARKER_RECORD_tsc(x)               (x)->tsc
+#define DRV_USER_MARKER_RECORD_payload(x)           (x)->payload
+
+/*
+ * Task filter
+ *
+ * Restricts sampling, the sideband context-switch records and the module
+ * notifications to a set of processes (tgids) and/or cgroup v2 ids (the
+ * inode number of the cgroup directory). A task is accepted when it matches
+ * either list; two empty lists accept everything. The filter is applied at
+ * the next collection start.
+ */
+#define DRV_TASK_FILTER_MAX_TGIDS           64
+#define DRV_TASK_FILTER_MAX_CGROUPS         16
+
+typedef struct DRV_TASK_FILTER_NODE_S  DRV_TASK_FILTER_NODE;
+typedef        DRV_TASK_FILTER_NODE   *DRV_TASK_FILTER;
+
+struct DRV_TASK_FILTER_NODE_S {
+    U32   num_tgids;
+    U32   num_cgroups;
+    U32   tgids[DRV_TASK_FILTER_MAX_TGIDS];
+    U64   cgroup_ids[DRV_TASK_FILTER_MAX_CGROUPS];
+    U64   reserved1;
+    U64   reserved2;
+};
+
+#define DRV_TASK_FILTER_num_tgids(x)                (x)->num_tgids
+#define DRV_TASK_FILTER_num_cgroups(x)              (x)->num_cgroups
+#define DRV_TASK_FILTER_tgids(x)                    (x)->tgids
+#define DRV_TASK_FILTER_cgroup_ids(x)               (x)->cgroup_ids
+
+/*
+ * Time synchronisation records
+ *
+ * When enabled, every CPU periodically writes a DRV_TIME_SYNC_RECORD into its
+ * sample stream, and a sideband entry with pid and tid set to
+ * DRV_TIME_SYNC_SIDEBAND_ID into its sideband stream when PEBS sideband is
+ * collected. No record written after it in the same stream carries an older
+ * TSC, so a consumer can merge the per-CPU streams on the fly, releasing
+ * everything below the smallest watermark seen across CPUs. Marker records
+ * are excluded from this guarantee: they carry the TSC the application read
+ * when recording them, which can be older than a watermark already written,
+ * so a consumer must buffer them rather than release them by watermark.
+ *
+ * Each record also anchors the CPU's raw TSC to CLOCK_MONOTONIC, so TSC skew
+ * between CPUs can be tracked during the collection rather than only from
+ * the measurement taken at driver load. The last record of each stream has
+ * DRV_TIME_SYNC_FLAG_FINAL set.
+ */
+#define DRV_TIME_SYNC_DESCRIPTOR_ID         0xFFFFFFEB
+#define DRV_TIME_SYNC_SIDEBAND_ID           0xFFFFFFFF
+#define DRV_TIME_SYNC_FLAG_FINAL            0x1
+
+typedef struct DRV_TIME_SYNC_CONFIG_NODE_S  DRV_TIME_SYNC_CONFIG_NODE;
+typedef        DRV_TIME_SYNC_CONFIG_NODE   *DRV_TIME_SYNC_CONFIG;
+
+struct DRV_TIME_SYNC_CONFIG_NODE_S {
+    U32   interval_ms;                // period of the records, 0 disables them
+    U32   reserved1;
+    U64   reserved2;
+};
+
+#define DRV_TIME_SYNC_CONFIG_interval_ms(x)         (x)->interval_ms
+
+typedef struct DRV_TIME_SYNC_RECORD_NODE_S  DRV_TIME_SYNC_RECORD_NODE;
+typedef        DRV_TIME_SYNC_RECORD_NODE   *DRV_TIME_SYNC_RECORD;
+
+struct DRV_TIME_SYNC_RECORD_NODE_S {
+    U32   descriptor_id;              // always DRV_TIME_SYNC_DESCRIPTOR_ID
+    U32   osid;
+    U32   cpu_num;
+    U32   flags;
+    U64   sequence;                   // per-CPU record count, starting at 0
+    U64   watermark_tsc;              // raw TSC of this CPU
+    U64   monotonic_ns;               // CLOCK_MONOTONIC read next to watermark_tsc
+    U64   load_tsc_skew;              // TSC skew to CPU 0 measured at driver load
+};
+
+#define DRV_TIME_SYNC_RECORD_descriptor_id(x)       (x)->descriptor_id
+#define DRV_TIME_SYNC_RECORD_osid(x)                (x)->osid
+#define DRV_TIME_SYNC_RECORD_cpu_num(x)             (x)->cpu_num
+#define DRV_TIME_SYNC_RECORD_flags(x)               (x)->flags
+#define DRV_TIME_SYNC_RECORD_sequence(x)            (x)->sequence
+#define DRV_TIME_SYNC_RECORD_watermark_tsc(x)       (x)->watermark_tsc
+#define DRV_TIME_SYNC_RECORD_monotonic_ns(x)        (x)->monotonic_ns
+#define DRV_TIME_SYNC_RECORD_load_tsc_skew(x)       (x)->load_tsc_skew
+
+/*
+ * Hot reconfiguration
+ *
+ * DRV_OPERATION_RECONFIGURE changes the sample-after values of core sampling
+ * events, and optionally selects the current event group, while a collection
+ * is running or paused. The driver pauses the PMUs, updates the ECBs, reloads
+ * the PMU of every CPU and resumes; output buffers, module records and the
+ * reader devices stay live. Events are identified by their event index, as
+ * in the sample records. Precise (PEBS) events cannot be changed this way.
+ *
+ * Each CPU writes a DRV_CONFIG_EPOCH_RECORD in its sample stream at the point
+ * the new configuration is loaded: the samples after it in that stream were
+ * taken with the configuration of that epoch. A config epoch also resets the
+ * throttle factor to 1.
+ */
+#define DRV_CONFIG_EPOCH_DESCRIPTOR_ID      0xFFFFFFEA
+#define DRV_RECONFIG_MAX_EVENTS             64
+#define DRV_RECONFIG_KEEP_GROUP             0xFFFFFFFF
+
+typedef struct DRV_RECONFIG_EVENT_NODE_S  DRV_RECONFIG_EVENT_NODE;
+typedef        DRV_RECONFIG_EVENT_NODE   *DRV_RECONFIG_EVENT;
+
+struct DRV_RECONFIG_EVENT_NODE_S {
+    U32   event_index;                // event index as reported in the sample records
+    U32   reserved1;
+    U64   sample_after;               // new sample-after value, must not be 0
+};
+
+#define DRV_RECONFIG_EVENT_event_index(x)           (x)->event_index
+#define DRV_RECONFIG_EVENT_sample_after(x)          (x)->sample_after
+
+typedef struct DRV_RECONFIG_NODE_S  DRV_RECONFIG_NODE;
+typedef        DRV_RECONFIG_NODE   *DRV_RECONFIG;
+
+struct DRV_RECONFIG_NODE_S {
+    U32                       num_events;
+    U32                       group;  // group to make current on every CPU, or DRV_RECONFIG_KEEP_GROUP
+    U64                       reserved1;
+    U64                       reserved2;
+    DRV_RECONFIG_EVENT_NODE   events[DRV_RECONFIG_MAX_EVENTS];
+};
+
+#define DRV_RECONFIG_num_events(x)                  (x)->num_events
+#define DRV_RECONFIG_group(x)                       (x)->group
+#define DRV_RECONFIG_events(x)                      (x)->events
+
+typedef struct DRV_CONFIG_EPOCH_RECORD_NODE_S  DRV_CONFIG_EPOCH_RECORD_NODE;
+typedef        DRV_CONFIG_EPOCH_RECORD_NODE   *DRV_CONFIG_EPOCH_RECORD;
+
+struct DRV_CONFIG_EPOCH_RECORD_NODE_S {
+    U32   descriptor_id;              // always DRV_CONFIG_EPOCH_DESCRIPTOR_ID
+    U32   osid;
+    U32   cpu_num;
+    U32   group;                      // current group of the CPU after the change
+    U64   epoch;                      // 1 for the first reconfiguration of the collection
+    U64   tsc;
+};
+
+#define DRV_CONFIG_EPOCH_RECORD_descriptor_id(x)    (x)->descriptor_id
+#define DRV_CONFIG_EPOCH_RECORD_osid(x)             (x)->osid
+#define DRV_CONFIG_EPOCH_RECORD_cpu_num(x)          (x)->cpu_num
+#define DRV_CONFIG_EPOCH_RECORD_group(x)            (x)->group
+#define DRV_CONFIG_EPOCH_RECORD_epoch(x)            (x)->epoch
+#define DRV_CONFIG_EPOCH_RECORD_tsc(x)              (x)->tsc
+
+/*
+ * Frame-pointer call stacks
+ *
+ * With DEV_CONFIG_collect_callstacks set, each sample of a descriptor with a
+ * non-zero callstack_offset carries a DRV_CALLSTACK_NODE at that offset. The
+ * header is followed by kernel_depth kernel return addresses, then user_depth
+ * user return addresses, innermost first; the first address of each part is
+ * the interrupted instruction pointer. Kernel frames are only walked with
+ * DEV_CONFIG_collect_kernel_callstacks. callstack_size bounds the payload,
+ * DRV_CALLSTACK_MAX_DEPTH and DRV_CALLSTACK_MAX_KERNEL_DEPTH bound the walks.
+ */
+#define DRV_CALLSTACK_MAX_DEPTH             128
+#define DRV_CALLSTACK_MAX_KERNEL_DEPTH      32
+
+#define DRV_CALLSTACK_KERNEL_TRUNCATED      0x1     // kernel walk stopped at the depth bound
+#define DRV_CALLSTACK_USER_TRUNCATED        0x2     // user walk stopped at the depth bound
+#define DRV_CALLSTACK_USER_FAULT            0x4     // user walk stopped on a frame that could not be read without faulting
+#define DRV_CALLSTACK_USER_32BIT            0x8     // user frames of a 32-bit task
+#define DRV_CALLSTACK_KERNEL_NO_FP          0x10    // kernel built without frame pointers, only the interrupted ip is given
+
+typedef struct DRV_CALLSTACK_NODE_S  DRV_CALLSTACK_NODE;
+typedef        DRV_CALLSTACK_NODE   *DRV_CALLSTACK;
+
+struct DRV_CALLSTACK_NODE_S {
+    U16   kernel_depth;
+    U16   user_depth;
+    U32   flags;                      // DRV_CALLSTACK_*
+};
+
+#define DRV_CALLSTACK_kernel_depth(x)               (x)->kernel_depth
+#define DRV_CALLSTACK_user_depth(x)                 (x)->user_depth
+#define DRV_CALLSTACK_flags(x)                      (x)->flags
+#define DRV_CALLSTACK_ips(x)                        ((U64 *)((x) + 1))
+
+
+/*
+ * Driver records in the sample streams
+ *
+ * The records with a DRV_*_DESCRIPTOR_ID above share the per-CPU sample
+ * streams with the samples of the event descriptors. DRV_RECORD_Size gives
+ * the size of such a record, from its type or from its size field, and 0 for
+ * any other record; a self-sized record cut short before its size field is
+ * given its header size. DRV_RECORD_Tsc gives the TSC it was written at, 0
+ * for a record without one. At least the descriptor id must be readable.
+ */
+static inline U32
+DRV_RECORD_Size (
+    const void  *record,
+    U64          available
+)
+{
+    switch (*(const U32 *)record) {
+        case DRV_THROTTLE_DESCRIPTOR_ID:
+            return sizeof(DRV_THROTTLE_RECORD_NODE);
+        case DRV_EM_TIME_DESCRIPTOR_ID:
+            return sizeof(DRV_EM_TIME_RECORD_NODE);
+        case DRV_EMON_CPU_DESCRIPTOR_ID:
+            if (available < sizeof(DRV_EMON_CPU_RECORD_NODE)) {
+                return sizeof(DRV_EMON_CPU_RECORD_NODE);
+            }
+            return DRV_EMON_CPU_RECORD_size((DRV_EMON_CPU_RECORD)record) >= sizeof(DRV_EMON_CPU_RECORD_NODE) ?
+                   DRV_EMON_CPU_RECORD_size((DRV_EMON_CPU_RECORD)record) : sizeof(DRV_EMON_CPU_RECORD_NODE);
+        case DRV_EMON_DELTA_DESCRIPTOR_ID:
+            if (available < sizeof(DRV_EMON_DELTA_RECORD_NODE)) {
+                return sizeof(DRV_EMON_DELTA_RECORD_NODE);
+            }
+            return DRV_EMON_DELTA_RECORD_size((DRV_EMON_DELTA_RECORD)record) >= sizeof(DRV_EMON_DELTA_RECORD_NODE) ?
+                   DRV_EMON_DELTA_RECORD_size((DRV_EMON_DELTA_RECORD)record) : sizeof(DRV_EMON_DELTA_RECORD_NODE);
+        case DRV_USER_MARKER_DESCRIPTOR_ID:
+            return sizeof(DRV_USER_MARKER_RECORD_NODE);
+        case DRV_TIME_SYNC_DESCRIPTOR_ID:
+            return sizeof(DRV_TIME_SYNC_RECORD_NODE);
+        case DRV_CONFIG_EPOCH_DESCRIPTOR_ID:
+            return sizeof(DRV_CONFIG_EPOCH_RECORD_NODE);
+    }
+
+    return 0;
+}
+
+static inline U64
+DRV_RECORD_Tsc (
+    const void  *record
+)
+{
+    switch (*(const U32 *)record) {
+        case DRV_THROTTLE_DESCRIPTOR_ID:
+            return DRV_THROTTLE_RECORD_tsc((DRV_THROTTLE_RECORD)record);
+        case DRV_EM_TIME_DESCRIPTOR_ID:
+            return DRV_EM_TIME_RECORD_tsc((DRV_EM_TIME_RECORD)record);
+        case DRV_EMON_CPU_DESCRIPTOR_ID:
+            return DRV_EMON_CPU_RECORD_tsc((DRV_EMON_CPU_RECORD)record);
+        case DRV_USER_MARKER_DESCRIPTOR_ID:
+            return DRV_USER_MARKER_RECORD_tsc((DRV_USER_MARKER_RECORD)record);
+        case DRV_TIME_SYNC_DESCRIPTOR_ID:
+            return DRV_TIME_SYNC_RECORD_watermark_tsc((DRV_TIME_SYNC_RECORD)record);
+        case DRV_CONFIG_EPOCH_DESCRIPTOR_ID:
+            return DRV_CONFIG_EPOCH_RECORD_tsc((DRV_CONFIG_EPOCH_RECORD)record);
+    }
+
+    return 0;
+}
+
+
 #if defined(__cplusplus)
 }
 #endif
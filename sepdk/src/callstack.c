@@ -0,0 +1,356 @@
+/*COPYRIGHT**
+    Copyright (C) 2005-2020 Intel Corporation.  All Rights Reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+
+
+
+
+**COPYRIGHT*/
+
+
+
+
+
+/*
+ *  CVS_Id="$Id$"
+ */
+
+#include "lwpmudrv_defines.h"
+#include <linux/version.h>
+#include <linux/sched.h>
+#include <linux/ptrace.h>
+#include <linux/uaccess.h>
+#include <asm/uaccess.h>
+
+#include "lwpmudrv_types.h"
+#include "rise_errors.h"
+#include "lwpmudrv_ecb.h"
+#include "lwpmudrv_struct.h"
+#include "lwpmudrv.h"
+#include "utility.h"
+#include "overhead.h"
+#include "callstack.h"
+
+/*
+ * A frame as laid out by "push %rbp; mov %rsp, %rbp": the caller's frame
+ * pointer, then the return address into the caller.
+ */
+typedef struct CALLSTACK_FRAME_NODE_S  CALLSTACK_FRAME_NODE;
+typedef        CALLSTACK_FRAME_NODE   *CALLSTACK_FRAME;
+
+struct CALLSTACK_FRAME_NODE_S {
+    unsigned long   next;
+    unsigned long   ret;
+};
+
+#if defined(DRV_EM64T)
+typedef struct CALLSTACK_FRAME32_NODE_S  CALLSTACK_FRAME32_NODE;
+typedef        CALLSTACK_FRAME32_NODE   *CALLSTACK_FRAME32;
+
+struct CALLSTACK_FRAME32_NODE_S {
+    U32   next;
+    U32   ret;
+};
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,8,0)
+#define CALLSTACK_READ_KERNEL(dst, src, size)   copy_from_kernel_nofault((dst), (const void *)(src), (size))
+#else
+#define CALLSTACK_READ_KERNEL(dst, src, size)   probe_kernel_read((dst), (const void *)(src), (size))
+#endif
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          static U32 callstack_Walk_Kernel(struct pt_regs *regs, U64 *ips, U32 max, U32 *flags)
+ *
+ * @brief       Walk the kernel frame pointer chain of the interrupted context
+ *
+ * @param       regs  - interrupted kernel context
+ * @param       ips   - where to store the return addresses
+ * @param       max   - room in ips
+ * @param       flags - DRV_CALLSTACK_* flags to update
+ *
+ * @return      number of addresses stored
+ *
+ * <I>Special Notes:</I>
+ *              Every frame is read with the no-fault kernel accessor, so a
+ *              broken chain only ends the walk. Without CONFIG_FRAME_POINTER,
+ *              %rbp is a general purpose register and only the interrupted
+ *              ip is stored.
+ */
+static U32
+callstack_Walk_Kernel (
+    struct pt_regs  *regs,
+    U64             *ips,
+    U32              max,
+    U32             *flags
+)
+{
+    U32                   depth = 0;
+#if defined(CONFIG_FRAME_POINTER)
+    CALLSTACK_FRAME_NODE  frame;
+    unsigned long         bp;
+#endif
+
+    if (!max) {
+        return 0;
+    }
+    ips[depth++] = instruction_pointer(regs);
+
+#if defined(CONFIG_FRAME_POINTER)
+    bp = frame_pointer(regs);
+    while (depth < max) {
+        if (bp < PAGE_OFFSET || (bp & (sizeof(unsigned long) - 1)) ||
+            CALLSTACK_READ_KERNEL(&frame, bp, sizeof(CALLSTACK_FRAME_NODE)) ||
+            frame.ret < PAGE_OFFSET) {
+            return depth;
+        }
+        ips[depth++] = frame.ret;
+        // frames live higher up the stack than their callees
+        if (frame.next <= bp) {
+            return depth;
+        }
+        bp = frame.next;
+    }
+    *flags |= DRV_CALLSTACK_KERNEL_TRUNCATED;
+#else
+    *flags |= DRV_CALLSTACK_KERNEL_NO_FP;
+#endif
+
+    return depth;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          static U32 callstack_Walk_User(struct pt_regs *uregs, U64 *ips, U32 max, U32 *flags)
+ *
+ * @brief       Walk the user frame pointer chain of the current task
+ *
+ * @param       uregs - user context of the current task
+ * @param       ips   - where to store the return addresses
+ * @param       max   - room in ips
+ * @param       flags - DRV_CALLSTACK_* flags to update
+ *
+ * @return      number of addresses stored
+ *
+ * <I>Special Notes:</I>
+ *              Runs in NMI context: user memory is only read through
+ *              copy_from_user_nmi, which never takes a page fault and fails
+ *              when the current mm is not the one loaded. A frame that is
+ *              not resident ends the walk with DRV_CALLSTACK_USER_FAULT.
+ */
+static U32
+callstack_Walk_User (
+    struct pt_regs  *uregs,
+    U64             *ips,
+    U32              max,
+    U32             *flags
+)
+{
+    CALLSTACK_FRAME_NODE    frame;
+#if defined(DRV_EM64T)
+    CALLSTACK_FRAME32_NODE  frame32;
+    DRV_BOOL                compat     = !user_64bit_mode(uregs);
+#else
+    DRV_BOOL                compat     = FALSE;
+#endif
+    unsigned long           word_size  = compat ? sizeof(U32) : sizeof(unsigned long);
+    unsigned long           bp         = frame_pointer(uregs);
+    unsigned long           fault;
+    U32                     depth      = 0;
+
+    if (!max) {
+        return 0;
+    }
+    ips[depth++] = instruction_pointer(uregs);
+    if (compat) {
+        *flags |= DRV_CALLSTACK_USER_32BIT;
+    }
+
+    while (depth < max) {
+        if (!bp || (bp & (word_size - 1))) {
+            return depth;
+        }
+#if defined(DRV_EM64T)
+        if (compat) {
+            fault      = copy_from_user_nmi(&frame32, (const void __user *)bp, sizeof(CALLSTACK_FRAME32_NODE));
+            frame.next = frame32.next;
+            frame.ret  = frame32.ret;
+        }
+        else
+#endif
+        {
+            fault = copy_from_user_nmi(&frame, (const void __user *)bp, sizeof(CALLSTACK_FRAME_NODE));
+        }
+        if (fault) {
+            *flags |= DRV_CALLSTACK_USER_FAULT;
+            return depth;
+        }
+        if (!frame.ret) {
+            return depth;
+        }
+        ips[depth++] = frame.ret;
+        if (frame.next <= bp) {
+            return depth;
+        }
+        bp = frame.next;
+    }
+    *flags |= DRV_CALLSTACK_USER_TRUNCATED;
+
+    return depth;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          DRV_BOOL CALLSTACK_Capture(struct pt_regs *regs, S8 *buffer, U32 size, DRV_BOOL kernel)
+ *
+ * @brief       Fill a sample's call stack payload from the interrupted context
+ *
+ * @param       regs   - registers of the interrupted context, as given to the PMI handler
+ * @param       buffer - call stack payload of the sample (EVENT_DESC_callstack_offset)
+ * @param       size   - size of the payload (EVENT_DESC_callstack_size)
+ * @param       kernel - TRUE to walk the kernel stack as well
+ *
+ * @return      TRUE if the payload was written
+ *
+ * <I>Special Notes:</I>
+ *              When the sample hit in the kernel, the user stack is walked
+ *              from the registers saved at kernel entry, unless the task is
+ *              a kernel thread. The walk depth and its TSC cost are added to
+ *              the driver overhead events.
+ */
+extern DRV_BOOL
+CALLSTACK_Capture (
+    struct pt_regs  *regs,
+    S8              *buffer,
+    U32              size,
+    DRV_BOOL         kernel
+)
+{
+    DRV_CALLSTACK    cs           = (DRV_CALLSTACK)buffer;
+    U64             *ips          = DRV_CALLSTACK_ips(cs);
+    struct pt_regs  *uregs        = NULL;
+    U32              capacity;
+    U32              kernel_depth = 0;
+    U32              user_depth   = 0;
+    U32              flags        = 0;
+    U64              start_tsc;
+    U64              end_tsc;
+
+    if (size < sizeof(DRV_CALLSTACK_NODE) + sizeof(U64)) {
+        return FALSE;
+    }
+    UTILITY_Read_TSC(&start_tsc);
+
+    capacity = (size - sizeof(DRV_CALLSTACK_NODE)) / sizeof(U64);
+    if (capacity > DRV_CALLSTACK_MAX_DEPTH) {
+        capacity = DRV_CALLSTACK_MAX_DEPTH;
+    }
+
+    if (user_mode(regs)) {
+        uregs = regs;
+    }
+    else {
+        if (kernel) {
+            kernel_depth = callstack_Walk_Kernel(regs, ips,
+                                                 capacity < DRV_CALLSTACK_MAX_KERNEL_DEPTH ? capacity : DRV_CALLSTACK_MAX_KERNEL_DEPTH,
+                                                 &flags);
+        }
+        if (current->mm && !(current->flags & PF_KTHREAD)) {
+            uregs = task_pt_regs(current);
+        }
+    }
+    if (uregs) {
+        user_depth = callstack_Walk_User(uregs, ips + kernel_depth, capacity - kernel_depth, &flags);
+    }
+
+    DRV_CALLSTACK_kernel_depth(cs) = (U16)kernel_depth;
+    DRV_CALLSTACK_user_depth(cs)   = (U16)user_depth;
+    DRV_CALLSTACK_flags(cs)        = flags;
+
+    UTILITY_Read_TSC(&end_tsc);
+    OVERHEAD_Add_Event(DRV_OVERHEAD_EVENT_CALLSTACK_FRAMES, kernel_depth + user_depth);
+    OVERHEAD_Add_Event(DRV_OVERHEAD_EVENT_CALLSTACK_CYCLES, end_tsc > start_tsc ? end_tsc - start_tsc : 0);
+
+    return TRUE;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          VOID CALLSTACK_Copy(S8 *buffer, U32 size, S8 *src)
+ *
+ * @brief       Fill a sample's call stack payload from one captured for the same interrupt
+ *
+ * @param       buffer - call stack payload to fill
+ * @param       size   - size of that payload
+ * @param       src    - payload filled by CALLSTACK_Capture
+ *
+ * @return      None
+ *
+ * <I>Special Notes:</I>
+ *              Samples of several events overflowing in one PMI share a
+ *              single walk. A smaller payload keeps the innermost frames of
+ *              each part and is flagged as truncated.
+ */
+extern VOID
+CALLSTACK_Copy (
+    S8   *buffer,
+    U32   size,
+    S8   *src
+)
+{
+    DRV_CALLSTACK  cs     = (DRV_CALLSTACK)buffer;
+    DRV_CALLSTACK  src_cs = (DRV_CALLSTACK)src;
+    U32            capacity;
+    U32            kernel_depth;
+    U32            user_depth;
+    U32            flags;
+
+    if (size < sizeof(DRV_CALLSTACK_NODE) + sizeof(U64)) {
+        return;
+    }
+    capacity = (size - sizeof(DRV_CALLSTACK_NODE)) / sizeof(U64);
+
+    flags        = DRV_CALLSTACK_flags(src_cs);
+    kernel_depth = DRV_CALLSTACK_kernel_depth(src_cs);
+    if (kernel_depth > capacity) {
+        kernel_depth = capacity;
+        flags       |= DRV_CALLSTACK_KERNEL_TRUNCATED;
+    }
+    user_depth = DRV_CALLSTACK_user_depth(src_cs);
+    if (user_depth > capacity - kernel_depth) {
+        user_depth = capacity - kernel_depth;
+        flags     |= DRV_CALLSTACK_USER_TRUNCATED;
+    }
+
+    memcpy(DRV_CALLSTACK_ips(cs), DRV_CALLSTACK_ips(src_cs), kernel_depth * sizeof(U64));
+    memcpy(DRV_CALLSTACK_ips(cs) + kernel_depth,
+           DRV_CALLSTACK_ips(src_cs) + DRV_CALLSTACK_kernel_depth(src_cs),
+           user_depth * sizeof(U64));
+    DRV_CALLSTACK_kernel_depth(cs) = (U16)kernel_depth;
+    DRV_CALLSTACK_user_depth(cs)   = (U16)user_depth;
+    DRV_CALLSTACK_flags(cs)        = flags;
+}
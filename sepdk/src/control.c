@@ -36,6 +36,7 @@
 #include <linux/mempool.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
+#include <linux/hash.h>
 
 #include "lwpmudrv_types.h"
 #include "rise_errors.h"
@@ -62,6 +63,9 @@ MSR_DATA           msr_data      = NULL;
 MEM_TRACKER        mem_tr_head   = NULL;   // start of the mem tracker list
 MEM_TRACKER        mem_tr_tail   = NULL;   // end of mem tracker list
 spinlock_t         mem_tr_lock;            // spinlock for mem tracker list
+static MEM_EL      mem_tr_hash[MEM_TR_HASH_SIZE]; // tracked elements indexed by address
+static MEM_ARENA_CHUNK mem_arena_head = NULL;  // most recent per-collection arena chunk
+static spinlock_t  mem_arena_lock;         // spinlock for the arena chunk list
 static unsigned long flags;
 
 /* ------------------------------------------------------------------------- */
@@ -149,6 +153,87 @@ CONTROL_Invoke_Parallel_Service (
     return;
 }
 
+/* ------------------------------------------------------------------------- */
+/*
+ * @fn VOID control_Memory_Tracker_Hash_Insert(mem_el)
+ *
+ * @param    IN mem_el    - tracked element to index
+ *
+ * @returns  None
+ *
+ * @brief    Add a tracked element to the address hash
+ *
+ * <I>Special Notes:</I>
+ *           Assumes mem_tr_lock is already held while calling this function!
+ */
+static VOID
+control_Memory_Tracker_Hash_Insert (
+    MEM_EL mem_el
+)
+{
+    U32 bucket = hash_ptr(MEM_EL_address(mem_el), MEM_TR_HASH_BITS);
+
+    MEM_EL_hash_next(mem_el) = mem_tr_hash[bucket];
+    mem_tr_hash[bucket]      = mem_el;
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * @fn VOID control_Memory_Tracker_Hash_Remove(mem_el)
+ *
+ * @param    IN mem_el    - tracked element to drop from the index
+ *
+ * @returns  None
+ *
+ * @brief    Remove a tracked element from the address hash
+ *
+ * <I>Special Notes:</I>
+ *           Assumes mem_tr_lock is already held while calling this function!
+ */
+static VOID
+control_Memory_Tracker_Hash_Remove (
+    MEM_EL mem_el
+)
+{
+    MEM_EL *link = &mem_tr_hash[hash_ptr(MEM_EL_address(mem_el), MEM_TR_HASH_BITS)];
+
+    while (*link) {
+        if (*link == mem_el) {
+            *link = MEM_EL_hash_next(mem_el);
+            break;
+        }
+        link = &MEM_EL_hash_next(*link);
+    }
+    MEM_EL_hash_next(mem_el) = NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * @fn MEM_EL control_Memory_Tracker_Hash_Find(location)
+ *
+ * @param    IN location  - address to look up
+ *
+ * @returns  the tracked element for location, NULL if it is not tracked
+ *
+ * @brief    Look up a tracked allocation by address
+ *
+ * <I>Special Notes:</I>
+ *           Assumes mem_tr_lock is already held while calling this function!
+ */
+static MEM_EL
+control_Memory_Tracker_Hash_Find (
+    PVOID location
+)
+{
+    MEM_EL mem_el = mem_tr_hash[hash_ptr(location, MEM_TR_HASH_BITS)];
+
+    while (mem_el && MEM_EL_address(mem_el) != location) {
+        mem_el = MEM_EL_hash_next(mem_el);
+    }
+
+    return mem_el;
+}
+
 /* ------------------------------------------------------------------------- */
 /*
  * @fn VOID control_Memory_Tracker_Delete_Node(mem_tr)
@@ -384,6 +469,8 @@ control_Memory_Tracker_Add (
     MEM_TRACKER_mem_address(mem_tr,n) = location;
     MEM_TRACKER_mem_size(mem_tr,n)    = size;
     MEM_TRACKER_mem_vmalloc(mem_tr,n) = vmalloc_flag;
+    MEM_EL_node(MEM_TRACKER_mem_el(mem_tr,n)) = mem_tr;
+    control_Memory_Tracker_Hash_Insert(MEM_TRACKER_mem_el(mem_tr,n));
     MEM_TRACKER_elements(mem_tr)++;
     SEP_DRV_LOG_ALLOC("Tracking (0x%p, %d) in node %d of %d.",
                      location, (S32)size, n, MEM_TRACKER_max_size(mem_tr) - 1);
@@ -415,10 +502,13 @@ CONTROL_Memory_Tracker_Init (
 {
     SEP_DRV_LOG_ALLOC_IN("Initializing mem tracker.");
 
-    mem_tr_head = NULL;
-    mem_tr_tail = NULL;
+    mem_tr_head    = NULL;
+    mem_tr_tail    = NULL;
+    mem_arena_head = NULL;
+    memset(mem_tr_hash, 0, sizeof(mem_tr_hash));
 
     spin_lock_init(&mem_tr_lock);
+    spin_lock_init(&mem_arena_lock);
 
     SEP_DRV_LOG_ALLOC_OUT("");
     return;
@@ -477,6 +567,7 @@ CONTROL_Memory_Tracker_Free (
     }
 
     mem_tr_tail = NULL;
+    memset(mem_tr_hash, 0, sizeof(mem_tr_hash));
 
     spin_unlock_irqrestore(&mem_tr_lock, flags);
 
@@ -603,7 +694,7 @@ CONTROL_Memory_Tracker_Compaction (
                                             j,
                                             MEM_TRACKER_max_size(mem_tr2)-1);
                         found = TRUE;
-                        // Any reason why we are not 'breaking' here?
+                        break;
                     }
                 }
             }
@@ -628,14 +719,18 @@ CONTROL_Memory_Tracker_Compaction (
         }
 
         // swap empty node with non-empty node so that "holes" get bubbled towards the end of list
+        control_Memory_Tracker_Hash_Remove(MEM_TRACKER_mem_el(mem_tr2,j));
         MEM_TRACKER_mem_address(mem_tr1,i) = MEM_TRACKER_mem_address(mem_tr2,j);
         MEM_TRACKER_mem_size(mem_tr1,i)    = MEM_TRACKER_mem_size(mem_tr2,j);
         MEM_TRACKER_mem_vmalloc(mem_tr1,i) = MEM_TRACKER_mem_vmalloc(mem_tr2,j);
+        MEM_EL_node(MEM_TRACKER_mem_el(mem_tr1,i)) = mem_tr1;
+        control_Memory_Tracker_Hash_Insert(MEM_TRACKER_mem_el(mem_tr1,i));
         MEM_TRACKER_elements(mem_tr1)++;
 
         MEM_TRACKER_mem_address(mem_tr2,j) = NULL;
         MEM_TRACKER_mem_size(mem_tr2,j)    = 0;
         MEM_TRACKER_mem_vmalloc(mem_tr2,j) = FALSE;
+        MEM_EL_node(MEM_TRACKER_mem_el(mem_tr2,j)) = NULL;
         MEM_TRACKER_elements(mem_tr2)--;
 
         SEP_DRV_LOG_ALLOC("Node <%p,elemts %d,index %d> moved to <%p,elemts %d,index %d>.", mem_tr2, MEM_TRACKER_elements(mem_tr2), j, mem_tr1, MEM_TRACKER_elements(mem_tr1), i);
@@ -801,14 +896,16 @@ CONTROL_Allocate_KMemory (
  *               ptr = CONTROL_Free_Memory(ptr);
  *           Does not do compaction ... can have "holes" in
  *           mem_tracker list after this operation.
+ *           Tracked allocations are found through the address hash,
+ *           so the cost does not grow with the number of tracked blocks.
  */
 extern PVOID
 CONTROL_Free_Memory (
     PVOID  location
 )
 {
-    S32         i;
-    DRV_BOOL    found;
+    DRV_BOOL    found = FALSE;
+    MEM_EL      mem_el;
     MEM_TRACKER mem_tr;
 
     SEP_DRV_LOG_ALLOC_IN("Attempting to free %p.", location);
@@ -820,31 +917,25 @@ CONTROL_Free_Memory (
 
     spin_lock_irqsave(&mem_tr_lock, flags);
 
-    // scan through mem_tracker nodes for matching entry (if any)
-    mem_tr = mem_tr_head;
-    found = FALSE;
-    while (mem_tr) {
-        for (i = 0; i < MEM_TRACKER_max_size(mem_tr); i++) {
-            if (location == MEM_TRACKER_mem_address(mem_tr,i)) {
-                SEP_DRV_LOG_ALLOC("Freeing large memory location 0x%p", location);
-                found = TRUE;
-                if (MEM_TRACKER_mem_vmalloc(mem_tr, i)) {
-                    vfree(location);
-                }
-                else {
-                    free_pages((unsigned long)location, get_order(MEM_TRACKER_mem_size(mem_tr,i)));
-                }
-                MEM_TRACKER_mem_address(mem_tr,i) = NULL;
-                MEM_TRACKER_mem_size(mem_tr,i)    = 0;
-                MEM_TRACKER_mem_vmalloc(mem_tr,i) = 0;
-                MEM_TRACKER_elements(mem_tr)--;
-                goto finish_free;
-            }
+    mem_el = control_Memory_Tracker_Hash_Find(location);
+    if (mem_el) {
+        SEP_DRV_LOG_ALLOC("Freeing large memory location 0x%p", location);
+        found = TRUE;
+        if (MEM_EL_is_addr_vmalloc(mem_el)) {
+            vfree(location);
         }
-        mem_tr = MEM_TRACKER_next(mem_tr);
+        else {
+            free_pages((unsigned long)location, get_order(MEM_EL_size(mem_el)));
+        }
+        mem_tr = MEM_EL_node(mem_el);
+        control_Memory_Tracker_Hash_Remove(mem_el);
+        MEM_EL_address(mem_el)         = NULL;
+        MEM_EL_size(mem_el)            = 0;
+        MEM_EL_is_addr_vmalloc(mem_el) = 0;
+        MEM_EL_node(mem_el)            = NULL;
+        MEM_TRACKER_elements(mem_tr)--;
     }
 
-finish_free:
     spin_unlock_irqrestore(&mem_tr_lock, flags);
 
     // must have been of smaller than the size limit for mem tracker nodes
@@ -857,3 +948,119 @@ finish_free:
     return NULL;
 }
 
+/* ------------------------------------------------------------------------- */
+/*
+ * @fn PVOID CONTROL_Arena_Allocate(size)
+ *
+ * @param    IN size     - size of the memory to allocate
+ *
+ * @returns  pointer to the allocated memory block
+ *
+ * @brief    Allocate and zero memory from the per-collection arena
+ *
+ * <I>Special Notes:</I>
+ *           Requests are carved out of MEM_ARENA_CHUNK_SIZE chunks; larger
+ *           requests get a dedicated chunk.  Chunks are allocated with
+ *           CONTROL_Allocate_Memory, so this may sleep.
+ */
+extern PVOID
+CONTROL_Arena_Allocate (
+    size_t  size
+)
+{
+    size_t          chunk_size;
+    PVOID           location = NULL;
+    MEM_ARENA_CHUNK chunk;
+
+    SEP_DRV_LOG_ALLOC_IN("Attempting to allocate %d bytes from arena.", (S32) size);
+
+    if (size <= 0) {
+        SEP_DRV_LOG_WARNING_ALLOC_OUT("Cannot allocate a number of bytes <= 0.");
+        return NULL;
+    }
+    size = ALIGN(size, MEM_ARENA_ALIGN);
+
+    spin_lock(&mem_arena_lock);
+    chunk = mem_arena_head;
+    if (chunk && MEM_ARENA_CHUNK_size(chunk) - MEM_ARENA_CHUNK_used(chunk) >= size) {
+        location = MEM_ARENA_CHUNK_data(chunk) + MEM_ARENA_CHUNK_used(chunk);
+        MEM_ARENA_CHUNK_used(chunk) += size;
+    }
+    spin_unlock(&mem_arena_lock);
+
+    if (location) {
+        // chunks are zeroed on allocation and blocks are never recycled
+        SEP_DRV_LOG_ALLOC_OUT("Returning %p.", location);
+        return location;
+    }
+
+    chunk_size = MEM_ARENA_CHUNK_SIZE - MEM_ARENA_CHUNK_HDR_SIZE;
+    if (size > chunk_size) {
+        chunk_size = size;
+    }
+    chunk = CONTROL_Allocate_Memory(MEM_ARENA_CHUNK_HDR_SIZE + chunk_size);
+    if (!chunk) {
+        SEP_DRV_LOG_ERROR_ALLOC_OUT("Failed to allocate arena chunk of %d bytes.", (S32) chunk_size);
+        return NULL;
+    }
+    MEM_ARENA_CHUNK_size(chunk) = chunk_size;
+    MEM_ARENA_CHUNK_used(chunk) = size;
+    location = MEM_ARENA_CHUNK_data(chunk);
+
+    spin_lock(&mem_arena_lock);
+    // keep the chunk with more room at the head so it is used for the next request
+    if (mem_arena_head &&
+        MEM_ARENA_CHUNK_size(mem_arena_head) - MEM_ARENA_CHUNK_used(mem_arena_head) >
+        chunk_size - size) {
+        MEM_ARENA_CHUNK_next(chunk)          = MEM_ARENA_CHUNK_next(mem_arena_head);
+        MEM_ARENA_CHUNK_next(mem_arena_head) = chunk;
+    }
+    else {
+        MEM_ARENA_CHUNK_next(chunk) = mem_arena_head;
+        mem_arena_head              = chunk;
+    }
+    spin_unlock(&mem_arena_lock);
+
+    SEP_DRV_LOG_ALLOC_OUT("Returning %p (new chunk %p).", location, chunk);
+    return location;
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * @fn VOID CONTROL_Arena_Release(void)
+ *
+ * @param    None
+ *
+ * @returns  None
+ *
+ * @brief    Frees every block handed out by CONTROL_Arena_Allocate
+ *
+ * <I>Special Notes:</I>
+ *           One free per chunk instead of one per block.
+ */
+extern VOID
+CONTROL_Arena_Release (
+    VOID
+)
+{
+    U32             n = 0;
+    MEM_ARENA_CHUNK chunk;
+    MEM_ARENA_CHUNK next;
+
+    SEP_DRV_LOG_ALLOC_IN("");
+
+    spin_lock(&mem_arena_lock);
+    chunk          = mem_arena_head;
+    mem_arena_head = NULL;
+    spin_unlock(&mem_arena_lock);
+
+    while (chunk) {
+        next = MEM_ARENA_CHUNK_next(chunk);
+        CONTROL_Free_Memory(chunk);
+        chunk = next;
+        n++;
+    }
+
+    SEP_DRV_LOG_ALLOC_OUT("Released %u arena chunks.", n);
+    return;
+}
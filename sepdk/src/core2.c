@@ -42,6 +42,7 @@
 
 #include "lwpmudrv.h"
 #include "utility.h"
+#include "overhead.h"
 #include "control.h"
 #include "output.h"
 #include "core2.h"
@@ -352,6 +353,9 @@ core2_Write_PMU (
 #endif
     } END_FOR_EACH_REG_CORE_OPERATION;
 
+    // the event selects were programmed directly
+    SYS_Reset_MSR_Shadow(this_cpu);
+
     SEP_DRV_LOG_TRACE_OUT("");
     return;
 }
@@ -618,7 +622,7 @@ core2_Read_PMU_Data (
         j = EMON_BUFFER_CORE_EVENT_OFFSET(EMON_BUFFER_DRIVER_HELPER_core_index_to_thread_offset_map(emon_buffer_driver_helper)[this_cpu],
                                           ECB_entries_core_event_id(pecb,i));
 
-        buffer[j] = SYS_Read_MSR(ECB_entries_reg_id(pecb,i));
+        buffer[j] = SYS_Read_PMC(ECB_entries_reg_id(pecb,i));
         SEP_DRV_LOG_TRACE("j=%u, value=%llu, cpu=%u, event_id=%u", j, buffer[j], this_cpu, ECB_entries_core_event_id(pecb,i));
 
     } END_FOR_EACH_REG_CORE_OPERATION;
@@ -843,6 +847,8 @@ core2_Swap_Group (
     DEV_CONFIG     pcfg;
     DISPATCH       dispatch;
     EVENT_CONFIG   ec;
+    U32            nb_writes  = 0;
+    U32            nb_skipped = 0;
 
     SEP_DRV_LOG_TRACE_IN("");
 
@@ -883,11 +889,18 @@ core2_Swap_Group (
 
     if (dispatch->hw_errata) {
         dispatch->hw_errata();
+        // errata fixes may program the event selects behind the shadow's back
+        SYS_Reset_MSR_Shadow(this_cpu);
     }
 
-    // First write the GP control registers (eventsel)
-    FOR_EACH_REG_CORE_OPERATION(pecb, i, PMU_OPERATION_CTRL_GP)  {
-        SYS_Write_MSR(ECB_entries_reg_id(pecb,i), ECB_entries_reg_value(pecb,i));
+    // First write the GP control registers (eventsel), skipping those already holding the next group's value
+    FOR_EACH_REG_CORE_OPERATION(pecb, i, PMU_OPERATION_CTRL_GP) {
+        if (SYS_Write_MSR_Shadowed(this_cpu, ECB_entries_reg_id(pecb,i), ECB_entries_reg_value(pecb,i))) {
+            nb_writes++;
+        }
+        else {
+            nb_skipped++;
+        }
     } END_FOR_EACH_REG_CORE_OPERATION;
 
     if (DRV_CONFIG_event_based_counts(drv_cfg)) {
@@ -895,6 +908,7 @@ core2_Swap_Group (
         FOR_EACH_REG_CORE_OPERATION(pecb, i, PMU_OPERATION_DATA_ALL) {
             if (ECB_entries_event_id_index(pecb, i) != CPU_STATE_trigger_event_num(pcpu)) {
                 SYS_Write_MSR(ECB_entries_reg_id(pecb,i), 0LL);
+                nb_writes++;
             }
         } END_FOR_EACH_REG_CORE_OPERATION;
     }
@@ -904,6 +918,7 @@ core2_Swap_Group (
         FOR_EACH_REG_CORE_OPERATION(pecb, i, PMU_OPERATION_DATA_GP) {
             index = st_index + i - ECB_operations_register_start(pecb, PMU_OPERATION_DATA_GP);
             SYS_Write_MSR(ECB_entries_reg_id(pecb,i), CPU_STATE_em_tables(pcpu)[index]);
+            nb_writes++;
             SEP_DRV_LOG_TRACE("Restore value for reg 0x%x : 0x%llx.",
                             ECB_entries_reg_id(pecb,i),
                             CPU_STATE_em_tables(pcpu)[index]);
@@ -911,7 +926,12 @@ core2_Swap_Group (
     }
 
     FOR_EACH_REG_CORE_OPERATION(pecb, i, PMU_OPERATION_OCR) {
-        SYS_Write_MSR(ECB_entries_reg_id(pecb, i), ECB_entries_reg_value(pecb, i));
+        if (SYS_Write_MSR_Shadowed(this_cpu, ECB_entries_reg_id(pecb, i), ECB_entries_reg_value(pecb, i))) {
+            nb_writes++;
+        }
+        else {
+            nb_skipped++;
+        }
     } END_FOR_EACH_REG_CORE_OPERATION;
 
     /*
@@ -925,6 +945,10 @@ core2_Swap_Group (
     CPU_STATE_reset_mask(pcpu) = 0LL;
     CPU_STATE_group_swap(pcpu) = 1;
 
+    OVERHEAD_Count_Event(DRV_OVERHEAD_EVENT_GROUP_SWAPS);
+    OVERHEAD_Add_Event(DRV_OVERHEAD_EVENT_SWAP_MSR_WRITES, nb_writes);
+    OVERHEAD_Add_Event(DRV_OVERHEAD_EVENT_SWAP_MSR_SKIPPED, nb_skipped);
+
     SEP_DRV_LOG_TRACE_OUT("");
     return;
 }
@@ -1345,6 +1369,8 @@ core2_Clean_Up (
     }
 #endif
 
+    SYS_Reset_MSR_Shadow(CONTROL_THIS_CPU());
+
     SEP_DRV_LOG_TRACE_OUT("");
     return;
 }
@@ -1599,7 +1625,7 @@ core2_Read_Counts (
                                            ECB_entries_max_bits(pecb,i);;
         }
         else {
-            *data = SYS_Read_MSR(ECB_entries_reg_id(pecb,i));
+            *data = SYS_Read_PMC(ECB_entries_reg_id(pecb,i));
             SYS_Write_MSR(ECB_entries_reg_id(pecb,i), 0LL);
         }
     } END_FOR_EACH_REG_CORE_OPERATION;
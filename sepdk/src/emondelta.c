@@ -0,0 +1,357 @@
+/*COPYRIGHT**
+    Copyright (C) 2005-2020 Intel Corporation.  All Rights Reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+
+
+
+
+**COPYRIGHT*/
+
+
+
+
+
+/*
+ *  CVS_Id="$Id$"
+ */
+
+#include "lwpmudrv_defines.h"
+#include <linux/version.h>
+#include <linux/string.h>
+
+#include "lwpmudrv_types.h"
+#include "rise_errors.h"
+#include "lwpmudrv_ecb.h"
+#include "lwpmudrv_struct.h"
+#include "lwpmudrv.h"
+#include "control.h"
+#include "utility.h"
+#include "output.h"
+#include "emondelta.h"
+
+// worst case LEB128 length of a 64-bit value
+#define EMONDELTA_MAX_VARINT_BYTES      10
+
+static DRV_EMON_DELTA_CONFIG_NODE  emon_delta_cfg;
+static U64                        *emon_delta_cur        = NULL;  // snapshot being filled by the EMON read
+static U64                        *emon_delta_acc        = NULL;  // intervals of the pending record
+static U64                        *emon_delta_prev       = NULL;  // last record written, base of the deltas
+static U8                         *emon_delta_out        = NULL;  // encoded record
+static U32                         emon_delta_entries    = 0;
+static U32                         emon_delta_header     = 0;     // leading entries that are not summed
+static U32                         emon_delta_factor     = 1;
+static U32                         emon_delta_keyframe   = DRV_EMON_DELTA_DEFAULT_KEYFRAME;
+static U32                         emon_delta_pending    = 0;     // intervals summed in emon_delta_acc
+static U32                         emon_delta_since_key  = 0;     // records written since the last keyframe
+static DRV_BOOL                    emon_delta_need_key   = TRUE;
+static U64                         emon_delta_interval   = 0;     // interval of the next snapshot
+static U64                         emon_delta_first      = 0;     // first interval in emon_delta_acc
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          OS_STATUS EMONDELTA_Configure(DRV_EMON_DELTA_CONFIG cfg)
+ *
+ * @brief       Stores the delta encoding settings of the EMON output
+ *
+ * @param       cfg - settings requested by the collector
+ *
+ * @return      OS_STATUS
+ *
+ * <I>Special Notes:</I>
+ *              The settings take effect at the next collection start.
+ */
+extern OS_STATUS
+EMONDELTA_Configure (
+    DRV_EMON_DELTA_CONFIG cfg
+)
+{
+    SEP_DRV_LOG_TRACE_IN("Cfg: %p.", cfg);
+
+    if (!cfg) {
+        SEP_DRV_LOG_ERROR_TRACE_OUT("Invalid configuration!");
+        return OS_INVALID;
+    }
+
+    memcpy(&emon_delta_cfg, cfg, sizeof(DRV_EMON_DELTA_CONFIG_NODE));
+    if (!DRV_EMON_DELTA_CONFIG_keyframe_interval(&emon_delta_cfg)) {
+        DRV_EMON_DELTA_CONFIG_keyframe_interval(&emon_delta_cfg) = DRV_EMON_DELTA_DEFAULT_KEYFRAME;
+    }
+    if (!DRV_EMON_DELTA_CONFIG_downsample_factor(&emon_delta_cfg)) {
+        DRV_EMON_DELTA_CONFIG_downsample_factor(&emon_delta_cfg) = 1;
+    }
+
+    SEP_DRV_LOG_TRACE_OUT("Enabled: %u, keyframe interval: %u, downsample factor: %u.",
+                          DRV_EMON_DELTA_CONFIG_enabled(&emon_delta_cfg),
+                          DRV_EMON_DELTA_CONFIG_keyframe_interval(&emon_delta_cfg),
+                          DRV_EMON_DELTA_CONFIG_downsample_factor(&emon_delta_cfg));
+    return OS_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          VOID emondelta_Free(VOID)
+ *
+ * @brief       Releases the encoder buffers
+ *
+ * @return      NONE
+ */
+static VOID
+emondelta_Free (
+    VOID
+)
+{
+    emon_delta_cur  = CONTROL_Free_Memory(emon_delta_cur);
+    emon_delta_acc  = CONTROL_Free_Memory(emon_delta_acc);
+    emon_delta_prev = CONTROL_Free_Memory(emon_delta_prev);
+    emon_delta_out  = CONTROL_Free_Memory(emon_delta_out);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          OS_STATUS EMONDELTA_Start(U32 record_size, U32 header_entries)
+ *
+ * @brief       Sets up the encoder for a collection
+ *
+ * @param       record_size    - size in bytes of a classic EMON record
+ * @param       header_entries - leading U64 entries holding the wall clock
+ *
+ * @return      OS_STATUS
+ *
+ * <I>Special Notes:</I>
+ *              Does nothing when delta encoding is not configured; the EMON
+ *              read then reserves classic records as before.
+ */
+extern OS_STATUS
+EMONDELTA_Start (
+    U32 record_size,
+    U32 header_entries
+)
+{
+    SEP_DRV_LOG_TRACE_IN("Record size: %u, header entries: %u.", record_size, header_entries);
+
+    if (!DRV_EMON_DELTA_CONFIG_enabled(&emon_delta_cfg) || !record_size) {
+        SEP_DRV_LOG_TRACE_OUT("Delta encoding disabled.");
+        return OS_SUCCESS;
+    }
+
+    emon_delta_entries   = record_size / sizeof(U64);
+    emon_delta_header    = header_entries;
+    emon_delta_factor    = DRV_EMON_DELTA_CONFIG_downsample_factor(&emon_delta_cfg);
+    emon_delta_keyframe  = DRV_EMON_DELTA_CONFIG_keyframe_interval(&emon_delta_cfg);
+    emon_delta_pending   = 0;
+    emon_delta_since_key = 0;
+    emon_delta_need_key  = TRUE;
+    emon_delta_interval  = 0;
+    emon_delta_first     = 0;
+
+    emon_delta_cur  = CONTROL_Allocate_Memory(emon_delta_entries * sizeof(U64));
+    emon_delta_acc  = CONTROL_Allocate_Memory(emon_delta_entries * sizeof(U64));
+    emon_delta_prev = CONTROL_Allocate_Memory(emon_delta_entries * sizeof(U64));
+    emon_delta_out  = CONTROL_Allocate_Memory(sizeof(DRV_EMON_DELTA_RECORD_NODE) +
+                                              emon_delta_entries * EMONDELTA_MAX_VARINT_BYTES + sizeof(U64));
+    if (!emon_delta_cur || !emon_delta_acc || !emon_delta_prev || !emon_delta_out) {
+        emondelta_Free();
+        SEP_DRV_LOG_ERROR_TRACE_OUT("Memory allocation failure!");
+        return OS_NO_MEM;
+    }
+
+    SEP_DRV_LOG_TRACE_OUT("Entries: %u.", emon_delta_entries);
+    return OS_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          DRV_BOOL EMONDELTA_Active(VOID)
+ *
+ * @brief       Tells whether the current collection writes delta-encoded EMON records
+ *
+ * @return      TRUE if EMONDELTA_Start set up the encoder
+ */
+extern DRV_BOOL
+EMONDELTA_Active (
+    VOID
+)
+{
+    return (emon_delta_acc != NULL)? TRUE : FALSE;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          VOID emondelta_Write_Record(VOID)
+ *
+ * @brief       Encodes the pending record and writes it to the EMON buffer
+ *
+ * @return      NONE
+ *
+ * <I>Special Notes:</I>
+ *              The previous record only advances when a record is written. If
+ *              the EMON buffer is full, the record is dropped and the next one
+ *              is forced to be a keyframe so that the stream stays decodable.
+ */
+static VOID
+emondelta_Write_Record (
+    VOID
+)
+{
+    DRV_EMON_DELTA_RECORD  rec;
+    PVOID                  outloc;
+    U8                    *p;
+    U64                    delta;
+    U64                    zz;
+    U32                    size;
+    U32                    i;
+    DRV_BOOL               keyframe;
+
+    keyframe = emon_delta_need_key || emon_delta_since_key >= emon_delta_keyframe;
+
+    p = emon_delta_out + sizeof(DRV_EMON_DELTA_RECORD_NODE);
+    for (i = 0; i < emon_delta_entries; i++) {
+        delta = emon_delta_acc[i] - ((keyframe)? 0 : emon_delta_prev[i]);
+        zz    = (delta << 1) ^ (U64)(((S64)delta) >> 63);
+        do {
+            *p = (U8)(zz & 0x7f);
+            zz >>= 7;
+            if (zz) {
+                *p |= 0x80;
+            }
+            p++;
+        } while (zz);
+    }
+    size = (U32)(p - emon_delta_out);
+    while (size & (sizeof(U64) - 1)) {
+        emon_delta_out[size++] = 0;
+    }
+
+    rec = (DRV_EMON_DELTA_RECORD)emon_delta_out;
+    memset(rec, 0, sizeof(DRV_EMON_DELTA_RECORD_NODE));
+    DRV_EMON_DELTA_RECORD_descriptor_id(rec) = DRV_EMON_DELTA_DESCRIPTOR_ID;
+    DRV_EMON_DELTA_RECORD_flags(rec)         = (keyframe)? DRV_EMON_DELTA_FLAG_KEYFRAME : 0;
+    DRV_EMON_DELTA_RECORD_interval_id(rec)   = emon_delta_first;
+    DRV_EMON_DELTA_RECORD_num_intervals(rec) = emon_delta_pending;
+    DRV_EMON_DELTA_RECORD_num_entries(rec)   = emon_delta_entries;
+    DRV_EMON_DELTA_RECORD_size(rec)          = size;
+
+    emon_delta_pending = 0;
+
+    outloc = OUTPUT_Reserve_Buffer_Space(emon_buf, size, FALSE, !SEP_IN_NOTIFICATION);
+    if (!outloc) {
+        SEP_DRV_LOG_WARNING("Output buffers are full. Dropping EMON intervals from %llu!", emon_delta_first);
+        emon_delta_need_key = TRUE;
+        return;
+    }
+    memcpy(outloc, emon_delta_out, size);
+    memcpy(emon_delta_prev, emon_delta_acc, emon_delta_entries * sizeof(U64));
+
+    emon_delta_need_key  = FALSE;
+    emon_delta_since_key = (keyframe)? 1 : emon_delta_since_key + 1;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          PVOID EMONDELTA_Begin_Snapshot(VOID)
+ *
+ * @brief       Returns the zeroed record the next EMON read fills in
+ *
+ * @return      classic EMON record, emon_buffer_size bytes
+ */
+extern PVOID
+EMONDELTA_Begin_Snapshot (
+    VOID
+)
+{
+    memset(emon_delta_cur, 0, emon_delta_entries * sizeof(U64));
+
+    return emon_delta_cur;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          VOID EMONDELTA_End_Snapshot(VOID)
+ *
+ * @brief       Adds the filled snapshot to the pending record
+ *
+ * @return      NONE
+ *
+ * <I>Special Notes:</I>
+ *              Called from the EMON timer once every CPU filled its part of
+ *              the snapshot. A record is written every downsample_factor
+ *              snapshots.
+ */
+extern VOID
+EMONDELTA_End_Snapshot (
+    VOID
+)
+{
+    U32 i;
+
+    if (!emon_delta_pending) {
+        memcpy(emon_delta_acc, emon_delta_cur, emon_delta_entries * sizeof(U64));
+        emon_delta_first = emon_delta_interval;
+    }
+    else {
+        for (i = 0; i < emon_delta_header; i++) {
+            emon_delta_acc[i] = emon_delta_cur[i];
+        }
+        for (i = emon_delta_header; i < emon_delta_entries; i++) {
+            emon_delta_acc[i] += emon_delta_cur[i];
+        }
+    }
+    emon_delta_pending++;
+    emon_delta_interval++;
+
+    if (emon_delta_pending >= emon_delta_factor) {
+        emondelta_Write_Record();
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          VOID EMONDELTA_Stop(VOID)
+ *
+ * @brief       Writes the last, partially downsampled record and releases the encoder
+ *
+ * @return      NONE
+ *
+ * <I>Special Notes:</I>
+ *              Called once the EMON timer is stopped, before the EMON buffer
+ *              is flushed.
+ */
+extern VOID
+EMONDELTA_Stop (
+    VOID
+)
+{
+    SEP_DRV_LOG_TRACE_IN("");
+
+    if (!EMONDELTA_Active()) {
+        SEP_DRV_LOG_TRACE_OUT("Delta encoding disabled.");
+        return;
+    }
+
+    if (emon_delta_pending) {
+        emondelta_Write_Record();
+    }
+    emondelta_Free();
+
+    SEP_DRV_LOG_TRACE_OUT("");
+}
@@ -36,6 +36,8 @@
 #include <linux/jiffies.h>
 #include <linux/time.h>
 #include <linux/percpu.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
 #include "lwpmudrv_types.h"
 #include "rise_errors.h"
 #include "lwpmudrv_ecb.h"
@@ -43,9 +45,16 @@
 #include "lwpmudrv.h"
 #include "control.h"
 #include "utility.h"
+#include "output.h"
+#include "eventmux.h"
 
 static PVOID     em_tables      = NULL;
 static size_t    em_tables_size = 0;
+static PVOID     em_times       = NULL;
+static size_t    em_times_size  = 0;
+
+// zeroed: slices of em_factor ms, all groups weighted equally
+static DRV_EM_TIMING_NODE em_cfg;
 
 /* ------------------------------------------------------------------------- */
 /*!
@@ -91,7 +100,8 @@ eventmux_Allocate_Groups (
         return;
     }
 
-    CPU_STATE_em_tables(cpu_state) = em_tables + CPU_STATE_em_table_offset(cpu_state);
+    CPU_STATE_em_tables(cpu_state)       = em_tables + CPU_STATE_em_table_offset(cpu_state);
+    CPU_STATE_em_time_running(cpu_state) = (em_times)? em_times + CPU_STATE_em_time_offset(cpu_state) : NULL;
 
     SEP_DRV_LOG_TRACE_OUT("");
 }
@@ -140,7 +150,11 @@ eventmux_Deallocate_Groups (
         return;
     }
 
-    CPU_STATE_em_tables(cpu_state) = NULL;
+    CPU_STATE_em_tables(cpu_state)       = NULL;
+    CPU_STATE_em_time_running(cpu_state) = NULL;
+    CPU_STATE_em_time_pending(cpu_state)    = 0;
+    CPU_STATE_em_time_next_group(cpu_state) = 0;
+    CPU_STATE_em_time_start(cpu_state)      = 0;
 
     SEP_DRV_LOG_TRACE_OUT("");
     return;
@@ -148,60 +162,119 @@ eventmux_Deallocate_Groups (
 
 /* ------------------------------------------------------------------------- */
 /*!
- * @fn          VOID eventmux_Timer_Callback_Thread (
+ * @fn          ktime_t eventmux_Slice_Duration (
+ *                         EVENT_CONFIG ec,
+ *                         U32          group
  *                         )
  *
- * @brief       Stop all the timer threads and terminate them
+ * @brief       Time slice of a group
+ *
+ * @param       ec    - event configuration of the CPU
+ * @param       group - group index
+ *
+ * @return      slice duration
+ *
+ * <I>Special Notes:</I>
+ *              The base slice is period_us from the EM configuration, or
+ *              em_factor milliseconds when none was given, multiplied by the
+ *              weight of the group.
+ */
+static ktime_t
+eventmux_Slice_Duration (
+    EVENT_CONFIG ec,
+    U32          group
+)
+{
+    U64 weight = 1;
+
+    if (group < DRV_EM_TIMING_num_weights(&em_cfg) &&
+        DRV_EM_TIMING_weights(&em_cfg)[group]) {
+        weight = DRV_EM_TIMING_weights(&em_cfg)[group];
+    }
+
+    if (DRV_EM_TIMING_period_us(&em_cfg)) {
+        return ns_to_ktime(DRV_EM_TIMING_period_us(&em_cfg) * weight * NSEC_PER_USEC);
+    }
+
+    return ms_to_ktime(EVENT_CONFIG_em_factor(ec) * weight);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          VOID eventmux_Account_Slice (
+ *                         CPU_STATE pcpu
+ *                         )
  *
- * @param       none
+ * @brief       Adds the time since the last group switch to the running time of the current group
+ *
+ * @param       pcpu - state of the current CPU
  *
  * @return      NONE
  *
  * <I>Special Notes:</I>
- *              timer routine - The event multiplexing happens here.
+ *              Must be called before current_group changes. Marks the group
+ *              times as pending so that the next PMI emits EM time records.
  */
 static VOID
+eventmux_Account_Slice (
+    CPU_STATE pcpu
+)
+{
+    U64 now;
+
+    UTILITY_Read_TSC(&now);
+    CPU_STATE_em_time_running(pcpu)[CPU_STATE_current_group(pcpu)] += now - CPU_STATE_em_slice_start(pcpu);
+    CPU_STATE_em_slice_start(pcpu)     = now;
+    CPU_STATE_em_time_pending(pcpu)    = 1;
+    CPU_STATE_em_time_next_group(pcpu) = 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          enum hrtimer_restart eventmux_Timer_Callback_Thread (
+ *                         struct hrtimer *timer
+ *                         )
+ *
+ * @brief       Switches the current CPU to its next group
+ *
+ * @param       timer - multiplexing timer of the current CPU
+ *
+ * @return      HRTIMER_RESTART while multiplexing is active
+ *
+ * <I>Special Notes:</I>
+ *              timer routine - The event multiplexing happens here.
+ *              The timer is re-armed with the slice of the incoming group.
+ */
+static enum hrtimer_restart
 eventmux_Timer_Callback_Thread (
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,15,0)
-    struct timer_list *tl
-#else
-    unsigned long arg
-#endif
+    struct hrtimer *timer
 )
 {
-    U32        this_cpu;
-    CPU_STATE  pcpu;
-    U32        dev_idx;
-    DISPATCH   dispatch;
+    U32          this_cpu;
+    CPU_STATE    pcpu;
+    U32          dev_idx;
+    DISPATCH     dispatch;
+    EVENT_CONFIG ec;
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,15,0)
-    SEP_DRV_LOG_TRACE_IN("");
-#else
-    SEP_DRV_LOG_TRACE_IN("Arg: %u.", (U32) arg);
-#endif
+    SEP_DRV_LOG_TRACE_IN("Timer: %p.", timer);
 
-    preempt_disable();
     this_cpu = CONTROL_THIS_CPU();
     pcpu     = &pcb[this_cpu];
     dev_idx  = core_to_dev_map[this_cpu];
     dispatch = LWPMU_DEVICE_dispatch(&devices[dev_idx]);
-    preempt_enable();
+    ec       = LWPMU_DEVICE_ec(&devices[dev_idx]);
 
     if (CPU_STATE_em_tables(pcpu) == NULL) {
         SEP_DRV_LOG_ERROR_TRACE_OUT("Em_tables is NULL!");
-        return;
+        return HRTIMER_NORESTART;
     }
 
-
+    eventmux_Account_Slice(pcpu);
     dispatch->swap_group(TRUE);
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,15,0)
-    mod_timer(CPU_STATE_em_timer(pcpu), jiffies + CPU_STATE_em_timer_delay(pcpu));
-#else
-    CPU_STATE_em_timer(pcpu)->expires = jiffies + arg;
-    add_timer(CPU_STATE_em_timer(pcpu));
-#endif
+    hrtimer_forward_now(timer, eventmux_Slice_Duration(ec, CPU_STATE_current_group(pcpu)));
 
     SEP_DRV_LOG_TRACE_OUT("");
+    return HRTIMER_RESTART;
 }
 
 /* ------------------------------------------------------------------------- */
@@ -249,13 +322,16 @@ eventmux_Prepare_Timer_Threads (
         return;
     }
 
-    CPU_STATE_em_timer(pcpu) = (struct timer_list*)CONTROL_Allocate_Memory(sizeof(struct timer_list));
+    CPU_STATE_em_timer(pcpu) = (struct hrtimer*)CONTROL_Allocate_Memory(sizeof(struct hrtimer));
 
     if (CPU_STATE_em_timer(pcpu) == NULL) {
         SEP_DRV_LOG_ERROR_TRACE_OUT("Pcpu = NULL!");
         return;
     }
 
+    hrtimer_init(CPU_STATE_em_timer(pcpu), CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    CPU_STATE_em_timer(pcpu)->function = eventmux_Timer_Callback_Thread;
+
     SEP_DRV_LOG_TRACE_OUT("");
 }
 
@@ -296,11 +372,12 @@ eventmux_Cancel_Timers (
         if (ec == NULL) {
             continue;
         }
-        if (EVENT_CONFIG_mode(ec) != EM_TIMER_BASED) {
+        if (EVENT_CONFIG_mode(ec) != EM_TIMER_BASED ||
+            CPU_STATE_em_timer(pcpu) == NULL) {
             continue;
         }
-        del_timer_sync(CPU_STATE_em_timer(pcpu));
-        CPU_STATE_em_timer(pcpu) = (struct timer_list*)CONTROL_Free_Memory(CPU_STATE_em_timer(pcpu));
+        hrtimer_cancel(CPU_STATE_em_timer(pcpu));
+        CPU_STATE_em_timer(pcpu) = (struct hrtimer*)CONTROL_Free_Memory(CPU_STATE_em_timer(pcpu));
     }
 
     SEP_DRV_LOG_TRACE_OUT("");
@@ -309,12 +386,12 @@ eventmux_Cancel_Timers (
 /* ------------------------------------------------------------------------- */
 /*!
  * @fn          VOID eventmux_Start_Timers (
- *                         long unsigned arg
+ *                         PVOID arg
  *                         )
  *
  * @brief       Start the timer on a single cpu
  *
- * @param       delay   interval time in jiffies
+ * @param       arg     unused
  *
  * @return      NONE
  *
@@ -331,7 +408,6 @@ eventmux_Start_Timers(
     CPU_STATE     pcpu;
     U32           dev_idx;
     EVENT_CONFIG  ec;
-    unsigned long delay;
 
     SEP_DRV_LOG_TRACE_IN("");
 
@@ -351,22 +427,24 @@ eventmux_Start_Timers(
         return;
     }
 
+    if (CPU_STATE_em_timer(pcpu) == NULL || CPU_STATE_em_time_running(pcpu) == NULL) {
+        SEP_DRV_LOG_WARNING_TRACE_OUT("No multiplexing timer on CPU %u, group %u is counted alone.",
+                                      this_cpu, CPU_STATE_current_group(pcpu));
+        return;
+    }
+
+    memset(CPU_STATE_em_time_running(pcpu), 0, EVENT_CONFIG_num_groups(ec) * sizeof(U64));
+    CPU_STATE_em_time_pending(pcpu)    = 0;
+    CPU_STATE_em_time_next_group(pcpu) = 0;
+    UTILITY_Read_TSC(&CPU_STATE_em_time_start(pcpu));
+    CPU_STATE_em_slice_start(pcpu)  = CPU_STATE_em_time_start(pcpu);
+
     /*
-     * notice we want to use group 0's time slice for the initial timer
+     * the first slice belongs to the group loaded by Write_PMU
      */
-    delay = msecs_to_jiffies(EVENT_CONFIG_em_factor(ec));
-
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,15,0)
-    CPU_STATE_em_timer_delay(pcpu) = delay;
-    timer_setup(CPU_STATE_em_timer(pcpu), eventmux_Timer_Callback_Thread, 0);
-    mod_timer(CPU_STATE_em_timer(pcpu), jiffies + CPU_STATE_em_timer_delay(pcpu));
-#else
-    init_timer(CPU_STATE_em_timer(pcpu));
-    CPU_STATE_em_timer(pcpu)->function = eventmux_Timer_Callback_Thread;
-    CPU_STATE_em_timer(pcpu)->data     = delay;
-    CPU_STATE_em_timer(pcpu)->expires  = jiffies+delay;
-    add_timer(CPU_STATE_em_timer(pcpu));
-#endif
+    hrtimer_start(CPU_STATE_em_timer(pcpu),
+                  eventmux_Slice_Duration(ec, CPU_STATE_current_group(pcpu)),
+                  HRTIMER_MODE_REL_PINNED);
 
     SEP_DRV_LOG_TRACE_OUT("");
 }
@@ -402,6 +480,84 @@ EVENTMUX_Start (
     SEP_DRV_LOG_TRACE_OUT("");
 }
 
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          VOID eventmux_Final_Times (
+ *                         PVOID arg
+ *                         )
+ *
+ * @brief       Closes the current slice and emits the final EM time records of a CPU
+ *
+ * @param       arg - unused
+ *
+ * @return      NONE
+ *
+ * <I>Special Notes:</I>
+ *              Called via the parallel control mechanism once the timers
+ *              are cancelled.
+ */
+static VOID
+eventmux_Final_Times (
+    PVOID arg
+)
+{
+    U32        this_cpu;
+    CPU_STATE  pcpu;
+
+    SEP_DRV_LOG_TRACE_IN("");
+
+    this_cpu = CONTROL_THIS_CPU();
+    pcpu     = &pcb[this_cpu];
+
+    if (!CPU_STATE_em_time_start(pcpu) || !cpu_buf) {
+        SEP_DRV_LOG_TRACE_OUT("Early exit (multiplexing not started).");
+        return;
+    }
+
+    eventmux_Account_Slice(pcpu);
+    EVENTMUX_Write_Time_Records(&cpu_buf[this_cpu], this_cpu);
+    CPU_STATE_em_time_start(pcpu) = 0;
+
+    SEP_DRV_LOG_TRACE_OUT("");
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          VOID EVENTMUX_Stop (
+ *                         VOID
+ *                         )
+ *
+ * @brief       Stops the group switches and emits the final group times
+ *
+ * @param       NONE
+ *
+ * @return      NONE
+ *
+ * <I>Special Notes:</I>
+ *              Must be called once PMIs no longer write to the sample
+ *              buffers. The timers are freed later by EVENTMUX_Destroy.
+ */
+extern VOID
+EVENTMUX_Stop (
+    VOID
+)
+{
+    CPU_STATE    pcpu;
+    S32          i;
+
+    SEP_DRV_LOG_TRACE_IN("");
+
+    for (i = 0; i < GLOBAL_STATE_active_cpus(driver_state); i++) {
+        pcpu = &pcb[i];
+        if (CPU_STATE_em_timer(pcpu)) {
+            hrtimer_cancel(CPU_STATE_em_timer(pcpu));
+        }
+    }
+    CONTROL_Invoke_Parallel(eventmux_Final_Times, NULL);
+
+    SEP_DRV_LOG_TRACE_OUT("");
+}
+
 /* ------------------------------------------------------------------------- */
 /*!
  * @fn          VOID EVENTMUX_Initialize (
@@ -412,14 +568,16 @@ EVENTMUX_Start (
  *
  * @param       NONE
  *
- * @return      NONE
+ * @return      OS_STATUS
  *
  * <I>Special Notes:</I>
  *              if event multiplexing has been enabled, 
  *              then allocate the memory needed to save and restore all the counter data
  *              set up the timers needed, but do not start them
+ *              Without the group tables and times the groups cannot be
+ *              switched, so the configuration is refused with OS_NO_MEM.
  */
-extern VOID
+extern OS_STATUS
 EVENTMUX_Initialize (
     VOID
 )
@@ -448,16 +606,28 @@ EVENTMUX_Initialize (
                          sizeof(S64);
         CPU_STATE_em_table_offset(pcpu) = em_tables_size;
         em_tables_size += size_of_vector;
+        CPU_STATE_em_time_offset(pcpu)  = em_times_size;
+        em_times_size  += EVENT_CONFIG_num_groups(ec) * sizeof(U64);
     }
 
     if (em_tables_size) {
         em_tables = CONTROL_Allocate_Memory(em_tables_size);
+        em_times  = CONTROL_Allocate_Memory(em_times_size);
+        if (!em_tables || !em_times) {
+            em_tables      = em_tables ? CONTROL_Free_Memory(em_tables) : NULL;
+            em_times       = em_times  ? CONTROL_Free_Memory(em_times)  : NULL;
+            em_tables_size = 0;
+            em_times_size  = 0;
+            SEP_DRV_LOG_ERROR_TRACE_OUT("Memory allocation failure for the multiplexing groups!");
+            return OS_NO_MEM;
+        }
     }
     CONTROL_Invoke_Parallel(eventmux_Allocate_Groups, NULL);
     
     CONTROL_Invoke_Parallel(eventmux_Prepare_Timer_Threads, (VOID *)(size_t)0);
 
     SEP_DRV_LOG_TRACE_OUT("");
+    return OS_SUCCESS;
 }
 
 /* ------------------------------------------------------------------------- */
@@ -489,8 +659,110 @@ EVENTMUX_Destroy (
         em_tables      = CONTROL_Free_Memory(em_tables);
         em_tables_size = 0;
     }
+    if (em_times) {
+        em_times       = CONTROL_Free_Memory(em_times);
+        em_times_size  = 0;
+    }
     CONTROL_Invoke_Parallel(eventmux_Deallocate_Groups, (VOID *)(size_t)0);
 
     SEP_DRV_LOG_TRACE_OUT("");
 }
 
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          OS_STATUS EVENTMUX_Configure (
+ *                         DRV_EM_TIMING cfg
+ *                         )
+ *
+ * @brief       Stores the slice period and group weights of timer-based multiplexing
+ *
+ * @param       cfg - settings requested by the collector
+ *
+ * @return      OS_STATUS
+ *
+ * <I>Special Notes:</I>
+ *              The settings take effect at the next collection start.
+ */
+extern OS_STATUS
+EVENTMUX_Configure (
+    DRV_EM_TIMING cfg
+)
+{
+    SEP_DRV_LOG_TRACE_IN("Cfg: %p.", cfg);
+
+    if (!cfg) {
+        SEP_DRV_LOG_ERROR_TRACE_OUT("Invalid configuration!");
+        return OS_INVALID;
+    }
+    if (DRV_EM_TIMING_period_us(cfg) &&
+        DRV_EM_TIMING_period_us(cfg) < DRV_EM_MIN_PERIOD_US) {
+        SEP_DRV_LOG_ERROR_TRACE_OUT("Period too short: %u us!", DRV_EM_TIMING_period_us(cfg));
+        return OS_INVALID;
+    }
+    if (DRV_EM_TIMING_num_weights(cfg) > DRV_EM_MAX_WEIGHTED_GROUPS) {
+        SEP_DRV_LOG_ERROR_TRACE_OUT("Too many weights: %u!", DRV_EM_TIMING_num_weights(cfg));
+        return OS_INVALID;
+    }
+
+    memcpy(&em_cfg, cfg, sizeof(DRV_EM_TIMING_NODE));
+
+    SEP_DRV_LOG_TRACE_OUT("Period: %u us, weights: %u.",
+                          DRV_EM_TIMING_period_us(&em_cfg),
+                          DRV_EM_TIMING_num_weights(&em_cfg));
+    return OS_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          VOID EVENTMUX_Write_Time_Records (
+ *                         BUFFER_DESC bd,
+ *                         U32         this_cpu
+ *                         )
+ *
+ * @brief       Writes the enabled and running time of every group in a CPU's sample stream
+ *
+ * @param       bd       - output buffer of the CPU
+ * @param       this_cpu - current CPU
+ *
+ * @return      NONE
+ *
+ * <I>Special Notes:</I>
+ *              Called from the PMI handler when the group times of the CPU
+ *              changed, and once more at stop. The times are those of the
+ *              last group switch, which is also the time stamp of the records.
+ *              If a record cannot be written, the CPU retries at its next PMI
+ *              from the first group not yet written, unless the group times
+ *              changed in between, in which case every group is written again.
+ */
+extern VOID
+EVENTMUX_Write_Time_Records (
+    BUFFER_DESC bd,
+    U32         this_cpu
+)
+{
+    CPU_STATE          pcpu = &pcb[this_cpu];
+    EVENT_CONFIG       ec   = LWPMU_DEVICE_ec(&devices[core_to_dev_map[this_cpu]]);
+    DRV_EM_TIME_RECORD rec;
+    U64                slice_start;
+    U32                i;
+
+    CPU_STATE_em_time_pending(pcpu) = 0;
+    slice_start = CPU_STATE_em_slice_start(pcpu);
+
+    for (i = CPU_STATE_em_time_next_group(pcpu); i < (U32)EVENT_CONFIG_num_groups(ec); i++) {
+        rec = (DRV_EM_TIME_RECORD)OUTPUT_Reserve_Buffer_Space(bd, sizeof(DRV_EM_TIME_RECORD_NODE), (NMI_mode)? TRUE:FALSE, !SEP_IN_NOTIFICATION);
+        if (!rec) {
+            CPU_STATE_em_time_next_group(pcpu) = i;
+            CPU_STATE_em_time_pending(pcpu)    = 1;
+            return;
+        }
+        DRV_EM_TIME_RECORD_descriptor_id(rec) = DRV_EM_TIME_DESCRIPTOR_ID;
+        DRV_EM_TIME_RECORD_osid(rec)          = OS_ID_NATIVE;
+        DRV_EM_TIME_RECORD_cpu_num(rec)       = this_cpu;
+        DRV_EM_TIME_RECORD_group_id(rec)      = i;
+        DRV_EM_TIME_RECORD_time_enabled(rec)  = slice_start - CPU_STATE_em_time_start(pcpu);
+        DRV_EM_TIME_RECORD_time_running(rec)  = CPU_STATE_em_time_running(pcpu)[i];
+        DRV_EM_TIME_RECORD_tsc(rec)           = slice_start;
+    }
+    CPU_STATE_em_time_next_group(pcpu) = 0;
+}
@@ -0,0 +1,436 @@
+/*COPYRIGHT**
+    Copyright (C) 2005-2020 Intel Corporation.  All Rights Reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+
+
+
+
+**COPYRIGHT*/
+
+
+
+
+
+/*
+ *  CVS_Id="$Id$"
+ */
+
+
+#include "lwpmudrv_defines.h"
+#include <linux/version.h>
+#include <linux/sched.h>
+#include <linux/percpu.h>
+#include <linux/rcupdate.h>
+#if defined(CONFIG_CGROUPS)
+#include <linux/cgroup.h>
+#endif
+
+#include "lwpmudrv_types.h"
+#include "rise_errors.h"
+#include "lwpmudrv_ecb.h"
+#include "lwpmudrv_struct.h"
+#include "lwpmudrv.h"
+#include "control.h"
+#include "utility.h"
+#include "filter.h"
+
+/*
+ * Open-addressed hash sets, sized to at least four times the largest list so
+ * probes stay short. 0 marks an empty slot: tgid 0 is the idle task and
+ * cgroup id 0 does not exist, so neither can be filtered on.
+ */
+#define FILTER_TGID_SLOTS       256
+#define FILTER_CGROUP_SLOTS     64
+#define FILTER_HASH(key, slots) ((U32)(((key) * 0x9E3779B97F4A7C15ULL) >> 32) & ((slots) - 1))
+
+/*
+ * Last verdict per CPU, keyed by task. Most PMIs on a CPU land in the
+ * thread that was already checked, and a context switch leaves the task
+ * that was switched to last, so the common case is two compares. The
+ * task_struct pointer is part of the key so that a recycled thread id does
+ * not inherit the verdict of the thread that used it before. The PMI and
+ * the context switch path each have their own entry, as a PMI may land in
+ * the middle of an update.
+ */
+#define FILTER_CACHE_PMI        0
+#define FILTER_CACHE_SWITCH     1
+#define FILTER_CACHE_ENTRIES    2
+
+typedef struct FILTER_CACHE_NODE_S  FILTER_CACHE_NODE;
+
+struct FILTER_CACHE_NODE_S {
+    U64                  epoch;
+    struct task_struct  *task;
+    pid_t                tid;
+    DRV_BOOL             accept;
+};
+
+DRV_BOOL                 filter_enabled = FALSE;
+static U64               filter_epoch   = 0;
+static U32               filter_num_tgids;
+static U32               filter_num_cgroups;
+static U32               filter_tgids[FILTER_TGID_SLOTS];
+static U64               filter_cgroups[FILTER_CGROUP_SLOTS];
+static DEFINE_PER_CPU(FILTER_CACHE_NODE, filter_cache[FILTER_CACHE_ENTRIES]);
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          static VOID filter_Insert(U64 *table, U32 *table32, U32 slots, U64 key)
+ *
+ * @brief       Adds a key to one of the hash sets
+ *
+ * @param       table   - U64 set, or NULL
+ * @param       table32 - U32 set, or NULL
+ * @param       slots   - number of slots of the set
+ * @param       key     - value to add
+ *
+ * @return      None
+ *
+ * <I>Special Notes:</I>
+ *              The sets never fill up: the list limits are a quarter of the
+ *              slot counts.
+ */
+static VOID
+filter_Insert (
+    U64  *table,
+    U32  *table32,
+    U32   slots,
+    U64   key
+)
+{
+    U32 i = FILTER_HASH(key, slots);
+
+    while (table ? table[i] != 0 : table32[i] != 0) {
+        if (table ? table[i] == key : table32[i] == (U32)key) {
+            return;
+        }
+        i = (i + 1) & (slots - 1);
+    }
+    if (table) {
+        table[i] = key;
+    }
+    else {
+        table32[i] = (U32)key;
+    }
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          static DRV_BOOL filter_Find_Tgid(U32 tgid)
+ *
+ * @brief       Looks a process up in the tgid set
+ *
+ * @param       tgid - process id
+ *
+ * @return      TRUE if the process is in the set
+ *
+ * <I>Special Notes:</I>
+ */
+static DRV_BOOL
+filter_Find_Tgid (
+    U32 tgid
+)
+{
+    U32 i = FILTER_HASH((U64)tgid, FILTER_TGID_SLOTS);
+
+    while (filter_tgids[i]) {
+        if (filter_tgids[i] == tgid) {
+            return TRUE;
+        }
+        i = (i + 1) & (FILTER_TGID_SLOTS - 1);
+    }
+    return FALSE;
+}
+
+
+#if defined(DRV_TASK_FILTER_CGROUPS)
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          static DRV_BOOL filter_Find_Cgroup(struct task_struct *task)
+ *
+ * @brief       Checks whether the task's cgroup v2, or one of its ancestors,
+ *              is in the cgroup set
+ *
+ * @param       task - task to check
+ *
+ * @return      TRUE if the task belongs to a selected cgroup
+ *
+ * <I>Special Notes:</I>
+ *              Ancestors are checked so that selecting a pod also selects
+ *              its containers. The walk is bounded by FILTER_MAX_CGROUP_DEPTH.
+ */
+static DRV_BOOL
+filter_Find_Cgroup (
+    struct task_struct *task
+)
+{
+    struct cgroup *cgrp;
+    U32            depth;
+    U32            i;
+    U64            id;
+    DRV_BOOL       found = FALSE;
+
+    rcu_read_lock();
+    cgrp = task_dfl_cgroup(task);
+    for (depth = 0; cgrp && depth < FILTER_MAX_CGROUP_DEPTH && !found; depth++) {
+        id = cgroup_id(cgrp);
+        i  = FILTER_HASH(id, FILTER_CGROUP_SLOTS);
+        while (filter_cgroups[i]) {
+            if (filter_cgroups[i] == id) {
+                found = TRUE;
+                break;
+            }
+            i = (i + 1) & (FILTER_CGROUP_SLOTS - 1);
+        }
+        cgrp = cgroup_parent(cgrp);
+    }
+    rcu_read_unlock();
+
+    return found;
+}
+#endif
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          OS_STATUS FILTER_Configure(DRV_TASK_FILTER cfg)
+ *
+ * @brief       Replaces the task filter
+ *
+ * @param       cfg - filter requested by the collector
+ *
+ * @return      OS_STATUS
+ *
+ * <I>Special Notes:</I>
+ *              Rejected while a collection is running. Empty lists turn the
+ *              filter off.
+ */
+extern OS_STATUS
+FILTER_Configure (
+    DRV_TASK_FILTER cfg
+)
+{
+    U32 i;
+
+    SEP_DRV_LOG_TRACE_IN("Cfg: %p.", cfg);
+
+    if (!cfg                                                            ||
+        DRV_TASK_FILTER_num_tgids(cfg)   > DRV_TASK_FILTER_MAX_TGIDS    ||
+        DRV_TASK_FILTER_num_cgroups(cfg) > DRV_TASK_FILTER_MAX_CGROUPS) {
+        SEP_DRV_LOG_ERROR_TRACE_OUT("Invalid configuration!");
+        return OS_INVALID;
+    }
+#if !defined(DRV_TASK_FILTER_CGROUPS)
+    if (DRV_TASK_FILTER_num_cgroups(cfg)) {
+        SEP_DRV_LOG_ERROR_TRACE_OUT("cgroup filtering is not supported by this kernel!");
+        return OS_INVALID;
+    }
+#endif
+    for (i = 0; i < DRV_TASK_FILTER_num_tgids(cfg); i++) {
+        if (!DRV_TASK_FILTER_tgids(cfg)[i]) {
+            SEP_DRV_LOG_ERROR_TRACE_OUT("Invalid tgid at index %u!", i);
+            return OS_INVALID;
+        }
+    }
+    for (i = 0; i < DRV_TASK_FILTER_num_cgroups(cfg); i++) {
+        if (!DRV_TASK_FILTER_cgroup_ids(cfg)[i]) {
+            SEP_DRV_LOG_ERROR_TRACE_OUT("Invalid cgroup id at index %u!", i);
+            return OS_INVALID;
+        }
+    }
+    if (IS_COLLECTING_STATE(GET_DRIVER_STATE())) {
+        SEP_DRV_LOG_ERROR_TRACE_OUT("Cannot change the filter during a collection!");
+        return OS_IN_PROGRESS;
+    }
+
+    /*
+     * The module notifiers may be running: let them accept everything while
+     * the sets are rebuilt.
+     */
+    filter_enabled = FALSE;
+    smp_mb();
+
+    memset(filter_tgids,   0, sizeof(filter_tgids));
+    memset(filter_cgroups, 0, sizeof(filter_cgroups));
+    filter_num_tgids   = DRV_TASK_FILTER_num_tgids(cfg);
+    filter_num_cgroups = DRV_TASK_FILTER_num_cgroups(cfg);
+    for (i = 0; i < filter_num_tgids; i++) {
+        filter_Insert(NULL, filter_tgids, FILTER_TGID_SLOTS, DRV_TASK_FILTER_tgids(cfg)[i]);
+    }
+    for (i = 0; i < filter_num_cgroups; i++) {
+        filter_Insert(filter_cgroups, NULL, FILTER_CGROUP_SLOTS, DRV_TASK_FILTER_cgroup_ids(cfg)[i]);
+    }
+    filter_epoch++;
+
+    smp_wmb();
+    filter_enabled = (filter_num_tgids || filter_num_cgroups) ? TRUE : FALSE;
+
+    SEP_DRV_LOG_TRACE_OUT("Enabled: %u, tgids: %u, cgroups: %u.", filter_enabled, filter_num_tgids, filter_num_cgroups);
+    return OS_SUCCESS;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          VOID FILTER_Clear(VOID)
+ *
+ * @brief       Turns the task filter off
+ *
+ * @param       None
+ *
+ * @return      None
+ *
+ * <I>Special Notes:</I>
+ *              Called when the driver is terminated so that a filter never
+ *              outlives the session that set it.
+ */
+extern VOID
+FILTER_Clear (
+    VOID
+)
+{
+    SEP_DRV_LOG_TRACE_IN("");
+
+    filter_enabled     = FALSE;
+    filter_num_tgids   = 0;
+    filter_num_cgroups = 0;
+    filter_epoch++;
+
+    SEP_DRV_LOG_TRACE_OUT("");
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          DRV_BOOL FILTER_Match_Task(struct task_struct *task)
+ *
+ * @brief       Checks a task against the filter sets
+ *
+ * @param       task - task to check
+ *
+ * @return      TRUE if the task is selected
+ *
+ * <I>Special Notes:</I>
+ *              Use FILTER_Accept_Task, which skips the lookup when the filter
+ *              is off.
+ */
+extern DRV_BOOL
+FILTER_Match_Task (
+    struct task_struct *task
+)
+{
+    if (!task) {
+        return FALSE;
+    }
+    if (filter_num_tgids && filter_Find_Tgid((U32)task->tgid)) {
+        return TRUE;
+    }
+#if defined(DRV_TASK_FILTER_CGROUPS)
+    if (filter_num_cgroups && filter_Find_Cgroup(task)) {
+        return TRUE;
+    }
+#endif
+    return FALSE;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          static DRV_BOOL filter_Match_Cached(FILTER_CACHE_NODE *cache, struct task_struct *task)
+ *
+ * @brief       Checks a task against the filter sets, through a cache entry
+ *
+ * @param       cache - per-CPU cache entry of the caller
+ * @param       task  - task to check
+ *
+ * @return      TRUE if the task is selected
+ *
+ * <I>Special Notes:</I>
+ *              A thread that moves to another cgroup keeps its verdict until
+ *              another thread is checked through the same entry.
+ */
+static DRV_BOOL
+filter_Match_Cached (
+    FILTER_CACHE_NODE   *cache,
+    struct task_struct  *task
+)
+{
+    if (cache->epoch != filter_epoch || cache->task != task || cache->tid != task->pid) {
+        cache->accept = FILTER_Match_Task(task);
+        cache->task   = task;
+        cache->tid    = task->pid;
+        cache->epoch  = filter_epoch;
+    }
+
+    return cache->accept;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          DRV_BOOL FILTER_Match_Current(U32 this_cpu)
+ *
+ * @brief       Checks the task running on this CPU, through the per-CPU cache
+ *
+ * @param       this_cpu - current CPU
+ *
+ * @return      TRUE if the current task is selected
+ *
+ * <I>Special Notes:</I>
+ *              Called from the PMI handler.
+ */
+extern DRV_BOOL
+FILTER_Match_Current (
+    U32 this_cpu
+)
+{
+    return filter_Match_Cached(&per_cpu(filter_cache, this_cpu)[FILTER_CACHE_PMI], current);
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          DRV_BOOL FILTER_Match_Switch(struct task_struct *task, U32 this_cpu)
+ *
+ * @brief       Checks a task of a context switch, through the per-CPU cache
+ *
+ * @param       task     - task switched from or to
+ * @param       this_cpu - current CPU
+ *
+ * @return      TRUE if the task is selected
+ *
+ * <I>Special Notes:</I>
+ *              Called from the sched_switch probe, with preemption disabled.
+ */
+extern DRV_BOOL
+FILTER_Match_Switch (
+    struct task_struct *task,
+    U32                 this_cpu
+)
+{
+    if (!task) {
+        return FALSE;
+    }
+    return filter_Match_Cached(&per_cpu(filter_cache, this_cpu)[FILTER_CACHE_SWITCH], task);
+}
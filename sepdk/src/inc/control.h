@@ -35,6 +35,7 @@
 
 #include <linux/smp.h>
 #include <linux/timer.h>
+#include <linux/hrtimer.h>
 #if defined(DRV_IA32)
 #include <asm/apic.h>
 #endif
@@ -101,6 +102,8 @@ struct GLOBAL_STATE_NODE_S {
  * CPU State data structure and access macros
  *
  */
+#define CPU_MSR_SHADOW_SIZE    32        // MSRs tracked by SYS_Write_MSR_Shadowed on each CPU
+
 typedef struct CPU_STATE_NODE_S  CPU_STATE_NODE;
 typedef        CPU_STATE_NODE   *CPU_STATE;
 struct CPU_STATE_NODE_S {
@@ -127,8 +130,14 @@ struct CPU_STATE_NODE_S {
     S64        *em_tables;           // holds the data that is saved/restored
                                      // during event multiplexing
     U32         em_table_offset;
-
-    struct timer_list *em_timer;
+    U64        *em_time_running;     // TSC ticks each group has been loaded
+    U32         em_time_offset;
+    U32         em_time_pending;     // group times changed since the last EM time records
+    U32         em_time_next_group;  // first group whose EM time record is still to be written
+    U64         em_time_start;       // TSC when timer-based multiplexing started
+    U64         em_slice_start;      // TSC when current_group was loaded
+
+    struct hrtimer *em_timer;
     U32         current_group;
     S32         trigger_count;
     S32         trigger_event_num;
@@ -157,9 +166,11 @@ struct CPU_STATE_NODE_S {
     DRV_BOOL    offlined;
     U32         nmi_handled;
     struct tasklet_struct nmi_tasklet;
-    U32         em_timer_delay;
     U32         core_type;
     U32         last_thread_id;
+    U32         msr_shadow_count;    // valid entries in msr_shadow_id/value
+    U32         msr_shadow_id[CPU_MSR_SHADOW_SIZE];
+    U64         msr_shadow_value[CPU_MSR_SHADOW_SIZE];  // last value written to msr_shadow_id[i]
 };
 
 #define CPU_STATE_apic_id(cpu)              (cpu)->apic_id
@@ -172,6 +183,12 @@ struct CPU_STATE_NODE_S {
 #define CPU_STATE_dpc(cpu)                  (cpu)->dpc
 #define CPU_STATE_em_tables(cpu)            (cpu)->em_tables
 #define CPU_STATE_em_table_offset(cpu)      (cpu)->em_table_offset
+#define CPU_STATE_em_time_running(cpu)      (cpu)->em_time_running
+#define CPU_STATE_em_time_offset(cpu)       (cpu)->em_time_offset
+#define CPU_STATE_em_time_pending(cpu)      (cpu)->em_time_pending
+#define CPU_STATE_em_time_next_group(cpu)   (cpu)->em_time_next_group
+#define CPU_STATE_em_time_start(cpu)        (cpu)->em_time_start
+#define CPU_STATE_em_slice_start(cpu)       (cpu)->em_slice_start
 #define CPU_STATE_pmu_state(cpu)            (cpu)->pmu_state
 #define CPU_STATE_em_dpc(cpu)               (cpu)->em_dpc
 #define CPU_STATE_em_timer(cpu)             (cpu)->em_timer
@@ -204,9 +221,11 @@ struct CPU_STATE_NODE_S {
 #define CPU_STATE_offlined(cpu)             (cpu)->offlined
 #define CPU_STATE_nmi_handled(cpu)          (cpu)->nmi_handled
 #define CPU_STATE_nmi_tasklet(cpu)          (cpu)->nmi_tasklet
-#define CPU_STATE_em_timer_delay(cpu)       (cpu)->em_timer_delay
 #define CPU_STATE_core_type(cpu)            (cpu)->core_type
 #define CPU_STATE_last_thread_id(cpu)       (cpu)->last_thread_id
+#define CPU_STATE_msr_shadow_count(cpu)     (cpu)->msr_shadow_count
+#define CPU_STATE_msr_shadow_id(cpu)        (cpu)->msr_shadow_id
+#define CPU_STATE_msr_shadow_value(cpu)     (cpu)->msr_shadow_value
 
 /*
  * For storing data for --read/--write-msr command line options
@@ -227,20 +246,31 @@ struct MSR_DATA_NODE_S {
  * Currently used to track large memory allocations
  */
 
+typedef struct MEM_TRACKER_NODE_S  MEM_TRACKER_NODE;
+typedef        MEM_TRACKER_NODE   *MEM_TRACKER;
+
 typedef struct MEM_EL_NODE_S  MEM_EL_NODE;
 typedef        MEM_EL_NODE   *MEM_EL;
 struct MEM_EL_NODE_S {
-    PVOID     address;         // pointer to piece of memory we're tracking
-    S32       size;            // size (bytes) of the piece of memory
-    U32       is_addr_vmalloc; // flag to check if the memory is allocated using vmalloc
+    PVOID       address;         // pointer to piece of memory we're tracking
+    S32         size;            // size (bytes) of the piece of memory
+    U32         is_addr_vmalloc; // flag to check if the memory is allocated using vmalloc
+    MEM_EL      hash_next;       // next element in the same address hash bucket
+    MEM_TRACKER node;            // mem tracker node owning this element
 };
 
 // accessors for MEM_EL defined in terms of MEM_TRACKER below
 
 #define MEM_EL_MAX_ARRAY_SIZE  32   // minimum is 1, nominal is 64
 
-typedef struct MEM_TRACKER_NODE_S  MEM_TRACKER_NODE;
-typedef        MEM_TRACKER_NODE   *MEM_TRACKER;
+/*
+ * Tracked elements are also indexed by address so that CONTROL_Free_Memory
+ * does not have to scan the whole tracker list to find out whether a
+ * pointer came from vmalloc/__get_free_pages or from kmalloc.
+ */
+#define MEM_TR_HASH_BITS       10
+#define MEM_TR_HASH_SIZE       (1 << MEM_TR_HASH_BITS)
+
 struct MEM_TRACKER_NODE_S {
     U16         max_size;            // MAX number of elements in the array (default: MEM_EL_MAX_ARRAY_SIZE)
     U16         elements;            // number of elements available in this array
@@ -259,6 +289,36 @@ struct MEM_TRACKER_NODE_S {
 #define MEM_TRACKER_mem_address(mt, i)   ((MEM_TRACKER_mem(mt)[(i)].address))
 #define MEM_TRACKER_mem_size(mt, i)      ((MEM_TRACKER_mem(mt)[(i)].size))
 #define MEM_TRACKER_mem_vmalloc(mt, i)   ((MEM_TRACKER_mem(mt)[(i)].is_addr_vmalloc))
+#define MEM_TRACKER_mem_el(mt, i)        (&(MEM_TRACKER_mem(mt)[(i)]))
+
+#define MEM_EL_address(el)               ((el)->address)
+#define MEM_EL_size(el)                  ((el)->size)
+#define MEM_EL_is_addr_vmalloc(el)       ((el)->is_addr_vmalloc)
+#define MEM_EL_hash_next(el)             ((el)->hash_next)
+#define MEM_EL_node(el)                  ((el)->node)
+
+/*
+ * Per-collection memory arena
+ *
+ * Bump allocator for the many small per-device/per-package buffers created
+ * while a collection is configured.  Individual blocks are never freed;
+ * the whole arena is released at once when the collection is cleaned up.
+ */
+#define MEM_ARENA_CHUNK_SIZE   (64 * 1024)
+#define MEM_ARENA_ALIGN        16
+
+typedef struct MEM_ARENA_CHUNK_NODE_S  MEM_ARENA_CHUNK_NODE;
+typedef        MEM_ARENA_CHUNK_NODE   *MEM_ARENA_CHUNK;
+struct MEM_ARENA_CHUNK_NODE_S {
+    MEM_ARENA_CHUNK next;            // previously filled chunk (if any)
+    size_t          size;            // usable bytes following the header
+    size_t          used;            // bytes handed out so far
+};
+#define MEM_ARENA_CHUNK_next(ch)         ((ch)->next)
+#define MEM_ARENA_CHUNK_size(ch)         ((ch)->size)
+#define MEM_ARENA_CHUNK_used(ch)         ((ch)->used)
+#define MEM_ARENA_CHUNK_HDR_SIZE         ALIGN(sizeof(MEM_ARENA_CHUNK_NODE), MEM_ARENA_ALIGN)
+#define MEM_ARENA_CHUNK_data(ch)         ((S8 *)(ch) + MEM_ARENA_CHUNK_HDR_SIZE)
 
 /****************************************************************************
  ** Global State variables exported
@@ -516,5 +576,42 @@ CONTROL_Free_Memory (
     PVOID    location
 );
 
+/*
+ * @fn PVOID CONTROL_Arena_Allocate(size)
+ *
+ * @param    IN size     - size of the memory to allocate
+ *
+ * @returns  pointer to the allocated memory block
+ *
+ * @brief    Allocate and zero memory from the per-collection arena
+ *
+ * <I>Special Notes:</I>
+ *           Blocks must NOT be passed to CONTROL_Free_Memory.
+ *           They stay valid until CONTROL_Arena_Release is called.
+ *           May sleep; do not call from atomic context.
+ */
+extern PVOID
+CONTROL_Arena_Allocate (
+    size_t   size
+);
+
+/*
+ * @fn VOID CONTROL_Arena_Release(void)
+ *
+ * @param    None
+ *
+ * @returns  None
+ *
+ * @brief    Frees every block handed out by CONTROL_Arena_Allocate
+ *
+ * <I>Special Notes:</I>
+ *           Called from lwpmudrv_Clean_Up at the end of a collection
+ *           and when the driver is unloaded.
+ */
+extern VOID
+CONTROL_Arena_Release (
+    VOID
+);
+
 #endif
 
@@ -0,0 +1,57 @@
+/*COPYRIGHT**
+    Copyright (C) 2005-2020 Intel Corporation.  All Rights Reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+
+
+
+
+**COPYRIGHT*/
+
+
+
+
+
+
+
+
+
+
+#ifndef _EMONDELTA_H_
+#define _EMONDELTA_H_
+
+#include "lwpmudrv_defines.h"
+#include "lwpmudrv_types.h"
+#include "lwpmudrv_struct.h"
+
+
+/**
+ * Function Declarations
+ */
+
+extern OS_STATUS EMONDELTA_Configure(DRV_EMON_DELTA_CONFIG cfg);
+extern OS_STATUS EMONDELTA_Start(U32 record_size, U32 header_entries);
+extern VOID      EMONDELTA_Stop(VOID);
+extern DRV_BOOL  EMONDELTA_Active(VOID);
+extern PVOID     EMONDELTA_Begin_Snapshot(VOID);
+extern VOID      EMONDELTA_End_Snapshot(VOID);
+
+#endif
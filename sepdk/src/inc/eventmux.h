@@ -39,13 +39,15 @@
 
 #include "lwpmudrv_ecb.h"
 #include "lwpmudrv_types.h"
+#include "lwpmudrv_struct.h"
+#include "output.h"
 
 extern VOID 
 EVENTMUX_Start (
     VOID
 );
 
-extern VOID
+extern OS_STATUS
 EVENTMUX_Initialize (
     VOID
 );
@@ -55,5 +57,21 @@ EVENTMUX_Destroy (
     VOID
 );
 
+extern VOID
+EVENTMUX_Stop (
+    VOID
+);
+
+extern OS_STATUS
+EVENTMUX_Configure (
+    DRV_EM_TIMING cfg
+);
+
+extern VOID
+EVENTMUX_Write_Time_Records (
+    BUFFER_DESC bd,
+    U32         this_cpu
+);
+
 #endif /* _EVENTMUX_H_ */
 
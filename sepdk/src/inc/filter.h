@@ -0,0 +1,88 @@
+/*COPYRIGHT**
+    Copyright (C) 2005-2020 Intel Corporation.  All Rights Reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+
+
+
+
+**COPYRIGHT*/
+
+
+
+
+
+
+
+
+#ifndef _FILTER_H_
+#define _FILTER_H_
+
+#include <linux/version.h>
+#include <linux/sched.h>
+#include "lwpmudrv_defines.h"
+#include "lwpmudrv_types.h"
+#include "lwpmudrv_struct.h"
+
+/*
+ *  Defines
+ */
+
+#if defined(CONFIG_CGROUPS) && LINUX_VERSION_CODE >= KERNEL_VERSION(5,5,0)
+#define DRV_TASK_FILTER_CGROUPS
+#endif
+
+#define FILTER_MAX_CGROUP_DEPTH     8
+
+extern DRV_BOOL filter_enabled;
+
+/*
+ * @macro FILTER_Accept_Task (task)
+ * @brief True when the task passes the task filter. Always true when no
+ *        filter is set.
+ */
+#define FILTER_Accept_Task(task)        (!filter_enabled || FILTER_Match_Task(task))
+
+/*
+ * @macro FILTER_Accept_Current (cpu)
+ * @brief Same as FILTER_Accept_Task(current), with the per-CPU cached verdict.
+ */
+#define FILTER_Accept_Current(cpu)      (!filter_enabled || FILTER_Match_Current(cpu))
+
+/*
+ * @macro FILTER_Accept_Switch (task, cpu)
+ * @brief Same as FILTER_Accept_Task(task), with the per-CPU cached verdict
+ *        of the context switch path.
+ */
+#define FILTER_Accept_Switch(task, cpu) (!filter_enabled || FILTER_Match_Switch(task, cpu))
+
+
+/**
+ * Function Declarations
+ */
+
+extern OS_STATUS FILTER_Configure(DRV_TASK_FILTER cfg);
+extern VOID      FILTER_Clear(VOID);
+extern DRV_BOOL  FILTER_Match_Task(struct task_struct *task);
+extern DRV_BOOL  FILTER_Match_Current(U32 this_cpu);
+extern DRV_BOOL  FILTER_Match_Switch(struct task_struct *task, U32 this_cpu);
+
+#endif
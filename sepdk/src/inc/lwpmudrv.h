@@ -260,11 +260,17 @@ struct EMON_DESC_NODE_S {
     struct timer_list *read_timer;
     U32                call_count;
     U32                buf_index;
+    struct hrtimer    *cpu_timer;    // per-CPU EMON mode only
+    U64                interval_id;  // interval of the next per-CPU snapshot
+    U64                last_tsc;     // TSC of the previous per-CPU snapshot
 };
 
 #define EMON_read_timer(desc)  (desc)->read_timer
 #define EMON_call_count(desc)  (desc)->call_count
 #define EMON_buf_index(desc)   (desc)->buf_index
+#define EMON_cpu_timer(desc)   (desc)->cpu_timer
+#define EMON_interval_id(desc) (desc)->interval_id
+#define EMON_last_tsc(desc)    (desc)->last_tsc
 
 // Handy macro
 #define TSC_SKEW(this_cpu)     (cpu_tsc[this_cpu] - cpu_tsc[0])
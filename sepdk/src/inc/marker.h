@@ -0,0 +1,63 @@
+/*COPYRIGHT**
+    Copyright (C) 2005-2020 Intel Corporation.  All Rights Reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+
+
+
+
+**COPYRIGHT*/
+
+
+
+
+
+
+
+
+#ifndef _MARKER_H_
+#define _MARKER_H_
+
+#include "lwpmudrv_defines.h"
+#include "lwpmudrv_types.h"
+#include "lwpmudrv_ecb.h"
+#include "lwpmudrv_struct.h"
+#include "output.h"
+
+/*
+ *  Defines
+ */
+
+#define MARKER_RING_SIZE        256     // staged markers per CPU (power of 2)
+#define MARKER_WRITE_BATCH      16      // markers copied from user space at a time
+
+
+/**
+ * Function Declarations
+ */
+
+extern VOID    MARKER_Start(VOID);
+extern VOID    MARKER_Stop(VOID);
+extern ssize_t MARKER_Write(const char *buf, size_t count);
+extern VOID    MARKER_Write_Records(BUFFER_DESC bd, U32 this_cpu);
+extern VOID    MARKER_Flush_Op(PVOID param);
+
+#endif
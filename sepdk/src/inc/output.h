@@ -35,6 +35,7 @@
 
 #include <linux/timer.h>
 #include <linux/vmalloc.h>
+#include <linux/poll.h>
 
 /*
  * Initial allocation
@@ -72,6 +73,11 @@ typedef struct {
     U8         *buffer[OUTPUT_NUM_BUFFERS];
     U32         signal_full;
     DRV_BOOL    tasklet_queued;
+    U32         wakeup_bytes;        // hand over the current buffer once it holds this many bytes
+    U32         wakeup_records;      // hand over the current buffer once it holds this many records
+    U32         nb_records;          // records in the current buffer
+    DRV_BOOL    flip_requested;      // set by the latency timer, the next write hands over the buffer
+    DRV_BOOL    handoff_active;      // set while the per-CPU latency timer hands over the buffer
 } OUTPUT_NODE, *OUTPUT;
 
 #define OUTPUT_buffer_lock(x)            (x)->buffer_lock
@@ -82,6 +88,11 @@ typedef struct {
 #define OUTPUT_current_buffer(x)         (x)->current_buffer
 #define OUTPUT_signal_full(x)            (x)->signal_full
 #define OUTPUT_tasklet_queued(x)         (x)->tasklet_queued
+#define OUTPUT_wakeup_bytes(x)           (x)->wakeup_bytes
+#define OUTPUT_wakeup_records(x)         (x)->wakeup_records
+#define OUTPUT_nb_records(x)             (x)->nb_records
+#define OUTPUT_flip_requested(x)         (x)->flip_requested
+#define OUTPUT_handoff_active(x)         (x)->handoff_active
 /*
  *  Add an array of control buffer for per-cpu
  */
@@ -118,6 +129,13 @@ extern ssize_t   OUTPUT_Sample_Read (struct file *filp, char *buf, size_t count,
 extern ssize_t   OUTPUT_UncSample_Read (struct file *filp, char *buf, size_t count, loff_t *f_pos);
 extern ssize_t   OUTPUT_SidebandInfo_Read (struct file *filp, char *buf, size_t count, loff_t *f_pos);
 extern ssize_t   OUTPUT_Emon_Read (struct file *filp, char *buf, size_t count, loff_t *f_pos);
+extern unsigned int OUTPUT_Module_Poll (struct file *filp, poll_table *wait);
+extern unsigned int OUTPUT_Sample_Poll (struct file *filp, poll_table *wait);
+extern unsigned int OUTPUT_UncSample_Poll (struct file *filp, poll_table *wait);
+extern unsigned int OUTPUT_SidebandInfo_Poll (struct file *filp, poll_table *wait);
+extern OS_STATUS OUTPUT_Set_Wakeup (DRV_WAKEUP_CONFIG cfg);
+extern VOID      OUTPUT_Wakeup_Start (VOID);
+extern VOID      OUTPUT_Wakeup_Stop (VOID);
 extern void*     OUTPUT_Reserve_Buffer_Space (BUFFER_DESC  bd, U32 size, DRV_BOOL defer, U8 in_notification);
 extern void*     OUTPUT_Get_Buffer (BUFFER_DESC  bd);
 
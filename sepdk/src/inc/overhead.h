@@ -0,0 +1,120 @@
+/*COPYRIGHT**
+    Copyright (C) 2005-2020 Intel Corporation.  All Rights Reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+
+
+
+
+**COPYRIGHT*/
+
+
+
+
+
+
+
+
+
+
+#ifndef _OVERHEAD_H_
+#define _OVERHEAD_H_
+
+#include <linux/version.h>
+#include <linux/percpu.h>
+#include <linux/bitops.h>
+#include "lwpmudrv_defines.h"
+#include "lwpmudrv_types.h"
+#include "lwpmudrv_ecb.h"
+#include "lwpmudrv_struct.h"
+#include "utility.h"
+
+/*
+ *  Defines
+ */
+
+DECLARE_PER_CPU(DRV_OVERHEAD_NODE, overhead_stats);
+extern U64 overhead_first_sample_tsc;
+
+/*
+ * @macro OVERHEAD_Record (path, start_tsc)
+ * @brief Accounts for one call of the given driver path, started at start_tsc.
+ *
+ * Statistics are per CPU and updated without atomics: a caller preempted or
+ * migrated between the two TSC reads may be accounted on another core, and
+ * a nested PMI may occasionally lose an update. The figures are indicative.
+ */
+static inline VOID
+OVERHEAD_Record (
+    U32 path,
+    U64 start_tsc
+)
+{
+    DRV_OVERHEAD_PATH stats = DRV_OVERHEAD_path(&per_cpu(overhead_stats, raw_smp_processor_id()), path);
+    U64               end_tsc;
+    U64               cycles;
+    U32               bucket;
+
+    UTILITY_Read_TSC(&end_tsc);
+    cycles = end_tsc > start_tsc ? end_tsc - start_tsc : 0;
+    bucket = fls64(cycles);
+    if (bucket >= DRV_OVERHEAD_NB_BUCKETS) {
+        bucket = DRV_OVERHEAD_NB_BUCKETS - 1;
+    }
+
+    DRV_OVERHEAD_PATH_count(stats)++;
+    DRV_OVERHEAD_PATH_total_cycles(stats) += cycles;
+    if (cycles > DRV_OVERHEAD_PATH_max_cycles(stats)) {
+        DRV_OVERHEAD_PATH_max_cycles(stats) = cycles;
+    }
+    DRV_OVERHEAD_PATH_histogram(stats)[bucket]++;
+}
+
+/*
+ * @macro OVERHEAD_Note_Sample (tsc)
+ * @brief Remembers the TSC of the first sample written since OVERHEAD_Reset,
+ *        used by user mode to report the time to first sample.
+ */
+#define OVERHEAD_Note_Sample(tsc)                                                        \
+    do {                                                                                 \
+        if (unlikely(!overhead_first_sample_tsc)) {                                      \
+            cmpxchg(&overhead_first_sample_tsc, 0ULL, (U64)(tsc));                       \
+        }                                                                                \
+    } while (0)
+
+#define OVERHEAD_Count_Event(event)                                                      \
+    (DRV_OVERHEAD_events(&per_cpu(overhead_stats, raw_smp_processor_id()))[event]++)
+
+#define OVERHEAD_Add_Event(event, n)                                                     \
+    (DRV_OVERHEAD_events(&per_cpu(overhead_stats, raw_smp_processor_id()))[event] += (n))
+
+
+/**
+ * Function Declarations
+ */
+
+extern VOID      OVERHEAD_Reset(VOID);
+extern VOID      OVERHEAD_Stop(VOID);
+extern VOID      OVERHEAD_Snapshot(DRV_OVERHEAD_INFO info, U32 num_cpus);
+extern VOID      OVERHEAD_Debugfs_Create(VOID);
+extern VOID      OVERHEAD_Debugfs_Remove(VOID);
+
+#endif
@@ -65,6 +65,15 @@
 #define DRV_IS_PCI_VENDOR_ID_INTEL            0x8086
 #define MAX_PCI_DEVS                          32
 
+/*
+ * Memory-mapped (ECAM) configuration space layout
+ */
+#define PCI_MAX_ECAM_RANGES                   16
+#define PCI_ECAM_BUS_SIZE                     (1 << 20)
+#define PCI_ECAM_OFFSET(dev,fun,off)          ((((dev) & 0x1F) << 15) |   \
+                                               (((fun) & 0x07) << 12) |   \
+                                               (((off) & 0xFFF) << 0))
+
 #define CONTINUE_IF_NOT_GENUINE_INTEL_DEVICE(value, vendor_id, device_id)    \
     {                                                                        \
         vendor_id = value & VENDOR_ID_MASK;                                  \
@@ -116,6 +125,11 @@ PCI_Unmap_Memory (
     SEP_MMIO_NODE *node
 );
 
+extern U64
+PCI_Get_ECAM_Address (
+    U32    bus
+);
+
 extern int
 PCI_Read_From_Memory_Address (
     U32 addr,
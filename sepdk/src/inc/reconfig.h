@@ -0,0 +1,71 @@
+/*COPYRIGHT**
+    Copyright (C) 2005-2020 Intel Corporation.  All Rights Reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+
+
+
+
+**COPYRIGHT*/
+
+
+
+
+
+
+
+
+#ifndef _RECONFIG_H_
+#define _RECONFIG_H_
+
+#include <linux/percpu.h>
+#include "lwpmudrv_defines.h"
+#include "lwpmudrv_types.h"
+#include "lwpmudrv_ecb.h"
+#include "lwpmudrv_struct.h"
+#include "output.h"
+
+/*
+ *  Defines
+ */
+
+extern U64 reconfig_epoch;
+DECLARE_PER_CPU(U64, reconfig_cpu_epoch);
+
+/*
+ * @macro RECONFIG_Record_Pending (cpu)
+ * @brief True when the configuration changed since the given CPU last wrote
+ *        a config epoch record.
+ */
+#define RECONFIG_Record_Pending(cpu)    (reconfig_epoch != per_cpu(reconfig_cpu_epoch, (cpu)))
+
+
+/**
+ * Function Declarations
+ */
+
+extern VOID      RECONFIG_Reset(VOID);
+extern OS_STATUS RECONFIG_Prepare(DRV_RECONFIG cfg);
+extern VOID      RECONFIG_Apply(VOID);
+extern U32       RECONFIG_Group(VOID);
+extern VOID      RECONFIG_Write_Record(BUFFER_DESC bd, U32 this_cpu, U64 tsc);
+
+#endif
@@ -70,6 +70,7 @@ extern  U32   SYS_INFO_Build (void);
 extern  void  SYS_INFO_Transfer (PVOID buf_usr_to_drv, unsigned long len_usr_to_drv);
 extern  void  SYS_INFO_Destroy (void);
 extern  void  SYS_INFO_Build_Cpu (PVOID param);
+extern  U64   SYS_INFO_Generation (void);
 
 #endif
 
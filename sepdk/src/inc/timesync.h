@@ -0,0 +1,67 @@
+/*COPYRIGHT**
+    Copyright (C) 2005-2020 Intel Corporation.  All Rights Reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+
+
+
+
+**COPYRIGHT*/
+
+
+
+
+
+
+
+
+#ifndef _TIMESYNC_H_
+#define _TIMESYNC_H_
+
+#include <linux/percpu.h>
+#include "lwpmudrv_defines.h"
+#include "lwpmudrv_types.h"
+#include "lwpmudrv_struct.h"
+
+/*
+ *  Defines
+ */
+
+DECLARE_PER_CPU(U32, timesync_writing);
+
+/*
+ * @macro TIMESYNC_Writing (cpu)
+ * @brief True while the CPU is writing its time synchronisation records. A
+ *        PMI arriving in that window must not touch the sample buffer.
+ */
+#define TIMESYNC_Writing(cpu)           (per_cpu(timesync_writing, (cpu)))
+
+
+/**
+ * Function Declarations
+ */
+
+extern OS_STATUS TIMESYNC_Configure(DRV_TIME_SYNC_CONFIG cfg);
+extern VOID      TIMESYNC_Start(VOID);
+extern VOID      TIMESYNC_Stop(VOID);
+extern VOID      TIMESYNC_Flush(VOID);
+
+#endif
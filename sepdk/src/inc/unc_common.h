@@ -69,6 +69,7 @@ struct UNC_PCIDEV_NODE_S {
     SEP_MMIO_NODE    *mmio_map;                        // virtual memory mapping entries
     U32               num_mmio_main_bar_per_entry;
     U32               num_mmio_secondary_bar_per_entry;
+    U32               ecam_mapped;                     // mmio_map holds PCI ECAM windows
 };
 
 #define UNC_PCIDEV_max_entries(x)                      ((x)->max_entries)
@@ -79,6 +80,7 @@ struct UNC_PCIDEV_NODE_S {
 #define UNC_PCIDEV_mmio_map_entry(x, entry)            ((x)->mmio_map[entry])
 #define UNC_PCIDEV_num_mmio_main_bar_per_entry(x)      ((x)->num_mmio_main_bar_per_entry)
 #define UNC_PCIDEV_num_mmio_secondary_bar_per_entry(x) ((x)->num_mmio_secondary_bar_per_entry)
+#define UNC_PCIDEV_ecam_mapped(x)                      ((x)->ecam_mapped)
 #define UNC_PCIDEV_virtual_addr_entry(x, entry)        (SEP_MMIO_NODE_virtual_address(&UNC_PCIDEV_mmio_map_entry(x, entry)))
 
 #define UNC_PCIDEV_is_busno_valid(x, entry)            (((x)->busno_list) && ((x)->num_entries > (entry)) && ((x)->busno_list[(entry)] != INVALID_BUS_NUMBER))
@@ -93,6 +95,7 @@ extern UNC_PCIDEV_NODE  unc_pcidev_map[];
 #define GET_NUM_MMIO_SECONDARY_BAR(dev_node)           (UNC_PCIDEV_num_mmio_secondary_bar_per_entry(&(unc_pcidev_map[dev_node])))
 #define IS_MMIO_MAP_VALID(dev_node, entry)             (UNC_PCIDEV_is_vaddr_valid((&(unc_pcidev_map[dev_node])), entry))
 #define IS_BUS_MAP_VALID(dev_node, entry)              (UNC_PCIDEV_is_busno_valid((&(unc_pcidev_map[dev_node])), entry))
+#define IS_ECAM_MAP_VALID(dev_node, entry)             (UNC_PCIDEV_ecam_mapped(&(unc_pcidev_map[dev_node])) && IS_MMIO_MAP_VALID(dev_node, entry))
 #define virtual_address_table(dev_node, entry)         (UNC_PCIDEV_virtual_addr_entry(&(unc_pcidev_map[dev_node]), entry))
 
 
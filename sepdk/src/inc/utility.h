@@ -57,6 +57,15 @@ SYS_Read_MSR (U32 msr);
 extern void
 SYS_Write_MSR (U32 msr, U64 val);
 
+extern U64
+SYS_Read_PMC (U32 msr);
+
+extern DRV_BOOL
+SYS_Write_MSR_Shadowed (U32 this_cpu, U32 msr, U64 val);
+
+extern void
+SYS_Reset_MSR_Shadow (U32 this_cpu);
+
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3,14,0) || (LINUX_VERSION_CODE >= KERNEL_VERSION(3,5,0) && defined(CONFIG_UIDGID_STRICT_TYPE_CHECKS))
 #define DRV_GET_UID(p)      p->cred->uid.val
 #elif LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,29)
@@ -207,6 +216,23 @@ UTILITY_Log (
     ...
 );
 
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn       extern VOID UTILITY_Driver_Log_Render_Entry (DRV_LOG_ENTRY entry)
+ *
+ * @brief    Converts a binary (deferred-format) log entry into a text entry.
+ *
+ * @param    DRV_LOG_ENTRY entry - copy of a log entry
+ *
+ * @return   none
+ *
+ * <I>Special Notes:</I>
+ *           Text entries are left untouched. Used when handing the log over to
+ *           userland, so that readers never have to resolve driver addresses.
+ */
+extern VOID
+UTILITY_Driver_Log_Render_Entry (DRV_LOG_ENTRY entry);
+
 /* ------------------------------------------------------------------------- */
 /*!
  * @fn       extern DRV_STATUS UTILITY_Driver_Log_Init (void)
@@ -65,6 +65,8 @@
 #include "inc/cpumon.h"
 #include "inc/output.h"
 #include "inc/pebs.h"
+#include "inc/overhead.h"
+#include "inc/filter.h"
 
 #include "inc/linuxos.h"
 #include "inc/apic.h"
@@ -565,6 +567,7 @@ linuxos_Exec_Unmap_Notify (
     struct vm_area_struct *mmap  = NULL;
     U32                    first = 1;
     U32                    cur_driver_state;
+    U64                    start_tsc;
 
 #if defined(SECURE_SEP)
     uid_t                  l_uid;
@@ -573,6 +576,8 @@ linuxos_Exec_Unmap_Notify (
     SEP_DRV_LOG_NOTIFICATION_IN("Self: %p, val: %lu, data: %p.", self, val, data);
     SEP_DRV_LOG_NOTIFICATION_TRACE(SEP_IN_NOTIFICATION, "enter: unmap: hook_state %d.", atomic_read(&hook_state));
 
+    UTILITY_Read_TSC(&start_tsc);
+
     cur_driver_state = GET_DRIVER_STATE();
 
 #if defined(SECURE_SEP)
@@ -582,13 +587,17 @@ linuxos_Exec_Unmap_Notify (
      */
     if (l_uid != uid && l_uid != 0) {
         SEP_DRV_LOG_NOTIFICATION_OUT("Returns 0 (secure_sep && l_uid != uid && l_uid != 0).");
-        return 0;
+        goto unmap_exit;
     }
 #endif
 
     if (!IS_COLLECTING_STATE(cur_driver_state)) {
         SEP_DRV_LOG_NOTIFICATION_OUT("Early exit (driver state).");
-        return 0;
+        goto unmap_exit;
+    }
+    if (!FILTER_Accept_Task(current)) {
+        SEP_DRV_LOG_NOTIFICATION_OUT("Early exit (task filtered out).");
+        goto unmap_exit;
     }
     if (!atomic_add_negative(1, &hook_state)) {
         SEP_DRV_LOG_NOTIFICATION_TRACE(SEP_IN_NOTIFICATION, "unmap: hook_state %d.", atomic_read(&hook_state));
@@ -610,6 +619,9 @@ linuxos_Exec_Unmap_Notify (
     SEP_DRV_LOG_NOTIFICATION_TRACE(SEP_IN_NOTIFICATION, "exit: unmap done: hook_state %d.", atomic_read(&hook_state));
 
     SEP_DRV_LOG_NOTIFICATION_OUT("Returns 0.");
+unmap_exit:
+    // every call is accounted, including the ones returning early
+    OVERHEAD_Record(DRV_OVERHEAD_PATH_MODULE_NOTIFY, start_tsc);
     return 0;
 }
 
@@ -894,6 +906,9 @@ LINUXOS_Enum_Process_Modules (
             SEP_DRV_LOG_TRACE("Skipped (p=NULL).");
             continue;
         }
+        if (!FILTER_Accept_Task(p)) {
+            continue;
+        }
 
         p->comm[TASK_COMM_LEN - 1] = 0; // making sure there is a trailing 0
         mm = get_task_mm(p);
@@ -956,14 +971,17 @@ linuxos_Exit_Task_Notify (
     int                 status = OS_SUCCESS;
     U32                 cur_driver_state;
     struct mm_struct   *mm;
+    U64                 start_tsc;
 
     SEP_DRV_LOG_NOTIFICATION_IN("Self: %p, val: %lu, data: %p.", self, val, data);
 
+    UTILITY_Read_TSC(&start_tsc);
+
     cur_driver_state = GET_DRIVER_STATE();
 
     if (cur_driver_state == DRV_STATE_UNINITIALIZED || cur_driver_state == DRV_STATE_TERMINATING) {
         SEP_DRV_LOG_NOTIFICATION_OUT("Early exit (driver state).");
-        return status;
+        goto exit_task_exit;
     }
     SEP_DRV_LOG_TRACE("Pid = %d tgid = %d.", p->pid, p->tgid);
     if (p->pid == control_pid) {
@@ -973,18 +991,23 @@ linuxos_Exit_Task_Notify (
         wake_up_interruptible(&wait_exit);
 
         SEP_DRV_LOG_NOTIFICATION_OUT("Res = %u (pid == control_pid).", status);
-        return status;
+        goto exit_task_exit;
     }
 
     if (cur_driver_state != DRV_STATE_IDLE && !IS_COLLECTING_STATE(cur_driver_state)) {
         SEP_DRV_LOG_NOTIFICATION_OUT("Res = %u (stopping collection).", status);
-        return status;
+        goto exit_task_exit;
+    }
+
+    if (!FILTER_Accept_Task(p)) {
+        SEP_DRV_LOG_NOTIFICATION_OUT("Res = %u (task filtered out).", status);
+        goto exit_task_exit;
     }
 
     mm = get_task_mm(p);
     if (!mm) {
         SEP_DRV_LOG_NOTIFICATION_OUT("Res = %u (!p->mm).", status);
-        return status;
+        goto exit_task_exit;
     }
     UTILITY_down_read_mm(mm);
     if (GET_DRIVER_STATE() != DRV_STATE_TERMINATING) {
@@ -999,6 +1022,8 @@ linuxos_Exit_Task_Notify (
     SEP_DRV_LOG_NOTIFICATION_TRACE(SEP_IN_NOTIFICATION, "Hook_state %d.", atomic_read(&hook_state));
 
     SEP_DRV_LOG_NOTIFICATION_OUT("Res = %u.", status);
+exit_task_exit:
+    OVERHEAD_Record(DRV_OVERHEAD_PATH_MODULE_NOTIFY, start_tsc);
     return status;
 }
 
@@ -1098,6 +1123,8 @@ record_pebs_process_info(struct rq *ignore, struct task_struct *from, struct tas
 
     SEP_DRV_LOG_NOTIFICATION_IN("From: %p, to: %p.", from, to);
 
+    UTILITY_Read_TSC(&tsc);
+
     cur_driver_state = GET_DRIVER_STATE();
 
     if (cur_driver_state != DRV_STATE_IDLE && !IS_COLLECTING_STATE(cur_driver_state)) {
@@ -1105,12 +1132,19 @@ record_pebs_process_info(struct rq *ignore, struct task_struct *from, struct tas
         return;
     }
 
-    UTILITY_Read_TSC(&tsc);
-
     preempt_disable();
     this_cpu = CONTROL_THIS_CPU();
     preempt_enable();
 
+    /*
+     * A switch into a filtered-out task is still recorded when leaving a
+     * selected one, so PEBS records that follow are not charged to it.
+     */
+    if (!FILTER_Accept_Switch(from, this_cpu) && !FILTER_Accept_Switch(to, this_cpu)) {
+        SEP_DRV_LOG_NOTIFICATION_OUT("Early exit (tasks filtered out).");
+        return;
+    }
+
     SEP_DRV_LOG_NOTIFICATION_TRACE(SEP_IN_NOTIFICATION, "[OUT<%d:%d:%s>-IN<%d:%d:%s>].",
                      from->tgid, from->pid, from->comm, to->tgid, to->pid, to->comm);
 
@@ -1127,6 +1161,7 @@ record_pebs_process_info(struct rq *ignore, struct task_struct *from, struct tas
 #endif
 
     if (sideband_info == NULL) {
+        OVERHEAD_Record(DRV_OVERHEAD_PATH_SCHED_SWITCH, tsc);
         SEP_DRV_LOG_NOTIFICATION_OUT("Early exit (!sideband_info).");
         return;
     }
@@ -1134,6 +1169,7 @@ record_pebs_process_info(struct rq *ignore, struct task_struct *from, struct tas
     SIDEBAND_INFO_pid(sideband_info)      = to->tgid;
     SIDEBAND_INFO_tid(sideband_info)      = to->pid;
     SIDEBAND_INFO_tsc(sideband_info)      = tsc;
+    OVERHEAD_Record(DRV_OVERHEAD_PATH_SCHED_SWITCH, tsc);
 
     SEP_DRV_LOG_NOTIFICATION_OUT("");
 }
@@ -52,6 +52,7 @@
 #include <linux/device.h>
 #include <linux/ptrace.h>
 #include <linux/time.h>
+#include <linux/hrtimer.h>
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
 #include <linux/sched/clock.h>
 #else
@@ -99,7 +100,14 @@
 #include "linuxos.h"
 #include "sys_info.h"
 #include "eventmux.h"
+#include "emondelta.h"
 #include "pebs.h"
+#include "overhead.h"
+#include "throttle.h"
+#include "reconfig.h"
+#include "marker.h"
+#include "filter.h"
+#include "timesync.h"
 #include "pmu_info_struct.h"
 #include "pmu_list.h"
 
@@ -141,6 +149,7 @@ volatile pid_t             control_pid               = 0;
 U64                       *interrupt_counts          = NULL;
 LWPMU_DEV                  lwpmu_control             = NULL;
 LWPMU_DEV                  lwmod_control             = NULL;
+LWPMU_DEV                  lwmarker_control          = NULL;
 LWPMU_DEV                  lwemon_control            = NULL;
 LWPMU_DEV                  lwsamp_control            = NULL;
 LWPMU_DEV                  lwsampunc_control         = NULL;
@@ -157,6 +166,8 @@ LWPMU_DEVICE            devices                = NULL;
 static U32              uncore_em_factor       = 0;
 unsigned long           unc_timer_interval     = 0;
 struct timer_list      *unc_read_timer         = 0;
+static PVOID            emon_cpu_scratch       = NULL;   // shared record filled in per-CPU EMON mode
+static ktime_t          emon_cpu_interval;
 UNC_EM_DESC             unc_em_desc            = NULL;
 S32                     max_groups_unc         = 0;
 DRV_BOOL                multi_pebs_enabled     = FALSE;
@@ -166,7 +177,7 @@ DRV_BOOL                KVM_guest_mode         = FALSE;
 DRV_SETUP_INFO_NODE     req_drv_setup_info;
 
 #define UNCORE_EM_GROUP_SWAP_FACTOR   100
-#define PMU_DEVICES                   2   // pmu, mod
+#define PMU_DEVICES                   3   // pmu, mod, marker
 
 extern U32 *cpu_built_sysinfo;
 
@@ -302,43 +313,57 @@ lwpmudrv_Allocate_Restore_Buffer (
  * @return   OS_STATUS
  *
  * @brief    allocate buffer space for writing/reading uncore data
+ *
+ * <I>Special Notes</I>
+ *           The per-package/per-group arrays come from the collection
+ *           arena and are released in bulk by lwpmudrv_Clean_Up.
  */
 static OS_STATUS
 lwpmudrv_Allocate_Uncore_Buffer (
     VOID
 )
 {
-    U32  i, j, k, l;
+    U32  i, j, k;
     U32  max_entries = 0;
     U32  num_entries;
     ECB  ecb;
 
-    SEP_DRV_LOG_TRACE_IN(""); // this function is not checking memory allocations properly
+    SEP_DRV_LOG_TRACE_IN("");
 
     for (i = num_core_devs; i < num_devices; i++) {
         if (!LWPMU_DEVICE_pcfg(&devices[i])) {
             continue;
         }
-        LWPMU_DEVICE_acc_value(&devices[i]) = CONTROL_Allocate_Memory(num_packages * sizeof(U64 **));
-        LWPMU_DEVICE_prev_value(&devices[i]) = CONTROL_Allocate_Memory(num_packages * sizeof(U64 *));
+        LWPMU_DEVICE_acc_value(&devices[i]) = CONTROL_Arena_Allocate(num_packages * sizeof(U64 **));
+        LWPMU_DEVICE_prev_value(&devices[i]) = CONTROL_Arena_Allocate(num_packages * sizeof(U64 *));
+        if (!LWPMU_DEVICE_acc_value(&devices[i]) || !LWPMU_DEVICE_prev_value(&devices[i])) {
+            SEP_DRV_LOG_ERROR_TRACE_OUT("Memory allocation failure for uncore buffers!");
+            return OS_NO_MEM;
+        }
         for (j = 0; j < num_packages; j++) {
             // Allocate memory and zero out accumulator array (one per group)
-            LWPMU_DEVICE_acc_value(&devices[i])[j] = CONTROL_Allocate_Memory(LWPMU_DEVICE_em_groups_count(&devices[i]) * sizeof(U64 *));
+            LWPMU_DEVICE_acc_value(&devices[i])[j] = CONTROL_Arena_Allocate(LWPMU_DEVICE_em_groups_count(&devices[i]) * sizeof(U64 *));
+            if (!LWPMU_DEVICE_acc_value(&devices[i])[j]) {
+                SEP_DRV_LOG_ERROR_TRACE_OUT("Memory allocation failure for uncore buffers!");
+                return OS_NO_MEM;
+            }
             for (k = 0; k < LWPMU_DEVICE_em_groups_count(&devices[i]); k++) {
                 ecb = LWPMU_DEVICE_PMU_register_data(&devices[i])[k];
                 num_entries = ECB_num_events(ecb) * LWPMU_DEVICE_num_units(&devices[i]);
-                LWPMU_DEVICE_acc_value(&devices[i])[j][k] = CONTROL_Allocate_Memory(num_entries * sizeof(U64));
-                for (l = 0; l < num_entries; l++) {
-                    LWPMU_DEVICE_acc_value(&devices[i])[j][k][l] = 0LL;
+                LWPMU_DEVICE_acc_value(&devices[i])[j][k] = CONTROL_Arena_Allocate(num_entries * sizeof(U64));
+                if (num_entries && !LWPMU_DEVICE_acc_value(&devices[i])[j][k]) {
+                    SEP_DRV_LOG_ERROR_TRACE_OUT("Memory allocation failure for uncore buffers!");
+                    return OS_NO_MEM;
                 }
                 if (max_entries < num_entries) {
                     max_entries = num_entries;
                 }
             }
             // Allocate memory and zero out prev_value array (one across groups)
-            LWPMU_DEVICE_prev_value(&devices[i])[j] = CONTROL_Allocate_Memory(max_entries * sizeof(U64));
-            for (k = 0; k < max_entries; k++) {
-                LWPMU_DEVICE_prev_value(&devices[i])[j][k] = 0LL;
+            LWPMU_DEVICE_prev_value(&devices[i])[j] = CONTROL_Arena_Allocate(max_entries * sizeof(U64));
+            if (max_entries && !LWPMU_DEVICE_prev_value(&devices[i])[j]) {
+                SEP_DRV_LOG_ERROR_TRACE_OUT("Memory allocation failure for uncore buffers!");
+                return OS_NO_MEM;
             }
         }
         max_entries = 0;
@@ -356,33 +381,20 @@ lwpmudrv_Allocate_Uncore_Buffer (
  * @return   OS_STATUS
  *
  * @brief    Free uncore data buffers
+ *
+ * <I>Special Notes</I>
+ *           The buffers live in the collection arena, so only the
+ *           references are dropped here.
  */
 static OS_STATUS
 lwpmudrv_Free_Uncore_Buffer (
     U32  i
 )
 {
-    U32  j, k;
-
     SEP_DRV_LOG_TRACE_IN("");
 
-    if (LWPMU_DEVICE_prev_value(&devices[i])) {
-        for (j = 0; j < num_packages; j++) {
-            LWPMU_DEVICE_prev_value(&devices[i])[j] = CONTROL_Free_Memory(LWPMU_DEVICE_prev_value(&devices[i])[j]);
-        }
-        LWPMU_DEVICE_prev_value(&devices[i]) = CONTROL_Free_Memory(LWPMU_DEVICE_prev_value(&devices[i]));
-    }
-    if (LWPMU_DEVICE_acc_value(&devices[i])) {
-        for (j = 0; j < num_packages; j++) {
-            if (LWPMU_DEVICE_acc_value(&devices[i])[j]) {
-                for (k = 0; k < LWPMU_DEVICE_em_groups_count(&devices[i]); k++) {
-                    LWPMU_DEVICE_acc_value(&devices[i])[j][k] = CONTROL_Free_Memory(LWPMU_DEVICE_acc_value(&devices[i])[j][k]);
-                }
-                LWPMU_DEVICE_acc_value(&devices[i])[j] = CONTROL_Free_Memory(LWPMU_DEVICE_acc_value(&devices[i])[j]);
-            }
-        }
-        LWPMU_DEVICE_acc_value(&devices[i]) = CONTROL_Free_Memory(LWPMU_DEVICE_acc_value(&devices[i]));
-    }
+    LWPMU_DEVICE_prev_value(&devices[i]) = NULL;
+    LWPMU_DEVICE_acc_value(&devices[i])  = NULL;
 
     SEP_DRV_LOG_TRACE_OUT("Success");
     return OS_SUCCESS;
@@ -771,6 +783,8 @@ lwpmudrv_Clean_Up (
     cpu_mask_bits           = CONTROL_Free_Memory(cpu_mask_bits);
     core_to_dev_map         = CONTROL_Free_Memory(core_to_dev_map);
 
+    CONTROL_Arena_Release();
+
 signal_end:
     GLOBAL_STATE_num_em_groups(driver_state)   = 0;
     GLOBAL_STATE_num_descriptors(driver_state) = 0;
@@ -978,6 +992,14 @@ lwpmudrv_Initialize_Driver (
                 goto clean_return;
             }
         }
+        if (DRV_CONFIG_emon_per_cpu(drv_cfg) && cpu_buf == NULL) {
+            cpu_buf = CONTROL_Allocate_Memory(GLOBAL_STATE_num_cpus(driver_state)*sizeof(BUFFER_DESC_NODE));
+            if (!cpu_buf) {
+                SEP_DRV_LOG_ERROR("Memory allocation failure for cpu_buf!");
+                status = OS_NO_MEM;
+                goto clean_return;
+            }
+        }
         status = OUTPUT_Initialize_EMON();
         if (status != OS_SUCCESS) {
             SEP_DRV_LOG_ERROR("OUTPUT_Initialize_EMON failed!");
@@ -1319,6 +1341,7 @@ lwpmudrv_Terminate (
     }
 
     lwpmudrv_Clean_Up(TRUE);
+    FILTER_Clear();
 
     SEP_DRV_LOG_FLOW_OUT("Success");
     return OS_SUCCESS;
@@ -1846,6 +1869,130 @@ lwpmudrv_Switch_Group (
 }
 
 
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn  static VOID lwpmudrv_Reconfigure_Op(PVOID param)
+ *
+ * @param param - dummy
+ *
+ * @return None
+ *
+ * @brief Reload the core PMU of this CPU with the reconfigured group and
+ *        mark the change in its sample stream
+ *
+ * <I>Special Notes</I>
+ *     Runs with the collection paused and interrupts off, so neither the PMI
+ *     handler nor the multiplexing timer of this CPU can use its output
+ *     buffer or change its current group meanwhile.
+ */
+static VOID
+lwpmudrv_Reconfigure_Op (
+    PVOID param
+)
+{
+    U32 this_cpu = CONTROL_THIS_CPU();
+    U32 group    = RECONFIG_Group();
+    U64 tsc;
+
+    SEP_DRV_LOG_TRACE_IN("");
+
+    if (group != DRV_RECONFIG_KEEP_GROUP) {
+        CPU_STATE_current_group(&pcb[this_cpu]) = group;
+    }
+    // a non-NULL parameter leaves the uncore devices alone
+    lwpmudrv_Write_Op((VOID *)(size_t)TRUE);
+
+    UTILITY_Read_TSC(&tsc);
+    if (cpu_buf) {
+        RECONFIG_Write_Record(&cpu_buf[this_cpu], this_cpu, tsc);
+    }
+
+    SEP_DRV_LOG_TRACE_OUT("");
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn  static OS_STATUS lwpmudrv_Reconfigure(IOCTL_ARGS args)
+ *
+ * @param args - Pointer to the IOCTL structure
+ *
+ * @return OS_STATUS
+ *
+ * @brief Change sample-after values and/or the current group of a live collection
+ *
+ * <I>Special Notes</I>
+ *     The input is a DRV_RECONFIG_NODE. The request is validated as a whole
+ *     before anything changes. The collection is paused, the ECBs updated and
+ *     every CPU reloaded at the same group boundary as lwpmudrv_Switch_Group,
+ *     then sampling resumes. Buffers, module records and readers stay live.
+ *     The throttle governor is restarted so the new values become its
+ *     reference.
+ */
+static OS_STATUS
+lwpmudrv_Reconfigure (
+    IOCTL_ARGS args
+)
+{
+    DRV_RECONFIG   cfg;
+    OS_STATUS      status;
+    U32            current_state = GET_DRIVER_STATE();
+
+    SEP_DRV_LOG_FLOW_IN("");
+
+    if (!pcb || !drv_cfg || !devices) {
+        SEP_DRV_LOG_ERROR_FLOW_OUT("No collection is configured!");
+        return OS_INVALID;
+    }
+
+    if ((current_state != DRV_STATE_RUNNING && current_state != DRV_STATE_PAUSED) ||
+        DRV_CONFIG_counting_mode(drv_cfg) || DRV_CONFIG_use_pcl(drv_cfg)) {
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Reconfiguration needs a running or paused sampling collection!");
+        return OS_INVALID;
+    }
+
+    if (args->buf_usr_to_drv == NULL ||
+        args->len_usr_to_drv != sizeof(DRV_RECONFIG_NODE)) {
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Invalid arguments!");
+        return OS_INVALID;
+    }
+
+    cfg = CONTROL_Allocate_Memory(sizeof(DRV_RECONFIG_NODE));
+    if (!cfg) {
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Memory allocation failure for cfg!");
+        return OS_NO_MEM;
+    }
+    if (copy_from_user(cfg, args->buf_usr_to_drv, sizeof(DRV_RECONFIG_NODE))) {
+        cfg = CONTROL_Free_Memory(cfg);
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Memory copy failure!");
+        return OS_FAULT;
+    }
+
+    status = RECONFIG_Prepare(cfg);
+    cfg    = CONTROL_Free_Memory(cfg);
+    if (status != OS_SUCCESS) {
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Return value: %d (rejected request).", status);
+        return status;
+    }
+
+    if (current_state == DRV_STATE_RUNNING) {
+        lwpmudrv_Pause();
+    }
+
+    THROTTLE_Stop();
+    RECONFIG_Apply();
+    CONTROL_Invoke_Parallel(lwpmudrv_Reconfigure_Op, NULL);
+    THROTTLE_Start();
+
+    if (current_state == DRV_STATE_RUNNING) {
+        lwpmudrv_Resume();
+    }
+
+    SEP_DRV_LOG_FLOW_OUT("Return value: %d", status);
+    return status;
+}
+
+
 /* ------------------------------------------------------------------------- */
 /*!
  * @fn static OS_STATUS lwpmudrv_Trigger_Read_Op(void)
@@ -2042,6 +2189,7 @@ lwpmudrv_Trigger_Read (
 {
     U32 this_cpu = CONTROL_THIS_CPU();
     U32 pkg = core_to_package_map[this_cpu];
+    U64 start_tsc;
 
     SEP_DRV_LOG_TRACE_IN("");
 
@@ -2050,6 +2198,8 @@ lwpmudrv_Trigger_Read (
         return;
     }
 
+    UTILITY_Read_TSC(&start_tsc);
+
     if (GET_DRIVER_STATE() != DRV_STATE_RUNNING) {
         SEP_DRV_LOG_TRACE("Sampling driver state is not RUNNING");
         goto reset_uncore_timer;
@@ -2068,6 +2218,8 @@ reset_uncore_timer:
     UNC_EM_read_timer(&unc_em_desc[pkg])->expires = jiffies + unc_timer_interval;
     add_timer_on(UNC_EM_read_timer(&unc_em_desc[pkg]), this_cpu);
 
+    OVERHEAD_Record(DRV_OVERHEAD_PATH_UNC_TIMER, start_tsc);
+
     SEP_DRV_LOG_TRACE_OUT("Success.");
     return;
 }
@@ -2303,7 +2455,7 @@ lwpmudrv_Emon_Switch_Group (
                 cur_grp      = LWPMU_DEVICE_cur_group(&devices[i])[package_num];
                 pecb_unc     = LWPMU_DEVICE_PMU_register_data(&devices[i])[cur_grp];
                 LWPMU_DEVICE_cur_group(&devices[i])[package_num]++;
-                if (CPU_STATE_current_group(&pcb[0]) == 0) {
+                if (CPU_STATE_current_group(pcpu) == 0) {
                     LWPMU_DEVICE_cur_group(&devices[i])[package_num] = 0;
                 }
                 LWPMU_DEVICE_cur_group(&devices[i])[package_num] %= LWPMU_DEVICE_em_groups_count(&devices[i]);
@@ -2330,6 +2482,7 @@ lwpmudrv_Emon_Read_Op (
     PVOID     buf                  = arg;
     U64      *tsc                  = NULL;
     DRV_BOOL  enter_in_pause_state = FALSE;
+    U64       start_tsc;
 
     if (GET_DRIVER_STATE() == DRV_STATE_PAUSED) {
         SEP_DRV_LOG_TRACE("Entering in pause state.");
@@ -2352,7 +2505,9 @@ lwpmudrv_Emon_Read_Op (
     *tsc = diff_cpu_tsc[this_cpu];
 
     buf = (PVOID)(((U64 *)buf) + GLOBAL_STATE_num_cpus(driver_state));
+    UTILITY_Read_TSC(&start_tsc);
     lwpmudrv_Read_Data_Op(buf);
+    OVERHEAD_Record(DRV_OVERHEAD_PATH_EMON_SNAPSHOT, start_tsc);
 
     lwpmudrv_Emon_Switch_Group();
 
@@ -2396,6 +2551,7 @@ lwpmudrv_Emon_Read (
 {
     PVOID buf = NULL;
     U64  *time_info;
+    U64   start_tsc;
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5,0,0)
     struct timespec64 t;
 #else
@@ -2407,7 +2563,14 @@ lwpmudrv_Emon_Read (
         return;
     }
 
-    buf = OUTPUT_Reserve_Buffer_Space(emon_buf, emon_buffer_size, FALSE, !SEP_IN_NOTIFICATION);
+    UTILITY_Read_TSC(&start_tsc);
+
+    if (EMONDELTA_Active()) {
+        buf = EMONDELTA_Begin_Snapshot();
+    }
+    else {
+        buf = OUTPUT_Reserve_Buffer_Space(emon_buf, emon_buffer_size, FALSE, !SEP_IN_NOTIFICATION);
+    }
 
     if (buf) {
         time_info = (U64 *)buf;
@@ -2421,6 +2584,9 @@ lwpmudrv_Emon_Read (
         time_info[1] = t.tv_usec;
 #endif
         CONTROL_Invoke_Parallel(lwpmudrv_Emon_Read_Op, buf);
+        if (EMONDELTA_Active()) {
+            EMONDELTA_End_Snapshot();
+        }
     }
     else {
         SEP_DRV_LOG_WARNING("Output buffers are full. Might be dropping some samples!");
@@ -2433,10 +2599,187 @@ lwpmudrv_Emon_Read (
     add_timer(unc_read_timer);
 #endif
 
+    OVERHEAD_Record(DRV_OVERHEAD_PATH_EMON_TIMER, start_tsc);
+
     return;
 }
 
 
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          VOID lwpmudrv_Emon_Write_Cpu_Record (U32 this_cpu, U32 group, U64 tsc)
+ *
+ * @brief       Copies the counts of the current CPU from the shared record to its sample buffer
+ *
+ * @param       this_cpu - current CPU
+ * @param       group    - core event group the counts were read with
+ * @param       tsc      - TSC of the snapshot
+ *
+ * @return      none
+ *
+ * <I>Special Notes:</I>
+ *              Every CPU only writes its own entries of emon_cpu_scratch, so
+ *              the thread window is always current. The package window of a
+ *              socket master also holds entries written by the other threads
+ *              of the package; those are superseded by their thread windows
+ *              when the host rebuilds the record.
+ */
+static VOID
+lwpmudrv_Emon_Write_Cpu_Record (
+    U32 this_cpu,
+    U32 group,
+    U64 tsc
+)
+{
+    CPU_STATE            pcpu      = &pcb[this_cpu];
+    EMON_DESC            pdesc     = &emon_desc[this_cpu];
+    DEV_CONFIG           pcfg      = LWPMU_DEVICE_pcfg(&devices[core_to_dev_map[this_cpu]]);
+    U64                 *data;
+    U64                  thread_offset;
+    U64                  package_offset;
+    U32                  thread_count;
+    U32                  package_count = 0;
+    U32                  size;
+    DRV_EMON_CPU_RECORD  rec;
+    DRV_EMON_CPU_WINDOW  win;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,0,0)
+    struct timespec64    t;
+#else
+    struct timeval       t;
+#endif
+
+    data          = ((U64 *)emon_cpu_scratch) + 2 * GLOBAL_STATE_num_cpus(driver_state);
+    thread_offset = EMON_BUFFER_DRIVER_HELPER_core_index_to_thread_offset_map(emon_buffer_driver_helper)[this_cpu];
+    thread_count  = EMON_BUFFER_DRIVER_HELPER_core_num_events(emon_buffer_driver_helper);
+    if (pcfg && DEV_CONFIG_enable_perf_metrics(pcfg)) {
+        thread_count += DEV_CONFIG_num_perf_metrics(pcfg);
+    }
+    package_offset = (U64)core_to_package_map[this_cpu] *
+                     EMON_BUFFER_DRIVER_HELPER_num_entries_per_package(emon_buffer_driver_helper);
+    if (CPU_STATE_socket_master(pcpu)) {
+        package_count = EMON_BUFFER_DRIVER_HELPER_num_entries_per_package(emon_buffer_driver_helper);
+    }
+
+    size = sizeof(DRV_EMON_CPU_RECORD_NODE) + sizeof(DRV_EMON_CPU_WINDOW_NODE) +
+           thread_count * sizeof(U64);
+    if (package_count) {
+        size += sizeof(DRV_EMON_CPU_WINDOW_NODE) + package_count * sizeof(U64);
+    }
+
+    rec = (DRV_EMON_CPU_RECORD)OUTPUT_Reserve_Buffer_Space(&cpu_buf[this_cpu], size, FALSE, !SEP_IN_NOTIFICATION);
+    if (!rec) {
+        SEP_DRV_LOG_WARNING("Output buffer of cpu %u is full. Dropping EMON interval %llu!",
+                            this_cpu, EMON_interval_id(pdesc));
+        return;
+    }
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,0,0)
+    ktime_get_real_ts64(&t);
+    DRV_EMON_CPU_RECORD_time_usec(rec)   = t.tv_nsec / NSEC_PER_USEC;
+#else
+    do_gettimeofday(&t);
+    DRV_EMON_CPU_RECORD_time_usec(rec)   = t.tv_usec;
+#endif
+    DRV_EMON_CPU_RECORD_time_sec(rec)      = t.tv_sec;
+    DRV_EMON_CPU_RECORD_descriptor_id(rec) = DRV_EMON_CPU_DESCRIPTOR_ID;
+    DRV_EMON_CPU_RECORD_cpu_num(rec)       = this_cpu;
+    DRV_EMON_CPU_RECORD_interval_id(rec)   = EMON_interval_id(pdesc);
+    DRV_EMON_CPU_RECORD_tsc(rec)           = tsc;
+    DRV_EMON_CPU_RECORD_tsc_delta(rec)     = (EMON_last_tsc(pdesc))? tsc - EMON_last_tsc(pdesc) : 0;
+    DRV_EMON_CPU_RECORD_group_id(rec)      = group;
+    DRV_EMON_CPU_RECORD_num_windows(rec)   = (package_count)? 2 : 1;
+    DRV_EMON_CPU_RECORD_size(rec)          = size;
+    EMON_last_tsc(pdesc)                   = tsc;
+
+    win = (DRV_EMON_CPU_WINDOW)(rec + 1);
+    if (package_count) {
+        DRV_EMON_CPU_WINDOW_window_type(win) = DRV_EMON_CPU_WINDOW_PACKAGE;
+        DRV_EMON_CPU_WINDOW_count(win)       = package_count;
+        DRV_EMON_CPU_WINDOW_offset(win)      = package_offset;
+        memcpy(win + 1, data + package_offset, package_count * sizeof(U64));
+        win = (DRV_EMON_CPU_WINDOW)(((U64 *)(win + 1)) + package_count);
+    }
+    DRV_EMON_CPU_WINDOW_window_type(win) = DRV_EMON_CPU_WINDOW_THREAD;
+    DRV_EMON_CPU_WINDOW_count(win)       = thread_count;
+    DRV_EMON_CPU_WINDOW_offset(win)      = thread_offset;
+    memcpy(win + 1, data + thread_offset, thread_count * sizeof(U64));
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          enum hrtimer_restart lwpmudrv_Emon_Cpu_Read (struct hrtimer *timer)
+ *
+ * @brief       Per-CPU EMON timer: snapshots the counters of the current CPU
+ *
+ * @param       timer - EMON timer of the current CPU
+ *
+ * @return      HRTIMER_RESTART while the collection is running or paused
+ *
+ * <I>Special Notes:</I>
+ *              Replaces the IPI broadcast of lwpmudrv_Emon_Read in per-CPU
+ *              EMON mode. Missed intervals advance interval_id so that it
+ *              stays aligned across CPUs.
+ */
+static enum hrtimer_restart
+lwpmudrv_Emon_Cpu_Read (
+    struct hrtimer *timer
+)
+{
+    U32       this_cpu = CONTROL_THIS_CPU();
+    EMON_DESC pdesc    = &emon_desc[this_cpu];
+    U32       group    = CPU_STATE_current_group(&pcb[this_cpu]);
+    U64       start_tsc;
+
+    if (!DRIVER_STATE_IN(GET_DRIVER_STATE(), STATE_BIT_RUNNING | STATE_BIT_PAUSED)) {
+        SEP_DRV_LOG_ERROR("Unexpected driver state!");
+        return HRTIMER_NORESTART;
+    }
+
+    UTILITY_Read_TSC(&start_tsc);
+
+    lwpmudrv_Emon_Read_Op(emon_cpu_scratch);
+    lwpmudrv_Emon_Write_Cpu_Record(this_cpu, group, start_tsc);
+    EMON_interval_id(pdesc) += hrtimer_forward_now(timer, emon_cpu_interval);
+
+    OVERHEAD_Record(DRV_OVERHEAD_PATH_EMON_TIMER, start_tsc);
+
+    return HRTIMER_RESTART;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          VOID lwpmudrv_Emon_Start_Cpu_Timer (PVOID arg)
+ *
+ * @brief       Arms the EMON timer of the current CPU
+ *
+ * @param       arg - pointer to the ktime_t of the first expiry, common to all CPUs
+ *
+ * @return      none
+ *
+ * <I>Special Notes:</I>
+ *              Called via the parallel control mechanism so that the timer
+ *              is pinned to the CPU it reads. The timer is initialised by
+ *              lwpmudrv_Emon_Start_Timer, so that the timers of CPUs which
+ *              never arm theirs can still be cancelled at stop.
+ */
+static VOID
+lwpmudrv_Emon_Start_Cpu_Timer (
+    PVOID arg
+)
+{
+    U32             this_cpu = CONTROL_THIS_CPU();
+    struct hrtimer *timer    = EMON_cpu_timer(&emon_desc[this_cpu]);
+
+    if (timer == NULL) {
+        return;
+    }
+
+    hrtimer_start(timer, *(ktime_t *)arg, HRTIMER_MODE_ABS_PINNED);
+}
+
+
 /* ------------------------------------------------------------------------- */
 /*!
  * @fn          VOID lwpmudrv_Emon_Stop_Timer (void)
@@ -2454,14 +2797,27 @@ lwpmudrv_Emon_Stop_Timer (
     PVOID arg
 )
 {
+    U32 i;
+
     SEP_DRV_LOG_FLOW_IN("");
 
+    if (emon_cpu_scratch) {
+        for (i = 0; i < GLOBAL_STATE_num_cpus(driver_state); i++) {
+            if (EMON_cpu_timer(&emon_desc[i])) {
+                hrtimer_cancel(EMON_cpu_timer(&emon_desc[i]));
+                EMON_cpu_timer(&emon_desc[i]) = CONTROL_Free_Memory(EMON_cpu_timer(&emon_desc[i]));
+            }
+        }
+        emon_cpu_scratch = CONTROL_Free_Memory(emon_cpu_scratch);
+    }
+
     if (unc_read_timer == NULL) {
         return;
     }
 
     del_timer_sync(unc_read_timer);
     unc_read_timer = CONTROL_Free_Memory(unc_read_timer);
+    EMONDELTA_Stop();
 
     SEP_DRV_LOG_FLOW_OUT("");
 
@@ -2485,14 +2841,48 @@ lwpmudrv_Emon_Start_Timer (
     PVOID arg
 )
 {
-    U32 i;
+    U32     i;
+    ktime_t first;
 
     SEP_DRV_LOG_FLOW_IN("");
 
     for (i = 0; i < GLOBAL_STATE_num_cpus(driver_state); i++) {
-        EMON_call_count(&emon_desc[i]) = 0;
-        EMON_buf_index(&emon_desc[i])  = 0;
+        EMON_call_count(&emon_desc[i])  = 0;
+        EMON_buf_index(&emon_desc[i])   = 0;
+        EMON_interval_id(&emon_desc[i]) = 0;
+        EMON_last_tsc(&emon_desc[i])    = 0;
+    }
+
+    if (DRV_CONFIG_emon_per_cpu(drv_cfg)) {
+        emon_cpu_scratch = CONTROL_Allocate_Memory(emon_buffer_size);
+        if (emon_cpu_scratch == NULL) {
+            SEP_DRV_LOG_ERROR_FLOW_OUT("Memory allocation failure for emon_cpu_scratch!");
+            return;
+        }
+        for (i = 0; i < GLOBAL_STATE_num_cpus(driver_state); i++) {
+            EMON_cpu_timer(&emon_desc[i]) = CONTROL_Allocate_Memory(sizeof(struct hrtimer));
+            if (EMON_cpu_timer(&emon_desc[i]) == NULL) {
+                while (i-- > 0) {
+                    EMON_cpu_timer(&emon_desc[i]) = CONTROL_Free_Memory(EMON_cpu_timer(&emon_desc[i]));
+                }
+                emon_cpu_scratch = CONTROL_Free_Memory(emon_cpu_scratch);
+                SEP_DRV_LOG_ERROR_FLOW_OUT("Memory allocation failure for EMON per-CPU timers!");
+                return;
+            }
+            hrtimer_init(EMON_cpu_timer(&emon_desc[i]), CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+            EMON_cpu_timer(&emon_desc[i])->function = lwpmudrv_Emon_Cpu_Read;
+        }
+        emon_cpu_interval = ms_to_ktime(DRV_CONFIG_emon_timer_interval(drv_cfg));
+        first             = ktime_add_ns(ktime_get(), ktime_to_ns(emon_cpu_interval));
+        CONTROL_Invoke_Parallel(lwpmudrv_Emon_Start_Cpu_Timer, &first);
+        SEP_DRV_LOG_FLOW_OUT("Per-CPU timers started.");
+        return;
     }
+
+    if (EMONDELTA_Start(emon_buffer_size, GLOBAL_STATE_num_cpus(driver_state)) != OS_SUCCESS) {
+        SEP_DRV_LOG_WARNING("EMON delta encoding unavailable, writing full records.");
+    }
+
     unc_timer_interval = msecs_to_jiffies(DRV_CONFIG_emon_timer_interval(drv_cfg));
     unc_read_timer = CONTROL_Allocate_Memory(sizeof(struct timer_list));
     if (unc_read_timer == NULL) {
@@ -2628,7 +3018,11 @@ lwpmudrv_Init_PMU (
 
     // allocate uncore read buffers for SEP
     if (unc_buf_init && !DRV_CONFIG_emon_mode(drv_cfg)) {
-        lwpmudrv_Allocate_Uncore_Buffer();
+        status = lwpmudrv_Allocate_Uncore_Buffer();
+        if (status != OS_SUCCESS) {
+            SEP_DRV_LOG_ERROR_FLOW_OUT("Uncore buffer allocation failure!");
+            return status;
+        }
     }
 
     // must be done after pcb is created and before PMU is first written to
@@ -3389,7 +3783,10 @@ lwpmudrv_Set_EM_Config (
         return OS_NO_MEM;
     }
 
-    EVENTMUX_Initialize();
+    if (EVENTMUX_Initialize() != OS_SUCCESS) {
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Event multiplexing could not be set up!");
+        return OS_NO_MEM;
+    }
 
     SEP_DRV_LOG_FLOW_OUT("OS_SUCCESS.");
     return OS_SUCCESS;
@@ -4136,6 +4533,13 @@ lwpmudrv_Start (
         return status;
     }
 
+    OVERHEAD_Reset();
+    RECONFIG_Reset();
+    THROTTLE_Start();
+    MARKER_Start();
+    TIMESYNC_Start();
+    OUTPUT_Wakeup_Start();
+
     prev_set_CR4 = CONTROL_Allocate_Memory(GLOBAL_STATE_num_cpus(driver_state) * sizeof(U8));
     CONTROL_Invoke_Parallel(lwpmudrv_Set_CR4_PCE_Bit, (PVOID)(size_t)0);
 
@@ -4268,6 +4672,12 @@ lwpmudrv_Prepare_Stop (
     else if (DRV_CONFIG_emon_timer_interval(drv_cfg)) {
         lwpmudrv_Emon_Stop_Timer(NULL);
     }
+    OUTPUT_Wakeup_Stop();
+    TIMESYNC_Stop();
+    MARKER_Stop();
+    THROTTLE_Stop();
+    EVENTMUX_Stop();
+    OVERHEAD_Stop();
 
     if (drv_cfg == NULL) {
         SEP_DRV_LOG_ERROR_FLOW_OUT("drv_cfg is NULL!");
@@ -4330,6 +4740,7 @@ lwpmudrv_Finish_Stop (
     if (DRV_CONFIG_counting_mode(drv_cfg) == FALSE) {
         if (GET_DRIVER_STATE() != DRV_STATE_TERMINATING) {
             CONTROL_Invoke_Parallel(PEBS_Flush_Buffer, NULL);
+            TIMESYNC_Flush();
             /*
              *  Make sure that the module buffers are not deallocated and that the module flush
              *  thread has not been terminated.
@@ -4462,89 +4873,162 @@ lwpmudrv_Get_Num_Cores (
 
 /* ------------------------------------------------------------------------- */
 /*!
- * @fn  static OS_STATUS lwpmudrv_Set_CPU_Mask(PVOID buf_usr_to_drv, U32 len_usr_to_drv)
+ * @fn  static OS_STATUS lwpmudrv_Get_Num_Packages(IOCTL_ARGS arg)
  *
- * @param buf_usr_to_drv   - pointer to the CPU mask buffer
- * @param len_usr_to_drv   - size of the CPU mask buffer
+ * @param arg - Pointer to the IOCTL structure
  *
  * @return OS_STATUS
  *
- * @brief  process the CPU mask as requested by the user
+ * @brief  Return the number of packages, i.e. the number of uncore sampling
+ *         devices, so that user mode can set up one reader per package.
  *
  * <I>Special Notes</I>
  */
 static OS_STATUS
-lwpmudrv_Set_CPU_Mask (
-    PVOID         buf_usr_to_drv,
-    size_t        len_usr_to_drv
+lwpmudrv_Get_Num_Packages (
+    IOCTL_ARGS   arg
 )
 {
-    U32     cpu_count     = 0;
+    OS_STATUS status = OS_SUCCESS;
 
     SEP_DRV_LOG_FLOW_IN("");
 
-    if (GET_DRIVER_STATE() != DRV_STATE_IDLE) {
-        SEP_DRV_LOG_ERROR_FLOW_OUT("Skipped: driver state is not IDLE!");
-        return OS_IN_PROGRESS;
-    }
-
-    if (len_usr_to_drv == 0 || buf_usr_to_drv == NULL) {
-        SEP_DRV_LOG_ERROR_FLOW_OUT("len_usr_to_drv == 0 or buf_usr_to_drv is NULL!");
+    if (arg->len_drv_to_usr != sizeof(U32) || arg->buf_drv_to_usr == NULL) {
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Error: Invalid arguments.");
         return OS_INVALID;
     }
 
-    cpu_mask_bits = CONTROL_Allocate_Memory((int)len_usr_to_drv);
-    if (!cpu_mask_bits) {
-        SEP_DRV_LOG_ERROR_FLOW_OUT("Memory allocation failure for cpu_mask_bits!");
-        return OS_NO_MEM;
-    }
-
-    if (copy_from_user(cpu_mask_bits, (S8*)buf_usr_to_drv, (int)len_usr_to_drv)) {
-        SEP_DRV_LOG_ERROR_FLOW_OUT("Memory copy failure!");
-        return OS_FAULT;
-    }
-
-    for (cpu_count = 0; cpu_count < (U32)GLOBAL_STATE_num_cpus(driver_state); cpu_count++) {
-        CPU_STATE_accept_interrupt(&pcb[cpu_count]) = cpu_mask_bits[cpu_count] ? 1 : 0;
-        CPU_STATE_initial_mask(&pcb[cpu_count    ]) = cpu_mask_bits[cpu_count] ? 1 : 0;
-    }
+    SEP_DRV_LOG_TRACE("Num_Packages is %u.", num_packages);
+    status = put_user(num_packages, (U32*)arg->buf_drv_to_usr);
 
-    SEP_DRV_LOG_FLOW_OUT("Success");
-    return OS_SUCCESS;
+    SEP_DRV_LOG_FLOW_OUT("Return value: %d", status);
+    return status;
 }
 
-
 /* ------------------------------------------------------------------------- */
 /*!
- * @fn  static OS_STATUS lwpmudrv_Get_KERNEL_CS(IOCTL_ARGS arg)
+ * @fn  static OS_STATUS lwpmudrv_Get_Sys_Info_Generation(IOCTL_ARGS arg)
  *
  * @param arg - Pointer to the IOCTL structure
  *
  * @return OS_STATUS
  *
- * @brief  Return the value of the Kernel symbol KERNEL_CS.
+ * @brief  Return the generation of the cached system configuration, so that
+ *         user mode can tell whether its copy of the sys config and topology
+ *         replies is still current.
  *
  * <I>Special Notes</I>
  */
 static OS_STATUS
-lwpmudrv_Get_KERNEL_CS (
+lwpmudrv_Get_Sys_Info_Generation (
     IOCTL_ARGS   arg
 )
 {
-    OS_STATUS status = OS_SUCCESS;
-    S32       num    = __KERNEL_CS;
+    U64 generation;
 
     SEP_DRV_LOG_FLOW_IN("");
 
-    if (arg->len_drv_to_usr != sizeof(S32) || arg->buf_drv_to_usr == NULL) {
+    if (arg->len_drv_to_usr != sizeof(U64) || arg->buf_drv_to_usr == NULL) {
         SEP_DRV_LOG_ERROR_FLOW_OUT("Error: Invalid arguments.");
         return OS_INVALID;
     }
 
-    SEP_DRV_LOG_TRACE("__KERNEL_CS is %d, buf_usr_to_drv is 0x%p.", num, arg->buf_drv_to_usr);
-    status = put_user(num, (S32*)arg->buf_drv_to_usr);
+    generation = SYS_INFO_Generation();
+    SEP_DRV_LOG_TRACE("Sys info generation is %llu.", generation);
+    if (copy_to_user(arg->buf_drv_to_usr, &generation, sizeof(U64))) {
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Memory copy failure!");
+        return OS_FAULT;
+    }
 
-    SEP_DRV_LOG_FLOW_OUT("Return value: %d.", status);
+    SEP_DRV_LOG_FLOW_OUT("Success");
+    return OS_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn  static OS_STATUS lwpmudrv_Set_CPU_Mask(PVOID buf_usr_to_drv, U32 len_usr_to_drv)
+ *
+ * @param buf_usr_to_drv   - pointer to the CPU mask buffer
+ * @param len_usr_to_drv   - size of the CPU mask buffer
+ *
+ * @return OS_STATUS
+ *
+ * @brief  process the CPU mask as requested by the user
+ *
+ * <I>Special Notes</I>
+ */
+static OS_STATUS
+lwpmudrv_Set_CPU_Mask (
+    PVOID         buf_usr_to_drv,
+    size_t        len_usr_to_drv
+)
+{
+    U32     cpu_count     = 0;
+
+    SEP_DRV_LOG_FLOW_IN("");
+
+    if (GET_DRIVER_STATE() != DRV_STATE_IDLE) {
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Skipped: driver state is not IDLE!");
+        return OS_IN_PROGRESS;
+    }
+
+    if (len_usr_to_drv == 0 || buf_usr_to_drv == NULL) {
+        SEP_DRV_LOG_ERROR_FLOW_OUT("len_usr_to_drv == 0 or buf_usr_to_drv is NULL!");
+        return OS_INVALID;
+    }
+
+    cpu_mask_bits = CONTROL_Allocate_Memory((int)len_usr_to_drv);
+    if (!cpu_mask_bits) {
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Memory allocation failure for cpu_mask_bits!");
+        return OS_NO_MEM;
+    }
+
+    if (copy_from_user(cpu_mask_bits, (S8*)buf_usr_to_drv, (int)len_usr_to_drv)) {
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Memory copy failure!");
+        return OS_FAULT;
+    }
+
+    for (cpu_count = 0; cpu_count < (U32)GLOBAL_STATE_num_cpus(driver_state); cpu_count++) {
+        CPU_STATE_accept_interrupt(&pcb[cpu_count]) = cpu_mask_bits[cpu_count] ? 1 : 0;
+        CPU_STATE_initial_mask(&pcb[cpu_count    ]) = cpu_mask_bits[cpu_count] ? 1 : 0;
+    }
+
+    SEP_DRV_LOG_FLOW_OUT("Success");
+    return OS_SUCCESS;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn  static OS_STATUS lwpmudrv_Get_KERNEL_CS(IOCTL_ARGS arg)
+ *
+ * @param arg - Pointer to the IOCTL structure
+ *
+ * @return OS_STATUS
+ *
+ * @brief  Return the value of the Kernel symbol KERNEL_CS.
+ *
+ * <I>Special Notes</I>
+ */
+static OS_STATUS
+lwpmudrv_Get_KERNEL_CS (
+    IOCTL_ARGS   arg
+)
+{
+    OS_STATUS status = OS_SUCCESS;
+    S32       num    = __KERNEL_CS;
+
+    SEP_DRV_LOG_FLOW_IN("");
+
+    if (arg->len_drv_to_usr != sizeof(S32) || arg->buf_drv_to_usr == NULL) {
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Error: Invalid arguments.");
+        return OS_INVALID;
+    }
+
+    SEP_DRV_LOG_TRACE("__KERNEL_CS is %d, buf_usr_to_drv is 0x%p.", num, arg->buf_drv_to_usr);
+    status = put_user(num, (S32*)arg->buf_drv_to_usr);
+
+    SEP_DRV_LOG_FLOW_OUT("Return value: %d.", status);
     return status;
 }
 
@@ -5233,13 +5717,16 @@ lwpmudrv_Flush (
  * @return      status
  *
  * <I>Special Notes:</I>
- *              <NONE>
+ *              Entries logged in binary mode are formatted on the way out.
  */
 static OS_STATUS
 lwpmudrv_Get_Driver_Log (
     IOCTL_ARGS args
 )
 {
+    DRV_LOG_ENTRY_NODE entry;
+    U32                i;
+
     SEP_DRV_LOG_FLOW_IN("");
 
     if (args->buf_drv_to_usr == NULL) {
@@ -5256,6 +5743,22 @@ lwpmudrv_Get_Driver_Log (
         return OS_FAULT;
     }
 
+    /*
+     * Binary entries hold driver addresses instead of text: patch the user copy
+     * with formatted versions so that the log stays self-contained.
+     */
+    for (i = 0; i < DRV_LOG_MAX_NB_ENTRIES; i++) {
+        if (DRV_LOG_ENTRY_entry_format(&DRV_LOG_BUFFER_entries(DRV_LOG())[i]) != DRV_LOG_ENTRY_FORMAT_BINARY) {
+            continue;
+        }
+        memcpy(&entry, &DRV_LOG_BUFFER_entries(DRV_LOG())[i], sizeof(entry));
+        UTILITY_Driver_Log_Render_Entry(&entry);
+        if (copy_to_user(&DRV_LOG_BUFFER_entries((DRV_LOG_BUFFER)args->buf_drv_to_usr)[i], &entry, sizeof(entry))) {
+            SEP_DRV_LOG_ERROR_FLOW_OUT("Memory copy failure!");
+            return OS_FAULT;
+        }
+    }
+
     SEP_DRV_LOG_DISAMBIGUATE(); // keeps the driver log's footprint unique (has the highest disambiguator field)
 
     SEP_DRV_LOG_FLOW_OUT("Success");
@@ -5406,12 +5909,336 @@ lwpmudrv_Control_Driver_Log (
         SEP_DRV_LOG_INIT_OUT("Benchmark complete (%u/%u iterations).", i, nb_iterations);
 
     }
+    else if (DRV_LOG_CONTROL_command(&log_control) == DRV_LOG_CONTROL_COMMAND_SET_BINARY_MODE) {
+        if (DRV_LOG_CONTROL_binary_mode(&log_control) != LOG_VERBOSITY_UNSET) {
+            SEP_DRV_LOG_INIT("Changing log mode from %s to %s.",
+                DRV_LOG_BUFFER_binary_mode(DRV_LOG())       ? "binary" : "text",
+                DRV_LOG_CONTROL_binary_mode(&log_control)   ? "binary" : "text");
+            DRV_LOG_BUFFER_binary_mode(DRV_LOG()) = !!DRV_LOG_CONTROL_binary_mode(&log_control);
+        }
+        DRV_LOG_CONTROL_binary_mode(&log_control) = DRV_LOG_BUFFER_binary_mode(DRV_LOG());
+        if (copy_to_user(args->buf_drv_to_usr, &log_control, sizeof(log_control))) {
+            SEP_DRV_LOG_ERROR_FLOW_OUT("Memory copy failure!");
+            return OS_FAULT;
+        }
+    }
 
     SEP_DRV_LOG_FLOW_OUT("Success");
     return OS_SUCCESS;
 }
 
 
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          OS_STATUS lwpmudrv_Get_Driver_Overhead
+ *
+ * @brief       Returns the driver's self-overhead statistics
+ *
+ * @param arg   Pointer to the IOCTL structure
+ *
+ * @return      status
+ *
+ * <I>Special Notes:</I>
+ *              The output is a DRV_OVERHEAD_INFO_NODE header followed by one
+ *              DRV_OVERHEAD_NODE per CPU. A buffer only large enough for the
+ *              header can be used to query the number of CPUs first.
+ */
+static OS_STATUS
+lwpmudrv_Get_Driver_Overhead (
+    IOCTL_ARGS args
+)
+{
+    DRV_OVERHEAD_INFO info;
+    U32               num_cpus;
+    U32               size;
+    OS_STATUS         status = OS_SUCCESS;
+
+    SEP_DRV_LOG_FLOW_IN("");
+
+    if (args->buf_drv_to_usr == NULL ||
+        args->len_drv_to_usr < sizeof(DRV_OVERHEAD_INFO_NODE)) {
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Invalid arguments!");
+        return OS_INVALID;
+    }
+
+    num_cpus = (U32)((args->len_drv_to_usr - sizeof(DRV_OVERHEAD_INFO_NODE)) / sizeof(DRV_OVERHEAD_NODE));
+    if (num_cpus > (U32)GLOBAL_STATE_num_cpus(driver_state)) {
+        num_cpus = GLOBAL_STATE_num_cpus(driver_state);
+    }
+    size = sizeof(DRV_OVERHEAD_INFO_NODE) + num_cpus * sizeof(DRV_OVERHEAD_NODE);
+
+    info = CONTROL_Allocate_Memory(size);
+    if (!info) {
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Memory allocation failure!");
+        return OS_NO_MEM;
+    }
+
+    OVERHEAD_Snapshot(info, num_cpus);
+    DRV_OVERHEAD_INFO_num_cpus(info) = GLOBAL_STATE_num_cpus(driver_state);
+
+    if (copy_to_user(args->buf_drv_to_usr, info, size)) {
+        SEP_DRV_LOG_ERROR("Memory copy failure!");
+        status = OS_FAULT;
+    }
+    info = CONTROL_Free_Memory(info);
+
+    SEP_DRV_LOG_FLOW_OUT("Return value: %d.", status);
+    return status;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          OS_STATUS lwpmudrv_Set_Throttle
+ *
+ * @brief       Configures the adaptive sampling-rate governor
+ *
+ * @param arg   Pointer to the IOCTL structure
+ *
+ * @return      status
+ *
+ * <I>Special Notes:</I>
+ *              The input is a DRV_THROTTLE_CONFIG_NODE. The configuration is
+ *              applied at the next collection start.
+ */
+static OS_STATUS
+lwpmudrv_Set_Throttle (
+    IOCTL_ARGS args
+)
+{
+    DRV_THROTTLE_CONFIG_NODE cfg;
+    OS_STATUS                status;
+
+    SEP_DRV_LOG_FLOW_IN("");
+
+    if (args->buf_usr_to_drv == NULL ||
+        args->len_usr_to_drv != sizeof(DRV_THROTTLE_CONFIG_NODE)) {
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Invalid arguments!");
+        return OS_INVALID;
+    }
+
+    if (copy_from_user(&cfg, args->buf_usr_to_drv, sizeof(DRV_THROTTLE_CONFIG_NODE))) {
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Memory copy failure!");
+        return OS_FAULT;
+    }
+
+    status = THROTTLE_Configure(&cfg);
+
+    SEP_DRV_LOG_FLOW_OUT("Return value: %d.", status);
+    return status;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          OS_STATUS lwpmudrv_Set_Task_Filter
+ *
+ * @brief       Restricts the collection to a set of processes and/or cgroups
+ *
+ * @param arg   Pointer to the IOCTL structure
+ *
+ * @return      status
+ *
+ * <I>Special Notes:</I>
+ *              The input is a DRV_TASK_FILTER_NODE. Must be sent before the
+ *              collection is started.
+ */
+static OS_STATUS
+lwpmudrv_Set_Task_Filter (
+    IOCTL_ARGS args
+)
+{
+    DRV_TASK_FILTER_NODE cfg;
+    OS_STATUS            status;
+
+    SEP_DRV_LOG_FLOW_IN("");
+
+    if (args->buf_usr_to_drv == NULL ||
+        args->len_usr_to_drv != sizeof(DRV_TASK_FILTER_NODE)) {
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Invalid arguments!");
+        return OS_INVALID;
+    }
+
+    if (copy_from_user(&cfg, args->buf_usr_to_drv, sizeof(DRV_TASK_FILTER_NODE))) {
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Memory copy failure!");
+        return OS_FAULT;
+    }
+
+    status = FILTER_Configure(&cfg);
+
+    SEP_DRV_LOG_FLOW_OUT("Return value: %d.", status);
+    return status;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          OS_STATUS lwpmudrv_Set_Time_Sync
+ *
+ * @brief       Configures the periodic per-CPU time synchronisation records
+ *
+ * @param arg   Pointer to the IOCTL structure
+ *
+ * @return      status
+ *
+ * <I>Special Notes:</I>
+ *              The input is a DRV_TIME_SYNC_CONFIG_NODE. The configuration is
+ *              applied at the next collection start.
+ */
+static OS_STATUS
+lwpmudrv_Set_Time_Sync (
+    IOCTL_ARGS args
+)
+{
+    DRV_TIME_SYNC_CONFIG_NODE cfg;
+    OS_STATUS                 status;
+
+    SEP_DRV_LOG_FLOW_IN("");
+
+    if (args->buf_usr_to_drv == NULL ||
+        args->len_usr_to_drv != sizeof(DRV_TIME_SYNC_CONFIG_NODE)) {
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Invalid arguments!");
+        return OS_INVALID;
+    }
+
+    if (copy_from_user(&cfg, args->buf_usr_to_drv, sizeof(DRV_TIME_SYNC_CONFIG_NODE))) {
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Memory copy failure!");
+        return OS_FAULT;
+    }
+
+    status = TIMESYNC_Configure(&cfg);
+
+    SEP_DRV_LOG_FLOW_OUT("Return value: %d.", status);
+    return status;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          OS_STATUS lwpmudrv_Set_Wakeup
+ *
+ * @brief       Configures when readers of a class of output devices are woken up
+ *
+ * @param arg   Pointer to the IOCTL structure
+ *
+ * @return      status
+ *
+ * <I>Special Notes:</I>
+ *              The input is a DRV_WAKEUP_CONFIG_NODE. The configuration is
+ *              applied at the next collection start.
+ */
+static OS_STATUS
+lwpmudrv_Set_Wakeup (
+    IOCTL_ARGS args
+)
+{
+    DRV_WAKEUP_CONFIG_NODE cfg;
+    OS_STATUS              status;
+
+    SEP_DRV_LOG_FLOW_IN("");
+
+    if (args->buf_usr_to_drv == NULL ||
+        args->len_usr_to_drv != sizeof(DRV_WAKEUP_CONFIG_NODE)) {
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Invalid arguments!");
+        return OS_INVALID;
+    }
+
+    if (copy_from_user(&cfg, args->buf_usr_to_drv, sizeof(DRV_WAKEUP_CONFIG_NODE))) {
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Memory copy failure!");
+        return OS_FAULT;
+    }
+
+    status = OUTPUT_Set_Wakeup(&cfg);
+
+    SEP_DRV_LOG_FLOW_OUT("Return value: %d.", status);
+    return status;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          OS_STATUS lwpmudrv_Set_EM_Timing
+ *
+ * @brief       Configures the slice period and group weights of timer-based multiplexing
+ *
+ * @param arg   Pointer to the IOCTL structure
+ *
+ * @return      status
+ *
+ * <I>Special Notes:</I>
+ *              The input is a DRV_EM_TIMING_NODE. The configuration is
+ *              applied at the next collection start.
+ */
+static OS_STATUS
+lwpmudrv_Set_EM_Timing (
+    IOCTL_ARGS args
+)
+{
+    DRV_EM_TIMING_NODE cfg;
+    OS_STATUS          status;
+
+    SEP_DRV_LOG_FLOW_IN("");
+
+    if (args->buf_usr_to_drv == NULL ||
+        args->len_usr_to_drv != sizeof(DRV_EM_TIMING_NODE)) {
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Invalid arguments!");
+        return OS_INVALID;
+    }
+
+    if (copy_from_user(&cfg, args->buf_usr_to_drv, sizeof(DRV_EM_TIMING_NODE))) {
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Memory copy failure!");
+        return OS_FAULT;
+    }
+
+    status = EVENTMUX_Configure(&cfg);
+
+    SEP_DRV_LOG_FLOW_OUT("Return value: %d.", status);
+    return status;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          OS_STATUS lwpmudrv_Set_Emon_Delta
+ *
+ * @brief       Configures delta encoding and downsampling of the EMON output
+ *
+ * @param arg   Pointer to the IOCTL structure
+ *
+ * @return      status
+ *
+ * <I>Special Notes:</I>
+ *              The input is a DRV_EMON_DELTA_CONFIG_NODE. The configuration is
+ *              applied at the next collection start.
+ */
+static OS_STATUS
+lwpmudrv_Set_Emon_Delta (
+    IOCTL_ARGS args
+)
+{
+    DRV_EMON_DELTA_CONFIG_NODE cfg;
+    OS_STATUS                  status;
+
+    SEP_DRV_LOG_FLOW_IN("");
+
+    if (args->buf_usr_to_drv == NULL ||
+        args->len_usr_to_drv != sizeof(DRV_EMON_DELTA_CONFIG_NODE)) {
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Invalid arguments!");
+        return OS_INVALID;
+    }
+
+    if (copy_from_user(&cfg, args->buf_usr_to_drv, sizeof(DRV_EMON_DELTA_CONFIG_NODE))) {
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Memory copy failure!");
+        return OS_FAULT;
+    }
+
+    status = EMONDELTA_Configure(&cfg);
+
+    SEP_DRV_LOG_FLOW_OUT("Return value: %d.", status);
+    return status;
+}
+
+
 /* ------------------------------------------------------------------------- */
 /*!
  * @fn          U64 lwpmudrv_Get_Drv_Setup_Info
@@ -5709,6 +6536,20 @@ lwpmu_Write (
     return 1;
 }
 
+/*
+ * Marker writes sit on the application's hot path: no tracing here.
+ */
+static ssize_t
+lwmarker_Write (
+    struct file  *filp,
+    const  char  *buf,
+    size_t        count,
+    loff_t       *f_pos
+)
+{
+    return MARKER_Write(buf, count);
+}
+
 /* ------------------------------------------------------------------------- */
 /*!
  * @fn  extern IOCTL_OP_TYPE lwpmu_Service_IOCTL(IOCTL_USE_NODE, filp, cmd, arg)
@@ -5867,6 +6708,16 @@ lwpmu_Service_IOCTL (
             status = lwpmudrv_Get_Num_Cores(&local_args);
             break;
 
+        case DRV_OPERATION_GET_NUM_PACKAGES:
+            SEP_DRV_LOG_TRACE("DRV_OPERATION_GET_NUM_PACKAGES.");
+            status = lwpmudrv_Get_Num_Packages(&local_args);
+            break;
+
+        case DRV_OPERATION_GET_SYS_INFO_GENERATION:
+            SEP_DRV_LOG_TRACE("DRV_OPERATION_GET_SYS_INFO_GENERATION.");
+            status = lwpmudrv_Get_Sys_Info_Generation(&local_args);
+            break;
+
         case DRV_OPERATION_KERNEL_CS:
             SEP_DRV_LOG_TRACE("DRV_OPERATION_KERNEL_CS.");
             status = lwpmudrv_Get_KERNEL_CS(&local_args);
@@ -5917,11 +6768,51 @@ lwpmu_Service_IOCTL (
             status = lwpmudrv_Switch_Group();
             break;
 
+        case DRV_OPERATION_RECONFIGURE:
+            SEP_DRV_LOG_TRACE("DRV_OPERATION_RECONFIGURE.");
+            status = lwpmudrv_Reconfigure(&local_args);
+            break;
+
         case DRV_OPERATION_GET_PERF_CAPAB:
             SEP_DRV_LOG_TRACE("DRV_OPERATION_GET_PERF_CAPAB.");
             status = lwpmudrv_Get_Perf_Capab(&local_args);
             break;
 
+        case DRV_OPERATION_GET_DRIVER_OVERHEAD:
+            SEP_DRV_LOG_TRACE("DRV_OPERATION_GET_DRIVER_OVERHEAD.");
+            status = lwpmudrv_Get_Driver_Overhead(&local_args);
+            break;
+
+        case DRV_OPERATION_SET_THROTTLE:
+            SEP_DRV_LOG_TRACE("DRV_OPERATION_SET_THROTTLE.");
+            status = lwpmudrv_Set_Throttle(&local_args);
+            break;
+
+        case DRV_OPERATION_SET_WAKEUP:
+            SEP_DRV_LOG_TRACE("DRV_OPERATION_SET_WAKEUP.");
+            status = lwpmudrv_Set_Wakeup(&local_args);
+            break;
+
+        case DRV_OPERATION_SET_EM_TIMING:
+            SEP_DRV_LOG_TRACE("DRV_OPERATION_SET_EM_TIMING.");
+            status = lwpmudrv_Set_EM_Timing(&local_args);
+            break;
+
+        case DRV_OPERATION_SET_EMON_DELTA:
+            SEP_DRV_LOG_TRACE("DRV_OPERATION_SET_EMON_DELTA.");
+            status = lwpmudrv_Set_Emon_Delta(&local_args);
+            break;
+
+        case DRV_OPERATION_SET_TASK_FILTER:
+            SEP_DRV_LOG_TRACE("DRV_OPERATION_SET_TASK_FILTER.");
+            status = lwpmudrv_Set_Task_Filter(&local_args);
+            break;
+
+        case DRV_OPERATION_SET_TIME_SYNC:
+            SEP_DRV_LOG_TRACE("DRV_OPERATION_SET_TIME_SYNC.");
+            status = lwpmudrv_Set_Time_Sync(&local_args);
+            break;
+
             /*
              * EMON-specific IOCTL commands
              */
@@ -6196,12 +7087,26 @@ static struct file_operations lwmod_Fops = {
     .owner =   THIS_MODULE,
     IOCTL_OP = NULL,                //None needed
     .read =    OUTPUT_Module_Read,
+    .poll =    OUTPUT_Module_Poll,
     .write =   NULL,                //No writing accepted
     .open =    lwpmu_Open,
     .release = NULL,
     .llseek =  NULL,
 };
 
+/*
+ * lwpmu_k, the user-space region markers merged into the sample stream
+ */
+static struct file_operations lwmarker_Fops = {
+    .owner =   THIS_MODULE,
+    IOCTL_OP = NULL,                //None needed
+    .read =    NULL,
+    .write =   lwmarker_Write,
+    .open =    lwpmu_Open,
+    .release = NULL,
+    .llseek =  NULL,
+};
+
 /*
  * Third one is for lwsamp_nn, the sampling functions
  */
@@ -6209,6 +7114,7 @@ static struct file_operations lwsamp_Fops = {
     .owner =   THIS_MODULE,
     IOCTL_OP = NULL,                //None needed
     .read =    OUTPUT_Sample_Read,
+    .poll =    OUTPUT_Sample_Poll,
     .write =   NULL,                //No writing accepted
     .open =    lwpmu_Open,
     .release = NULL,
@@ -6222,6 +7128,7 @@ static struct file_operations lwsideband_Fops = {
     .owner =   THIS_MODULE,
     IOCTL_OP = NULL,                //None needed
     .read =    OUTPUT_SidebandInfo_Read,
+    .poll =    OUTPUT_SidebandInfo_Poll,
     .write =   NULL,                //No writing accepted
     .open =    lwpmu_Open,
     .release = NULL,
@@ -6235,6 +7142,7 @@ static struct file_operations lwsampunc_Fops = {
     .owner =   THIS_MODULE,
     IOCTL_OP = NULL,                //None needed
     .read =    OUTPUT_UncSample_Read,
+    .poll =    OUTPUT_UncSample_Poll,
     .write =   NULL,                //No writing accepted
     .open =    lwpmu_Open,
     .release = NULL,
@@ -6307,6 +7215,7 @@ lwpmu_Load (
 {
     int        i, num_cpus;
     dev_t      lwmod_DevNum;
+    dev_t      lwmarker_DevNum;
     OS_STATUS  status      = OS_INVALID;
 #if !defined (DRV_UDEV_UNAVAILABLE)
     char       dev_name[MAXNAMELEN];
@@ -6384,13 +7293,15 @@ lwpmu_Load (
     /* Allocate memory for the control structures */
     lwpmu_control      = CONTROL_Allocate_Memory(sizeof(LWPMU_DEV_NODE));
     lwmod_control      = CONTROL_Allocate_Memory(sizeof(LWPMU_DEV_NODE));
+    lwmarker_control   = CONTROL_Allocate_Memory(sizeof(LWPMU_DEV_NODE));
     lwemon_control     = CONTROL_Allocate_Memory(sizeof(LWPMU_DEV_NODE));
     lwsamp_control     = CONTROL_Allocate_Memory(num_cpus*sizeof(LWPMU_DEV_NODE));
     lwsideband_control = CONTROL_Allocate_Memory(num_cpus*sizeof(LWPMU_DEV_NODE));
 
-    if (!lwsideband_control || !lwsamp_control || !lwpmu_control || !lwmod_control) {
+    if (!lwsideband_control || !lwsamp_control || !lwpmu_control || !lwmod_control || !lwmarker_control) {
         CONTROL_Free_Memory(lwpmu_control);
         CONTROL_Free_Memory(lwmod_control);
+        CONTROL_Free_Memory(lwmarker_control);
         CONTROL_Free_Memory(lwemon_control);
         CONTROL_Free_Memory(lwsamp_control);
         CONTROL_Free_Memory(lwsideband_control);
@@ -6427,6 +7338,20 @@ lwpmu_Load (
         SEP_DRV_LOG_ERROR_FLOW_OUT("Error %d when adding lwpmu as char device!", status);
         return status;
     }
+    /* _m init was fine, now try _k */
+    lwmarker_DevNum = MKDEV(MAJOR(lwpmu_DevNum),MINOR(lwpmu_DevNum)+2);
+
+#if !defined(DRV_UDEV_UNAVAILABLE)
+    device_create(pmu_class, NULL, lwmarker_DevNum, NULL, SEP_DRIVER_NAME DRV_DEVICE_DELIMITER DRV_USER_MARKER_DEVICE_SUFFIX);
+#endif
+
+    status       = lwpmu_setup_cdev(lwmarker_control,&lwmarker_Fops,lwmarker_DevNum);
+    if (status) {
+        cdev_del(&LWPMU_DEV_cdev(lwmod_control));
+        cdev_del(&LWPMU_DEV_cdev(lwpmu_control));
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Error %d when adding lwpmu as char device!", status);
+        return status;
+    }
 
     lwemon_DevNum = MKDEV(0, 0);
     status = alloc_chrdev_region(&lwemon_DevNum, 0, 1, SEP_EMON_NAME);
@@ -6633,6 +7558,8 @@ lwpmu_Load (
     PMU_LIST_Build_PCI_List();
     PMU_LIST_Build_MMIO_List();
 
+    OVERHEAD_Debugfs_Create();
+
     SEP_DRV_LOG_FLOW_OUT("Return value: %d.", status);
     return status;
 }
@@ -6719,10 +7646,12 @@ lwpmu_Unload (
     unregister_chrdev(MAJOR(lwpmu_DevNum), SEP_DRIVER_NAME);
     device_destroy(pmu_class, lwpmu_DevNum);
     device_destroy(pmu_class, lwpmu_DevNum+1);
+    device_destroy(pmu_class, lwpmu_DevNum+2);
 #endif
 
     cdev_del(&LWPMU_DEV_cdev(lwpmu_control));
     cdev_del(&LWPMU_DEV_cdev(lwmod_control));
+    cdev_del(&LWPMU_DEV_cdev(lwmarker_control));
     unregister_chrdev_region(lwpmu_DevNum, PMU_DEVICES);
 
 #if !defined(DRV_UDEV_UNAVAILABLE)
@@ -6763,12 +7692,15 @@ lwpmu_Unload (
     unregister_chrdev_region(lwemon_DevNum, 1);
     lwpmu_control      = CONTROL_Free_Memory(lwpmu_control);
     lwmod_control      = CONTROL_Free_Memory(lwmod_control);
+    lwmarker_control   = CONTROL_Free_Memory(lwmarker_control);
     lwsamp_control     = CONTROL_Free_Memory(lwsamp_control);
     lwsampunc_control  = CONTROL_Free_Memory(lwsampunc_control);
     lwsideband_control = CONTROL_Free_Memory(lwsideband_control);
     lwemon_control     = CONTROL_Free_Memory(lwemon_control);
 
+    OVERHEAD_Debugfs_Remove();
 
+    CONTROL_Arena_Release();
     CONTROL_Memory_Tracker_Free();
 
 #if defined(DRV_CPU_HOTPLUG)
@@ -0,0 +1,314 @@
+/*COPYRIGHT**
+    Copyright (C) 2005-2020 Intel Corporation.  All Rights Reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+
+
+
+
+**COPYRIGHT*/
+
+
+
+
+
+/*
+ *  CVS_Id="$Id$"
+ */
+
+
+#include "lwpmudrv_defines.h"
+#include <linux/version.h>
+#include <linux/sched.h>
+#include <linux/compiler.h>
+#include <linux/rcupdate.h>
+
+#include "lwpmudrv_types.h"
+#include "rise_errors.h"
+#include "lwpmudrv_ecb.h"
+#include "lwpmudrv_struct.h"
+#include "lwpmudrv.h"
+#include "control.h"
+#include "utility.h"
+#include "output.h"
+#include "marker.h"
+
+extern DRV_CONFIG         drv_cfg;
+
+/*
+ * Per-CPU staging ring. The producer is the write() handler running on the
+ * CPU with preemption disabled; the consumer is the PMI handler (or the stop
+ * path) on the same CPU. An entry is filled before head moves past it, so a
+ * PMI landing in the middle of a write only ever sees complete entries.
+ */
+typedef struct MARKER_RING_NODE_S  MARKER_RING_NODE;
+typedef        MARKER_RING_NODE   *MARKER_RING;
+
+struct MARKER_RING_NODE_S {
+    U32                          head;
+    U32                          tail;
+    U64                          dropped;
+    DRV_USER_MARKER_RECORD_NODE  entries[MARKER_RING_SIZE];
+};
+
+#define MARKER_RING_head(x)         (x)->head
+#define MARKER_RING_tail(x)         (x)->tail
+#define MARKER_RING_dropped(x)      (x)->dropped
+#define MARKER_RING_entries(x)      (x)->entries
+
+static MARKER_RING        marker_rings   = NULL;
+static volatile DRV_BOOL  marker_active  = FALSE;
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          VOID MARKER_Start (VOID)
+ *
+ * @brief       Allocate the staging rings and start accepting markers.
+ *
+ * @param       None
+ *
+ * @return      None
+ *
+ * <I>Special Notes:</I>
+ *              Markers only go to the sample stream, so nothing is set up
+ *              in EMON mode.
+ */
+extern VOID
+MARKER_Start (
+    VOID
+)
+{
+    SEP_DRV_LOG_FLOW_IN("");
+
+    if (!drv_cfg || DRV_CONFIG_emon_mode(drv_cfg) || !cpu_buf) {
+        SEP_DRV_LOG_FLOW_OUT("Markers disabled (no sample stream).");
+        return;
+    }
+
+    marker_rings = CONTROL_Allocate_Memory(GLOBAL_STATE_num_cpus(driver_state) * sizeof(MARKER_RING_NODE));
+    if (!marker_rings) {
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Memory allocation failure for marker rings!");
+        return;
+    }
+    memset(marker_rings, 0, GLOBAL_STATE_num_cpus(driver_state) * sizeof(MARKER_RING_NODE));
+
+    smp_wmb();
+    marker_active = TRUE;
+
+    SEP_DRV_LOG_FLOW_OUT("");
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          VOID MARKER_Stop (VOID)
+ *
+ * @brief       Stop accepting markers, flush what is left in the rings and
+ *              free them.
+ *
+ * @param       None
+ *
+ * @return      None
+ *
+ * <I>Special Notes:</I>
+ *              Called once the PMIs are quiesced. Writers enqueue with
+ *              preemption disabled, so one RCU grace period after clearing
+ *              the active flag guarantees none is still touching a ring.
+ */
+extern VOID
+MARKER_Stop (
+    VOID
+)
+{
+    U32 i;
+
+    SEP_DRV_LOG_FLOW_IN("");
+
+    if (!marker_rings) {
+        SEP_DRV_LOG_FLOW_OUT("Nothing to do.");
+        return;
+    }
+
+    marker_active = FALSE;
+    synchronize_rcu();
+    CONTROL_Invoke_Parallel(MARKER_Flush_Op, NULL);
+
+    for (i = 0; i < GLOBAL_STATE_num_cpus(driver_state); i++) {
+        if (MARKER_RING_dropped(&marker_rings[i])) {
+            SEP_DRV_LOG_WARNING("CPU %u dropped %llu markers.", i, MARKER_RING_dropped(&marker_rings[i]));
+        }
+    }
+    marker_rings = CONTROL_Free_Memory(marker_rings);
+
+    SEP_DRV_LOG_FLOW_OUT("");
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          ssize_t MARKER_Write (buf, count)
+ *
+ * @brief       Queue the markers written by an application on the current CPU
+ *
+ * @param       buf   - user buffer holding DRV_USER_MARKER_NODE entries
+ * @param       count - size of the buffer in bytes
+ *
+ * @return      number of bytes consumed or -EINVAL/-EFAULT
+ *
+ * <I>Special Notes:</I>
+ *              Markers that do not fit in the ring are counted as dropped.
+ *              The record keeps the CPU and raw TSC read by the application,
+ *              which may differ from the CPU whose stream it is written to.
+ */
+extern ssize_t
+MARKER_Write (
+    const char   *buf,
+    size_t        count
+)
+{
+    DRV_USER_MARKER_NODE         batch[MARKER_WRITE_BATCH];
+    DRV_USER_MARKER_RECORD       rec;
+    MARKER_RING                  ring;
+    size_t                       done = 0;
+    U32                          n, i, this_cpu, head, cpu_num;
+
+    if (count % sizeof(DRV_USER_MARKER_NODE)) {
+        return -EINVAL;
+    }
+    if (!marker_active) {
+        return count;
+    }
+
+    while (done < count) {
+        n = (U32)min_t(size_t, (count - done) / sizeof(DRV_USER_MARKER_NODE), MARKER_WRITE_BATCH);
+        if (copy_from_user(batch, buf + done, n * sizeof(DRV_USER_MARKER_NODE))) {
+            return done ? (ssize_t)done : -EFAULT;
+        }
+
+        this_cpu = get_cpu();
+        if (!marker_active || !marker_rings) {
+            put_cpu();
+            return count;
+        }
+        ring = &marker_rings[this_cpu];
+        head = MARKER_RING_head(ring);
+        for (i = 0; i < n; i++) {
+            if (head - READ_ONCE(MARKER_RING_tail(ring)) >= MARKER_RING_SIZE) {
+                MARKER_RING_dropped(ring) += n - i;
+                break;
+            }
+            rec = &MARKER_RING_entries(ring)[head % MARKER_RING_SIZE];
+            cpu_num = DRV_USER_MARKER_cpu_num(&batch[i]);
+            if (cpu_num >= (U32)GLOBAL_STATE_num_cpus(driver_state)) {
+                cpu_num = this_cpu;
+            }
+            DRV_USER_MARKER_RECORD_descriptor_id(rec) = DRV_USER_MARKER_DESCRIPTOR_ID;
+            DRV_USER_MARKER_RECORD_osid(rec)          = OS_ID_NATIVE;
+            DRV_USER_MARKER_RECORD_cpu_num(rec)       = cpu_num;
+            DRV_USER_MARKER_RECORD_marker_id(rec)     = DRV_USER_MARKER_marker_id(&batch[i]);
+            DRV_USER_MARKER_RECORD_pid(rec)           = current->tgid;
+            DRV_USER_MARKER_RECORD_tid(rec)           = current->pid;
+            DRV_USER_MARKER_RECORD_tsc(rec)           = DRV_USER_MARKER_tsc(&batch[i]);
+            DRV_USER_MARKER_RECORD_payload(rec)       = DRV_USER_MARKER_payload(&batch[i]);
+            barrier();
+            head++;
+            WRITE_ONCE(MARKER_RING_head(ring), head);
+        }
+        put_cpu();
+
+        done += n * sizeof(DRV_USER_MARKER_NODE);
+    }
+
+    return count;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          VOID MARKER_Write_Records (bd, this_cpu)
+ *
+ * @brief       Move the markers queued on this CPU into its sample buffer
+ *
+ * @param       bd       - sample buffer of this CPU
+ * @param       this_cpu - current CPU
+ *
+ * @return      None
+ *
+ * <I>Special Notes:</I>
+ *              Called from the PMI handler, after the samples of the interrupt.
+ */
+extern VOID
+MARKER_Write_Records (
+    BUFFER_DESC bd,
+    U32         this_cpu
+)
+{
+    MARKER_RING             ring;
+    DRV_USER_MARKER_RECORD  rec;
+    U32                     head, tail;
+
+    if (!marker_rings) {
+        return;
+    }
+
+    ring = &marker_rings[this_cpu];
+    head = READ_ONCE(MARKER_RING_head(ring));
+    tail = MARKER_RING_tail(ring);
+    barrier();
+
+    while (tail != head) {
+        rec = (DRV_USER_MARKER_RECORD)OUTPUT_Reserve_Buffer_Space(bd, sizeof(DRV_USER_MARKER_RECORD_NODE), (NMI_mode)? TRUE:FALSE, !SEP_IN_NOTIFICATION);
+        if (!rec) {
+            MARKER_RING_dropped(ring) += head - tail;
+            tail = head;
+            break;
+        }
+        memcpy(rec, &MARKER_RING_entries(ring)[tail % MARKER_RING_SIZE], sizeof(DRV_USER_MARKER_RECORD_NODE));
+        tail++;
+    }
+
+    barrier();
+    WRITE_ONCE(MARKER_RING_tail(ring), tail);
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          VOID MARKER_Flush_Op (param)
+ *
+ * @brief       Per-CPU flush of the staging ring at stop
+ *
+ * @param       param - unused
+ *
+ * @return      None
+ *
+ * <I>Special Notes:</I>
+ */
+extern VOID
+MARKER_Flush_Op (
+    PVOID param
+)
+{
+    U32 this_cpu = CONTROL_THIS_CPU();
+
+    MARKER_Write_Records(&cpu_buf[this_cpu], this_cpu);
+}
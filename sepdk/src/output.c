@@ -36,6 +36,7 @@
 #include <linux/sched.h>
 #include <linux/jiffies.h>
 #include <linux/timer.h>
+#include <linux/hrtimer.h>
 #include <linux/time.h>
 #include <linux/wait.h>
 #include <linux/fs.h>
@@ -52,6 +53,7 @@
 #include "control.h"
 #include "output.h"
 #include "utility.h"
+#include "overhead.h"
 #include "inc/linuxos.h"
 #define OTHER_C_DEVICES  1     // one for module
 
@@ -71,6 +73,34 @@ extern U32               emon_read_threshold;
 static void output_NMI_Sample_Buffer(unsigned long data);
 static unsigned long flags;
 
+static DRV_WAKEUP_CONFIG_NODE  output_wakeup_cfg[DRV_WAKEUP_NB_DEVICES];
+static unsigned long           output_wakeup_next[DRV_WAKEUP_NB_DEVICES];
+static struct timer_list      *output_wakeup_timer    = NULL;
+static unsigned long           output_wakeup_interval = 0;
+
+/*
+ * Per-CPU latency timers: hand over partially filled per-CPU buffers on the
+ * CPU that writes them, so an idle CPU does not hold its records back.
+ */
+typedef struct OUTPUT_HANDOFF_NODE_S  OUTPUT_HANDOFF_NODE;
+typedef        OUTPUT_HANDOFF_NODE   *OUTPUT_HANDOFF;
+
+struct OUTPUT_HANDOFF_NODE_S {
+    struct hrtimer  timer;
+    U32             cpu;
+    U32             ticks;
+    DRV_BOOL        started;
+};
+
+#define OUTPUT_HANDOFF_timer(x)          (x)->timer
+#define OUTPUT_HANDOFF_cpu(x)            (x)->cpu
+#define OUTPUT_HANDOFF_ticks(x)          (x)->ticks
+#define OUTPUT_HANDOFF_started(x)        (x)->started
+
+static OUTPUT_HANDOFF          output_handoff        = NULL;  // one per CPU
+static ktime_t                 output_handoff_period;
+static U32                     output_handoff_every[DRV_WAKEUP_NB_DEVICES];  // in timer ticks, 0 if not handed over per CPU
+
 /*
  *  @fn output_Free_Buffers(output, size)
  *
@@ -104,6 +134,37 @@ output_Free_Buffers (
     return;
 }
 
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          static DRV_BOOL output_Wakeup_Due(OUTPUT outbuf)
+ *
+ * @brief       Checks whether the current buffer should be handed to the reader early
+ *
+ * @param       outbuf - output buffer being written to
+ *
+ * @return      TRUE when a watermark is reached or the latency timer asked for
+ *              a hand-over, and the other buffer is free to take the next record
+ *
+ * <I>Special Notes:</I>
+ *              Never true for an empty buffer, nor when all watermarks are unset.
+ */
+static inline DRV_BOOL
+output_Wakeup_Due (
+    OUTPUT outbuf
+)
+{
+    U32 used = OUTPUT_total_buffer_size(outbuf) - OUTPUT_remaining_buffer_size(outbuf);
+
+    if (!used ||
+        OUTPUT_buffer_full(outbuf, (OUTPUT_current_buffer(outbuf) + 1) % OUTPUT_NUM_BUFFERS)) {
+        return FALSE;
+    }
+
+    return (OUTPUT_wakeup_bytes(outbuf)   && used >= OUTPUT_wakeup_bytes(outbuf))                    ||
+           (OUTPUT_wakeup_records(outbuf) && OUTPUT_nb_records(outbuf) >= OUTPUT_wakeup_records(outbuf)) ||
+           OUTPUT_flip_requested(outbuf);
+}
+
 /* ------------------------------------------------------------------------- */
 /*!
  *  @fn  int OUTPUT_Reserve_Buffer_Space (OUTPUT      outbuf,
@@ -155,7 +216,17 @@ OUTPUT_Reserve_Buffer_Space (
         return NULL;
     }
 
-    if (OUTPUT_remaining_buffer_size(outbuf) >= size) {
+    /*
+     * Only an NMI that interrupted the latency hand-over of this CPU's
+     * buffer can get here (see output_Handoff), so the record is dropped.
+     */
+    if (OUTPUT_handoff_active(outbuf)) {
+        OVERHEAD_Count_Event(DRV_OVERHEAD_EVENT_DROPPED_RECORDS);
+        SEP_DRV_LOG_NOTIFICATION_TRACE_OUT(in_notification, "Res: NULL (hand-over in progress).");
+        return NULL;
+    }
+
+    if (OUTPUT_remaining_buffer_size(outbuf) >= size && !output_Wakeup_Due(outbuf)) {
         outloc = (OUTPUT_buffer(outbuf,OUTPUT_current_buffer(outbuf)) +
           (OUTPUT_total_buffer_size(outbuf) - OUTPUT_remaining_buffer_size(outbuf)));
     }
@@ -183,6 +254,8 @@ OUTPUT_Reserve_Buffer_Space (
             if (!OUTPUT_buffer_full(outbuf,j) || (DRV_CONFIG_enable_cp_mode(drv_cfg))) {
                 OUTPUT_current_buffer(outbuf) = j;
                 OUTPUT_remaining_buffer_size(outbuf) = OUTPUT_total_buffer_size(outbuf);
+                OUTPUT_nb_records(outbuf)     = 0;
+                OUTPUT_flip_requested(outbuf) = FALSE;
                 outloc = OUTPUT_buffer(outbuf,j);
                 if (DRV_CONFIG_enable_cp_mode(drv_cfg)) {
                 // discarding all the information in the new buffer in CP mode
@@ -204,8 +277,12 @@ OUTPUT_Reserve_Buffer_Space (
 
     if (outloc) {
         OUTPUT_remaining_buffer_size(outbuf) -= size;
+        OUTPUT_nb_records(outbuf)++;
         memset(outloc, 0, size);
     }
+    else {
+        OVERHEAD_Count_Event(DRV_OVERHEAD_EVENT_DROPPED_RECORDS);
+    }
 
     if (OUTPUT_signal_full(outbuf)) {
         if (!defer) {
@@ -213,6 +290,7 @@ OUTPUT_Reserve_Buffer_Space (
             SEP_DRV_LOG_NOTIFICATION_TRACE(in_notification, "Choosing direct wakeup approach.");
             wake_up_interruptible_sync(&BUFFER_DESC_queue(bd));
             OUTPUT_signal_full(outbuf) = FALSE;
+            OVERHEAD_Count_Event(DRV_OVERHEAD_EVENT_BUFFER_WAKEUPS);
 #endif
         }
         else {
@@ -222,6 +300,7 @@ OUTPUT_Reserve_Buffer_Space (
                     SEP_DRV_LOG_NOTIFICATION_TRACE(in_notification, "Scheduling the tasklet on cpu %u.", this_cpu);
                     OUTPUT_tasklet_queued(outbuf) = TRUE;
                     tasklet_schedule(&CPU_STATE_nmi_tasklet(&pcb[this_cpu]));
+                    OVERHEAD_Count_Event(DRV_OVERHEAD_EVENT_TASKLET_SCHEDULES);
                 }
                 else {
                     static U32 cpt = 0;
@@ -688,6 +767,675 @@ OUTPUT_Emon_Read (
     return res;
 }
 
+/* ------------------------------------------------------------------------- */
+/*!
+ *  @fn  unsigned int  output_Poll(struct file  *filp,
+ *                                 poll_table   *wait,
+ *                                 BUFFER_DESC   kernel_buf)
+ *
+ *  @brief  Reports whether a read on the buffer would return without blocking
+ *
+ *  @param *filp          a file pointer
+ *  @param *wait          poll table of the caller
+ *  @param  kernel_buf    the kernel output buffer structure
+ *
+ *  @return poll mask
+ *
+ * <I>Special Notes:</I>
+ *     Readable when a buffer has been handed over, or once the collection is
+ *     being flushed (the read then returns the remaining data, then 0). The
+ *     writers already wake BUFFER_DESC_queue on each hand-over, so pollers
+ *     need no periodic wakeup.
+ */
+static unsigned int
+output_Poll (
+    struct file  *filp,
+    poll_table   *wait,
+    BUFFER_DESC   kernel_buf
+)
+{
+    OUTPUT       outbuf = &BUFFER_DESC_outbuf(kernel_buf);
+    unsigned int mask   = 0;
+    U32          i;
+
+    SEP_DRV_LOG_TRACE_IN("Filp: %p, wait: %p, kernel_buf: %p.", filp, wait, kernel_buf);
+
+    poll_wait(filp, &BUFFER_DESC_queue(kernel_buf), wait);
+
+    if (flush) {
+        mask |= POLLIN | POLLRDNORM;
+    }
+    else if (!DRV_CONFIG_enable_cp_mode(drv_cfg)) {
+        for (i = 0; i < OUTPUT_NUM_BUFFERS; i++) {
+            if (OUTPUT_buffer_full(outbuf, i)) {
+                mask |= POLLIN | POLLRDNORM;
+                break;
+            }
+        }
+    }
+    if (GET_DRIVER_STATE() == DRV_STATE_TERMINATING) {
+        mask |= POLLIN | POLLRDNORM | POLLHUP;
+    }
+
+    SEP_DRV_LOG_TRACE_OUT("Res: 0x%x.", mask);
+    return mask;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ *  @fn  unsigned int  OUTPUT_Module_Poll(struct file  *filp,
+ *                                        poll_table   *wait)
+ *
+ *  @brief  Poll entry point of the module device
+ *
+ *  @param *filp   a file pointer
+ *  @param *wait   poll table of the caller
+ *
+ *  @return poll mask
+ *
+ * <I>Special Notes:</I>
+ *
+ */
+extern unsigned int
+OUTPUT_Module_Poll (
+    struct file  *filp,
+    poll_table   *wait
+)
+{
+    if (!module_buf) {
+        return POLLERR;
+    }
+    return output_Poll(filp, wait, module_buf);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ *  @fn  unsigned int  OUTPUT_Sample_Poll(struct file  *filp,
+ *                                        poll_table   *wait)
+ *
+ *  @brief  Poll entry point of the per-CPU sample devices
+ *
+ *  @param *filp   a file pointer
+ *  @param *wait   poll table of the caller
+ *
+ *  @return poll mask
+ *
+ * <I>Special Notes:</I>
+ *
+ */
+extern unsigned int
+OUTPUT_Sample_Poll (
+    struct file  *filp,
+    poll_table   *wait
+)
+{
+    int i = iminor(filp->DRV_F_DENTRY->d_inode); // kernel pointer - not user pointer
+
+    if (!cpu_buf || i >= GLOBAL_STATE_num_cpus(driver_state)) {
+        return POLLERR;
+    }
+    return output_Poll(filp, wait, &(cpu_buf[i]));
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ *  @fn  unsigned int  OUTPUT_UncSample_Poll(struct file  *filp,
+ *                                           poll_table   *wait)
+ *
+ *  @brief  Poll entry point of the per-package uncore sample devices
+ *
+ *  @param *filp   a file pointer
+ *  @param *wait   poll table of the caller
+ *
+ *  @return poll mask
+ *
+ * <I>Special Notes:</I>
+ *     Without uncore buffers a read returns 0 right away, so the device is
+ *     reported readable.
+ */
+extern unsigned int
+OUTPUT_UncSample_Poll (
+    struct file  *filp,
+    poll_table   *wait
+)
+{
+    int i = iminor(filp->DRV_F_DENTRY->d_inode); // kernel pointer - not user pointer
+
+    if (!unc_buf_init) {
+        return POLLIN | POLLRDNORM;
+    }
+    if (!unc_buf || i >= num_packages) {
+        return POLLERR;
+    }
+    return output_Poll(filp, wait, &(unc_buf[i]));
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ *  @fn  unsigned int  OUTPUT_SidebandInfo_Poll(struct file  *filp,
+ *                                              poll_table   *wait)
+ *
+ *  @brief  Poll entry point of the per-CPU sideband devices
+ *
+ *  @param *filp   a file pointer
+ *  @param *wait   poll table of the caller
+ *
+ *  @return poll mask
+ *
+ * <I>Special Notes:</I>
+ *     Without sideband buffers a read returns 0 right away, so the device is
+ *     reported readable.
+ */
+extern unsigned int
+OUTPUT_SidebandInfo_Poll (
+    struct file  *filp,
+    poll_table   *wait
+)
+{
+    int i = iminor(filp->DRV_F_DENTRY->d_inode); // kernel pointer - not user pointer
+
+    if (!multi_pebs_enabled) {
+        return POLLIN | POLLRDNORM;
+    }
+    if (!cpu_sideband_buf || i >= GLOBAL_STATE_num_cpus(driver_state)) {
+        return POLLERR;
+    }
+    return output_Poll(filp, wait, &(cpu_sideband_buf[i]));
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ *  @fn  static BUFFER_DESC output_Wakeup_Buffers(U32 device, U32 *count)
+ *
+ *  @brief  Returns the buffer descriptors of one device class
+ *
+ *  @param  device - DRV_WAKEUP_DEVICE_*
+ *  @param  count  - set to the number of descriptors
+ *
+ *  @return the first descriptor, or NULL when the class has no buffers
+ *
+ * <I>Special Notes:</I>
+ *
+ */
+static BUFFER_DESC
+output_Wakeup_Buffers (
+    U32  device,
+    U32 *count
+)
+{
+    *count = 0;
+    switch (device) {
+        case DRV_WAKEUP_DEVICE_SAMPLE:
+            if (cpu_buf) {
+                *count = GLOBAL_STATE_num_cpus(driver_state);
+            }
+            return cpu_buf;
+        case DRV_WAKEUP_DEVICE_SIDEBAND:
+            if (multi_pebs_enabled && cpu_sideband_buf) {
+                *count = GLOBAL_STATE_num_cpus(driver_state);
+                return cpu_sideband_buf;
+            }
+            return NULL;
+        case DRV_WAKEUP_DEVICE_UNCORE:
+            if (unc_buf_init && unc_buf) {
+                *count = num_packages;
+                return unc_buf;
+            }
+            return NULL;
+        case DRV_WAKEUP_DEVICE_MODULE:
+            if (module_buf) {
+                *count = 1;
+            }
+            return module_buf;
+        default:
+            return NULL;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ *  @fn  OS_STATUS OUTPUT_Set_Wakeup(DRV_WAKEUP_CONFIG cfg)
+ *
+ *  @brief  Stores the wakeup policy of one device class
+ *
+ *  @param  cfg - requested policy
+ *
+ *  @return OS_STATUS
+ *
+ * <I>Special Notes:</I>
+ *     The policy is applied to the buffers at the next collection start.
+ */
+extern OS_STATUS
+OUTPUT_Set_Wakeup (
+    DRV_WAKEUP_CONFIG cfg
+)
+{
+    SEP_DRV_LOG_TRACE_IN("Cfg: %p.", cfg);
+
+    if (!cfg || DRV_WAKEUP_CONFIG_device_type(cfg) >= DRV_WAKEUP_NB_DEVICES) {
+        SEP_DRV_LOG_ERROR_TRACE_OUT("Invalid wakeup configuration!");
+        return OS_INVALID;
+    }
+
+    memcpy(&output_wakeup_cfg[DRV_WAKEUP_CONFIG_device_type(cfg)], cfg, sizeof(DRV_WAKEUP_CONFIG_NODE));
+
+    SEP_DRV_LOG_TRACE_OUT("Device %u: %u bytes, %u records, %u ms.",
+                          DRV_WAKEUP_CONFIG_device_type(cfg),
+                          DRV_WAKEUP_CONFIG_watermark_bytes(cfg),
+                          DRV_WAKEUP_CONFIG_watermark_records(cfg),
+                          DRV_WAKEUP_CONFIG_max_latency_ms(cfg));
+    return OS_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ *  @fn  static DRV_BOOL output_Wakeup_Per_Cpu(U32 device)
+ *
+ *  @brief  Tells whether a device class has one buffer per CPU
+ *
+ *  @param  device - DRV_WAKEUP_DEVICE_*
+ *
+ *  @return TRUE for the sample and sideband classes
+ *
+ * <I>Special Notes:</I>
+ *     Only the per-CPU classes are handed over by the per-CPU latency timers.
+ *     The uncore and module buffers keep the hand-over at the next write.
+ */
+static inline DRV_BOOL
+output_Wakeup_Per_Cpu (
+    U32 device
+)
+{
+    return device == DRV_WAKEUP_DEVICE_SAMPLE || device == DRV_WAKEUP_DEVICE_SIDEBAND;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ *  @fn  static VOID output_Handoff(BUFFER_DESC bd)
+ *
+ *  @brief  Hands the partially filled current buffer over to the reader and
+ *          switches the writer to the other buffer
+ *
+ *  @param  bd - per-CPU buffer descriptor of the current CPU
+ *
+ *  @return none
+ *
+ * <I>Special Notes:</I>
+ *     Does nothing when the current buffer is empty or the other buffer has
+ *     not been read yet.
+ *     Must run on the CPU owning the buffer with interrupts disabled. Every
+ *     writer of a per-CPU buffer (PMI handler, sched_switch notification,
+ *     cross-CPU calls) also runs with interrupts disabled on that CPU, so the
+ *     only writer that can interleave is an NMI-mode PMI. Such a writer
+ *     interrupts this function, never the reverse, and sees handoff_active,
+ *     so it never observes a half-switched buffer.
+ */
+static VOID
+output_Handoff (
+    BUFFER_DESC bd
+)
+{
+    OUTPUT  outbuf = &BUFFER_DESC_outbuf(bd);
+    U32     cur;
+    U32     next;
+    U32     used;
+
+    OUTPUT_handoff_active(outbuf) = TRUE;
+    barrier();
+
+    cur  = OUTPUT_current_buffer(outbuf);
+    next = (cur + 1) % OUTPUT_NUM_BUFFERS;
+    used = OUTPUT_total_buffer_size(outbuf) - OUTPUT_remaining_buffer_size(outbuf);
+    if (used && !OUTPUT_buffer_full(outbuf, next)) {
+        OUTPUT_current_buffer(outbuf)        = next;
+        OUTPUT_remaining_buffer_size(outbuf) = OUTPUT_total_buffer_size(outbuf);
+        OUTPUT_nb_records(outbuf)            = 0;
+        OUTPUT_flip_requested(outbuf)        = FALSE;
+        // the reader may run on another CPU: publish the records before their size
+        smp_wmb();
+        OUTPUT_buffer_full(outbuf, cur)      = used;
+    }
+
+    barrier();
+    OUTPUT_handoff_active(outbuf) = FALSE;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ *  @fn  static enum hrtimer_restart output_Handoff_Timer(struct hrtimer *timer)
+ *
+ *  @brief  Per-CPU latency timer: hands over the non-empty per-CPU buffers of
+ *          this CPU and wakes their readers
+ *
+ *  @param  timer - the per-CPU timer
+ *
+ *  @return HRTIMER_RESTART until the collection stops
+ *
+ * <I>Special Notes:</I>
+ *     Pinned to its CPU. A timer migrated away by a CPU going offline stops,
+ *     since it could no longer hand over its buffers safely.
+ */
+static enum hrtimer_restart
+output_Handoff_Timer (
+    struct hrtimer *timer
+)
+{
+    OUTPUT_HANDOFF handoff = container_of(timer, OUTPUT_HANDOFF_NODE, timer);
+    U32            cpu     = OUTPUT_HANDOFF_cpu(handoff);
+    BUFFER_DESC    bufs;
+    OUTPUT         outbuf;
+    U32            device;
+    U32            count;
+    U32            j;
+
+    if (CONTROL_THIS_CPU() != cpu) {
+        return HRTIMER_NORESTART;
+    }
+
+    OUTPUT_HANDOFF_ticks(handoff)++;
+    if (DRIVER_STATE_IN(GET_DRIVER_STATE(), STATE_BIT_RUNNING | STATE_BIT_PAUSED)) {
+        for (device = 0; device < DRV_WAKEUP_NB_DEVICES; device++) {
+            if (!output_handoff_every[device] ||
+                OUTPUT_HANDOFF_ticks(handoff) % output_handoff_every[device]) {
+                continue;
+            }
+            bufs = output_Wakeup_Buffers(device, &count);
+            if (cpu >= count) {
+                continue;
+            }
+            output_Handoff(&bufs[cpu]);
+            outbuf = &BUFFER_DESC_outbuf(&bufs[cpu]);
+            for (j = 0; j < OUTPUT_NUM_BUFFERS; j++) {
+                if (OUTPUT_buffer_full(outbuf, j)) {
+                    wake_up_interruptible(&BUFFER_DESC_queue(&bufs[cpu]));
+                    OVERHEAD_Count_Event(DRV_OVERHEAD_EVENT_BUFFER_WAKEUPS);
+                    break;
+                }
+            }
+        }
+    }
+
+    hrtimer_forward_now(timer, output_handoff_period);
+    return HRTIMER_RESTART;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ *  @fn  static VOID output_Handoff_Start_Op(PVOID param)
+ *
+ *  @brief  Starts the latency timer of the current CPU
+ *
+ *  @param  param - dummy
+ *
+ *  @return none
+ *
+ * <I>Special Notes:</I>
+ *
+ */
+static VOID
+output_Handoff_Start_Op (
+    PVOID param
+)
+{
+    U32            this_cpu = CONTROL_THIS_CPU();
+    OUTPUT_HANDOFF handoff  = &output_handoff[this_cpu];
+
+    hrtimer_init(&OUTPUT_HANDOFF_timer(handoff), CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    OUTPUT_HANDOFF_timer(handoff).function = output_Handoff_Timer;
+    OUTPUT_HANDOFF_cpu(handoff)            = this_cpu;
+    OUTPUT_HANDOFF_ticks(handoff)          = 0;
+    OUTPUT_HANDOFF_started(handoff)        = TRUE;
+    hrtimer_start(&OUTPUT_HANDOFF_timer(handoff), output_handoff_period, HRTIMER_MODE_REL_PINNED);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ *  @fn  static VOID output_Handoff_Start(VOID)
+ *
+ *  @brief  Starts the per-CPU latency timers when a per-CPU class has a
+ *          latency bound
+ *
+ *  @param  none
+ *
+ *  @return none
+ *
+ * <I>Special Notes:</I>
+ *     The timers tick at the smallest per-CPU bound; each class is handed
+ *     over every max_latency_ms / period ticks. If the timers cannot be
+ *     allocated, output_handoff_every stays clear and the shared latency
+ *     timer covers the per-CPU classes as before.
+ */
+static VOID
+output_Handoff_Start (
+    VOID
+)
+{
+    U32 device;
+    U32 latency = 0;
+
+    SEP_DRV_LOG_TRACE_IN("");
+
+    memset(output_handoff_every, 0, sizeof(output_handoff_every));
+    for (device = 0; device < DRV_WAKEUP_NB_DEVICES; device++) {
+        U32 max_latency = DRV_WAKEUP_CONFIG_max_latency_ms(&output_wakeup_cfg[device]);
+        if (output_Wakeup_Per_Cpu(device) && max_latency &&
+            (!latency || max_latency < latency)) {
+            latency = max_latency;
+        }
+    }
+    if (!latency || !cpu_buf) {
+        SEP_DRV_LOG_TRACE_OUT("No per-CPU latency bound.");
+        return;
+    }
+
+    output_handoff = CONTROL_Allocate_Memory(GLOBAL_STATE_num_cpus(driver_state) * sizeof(OUTPUT_HANDOFF_NODE));
+    if (output_handoff == NULL) {
+        SEP_DRV_LOG_ERROR_TRACE_OUT("Memory allocation failure for output_handoff!");
+        return;
+    }
+
+    for (device = 0; device < DRV_WAKEUP_NB_DEVICES; device++) {
+        U32 max_latency = DRV_WAKEUP_CONFIG_max_latency_ms(&output_wakeup_cfg[device]);
+        if (output_Wakeup_Per_Cpu(device) && max_latency) {
+            output_handoff_every[device] = max_latency / latency;
+        }
+    }
+    output_handoff_period = ms_to_ktime(latency);
+    CONTROL_Invoke_Parallel(output_Handoff_Start_Op, NULL);
+
+    SEP_DRV_LOG_TRACE_OUT("Per-CPU latency timers started (%u ms).", latency);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ *  @fn  static VOID output_Wakeup_Timer(...)
+ *
+ *  @brief  Latency timer: asks for a hand-over of non-empty buffers and wakes
+ *          the readers of buffers that were handed over without a wakeup
+ *
+ *  @param  tl/arg - timer
+ *
+ *  @return none
+ *
+ * <I>Special Notes:</I>
+ *     The hand-over itself is done by the next write to the buffer, as only
+ *     the writer may switch buffers. Hand-overs from the sched_switch
+ *     notification do not wake the reader (see OUTPUT_Reserve_Buffer_Space);
+ *     this timer does. Classes covered by the per-CPU latency timers are
+ *     skipped.
+ */
+static VOID
+output_Wakeup_Timer (
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,15,0)
+    struct timer_list *tl
+#else
+    unsigned long arg
+#endif
+)
+{
+    BUFFER_DESC bufs;
+    OUTPUT      outbuf;
+    U32         device;
+    U32         count;
+    U32         i, j;
+
+    if (!DRIVER_STATE_IN(GET_DRIVER_STATE(), STATE_BIT_RUNNING | STATE_BIT_PAUSED)) {
+        return;
+    }
+
+    for (device = 0; device < DRV_WAKEUP_NB_DEVICES; device++) {
+        if (!DRV_WAKEUP_CONFIG_max_latency_ms(&output_wakeup_cfg[device]) ||
+            output_handoff_every[device] ||
+            time_before(jiffies, output_wakeup_next[device])) {
+            continue;
+        }
+        output_wakeup_next[device] = jiffies + msecs_to_jiffies(DRV_WAKEUP_CONFIG_max_latency_ms(&output_wakeup_cfg[device]));
+
+        bufs = output_Wakeup_Buffers(device, &count);
+        for (i = 0; i < count; i++) {
+            outbuf = &BUFFER_DESC_outbuf(&bufs[i]);
+            if (OUTPUT_remaining_buffer_size(outbuf) < OUTPUT_total_buffer_size(outbuf)) {
+                OUTPUT_flip_requested(outbuf) = TRUE;
+            }
+            for (j = 0; j < OUTPUT_NUM_BUFFERS; j++) {
+                if (OUTPUT_buffer_full(outbuf, j)) {
+                    wake_up_interruptible(&BUFFER_DESC_queue(&bufs[i]));
+                    break;
+                }
+            }
+        }
+    }
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,15,0)
+    mod_timer(output_wakeup_timer, jiffies + output_wakeup_interval);
+#else
+    output_wakeup_timer->expires = jiffies + output_wakeup_interval;
+    add_timer(output_wakeup_timer);
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ *  @fn  VOID OUTPUT_Wakeup_Start(VOID)
+ *
+ *  @brief  Applies the wakeup policies to the buffers and starts the latency timer
+ *
+ *  @param  none
+ *
+ *  @return none
+ *
+ * <I>Special Notes:</I>
+ *     Watermarks are ignored in continuous profiling mode, where the buffers
+ *     are only read at the end of the collection.
+ */
+extern VOID
+OUTPUT_Wakeup_Start (
+    VOID
+)
+{
+    BUFFER_DESC bufs;
+    OUTPUT      outbuf;
+    U32         device;
+    U32         count;
+    U32         i;
+    U32         min_latency = 0;
+
+    SEP_DRV_LOG_FLOW_IN("");
+
+    if (DRV_CONFIG_enable_cp_mode(drv_cfg)) {
+        SEP_DRV_LOG_FLOW_OUT("Continuous profiling mode, watermarks ignored.");
+        return;
+    }
+
+    output_Handoff_Start();
+
+    for (device = 0; device < DRV_WAKEUP_NB_DEVICES; device++) {
+        DRV_WAKEUP_CONFIG cfg = &output_wakeup_cfg[device];
+
+        bufs = output_Wakeup_Buffers(device, &count);
+        for (i = 0; i < count; i++) {
+            outbuf = &BUFFER_DESC_outbuf(&bufs[i]);
+            OUTPUT_wakeup_bytes(outbuf)   = DRV_WAKEUP_CONFIG_watermark_bytes(cfg);
+            OUTPUT_wakeup_records(outbuf) = DRV_WAKEUP_CONFIG_watermark_records(cfg);
+            OUTPUT_nb_records(outbuf)     = 0;
+            OUTPUT_flip_requested(outbuf) = FALSE;
+        }
+        if (count && DRV_WAKEUP_CONFIG_max_latency_ms(cfg) && !output_handoff_every[device] &&
+            (!min_latency || DRV_WAKEUP_CONFIG_max_latency_ms(cfg) < min_latency)) {
+            min_latency = DRV_WAKEUP_CONFIG_max_latency_ms(cfg);
+        }
+        output_wakeup_next[device] = jiffies + msecs_to_jiffies(DRV_WAKEUP_CONFIG_max_latency_ms(cfg));
+    }
+
+    if (!min_latency) {
+        SEP_DRV_LOG_FLOW_OUT("No latency bound.");
+        return;
+    }
+
+    output_wakeup_interval = msecs_to_jiffies(min_latency);
+    output_wakeup_timer    = CONTROL_Allocate_Memory(sizeof(struct timer_list));
+    if (output_wakeup_timer == NULL) {
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Memory allocation failure for output_wakeup_timer!");
+        return;
+    }
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,15,0)
+    timer_setup(output_wakeup_timer, output_Wakeup_Timer, 0);
+    mod_timer(output_wakeup_timer, jiffies + output_wakeup_interval);
+#else
+    init_timer(output_wakeup_timer);
+    output_wakeup_timer->function = output_Wakeup_Timer;
+    output_wakeup_timer->expires  = jiffies + output_wakeup_interval;
+    add_timer(output_wakeup_timer);
+#endif
+
+    SEP_DRV_LOG_FLOW_OUT("Latency timer started (%u ms).", min_latency);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ *  @fn  VOID OUTPUT_Wakeup_Stop(VOID)
+ *
+ *  @brief  Stops the latency timers
+ *
+ *  @param  none
+ *
+ *  @return none
+ *
+ * <I>Special Notes:</I>
+ *     Called once the PMIs are paused and before the final flush, which
+ *     then finds the per-CPU buffers in a stable state.
+ */
+extern VOID
+OUTPUT_Wakeup_Stop (
+    VOID
+)
+{
+    U32 cpu;
+
+    SEP_DRV_LOG_FLOW_IN("");
+
+    if (output_handoff) {
+        for (cpu = 0; cpu < GLOBAL_STATE_num_cpus(driver_state); cpu++) {
+            if (OUTPUT_HANDOFF_started(&output_handoff[cpu])) {
+                hrtimer_cancel(&OUTPUT_HANDOFF_timer(&output_handoff[cpu]));
+            }
+        }
+        output_handoff = CONTROL_Free_Memory(output_handoff);
+        memset(output_handoff_every, 0, sizeof(output_handoff_every));
+    }
+
+    if (output_wakeup_timer == NULL) {
+        SEP_DRV_LOG_FLOW_OUT("No latency timer.");
+        return;
+    }
+
+    del_timer_sync(output_wakeup_timer);
+    output_wakeup_timer = CONTROL_Free_Memory(output_wakeup_timer);
+
+    SEP_DRV_LOG_FLOW_OUT("");
+}
+
 /*
  *  @fn output_Initialized_Buffers()
  *
@@ -747,6 +1495,11 @@ output_Initialized_Buffers (
     OUTPUT_remaining_buffer_size(outbuf) = OUTPUT_BUFFER_SIZE * factor;
     OUTPUT_total_buffer_size(outbuf)     = OUTPUT_BUFFER_SIZE * factor;
     OUTPUT_tasklet_queued(outbuf)        = FALSE;
+    OUTPUT_wakeup_bytes(outbuf)          = 0;
+    OUTPUT_wakeup_records(outbuf)        = 0;
+    OUTPUT_nb_records(outbuf)            = 0;
+    OUTPUT_flip_requested(outbuf)        = FALSE;
+    OUTPUT_handoff_active(outbuf)        = FALSE;
     init_waitqueue_head(&BUFFER_DESC_queue(desc));
 
     SEP_DRV_LOG_TRACE_OUT("Res: %p.", desc);
@@ -788,6 +1541,7 @@ output_NMI_Sample_Buffer (
             wake_up_interruptible_sync(&BUFFER_DESC_queue(&cpu_buf[cpu_id]));
             OUTPUT_signal_full(outbuf) = FALSE;
             OUTPUT_tasklet_queued(outbuf) = FALSE;
+            OVERHEAD_Count_Event(DRV_OVERHEAD_EVENT_BUFFER_WAKEUPS);
         }
     }
 
@@ -797,6 +1551,7 @@ output_NMI_Sample_Buffer (
             wake_up_interruptible_sync(&BUFFER_DESC_queue(&cpu_sideband_buf[cpu_id]));
             OUTPUT_signal_full(outbuf) = FALSE;
             OUTPUT_tasklet_queued(outbuf) = FALSE;
+            OVERHEAD_Count_Event(DRV_OVERHEAD_EVENT_BUFFER_WAKEUPS);
         }
     }
 
@@ -1007,6 +1762,7 @@ OUTPUT_Initialize_UNC (void)
  *      For each CPU in the system, allocate the output buffers.
  *      Initialize a module buffer and temp file to hold module information
  *      Initialize the read queues for each sample buffer
+ *      In per-CPU EMON mode, also set up the sample buffer of each CPU.
  *
  */
 extern OS_STATUS
@@ -1014,6 +1770,7 @@ OUTPUT_Initialize_EMON (void)
 {
     BUFFER_DESC    unused;
     OS_STATUS      status = OS_SUCCESS;
+    int            i;
 
     SEP_DRV_LOG_TRACE_IN("");
 
@@ -1025,11 +1782,44 @@ OUTPUT_Initialize_EMON (void)
         return OS_NO_MEM;
     }
 
+    if (DRV_CONFIG_emon_per_cpu(drv_cfg)) {
+        for (i = 0; i < GLOBAL_STATE_num_cpus(driver_state); i++) {
+            unused = output_Initialized_Buffers(&cpu_buf[i], 1);
+            if (!unused) {
+                OUTPUT_Destroy();
+                SEP_DRV_LOG_ERROR_TRACE_OUT("OS_NO_MEM (failed to allocate per-CPU EMON buffers!).");
+                return OS_NO_MEM;
+            }
+        }
+    }
+
     SEP_DRV_LOG_TRACE_OUT("Res: %u.", (U32)status);
     return status;
 }
 
 
+/*
+ *  @fn static VOID  output_Mark_Flush(bd)
+ *
+ *  @brief  Publish the bytes written so far in the current buffer of bd
+ *
+ *  @param  bd - buffer descriptor to mark
+ *
+ *  @return None
+ *
+ */
+static VOID
+output_Mark_Flush (
+    BUFFER_DESC bd
+)
+{
+    OUTPUT outbuf = &BUFFER_DESC_outbuf(bd);
+
+    OUTPUT_buffer_full(outbuf,OUTPUT_current_buffer(outbuf)) =
+        OUTPUT_total_buffer_size(outbuf) - OUTPUT_remaining_buffer_size(outbuf);
+}
+
+
 /*
  *  @fn OS_STATUS  OUTPUT_Flush()
  *
@@ -1048,7 +1838,6 @@ OUTPUT_Flush (
 {
     int        i;
     int        writers = 0;
-    OUTPUT     outbuf;
 
     SEP_DRV_LOG_TRACE_IN("");
 
@@ -1058,83 +1847,62 @@ OUTPUT_Flush (
      */
     init_waitqueue_head(&flush_queue);
     SEP_DRV_LOG_TRACE("Waiting for %d writers.",(GLOBAL_STATE_num_cpus(driver_state)+ OTHER_C_DEVICES));
+
+    /*
+     *  Collection has stopped by the time we get here, so a single pass
+     *  over the buffers is enough to publish the residual byte counts.
+     */
     for (i = 0; i < GLOBAL_STATE_num_cpus(driver_state); i++) {
         if (CPU_STATE_initial_mask(&pcb[i]) == 0) {
             continue;
         }
-        outbuf = &(cpu_buf[i].outbuf);
+        output_Mark_Flush(&cpu_buf[i]);
         writers += 1;
-
-        OUTPUT_buffer_full(outbuf,OUTPUT_current_buffer(outbuf)) =
-            OUTPUT_total_buffer_size(outbuf) - OUTPUT_remaining_buffer_size(outbuf);
+        if (multi_pebs_enabled) {
+            output_Mark_Flush(&cpu_sideband_buf[i]);
+            writers += 1;
+        }
     }
 
     if (unc_buf_init) {
         for (i = 0; i < num_packages; i++) {
-            outbuf = &(unc_buf[i].outbuf);
+            output_Mark_Flush(&unc_buf[i]);
             writers += 1;
-
-            OUTPUT_buffer_full(outbuf,OUTPUT_current_buffer(outbuf)) =
-                OUTPUT_total_buffer_size(outbuf) - OUTPUT_remaining_buffer_size(outbuf);
         }
     }
 
-    if (multi_pebs_enabled) {
-        for (i = 0; i < GLOBAL_STATE_num_cpus(driver_state); i++) {
-            if (CPU_STATE_initial_mask(&pcb[i]) == 0) {
-                continue;
-            }
-            outbuf = &(cpu_sideband_buf[i].outbuf);
-            writers += 1;
-
-            OUTPUT_buffer_full(outbuf,OUTPUT_current_buffer(outbuf)) =
-                OUTPUT_total_buffer_size(outbuf) - OUTPUT_remaining_buffer_size(outbuf);
-        }
-    }
+    output_Mark_Flush(module_buf);
 
     atomic_set(&flush_writers, writers + OTHER_C_DEVICES);
     // Flip the switch to terminate the output threads
     // Do not do this earlier, as threads may terminate before all the data is flushed
+    smp_wmb();
     flush = 1;
+    smp_mb();
+
+    /*
+     *  Broadcast the flush to every reader in one sweep.  Use the non-sync
+     *  wake up so the readers are free to run on other CPUs and drain their
+     *  last buffers concurrently instead of one after another on this CPU.
+     */
     for (i = 0; i < GLOBAL_STATE_num_cpus(driver_state); i++) {
         if (CPU_STATE_initial_mask(&pcb[i]) == 0) {
             continue;
         }
-        outbuf = &BUFFER_DESC_outbuf(&cpu_buf[i]);
-        OUTPUT_buffer_full(outbuf,OUTPUT_current_buffer(outbuf)) =
-            OUTPUT_total_buffer_size(outbuf) - OUTPUT_remaining_buffer_size(outbuf);
-        wake_up_interruptible_sync(&BUFFER_DESC_queue(&cpu_buf[i]));
+        wake_up_interruptible(&BUFFER_DESC_queue(&cpu_buf[i]));
+        if (multi_pebs_enabled) {
+            wake_up_interruptible(&BUFFER_DESC_queue(&cpu_sideband_buf[i]));
+        }
     }
 
     if (unc_buf_init) {
         for (i = 0; i < num_packages; i++) {
-            outbuf = &BUFFER_DESC_outbuf(&unc_buf[i]);
-            OUTPUT_buffer_full(outbuf,OUTPUT_current_buffer(outbuf)) =
-                OUTPUT_total_buffer_size(outbuf) - OUTPUT_remaining_buffer_size(outbuf);
-            wake_up_interruptible_sync(&BUFFER_DESC_queue(&unc_buf[i]));
+            wake_up_interruptible(&BUFFER_DESC_queue(&unc_buf[i]));
         }
     }
 
-    if (multi_pebs_enabled) {
-        for (i = 0; i < GLOBAL_STATE_num_cpus(driver_state); i++) {
-            if (CPU_STATE_initial_mask(&pcb[i]) == 0) {
-                continue;
-            }
-            outbuf = &BUFFER_DESC_outbuf(&cpu_sideband_buf[i]);
-            OUTPUT_buffer_full(outbuf,OUTPUT_current_buffer(outbuf)) =
-                OUTPUT_total_buffer_size(outbuf) - OUTPUT_remaining_buffer_size(outbuf);
-            wake_up_interruptible_sync(&BUFFER_DESC_queue(&cpu_sideband_buf[i]));
-        }
-    }
-    // Flush all data from the module buffers
-
-    outbuf = &BUFFER_DESC_outbuf(module_buf);
-
-    OUTPUT_buffer_full(outbuf,OUTPUT_current_buffer(outbuf)) =
-        OUTPUT_total_buffer_size(outbuf) - OUTPUT_remaining_buffer_size(outbuf);
-
     SEP_DRV_LOG_TRACE("Waking up module_queue.");
-    wake_up_interruptible_sync(&BUFFER_DESC_queue(module_buf));
+    wake_up_interruptible(&BUFFER_DESC_queue(module_buf));
 
     //Wait for buffers to empty
     while (atomic_read(&flush_writers) != 0) {
@@ -1174,10 +1942,17 @@ OUTPUT_Flush_EMON (
 )
 {
     int        writers = 1;
+    int        i;
     OUTPUT     outbuf;
 
     SEP_DRV_LOG_TRACE_IN("");
 
+    // Per-CPU EMON records are drained from the s<N> devices by the
+    // collector, which merges them by interval id
+    if (DRV_CONFIG_emon_per_cpu(drv_cfg)) {
+        writers += GLOBAL_STATE_num_cpus(driver_state);
+    }
+
     /*
      *  Flush all remaining data to files
      *  set up a flush event
@@ -1196,6 +1971,15 @@ OUTPUT_Flush_EMON (
     SEP_DRV_LOG_TRACE("Waking up emon_queue.");
     wake_up_interruptible_sync(&BUFFER_DESC_queue(emon_buf));
 
+    if (DRV_CONFIG_emon_per_cpu(drv_cfg)) {
+        for (i = 0; i < GLOBAL_STATE_num_cpus(driver_state); i++) {
+            outbuf = &BUFFER_DESC_outbuf(&cpu_buf[i]);
+            OUTPUT_buffer_full(outbuf,OUTPUT_current_buffer(outbuf)) =
+                OUTPUT_total_buffer_size(outbuf) - OUTPUT_remaining_buffer_size(outbuf);
+            wake_up_interruptible_sync(&BUFFER_DESC_queue(&cpu_buf[i]));
+        }
+    }
+
     //Wait for buffers to empty
     while (atomic_read(&flush_writers) != 0) {
         unsigned long delay;
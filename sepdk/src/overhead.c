@@ -0,0 +1,325 @@
+/*COPYRIGHT**
+    Copyright (C) 2005-2020 Intel Corporation.  All Rights Reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+
+
+
+
+**COPYRIGHT*/
+
+
+
+
+
+/*
+ *  CVS_Id="$Id$"
+ */
+
+#include "lwpmudrv_defines.h"
+#include <linux/version.h>
+#include <linux/percpu.h>
+#include <linux/fs.h>
+#if defined(CONFIG_DEBUG_FS)
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#endif
+
+#include "lwpmudrv_types.h"
+#include "rise_errors.h"
+#include "lwpmudrv_ecb.h"
+#include "lwpmudrv_struct.h"
+#include "lwpmudrv_version.h"
+#include "lwpmudrv.h"
+#include "control.h"
+#include "utility.h"
+#include "overhead.h"
+
+DEFINE_PER_CPU(DRV_OVERHEAD_NODE, overhead_stats);
+
+static U64            overhead_start_tsc = 0;
+static U64            overhead_end_tsc   = 0;
+       U64            overhead_first_sample_tsc = 0;
+#if defined(CONFIG_DEBUG_FS)
+static struct dentry *overhead_debugfs_dir = NULL;
+#endif
+
+static const char* overhead_path_names[DRV_OVERHEAD_NB_PATHS] = {
+    "pmi",
+    "pebs_flush",
+    "sched_switch",
+    "module_notify",
+    "emon_timer",
+    "unc_timer",
+    "emon_snapshot",
+    "time_sync"
+};
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          VOID OVERHEAD_Reset(VOID)
+ *
+ * @brief       Clears the per-CPU statistics and starts the collection clock
+ *
+ * @param       none
+ *
+ * @return      none
+ *
+ * <I>Special Notes:</I>
+ *              Called at collection start, before interrupts are enabled.
+ */
+extern VOID
+OVERHEAD_Reset (
+    VOID
+)
+{
+    U32 cpu;
+
+    SEP_DRV_LOG_TRACE_IN("");
+
+    for_each_possible_cpu(cpu) {
+        memset(&per_cpu(overhead_stats, cpu), 0, sizeof(DRV_OVERHEAD_NODE));
+    }
+    UTILITY_Read_TSC(&overhead_start_tsc);
+    overhead_end_tsc          = 0;
+    overhead_first_sample_tsc = 0;
+
+    SEP_DRV_LOG_TRACE_OUT("");
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          VOID OVERHEAD_Stop(VOID)
+ *
+ * @brief       Stops the collection clock
+ *
+ * @param       none
+ *
+ * @return      none
+ *
+ * <I>Special Notes:</I>
+ *              The statistics are kept until the next collection starts.
+ */
+extern VOID
+OVERHEAD_Stop (
+    VOID
+)
+{
+    SEP_DRV_LOG_TRACE_IN("");
+
+    if (overhead_start_tsc && !overhead_end_tsc) {
+        UTILITY_Read_TSC(&overhead_end_tsc);
+    }
+
+    SEP_DRV_LOG_TRACE_OUT("");
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          VOID OVERHEAD_Snapshot(DRV_OVERHEAD_INFO info, U32 num_cpus)
+ *
+ * @brief       Copies the current statistics into a DRV_OVERHEAD_INFO buffer
+ *
+ * @param       info     - header, followed by room for num_cpus DRV_OVERHEAD_NODE elements
+ * @param       num_cpus - number of per-CPU elements to fill
+ *
+ * @return      none
+ *
+ * <I>Special Notes:</I>
+ *              When the collection is still running, the end of the interval is
+ *              the time of the snapshot.
+ */
+extern VOID
+OVERHEAD_Snapshot (
+    DRV_OVERHEAD_INFO info,
+    U32               num_cpus
+)
+{
+    U32 cpu;
+
+    SEP_DRV_LOG_TRACE_IN("Info: %p, num_cpus: %u.", info, num_cpus);
+
+    DRV_OVERHEAD_INFO_num_cpus(info)  = num_cpus;
+    DRV_OVERHEAD_INFO_nb_paths(info)  = DRV_OVERHEAD_NB_PATHS;
+    DRV_OVERHEAD_INFO_start_tsc(info) = overhead_start_tsc;
+    DRV_OVERHEAD_INFO_end_tsc(info)   = overhead_end_tsc;
+    DRV_OVERHEAD_INFO_first_sample_tsc(info) = overhead_first_sample_tsc;
+    if (!overhead_end_tsc) {
+        UTILITY_Read_TSC(&DRV_OVERHEAD_INFO_end_tsc(info));
+    }
+
+    for (cpu = 0; cpu < num_cpus; cpu++) {
+        memcpy(&DRV_OVERHEAD_INFO_cpu_stats(info)[cpu],
+               &per_cpu(overhead_stats, cpu),
+               sizeof(DRV_OVERHEAD_NODE));
+    }
+
+    SEP_DRV_LOG_TRACE_OUT("");
+}
+
+#if defined(CONFIG_DEBUG_FS)
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          static int overhead_Debugfs_Show(struct seq_file *m, void *v)
+ *
+ * @brief       Prints the per-CPU statistics in text form
+ *
+ * @param       m - seq_file to print to
+ * @param       v - unused
+ *
+ * @return      0
+ *
+ * <I>Special Notes:</I>
+ *              Overhead percentages are relative to the elapsed TSC time of the
+ *              last (or current) collection. Nested paths (e.g. a PEBS flush
+ *              interrupted by a PMI) are counted twice.
+ */
+static int
+overhead_Debugfs_Show (
+    struct seq_file *m,
+    void            *v
+)
+{
+    U64               elapsed;
+    U64               end_tsc = overhead_end_tsc;
+    U64               cpu_cycles;
+    U32               cpu;
+    U32               path;
+    DRV_OVERHEAD      stats;
+    DRV_OVERHEAD_PATH path_stats;
+
+    if (!end_tsc) {
+        UTILITY_Read_TSC(&end_tsc);
+    }
+    elapsed = (overhead_start_tsc && end_tsc > overhead_start_tsc) ? end_tsc - overhead_start_tsc : 0;
+
+    seq_printf(m, "elapsed_cycles %llu\n", (unsigned long long)elapsed);
+    for (cpu = 0; cpu < GLOBAL_STATE_num_cpus(driver_state); cpu++) {
+        stats      = &per_cpu(overhead_stats, cpu);
+        cpu_cycles = 0;
+        for (path = 0; path < DRV_OVERHEAD_NB_PATHS; path++) {
+            path_stats = DRV_OVERHEAD_path(stats, path);
+            if (!DRV_OVERHEAD_PATH_count(path_stats)) {
+                continue;
+            }
+            cpu_cycles += DRV_OVERHEAD_PATH_total_cycles(path_stats);
+            seq_printf(m, "cpu%u %s count %llu total_cycles %llu max_cycles %llu\n",
+                cpu, overhead_path_names[path],
+                (unsigned long long)DRV_OVERHEAD_PATH_count(path_stats),
+                (unsigned long long)DRV_OVERHEAD_PATH_total_cycles(path_stats),
+                (unsigned long long)DRV_OVERHEAD_PATH_max_cycles(path_stats));
+        }
+        seq_printf(m, "cpu%u dropped %llu wakeups %llu tasklets %llu overhead_ppm %llu\n",
+            cpu,
+            (unsigned long long)DRV_OVERHEAD_events(stats)[DRV_OVERHEAD_EVENT_DROPPED_RECORDS],
+            (unsigned long long)DRV_OVERHEAD_events(stats)[DRV_OVERHEAD_EVENT_BUFFER_WAKEUPS],
+            (unsigned long long)DRV_OVERHEAD_events(stats)[DRV_OVERHEAD_EVENT_TASKLET_SCHEDULES],
+            elapsed ? (unsigned long long)div64_u64(cpu_cycles * 1000000ULL, elapsed) : 0ULL);
+        if (DRV_OVERHEAD_events(stats)[DRV_OVERHEAD_EVENT_GROUP_SWAPS]) {
+            seq_printf(m, "cpu%u group_swaps %llu msr_writes %llu msr_writes_skipped %llu\n",
+                cpu,
+                (unsigned long long)DRV_OVERHEAD_events(stats)[DRV_OVERHEAD_EVENT_GROUP_SWAPS],
+                (unsigned long long)DRV_OVERHEAD_events(stats)[DRV_OVERHEAD_EVENT_SWAP_MSR_WRITES],
+                (unsigned long long)DRV_OVERHEAD_events(stats)[DRV_OVERHEAD_EVENT_SWAP_MSR_SKIPPED]);
+        }
+    }
+
+    return 0;
+}
+
+static int
+overhead_Debugfs_Open (
+    struct inode *inode,
+    struct file  *file
+)
+{
+    return single_open(file, overhead_Debugfs_Show, NULL);
+}
+
+static const struct file_operations overhead_debugfs_fops = {
+    .owner   = THIS_MODULE,
+    .open    = overhead_Debugfs_Open,
+    .read    = seq_read,
+    .llseek  = seq_lseek,
+    .release = single_release,
+};
+#endif
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          VOID OVERHEAD_Debugfs_Create(VOID)
+ *
+ * @brief       Exposes the statistics as <debugfs>/<driver name>/overhead
+ *
+ * @param       none
+ *
+ * @return      none
+ *
+ * <I>Special Notes:</I>
+ *              Failures are not fatal: the ioctl remains available.
+ */
+extern VOID
+OVERHEAD_Debugfs_Create (
+    VOID
+)
+{
+    SEP_DRV_LOG_TRACE_IN("");
+
+#if defined(CONFIG_DEBUG_FS)
+    overhead_debugfs_dir = debugfs_create_dir(SEP_DRIVER_NAME, NULL);
+    if (IS_ERR_OR_NULL(overhead_debugfs_dir)) {
+        overhead_debugfs_dir = NULL;
+        SEP_DRV_LOG_WARNING_TRACE_OUT("Could not create the debugfs directory.");
+        return;
+    }
+    debugfs_create_file("overhead", 0444, overhead_debugfs_dir, NULL, &overhead_debugfs_fops);
+#endif
+
+    SEP_DRV_LOG_TRACE_OUT("");
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          VOID OVERHEAD_Debugfs_Remove(VOID)
+ *
+ * @brief       Removes the debugfs entries created by OVERHEAD_Debugfs_Create
+ *
+ * @param       none
+ *
+ * @return      none
+ */
+extern VOID
+OVERHEAD_Debugfs_Remove (
+    VOID
+)
+{
+    SEP_DRV_LOG_TRACE_IN("");
+
+#if defined(CONFIG_DEBUG_FS)
+    if (overhead_debugfs_dir) {
+        debugfs_remove_recursive(overhead_debugfs_dir);
+        overhead_debugfs_dir = NULL;
+    }
+#endif
+
+    SEP_DRV_LOG_TRACE_OUT("");
+}
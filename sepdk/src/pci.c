@@ -36,6 +36,9 @@
 #include <linux/types.h>
 #include <asm/page.h>
 #include <asm/io.h>
+#if defined(CONFIG_ACPI)
+#include <linux/acpi.h>
+#endif
 
 #include "lwpmudrv_types.h"
 #include "rise_errors.h"
@@ -48,6 +51,107 @@
 
 struct pci_bus* pci_buses[MAX_BUSNO] = {0};
 
+/*
+ * ECAM windows of PCI segment 0, from the ACPI MCFG table
+ */
+typedef struct PCI_ECAM_RANGE_NODE_S  PCI_ECAM_RANGE_NODE;
+
+struct PCI_ECAM_RANGE_NODE_S {
+    U64    base;
+    U32    start_bus;
+    U32    end_bus;
+};
+
+static PCI_ECAM_RANGE_NODE  pci_ecam_ranges[PCI_MAX_ECAM_RANGES];
+static U32                  pci_num_ecam_ranges = 0;
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn static VOID pci_Read_MCFG(VOID)
+ *
+ * @param   none
+ *
+ * @return  none
+ *
+ * @brief   Record the ECAM (MMCONFIG) windows of PCI segment 0 described
+ *          by the ACPI MCFG table, if any.
+ *
+ */
+static VOID
+pci_Read_MCFG (
+    VOID
+)
+{
+#if defined(CONFIG_ACPI)
+    struct acpi_table_header    *hdr = NULL;
+    struct acpi_mcfg_allocation *alloc;
+    U32                          i, n;
+
+    SEP_DRV_LOG_INIT_IN("");
+
+    pci_num_ecam_ranges = 0;
+    if (ACPI_FAILURE(acpi_get_table(ACPI_SIG_MCFG, 0, &hdr)) || !hdr) {
+        SEP_DRV_LOG_INIT_OUT("No MCFG table.");
+        return;
+    }
+    if (hdr->length < sizeof(struct acpi_table_mcfg)) {
+        SEP_DRV_LOG_INIT_OUT("Malformed MCFG table.");
+        return;
+    }
+
+    n     = (hdr->length - sizeof(struct acpi_table_mcfg)) / sizeof(struct acpi_mcfg_allocation);
+    alloc = (struct acpi_mcfg_allocation *)((U8 *)hdr + sizeof(struct acpi_table_mcfg));
+    for (i = 0; i < n && pci_num_ecam_ranges < PCI_MAX_ECAM_RANGES; i++) {
+        if (alloc[i].pci_segment != 0 || !alloc[i].address) {
+            continue;
+        }
+        pci_ecam_ranges[pci_num_ecam_ranges].base      = alloc[i].address;
+        pci_ecam_ranges[pci_num_ecam_ranges].start_bus = alloc[i].start_bus_number;
+        pci_ecam_ranges[pci_num_ecam_ranges].end_bus   = alloc[i].end_bus_number;
+        SEP_DRV_LOG_DETECTION("ECAM window 0x%llx for buses 0x%x-0x%x.",
+                              alloc[i].address, alloc[i].start_bus_number, alloc[i].end_bus_number);
+        pci_num_ecam_ranges++;
+    }
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,10,0)
+    acpi_put_table(hdr);
+#endif
+
+    SEP_DRV_LOG_INIT_OUT("Found %u ECAM windows.", pci_num_ecam_ranges);
+#endif
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn extern U64 PCI_Get_ECAM_Address(bus)
+ *
+ * @param   bus - target bus
+ *
+ * @return  physical address of the bus configuration window, 0 if unknown
+ *
+ * @brief   Locate the memory-mapped configuration space of a bus. The
+ *          window covers PCI_ECAM_BUS_SIZE bytes, registers are found at
+ *          PCI_ECAM_OFFSET(device, function, offset).
+ *
+ */
+extern U64
+PCI_Get_ECAM_Address (
+    U32    bus
+)
+{
+    U32 i;
+
+    for (i = 0; i < pci_num_ecam_ranges; i++) {
+        if (bus >= pci_ecam_ranges[i].start_bus && bus <= pci_ecam_ranges[i].end_bus) {
+            // The MCFG base address is that of bus 0, whatever the start bus
+            return pci_ecam_ranges[i].base + (U64)bus * PCI_ECAM_BUS_SIZE;
+        }
+    }
+
+    return 0;
+}
+
 
 /* ------------------------------------------------------------------------- */
 /*!
@@ -78,6 +182,8 @@ extern VOID PCI_Initialize (
         SEP_DRV_LOG_TRACE("pci_buses[%u]: %p.", i, pci_buses[i]);
     }
 
+    pci_Read_MCFG();
+
     SEP_DRV_LOG_INIT_OUT("Found %u buses.", num_found_buses);
 }
 
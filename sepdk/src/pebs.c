@@ -49,6 +49,7 @@
 #include "output.h"
 #include "ecb_iterators.h"
 #include "pebs.h"
+#include "overhead.h"
 
 static PVOID                          pebs_global_memory      = NULL;
 static size_t                         pebs_global_memory_size = 0;
@@ -860,6 +861,7 @@ PEBS_Flush_Buffer(
     DEV_CONFIG       pcfg;
     U32              cur_grp;
     DRV_BOOL         multi_pebs_enabled;
+    U64              start_tsc;
 
     SEP_DRV_LOG_TRACE_IN("Param: %p.", param);
 
@@ -883,6 +885,7 @@ PEBS_Flush_Buffer(
         return;
     }
 
+    UTILITY_Read_TSC(&start_tsc);
     u32PebsRecordNumFilled = PEBS_Get_Num_Records_Filled();
     for (i = 0; i < u32PebsRecordNumFilled; i++) {
         pebs_overflow_status = PEBS_Overflowed(this_cpu, 0, i);
@@ -976,6 +979,7 @@ PEBS_Flush_Buffer(
         } END_FOR_EACH_DATA_REG;
     }
     PEBS_Reset_Index(this_cpu);
+    OVERHEAD_Record(DRV_OVERHEAD_PATH_PEBS_FLUSH, start_tsc);
 
     SEP_DRV_LOG_TRACE_OUT("");
 }
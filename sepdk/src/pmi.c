@@ -51,6 +51,14 @@
 #include "pmi.h"
 #include "utility.h"
 #include "pebs.h"
+#include "overhead.h"
+#include "throttle.h"
+#include "reconfig.h"
+#include "callstack.h"
+#include "eventmux.h"
+#include "marker.h"
+#include "filter.h"
+#include "timesync.h"
 
 #include "sepdrv_p_state.h"
 
@@ -158,11 +166,15 @@ PMI_Interrupt_Handler (
     uid_t            l_uid;
 #endif
     U64              lbr_tos_from_ip  = 0;
+    S8              *callstack        = NULL;
+    S8              *callstack_first  = NULL;
     U32              unc_dev_idx;
     DEV_UNC_CONFIG   pcfg_unc         = NULL;
     DISPATCH         dispatch_unc     = NULL;
     U32              read_unc_evt_counts_from_intr = 0;
+    U64              start_tsc;
 
+    UTILITY_Read_TSC(&start_tsc);
     SEP_DRV_LOG_INTERRUPT_IN("PID: %d, TID: %d.", current->pid, GET_CURRENT_TGID()); // needs to be before function calls for the tracing to make sense
                                                                                      // may later want to separate the INTERRUPT_IN from the PID/TID logging
 
@@ -185,7 +197,8 @@ PMI_Interrupt_Handler (
 #endif
     dispatch->check_overflow(&event_mask);
     if (GET_DRIVER_STATE() != DRV_STATE_RUNNING       ||
-        CPU_STATE_accept_interrupt(&pcb[this_cpu]) != 1) {
+        CPU_STATE_accept_interrupt(&pcb[this_cpu]) != 1 ||
+        TIMESYNC_Writing(this_cpu)) {
         goto pmi_cleanup;
     }
 
@@ -195,11 +208,17 @@ PMI_Interrupt_Handler (
     if (DRV_CONFIG_target_pid(drv_cfg) > 0 && pid != DRV_CONFIG_target_pid(drv_cfg)) {
         accept_interrupt = 0;
     }
+    else if (!FILTER_Accept_Current(this_cpu)) {
+        accept_interrupt = 0;
+    }
 
     if (accept_interrupt == 0) {
         goto pmi_cleanup;
     }
     UTILITY_Read_TSC(&tsc);
+    if (RECONFIG_Record_Pending(this_cpu)) {
+        RECONFIG_Write_Record(bd, this_cpu, tsc);
+    }
     if (multi_pebs_enabled
         && PEBS_Get_Num_Records_Filled() > 0) {
         PEBS_Flush_Buffer(NULL);
@@ -239,6 +258,7 @@ PMI_Interrupt_Handler (
         }
         lbr_tos_from_ip                        = 0;
         CPU_STATE_num_samples(pcpu)           += 1;
+        OVERHEAD_Note_Sample(tsc);
         SAMPLE_RECORD_descriptor_id(psamp)     = desc_id;
         SAMPLE_RECORD_tsc(psamp)               = tsc;
         SAMPLE_RECORD_pid_rec_index_raw(psamp) = 1;
@@ -313,6 +333,17 @@ PMI_Interrupt_Handler (
            !DEV_CONFIG_apebs_collect_lbrs(pcfg)) {
             lbr_tos_from_ip = dispatch->read_lbrs(!DEV_CONFIG_store_lbrs(pcfg) ? NULL:((S8 *)(psamp)+EVENT_DESC_lbr_offset(evt_desc)));
         }
+        if (DEV_CONFIG_collect_callstacks(pcfg) && EVENT_DESC_callstack_offset(evt_desc)) {
+            callstack = (S8 *)(psamp) + EVENT_DESC_callstack_offset(evt_desc);
+            // one walk per interrupt, the other samples of this PMI share it
+            if (callstack_first) {
+                CALLSTACK_Copy(callstack, EVENT_DESC_callstack_size(evt_desc), callstack_first);
+            }
+            else if (CALLSTACK_Capture(regs, callstack, EVENT_DESC_callstack_size(evt_desc),
+                                       DEV_CONFIG_collect_kernel_callstacks(pcfg))) {
+                callstack_first = callstack;
+            }
+        }
         if (DRV_EVENT_MASK_branch(&event_mask.eventmasks[i]) &&
             DEV_CONFIG_precise_ip_lbrs(pcfg)                 &&
             lbr_tos_from_ip) {
@@ -360,6 +391,14 @@ PMI_Interrupt_Handler (
         }
     }
 
+    if (THROTTLE_Record_Pending(this_cpu)) {
+        THROTTLE_Write_Record(bd, this_cpu, tsc);
+    }
+    if (CPU_STATE_em_time_pending(&pcb[this_cpu])) {
+        EVENTMUX_Write_Time_Records(bd, this_cpu);
+    }
+    MARKER_Write_Records(bd, this_cpu);
+
 pmi_cleanup:
     if (DEV_CONFIG_pebs_mode(pcfg)) {
         if (!multi_pebs_enabled) {
@@ -385,6 +424,8 @@ pmi_cleanup:
     dispatch->restart(NULL);
     SYS_Locked_Dec(&CPU_STATE_in_interrupt(&pcb[this_cpu])); // do not use SEP_DRV_LOG_X (where X != INTERRUPT) below this
 
+    OVERHEAD_Record(DRV_OVERHEAD_PATH_PMI, start_tsc);
+
     SEP_DRV_LOG_INTERRUPT_OUT("");
     return;
 }
@@ -0,0 +1,331 @@
+/*COPYRIGHT**
+    Copyright (C) 2005-2020 Intel Corporation.  All Rights Reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+
+
+
+
+**COPYRIGHT*/
+
+
+
+
+
+/*
+ *  CVS_Id="$Id$"
+ */
+
+#include "lwpmudrv_defines.h"
+#include <linux/version.h>
+#include <linux/percpu.h>
+
+#include "lwpmudrv_types.h"
+#include "rise_errors.h"
+#include "lwpmudrv_ecb.h"
+#include "lwpmudrv_struct.h"
+#include "lwpmudrv.h"
+#include "control.h"
+#include "utility.h"
+#include "output.h"
+#include "reconfig.h"
+
+U64 reconfig_epoch = 0;
+DEFINE_PER_CPU(U64, reconfig_cpu_epoch);
+
+static DRV_RECONFIG_NODE  reconfig_req;
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          VOID RECONFIG_Reset(VOID)
+ *
+ * @brief       Restarts the config epochs for a new collection
+ *
+ * @param       none
+ *
+ * @return      none
+ *
+ * <I>Special Notes:</I>
+ *              Called at collection start. Epoch 0 is the configuration sent
+ *              before the start, so no record is written until the first
+ *              reconfiguration.
+ */
+extern VOID
+RECONFIG_Reset (
+    VOID
+)
+{
+    U32 cpu;
+
+    SEP_DRV_LOG_TRACE_IN("");
+
+    reconfig_epoch = 0;
+    for_each_possible_cpu(cpu) {
+        per_cpu(reconfig_cpu_epoch, cpu) = 0;
+    }
+    memset(&reconfig_req, 0, sizeof(DRV_RECONFIG_NODE));
+    DRV_RECONFIG_group(&reconfig_req) = DRV_RECONFIG_KEEP_GROUP;
+
+    SEP_DRV_LOG_TRACE_OUT("");
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          static OS_STATUS reconfig_Walk_ECBs(DRV_BOOL apply)
+ *
+ * @brief       Checks (apply FALSE) or installs (apply TRUE) the requested sample-after values
+ *
+ * @param       apply - FALSE to only validate the request, TRUE to update the ECBs
+ *
+ * @return      OS_SUCCESS, or OS_INVALID if an event cannot be changed
+ *
+ * <I>Special Notes:</I>
+ *              Every requested event must be a non-precise sampling event of
+ *              at least one core group. The same walk is used for both passes
+ *              so that nothing is changed unless the whole request is valid.
+ */
+static OS_STATUS
+reconfig_Walk_ECBs (
+    DRV_BOOL apply
+)
+{
+    U32      dev_idx;
+    S32      grp;
+    U32      i;
+    U32      j;
+    ECB      pecb;
+    U64      mask;
+    U64      sav;
+    DRV_BOOL found[DRV_RECONFIG_MAX_EVENTS];
+
+    memset(found, 0, sizeof(found));
+
+    for (dev_idx = 0; dev_idx < num_core_devs; dev_idx++) {
+        if (!LWPMU_DEVICE_PMU_register_data(&devices[dev_idx])) {
+            continue;
+        }
+        for (grp = 0; grp < LWPMU_DEVICE_em_groups_count(&devices[dev_idx]); grp++) {
+            pecb = LWPMU_DEVICE_PMU_register_data(&devices[dev_idx])[grp];
+            if (!pecb) {
+                continue;
+            }
+            for (i = ECB_operations_register_start(pecb, PMU_OPERATION_DATA_ALL);
+                 i < ECB_operations_register_start(pecb, PMU_OPERATION_DATA_ALL) +
+                     ECB_operations_register_len(pecb, PMU_OPERATION_DATA_ALL); i++) {
+                for (j = 0; j < DRV_RECONFIG_num_events(&reconfig_req); j++) {
+                    if (DRV_RECONFIG_EVENT_event_index(&DRV_RECONFIG_events(&reconfig_req)[j]) ==
+                        ECB_entries_event_id_index(pecb, i)) {
+                        break;
+                    }
+                }
+                if (j == DRV_RECONFIG_num_events(&reconfig_req) ||
+                    ECB_entries_reg_id(pecb, i) == 0 ||
+                    !(ECB_entries_fixed_reg_get(pecb, i) || ECB_entries_is_gp_reg_get(pecb, i))) {
+                    continue;
+                }
+                mask = ECB_entries_max_bits(pecb, i);
+                sav  = DRV_RECONFIG_EVENT_sample_after(&DRV_RECONFIG_events(&reconfig_req)[j]);
+                if (!apply) {
+                    if (ECB_entries_precise_get(pecb, i)) {
+                        SEP_DRV_LOG_ERROR("Event %u is precise and cannot be reconfigured.",
+                                          ECB_entries_event_id_index(pecb, i));
+                        return OS_INVALID;
+                    }
+                    // counting-only events have no interrupt enabled, a reload value would not make them sample
+                    if (ECB_entries_reg_value(pecb, i) == 0) {
+                        SEP_DRV_LOG_ERROR("Event %u is not a sampling event.",
+                                          ECB_entries_event_id_index(pecb, i));
+                        return OS_INVALID;
+                    }
+                    if (mask == 0 || sav == 0 || sav > (mask >> 1)) {
+                        SEP_DRV_LOG_ERROR("Sample-after %llu is out of range for event %u.",
+                                          sav, ECB_entries_event_id_index(pecb, i));
+                        return OS_INVALID;
+                    }
+                    found[j] = TRUE;
+                    continue;
+                }
+                ECB_entries_reg_value(pecb, i) = (mask - sav + 1) & mask;
+            }
+        }
+    }
+
+    if (!apply) {
+        for (j = 0; j < DRV_RECONFIG_num_events(&reconfig_req); j++) {
+            if (!found[j]) {
+                SEP_DRV_LOG_ERROR("Event %u is not collected.",
+                                  DRV_RECONFIG_EVENT_event_index(&DRV_RECONFIG_events(&reconfig_req)[j]));
+                return OS_INVALID;
+            }
+        }
+    }
+
+    return OS_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          OS_STATUS RECONFIG_Prepare(DRV_RECONFIG cfg)
+ *
+ * @brief       Validates and stores a reconfiguration request
+ *
+ * @param       cfg - request received from user mode
+ *
+ * @return      OS_STATUS
+ *
+ * <I>Special Notes:</I>
+ *              Nothing is changed yet. A group can only be selected when the
+ *              groups are switched by user mode: with timer multiplexing every
+ *              CPU already rotates through all of them.
+ */
+extern OS_STATUS
+RECONFIG_Prepare (
+    DRV_RECONFIG cfg
+)
+{
+    U32          dev_idx;
+    EVENT_CONFIG ec;
+    OS_STATUS    status;
+
+    SEP_DRV_LOG_FLOW_IN("Cfg: %p.", cfg);
+
+    if (DRV_RECONFIG_num_events(cfg) > DRV_RECONFIG_MAX_EVENTS) {
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Too many events (%u)!", DRV_RECONFIG_num_events(cfg));
+        return OS_INVALID;
+    }
+    if (!DRV_RECONFIG_num_events(cfg) && DRV_RECONFIG_group(cfg) == DRV_RECONFIG_KEEP_GROUP) {
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Empty request!");
+        return OS_INVALID;
+    }
+
+    if (DRV_RECONFIG_group(cfg) != DRV_RECONFIG_KEEP_GROUP) {
+        for (dev_idx = 0; dev_idx < num_core_devs; dev_idx++) {
+            ec = LWPMU_DEVICE_ec(&devices[dev_idx]);
+            if (!ec) {
+                continue;
+            }
+            if (EVENT_CONFIG_mode(ec) != EM_DISABLED) {
+                SEP_DRV_LOG_ERROR_FLOW_OUT("Cannot select a group while multiplexing!");
+                return OS_INVALID;
+            }
+            if (DRV_RECONFIG_group(cfg) >= (U32)EVENT_CONFIG_num_groups(ec)) {
+                SEP_DRV_LOG_ERROR_FLOW_OUT("Group %u is out of range!", DRV_RECONFIG_group(cfg));
+                return OS_INVALID;
+            }
+        }
+    }
+
+    memcpy(&reconfig_req, cfg, sizeof(DRV_RECONFIG_NODE));
+    status = reconfig_Walk_ECBs(FALSE);
+    if (status != OS_SUCCESS) {
+        memset(&reconfig_req, 0, sizeof(DRV_RECONFIG_NODE));
+        DRV_RECONFIG_group(&reconfig_req) = DRV_RECONFIG_KEEP_GROUP;
+    }
+
+    SEP_DRV_LOG_FLOW_OUT("Return value: %d.", status);
+    return status;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          VOID RECONFIG_Apply(VOID)
+ *
+ * @brief       Installs the prepared sample-after values and opens a new epoch
+ *
+ * @param       none
+ *
+ * @return      none
+ *
+ * <I>Special Notes:</I>
+ *              Must be called with the collection paused. The PMUs pick the
+ *              values up when they are reloaded with the current group.
+ */
+extern VOID
+RECONFIG_Apply (
+    VOID
+)
+{
+    SEP_DRV_LOG_FLOW_IN("");
+
+    reconfig_Walk_ECBs(TRUE);
+    reconfig_epoch++;
+
+    SEP_DRV_LOG_FLOW_OUT("Epoch: %llu.", reconfig_epoch);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          U32 RECONFIG_Group(VOID)
+ *
+ * @brief       Returns the group requested by the prepared reconfiguration
+ *
+ * @param       none
+ *
+ * @return      group index, or DRV_RECONFIG_KEEP_GROUP
+ */
+extern U32
+RECONFIG_Group (
+    VOID
+)
+{
+    return DRV_RECONFIG_group(&reconfig_req);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          VOID RECONFIG_Write_Record(BUFFER_DESC bd, U32 this_cpu, U64 tsc)
+ *
+ * @brief       Writes a config epoch record in a CPU's sample stream
+ *
+ * @param       bd       - output buffer of the CPU
+ * @param       this_cpu - current CPU
+ * @param       tsc      - time stamp of the record
+ *
+ * <I>Special Notes:</I>
+ *              Called on each CPU when its PMU is reloaded. If the record
+ *              cannot be written, the PMI handler retries before the next
+ *              samples of that CPU.
+ */
+extern VOID
+RECONFIG_Write_Record (
+    BUFFER_DESC bd,
+    U32         this_cpu,
+    U64         tsc
+)
+{
+    DRV_CONFIG_EPOCH_RECORD rec;
+    U64                     epoch = reconfig_epoch;
+
+    rec = (DRV_CONFIG_EPOCH_RECORD)OUTPUT_Reserve_Buffer_Space(bd, sizeof(DRV_CONFIG_EPOCH_RECORD_NODE), (NMI_mode)? TRUE:FALSE, !SEP_IN_NOTIFICATION);
+    if (!rec) {
+        return;
+    }
+
+    DRV_CONFIG_EPOCH_RECORD_descriptor_id(rec) = DRV_CONFIG_EPOCH_DESCRIPTOR_ID;
+    DRV_CONFIG_EPOCH_RECORD_osid(rec)          = OS_ID_NATIVE;
+    DRV_CONFIG_EPOCH_RECORD_cpu_num(rec)       = this_cpu;
+    DRV_CONFIG_EPOCH_RECORD_group(rec)         = CPU_STATE_current_group(&pcb[this_cpu]);
+    DRV_CONFIG_EPOCH_RECORD_epoch(rec)         = epoch;
+    DRV_CONFIG_EPOCH_RECORD_tsc(rec)           = tsc;
+
+    per_cpu(reconfig_cpu_epoch, this_cpu) = epoch;
+}
@@ -33,6 +33,7 @@
 #include "lwpmudrv_defines.h"
 #include <linux/version.h>
 #include <linux/mm.h>
+#include <linux/ktime.h>
 #include <asm/apic.h>
 
 #include "lwpmudrv_types.h"
@@ -53,6 +54,8 @@ static size_t           ioctl_sys_info_size = 0;
 static U32             *cpuid_entry_count   = NULL;
 static U32             *cpuid_total_count   = NULL;
        U32             *cpu_built_sysinfo   = NULL;
+static U64              sys_info_epoch      = 0;
+static atomic_t         sys_info_updates    = ATOMIC_INIT(0);
 
 static U32             cpu_threads_per_core  = 1;
 
@@ -1009,6 +1012,9 @@ SYS_INFO_Build (
      */
     cpuid_entry_count = CONTROL_Free_Memory(cpuid_entry_count);
 
+    /* Wall clock time of the build tells a reloaded driver's cache apart */
+    sys_info_epoch = ktime_get_real_ns() | 1;
+
     res = ioctl_sys_info_size - sizeof(GENERIC_IOCTL);
 
     SEP_DRV_LOG_TRACE_OUT("Res: %u.", res);
@@ -1076,6 +1082,7 @@ SYS_INFO_Destroy (
     cpu_built_sysinfo   = CONTROL_Free_Memory(cpu_built_sysinfo);
     ioctl_sys_info      = CONTROL_Free_Memory(ioctl_sys_info);
     ioctl_sys_info_size = 0;
+    sys_info_epoch      = 0;
 
     SEP_DRV_LOG_TRACE_OUT("");
     return;
@@ -1123,8 +1130,36 @@ SYS_INFO_Build_Cpu(
 
     sys_info_Build_Percpu((VOID *)gen_per_cpu);
     sys_info_Update_Hyperthreading_Info((VOID *)gen_per_cpu);
+    atomic_inc(&sys_info_updates);
 
     SEP_DRV_LOG_TRACE_OUT("");
     return;
 }
 
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn extern U64 SYS_INFO_Generation(void)
+ *
+ * @param    None
+ * @return   U64 - generation of the cached sys info, 0 if there is none
+ *
+ * @brief  Identifies the content of the sys info built by SYS_INFO_Build
+ *
+ * <I>Special Notes:</I>
+ *         The value changes whenever a CPU entry is rebuilt (CPU brought
+ *         online) and when the driver is reloaded, so user mode can keep the
+ *         system configuration and topology replies across collections and
+ *         only fetch them again when the generation moves.
+ */
+extern U64
+SYS_INFO_Generation (
+    VOID
+)
+{
+    if (!ioctl_sys_info) {
+        return 0;
+    }
+
+    return sys_info_epoch + (U64)atomic_read(&sys_info_updates);
+}
+
@@ -0,0 +1,519 @@
+/*COPYRIGHT**
+    Copyright (C) 2005-2020 Intel Corporation.  All Rights Reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+
+
+
+
+**COPYRIGHT*/
+
+
+
+
+
+/*
+ *  CVS_Id="$Id$"
+ */
+
+#include "lwpmudrv_defines.h"
+#include <linux/version.h>
+#include <linux/percpu.h>
+#include <linux/jiffies.h>
+#include <linux/timer.h>
+
+#include "lwpmudrv_types.h"
+#include "rise_errors.h"
+#include "lwpmudrv_ecb.h"
+#include "lwpmudrv_struct.h"
+#include "lwpmudrv.h"
+#include "control.h"
+#include "utility.h"
+#include "output.h"
+#include "overhead.h"
+#include "throttle.h"
+
+/*
+ * Per-CPU values from the previous governor tick
+ */
+typedef struct THROTTLE_CPU_NODE_S  THROTTLE_CPU_NODE;
+typedef        THROTTLE_CPU_NODE   *THROTTLE_CPU;
+
+struct THROTTLE_CPU_NODE_S {
+    U32   nmi_handled;
+    U32   reserved;
+    U64   pmi_cycles;
+};
+
+#define THROTTLE_CPU_nmi_handled(x)     (x)->nmi_handled
+#define THROTTLE_CPU_pmi_cycles(x)      (x)->pmi_cycles
+
+U64 throttle_epoch = 0;
+DEFINE_PER_CPU(U64, throttle_cpu_epoch);
+
+static DRV_THROTTLE_CONFIG_NODE  throttle_cfg;
+static struct timer_list        *throttle_timer     = NULL;
+static unsigned long             throttle_interval  = 0;
+static U32                       throttle_factor    = 1;
+static U32                       throttle_max       = 1;
+static U64                      *throttle_saved     = NULL;  // original reload values, in ECB walk order
+static U32                       throttle_nb_saved  = 0;
+static THROTTLE_CPU              throttle_cpus      = NULL;
+static U64                       throttle_last_tsc  = 0;
+static unsigned long             throttle_last_jiffies = 0;
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          OS_STATUS THROTTLE_Configure(DRV_THROTTLE_CONFIG cfg)
+ *
+ * @brief       Stores the governor settings
+ *
+ * @param       cfg - settings requested by the collector
+ *
+ * @return      OS_STATUS
+ *
+ * <I>Special Notes:</I>
+ *              The settings take effect at the next collection start. A
+ *              configuration without any ceiling leaves the governor off.
+ */
+extern OS_STATUS
+THROTTLE_Configure (
+    DRV_THROTTLE_CONFIG cfg
+)
+{
+    SEP_DRV_LOG_TRACE_IN("Cfg: %p.", cfg);
+
+    if (!cfg) {
+        SEP_DRV_LOG_ERROR_TRACE_OUT("Invalid configuration!");
+        return OS_INVALID;
+    }
+    if (DRV_THROTTLE_CONFIG_max_buffer_fill_pct(cfg) > 100) {
+        SEP_DRV_LOG_ERROR_TRACE_OUT("Invalid buffer fill ceiling: %u!", DRV_THROTTLE_CONFIG_max_buffer_fill_pct(cfg));
+        return OS_INVALID;
+    }
+
+    memcpy(&throttle_cfg, cfg, sizeof(DRV_THROTTLE_CONFIG_NODE));
+    if (!DRV_THROTTLE_CONFIG_interval_ms(&throttle_cfg)) {
+        DRV_THROTTLE_CONFIG_interval_ms(&throttle_cfg) = DRV_THROTTLE_DEFAULT_INTERVAL_MS;
+    }
+    if (!DRV_THROTTLE_CONFIG_max_factor(&throttle_cfg)) {
+        DRV_THROTTLE_CONFIG_max_factor(&throttle_cfg) = DRV_THROTTLE_DEFAULT_MAX_FACTOR;
+    }
+    if (!DRV_THROTTLE_CONFIG_max_samples_per_sec(&throttle_cfg) &&
+        !DRV_THROTTLE_CONFIG_max_overhead_ppm(&throttle_cfg)    &&
+        !DRV_THROTTLE_CONFIG_max_buffer_fill_pct(&throttle_cfg)) {
+        DRV_THROTTLE_CONFIG_enabled(&throttle_cfg) = 0;
+    }
+
+    SEP_DRV_LOG_TRACE_OUT("Enabled: %u, interval: %u ms, max factor: %u.",
+                          DRV_THROTTLE_CONFIG_enabled(&throttle_cfg),
+                          DRV_THROTTLE_CONFIG_interval_ms(&throttle_cfg),
+                          DRV_THROTTLE_CONFIG_max_factor(&throttle_cfg));
+    return OS_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          static VOID throttle_Walk_ECBs(U32 factor)
+ *
+ * @brief       Saves (factor 0), scales or restores (factor 1) the reload values of the core sampling events
+ *
+ * @param       factor - 0 to save the original values, otherwise the scaling factor to apply
+ *
+ * @return      none
+ *
+ * <I>Special Notes:</I>
+ *              Only counters that are actually sampling (non-zero sample-after
+ *              value) and that are not precise are scaled: PEBS counters reload
+ *              from the DS area instead of the ECB. The new values are loaded
+ *              by the dispatch check_overflow/swap_group paths, i.e. at the
+ *              next overflow or group switch of each counter.
+ */
+static VOID
+throttle_Walk_ECBs (
+    U32 factor
+)
+{
+    U32 dev_idx;
+    S32 grp;
+    U32 i;
+    U32 k = 0;
+    ECB pecb;
+    U64 mask;
+    U64 sav;
+
+    for (dev_idx = 0; dev_idx < num_core_devs; dev_idx++) {
+        if (!LWPMU_DEVICE_PMU_register_data(&devices[dev_idx])) {
+            continue;
+        }
+        for (grp = 0; grp < LWPMU_DEVICE_em_groups_count(&devices[dev_idx]); grp++) {
+            pecb = LWPMU_DEVICE_PMU_register_data(&devices[dev_idx])[grp];
+            if (!pecb) {
+                continue;
+            }
+            for (i = ECB_operations_register_start(pecb, PMU_OPERATION_DATA_ALL);
+                 i < ECB_operations_register_start(pecb, PMU_OPERATION_DATA_ALL) +
+                     ECB_operations_register_len(pecb, PMU_OPERATION_DATA_ALL); i++) {
+                if (factor == 0) {
+                    if (throttle_saved) {
+                        throttle_saved[k] = ECB_entries_reg_value(pecb, i);
+                    }
+                    k++;
+                    continue;
+                }
+                if (k >= throttle_nb_saved) {
+                    return;
+                }
+                mask = ECB_entries_max_bits(pecb, i);
+                sav  = (mask - throttle_saved[k] + 1) & mask;
+                k++;
+                if (ECB_entries_reg_id(pecb, i) == 0 || ECB_entries_precise_get(pecb, i) ||
+                    !(ECB_entries_fixed_reg_get(pecb, i) || ECB_entries_is_gp_reg_get(pecb, i)) ||
+                    mask == 0 || sav == 0) {
+                    continue;
+                }
+                if (factor == 1) {
+                    ECB_entries_reg_value(pecb, i) = throttle_saved[k - 1];
+                    continue;
+                }
+                // keep the preset a large negative value so the counter cannot overflow right away
+                if (sav > (mask >> 1) / factor) {
+                    sav = mask >> 1;
+                }
+                else {
+                    sav *= factor;
+                }
+                ECB_entries_reg_value(pecb, i) = (mask - sav + 1) & mask;
+            }
+        }
+    }
+
+    if (factor == 0) {
+        throttle_nb_saved = k;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          static U32 throttle_Buffer_Fill_Pct(U32 cpu)
+ *
+ * @brief       Returns how full the sample output buffers of a CPU are
+ *
+ * @param       cpu - CPU index
+ *
+ * @return      percentage of the total buffer space holding unread data
+ *
+ * <I>Special Notes:</I>
+ *              Read without the buffer lock; the value is only a hint.
+ */
+static U32
+throttle_Buffer_Fill_Pct (
+    U32 cpu
+)
+{
+    OUTPUT outbuf;
+    U64    used  = 0;
+    U64    total;
+    U32    j;
+
+    if (!cpu_buf) {
+        return 0;
+    }
+    outbuf = &BUFFER_DESC_outbuf(&cpu_buf[cpu]);
+    total  = (U64)OUTPUT_total_buffer_size(outbuf) * OUTPUT_NUM_BUFFERS;
+    if (!total) {
+        return 0;
+    }
+    for (j = 0; j < OUTPUT_NUM_BUFFERS; j++) {
+        used += OUTPUT_buffer_full(outbuf, j);
+    }
+    if (!OUTPUT_buffer_full(outbuf, OUTPUT_current_buffer(outbuf))) {
+        used += OUTPUT_total_buffer_size(outbuf) - OUTPUT_remaining_buffer_size(outbuf);
+    }
+
+    return (U32)div64_u64(used * 100, total);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          static VOID throttle_Governor(...)
+ *
+ * @brief       Governor tick: adjusts the scaling factor from the last interval's load
+ *
+ * @param       tl/arg - timer
+ *
+ * @return      none
+ *
+ * <I>Special Notes:</I>
+ *              The factor doubles when any CPU is above one of the ceilings and
+ *              halves when all CPUs are below a quarter of every ceiling, so
+ *              that halving cannot immediately bring the load back over it.
+ */
+static VOID
+throttle_Governor (
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,15,0)
+    struct timer_list *tl
+#else
+    unsigned long arg
+#endif
+)
+{
+    U32      cpu;
+    U32      nmi_handled;
+    U64      pmi_cycles;
+    U64      now_tsc;
+    U64      elapsed_tsc;
+    U64      elapsed_ms;
+    U64      rate;
+    U64      ppm;
+    U32      fill;
+    DRV_BOOL over  = FALSE;
+    DRV_BOOL under = TRUE;
+    U32      new_factor;
+
+    if (!DRIVER_STATE_IN(GET_DRIVER_STATE(), STATE_BIT_RUNNING | STATE_BIT_PAUSED)) {
+        return;
+    }
+
+    UTILITY_Read_TSC(&now_tsc);
+    elapsed_tsc = now_tsc - throttle_last_tsc;
+    elapsed_ms  = jiffies_to_msecs(jiffies - throttle_last_jiffies);
+    if (!elapsed_ms) {
+        elapsed_ms = 1;
+    }
+    if (!elapsed_tsc) {
+        elapsed_tsc = 1;
+    }
+
+    for (cpu = 0; cpu < (U32)GLOBAL_STATE_num_cpus(driver_state); cpu++) {
+        nmi_handled = CPU_STATE_nmi_handled(&pcb[cpu]);
+        pmi_cycles  = DRV_OVERHEAD_PATH_total_cycles(DRV_OVERHEAD_path(&per_cpu(overhead_stats, cpu), DRV_OVERHEAD_PATH_PMI));
+        rate        = div64_u64((U64)(nmi_handled - THROTTLE_CPU_nmi_handled(&throttle_cpus[cpu])) * 1000, elapsed_ms);
+        ppm         = div64_u64((pmi_cycles - THROTTLE_CPU_pmi_cycles(&throttle_cpus[cpu])) * 1000000, elapsed_tsc);
+        fill        = throttle_Buffer_Fill_Pct(cpu);
+        THROTTLE_CPU_nmi_handled(&throttle_cpus[cpu]) = nmi_handled;
+        THROTTLE_CPU_pmi_cycles(&throttle_cpus[cpu])  = pmi_cycles;
+
+        if (DRV_THROTTLE_CONFIG_max_samples_per_sec(&throttle_cfg)) {
+            if (rate > DRV_THROTTLE_CONFIG_max_samples_per_sec(&throttle_cfg)) {
+                over = TRUE;
+            }
+            if (rate * 4 > DRV_THROTTLE_CONFIG_max_samples_per_sec(&throttle_cfg)) {
+                under = FALSE;
+            }
+        }
+        if (DRV_THROTTLE_CONFIG_max_overhead_ppm(&throttle_cfg)) {
+            if (ppm > DRV_THROTTLE_CONFIG_max_overhead_ppm(&throttle_cfg)) {
+                over = TRUE;
+            }
+            if (ppm * 4 > DRV_THROTTLE_CONFIG_max_overhead_ppm(&throttle_cfg)) {
+                under = FALSE;
+            }
+        }
+        if (DRV_THROTTLE_CONFIG_max_buffer_fill_pct(&throttle_cfg)) {
+            if (fill > DRV_THROTTLE_CONFIG_max_buffer_fill_pct(&throttle_cfg)) {
+                over = TRUE;
+            }
+            if (fill * 4 > DRV_THROTTLE_CONFIG_max_buffer_fill_pct(&throttle_cfg)) {
+                under = FALSE;
+            }
+        }
+    }
+    throttle_last_tsc     = now_tsc;
+    throttle_last_jiffies = jiffies;
+
+    new_factor = throttle_factor;
+    if (over && throttle_factor < throttle_max) {
+        new_factor = throttle_factor * 2;
+        if (new_factor > throttle_max) {
+            new_factor = throttle_max;
+        }
+    }
+    else if (!over && under && throttle_factor > 1) {
+        new_factor = throttle_factor / 2;
+    }
+
+    if (new_factor != throttle_factor) {
+        throttle_factor = new_factor;
+        throttle_Walk_ECBs(throttle_factor);
+        throttle_epoch++;
+    }
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,15,0)
+    mod_timer(throttle_timer, jiffies + throttle_interval);
+#else
+    throttle_timer->expires = jiffies + throttle_interval;
+    add_timer(throttle_timer);
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          VOID THROTTLE_Start(VOID)
+ *
+ * @brief       Saves the original reload values and starts the governor timer
+ *
+ * @param       none
+ *
+ * @return      none
+ *
+ * <I>Special Notes:</I>
+ *              Called at collection start, after OVERHEAD_Reset, and again
+ *              after a hot reconfiguration so that the new reload values are
+ *              the ones saved. Does nothing when the governor is not enabled,
+ *              so no throttle record is ever written in that case.
+ */
+extern VOID
+THROTTLE_Start (
+    VOID
+)
+{
+    U32 cpu;
+
+    SEP_DRV_LOG_FLOW_IN("");
+
+    throttle_epoch  = 0;
+    throttle_factor = 1;
+    for_each_possible_cpu(cpu) {
+        per_cpu(throttle_cpu_epoch, cpu) = 0;
+    }
+
+    if (!DRV_THROTTLE_CONFIG_enabled(&throttle_cfg) || !devices || !num_core_devs) {
+        SEP_DRV_LOG_FLOW_OUT("Governor disabled.");
+        return;
+    }
+
+    throttle_max = DRV_THROTTLE_CONFIG_max_factor(&throttle_cfg);
+
+    throttle_saved = NULL;
+    throttle_Walk_ECBs(0);
+    throttle_saved = CONTROL_Allocate_Memory(throttle_nb_saved * sizeof(U64));
+    throttle_cpus  = CONTROL_Allocate_Memory(GLOBAL_STATE_num_cpus(driver_state) * sizeof(THROTTLE_CPU_NODE));
+    throttle_timer = CONTROL_Allocate_Memory(sizeof(struct timer_list));
+    if (!throttle_saved || !throttle_cpus || !throttle_timer) {
+        throttle_saved = CONTROL_Free_Memory(throttle_saved);
+        throttle_cpus  = CONTROL_Free_Memory(throttle_cpus);
+        throttle_timer = CONTROL_Free_Memory(throttle_timer);
+        SEP_DRV_LOG_ERROR_FLOW_OUT("Memory allocation failure, governor disabled!");
+        return;
+    }
+    throttle_Walk_ECBs(0);
+
+    for (cpu = 0; cpu < (U32)GLOBAL_STATE_num_cpus(driver_state); cpu++) {
+        THROTTLE_CPU_nmi_handled(&throttle_cpus[cpu]) = CPU_STATE_nmi_handled(&pcb[cpu]);
+        THROTTLE_CPU_pmi_cycles(&throttle_cpus[cpu])  = 0;
+    }
+    UTILITY_Read_TSC(&throttle_last_tsc);
+    throttle_last_jiffies = jiffies;
+    throttle_interval     = msecs_to_jiffies(DRV_THROTTLE_CONFIG_interval_ms(&throttle_cfg));
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,15,0)
+    timer_setup(throttle_timer, throttle_Governor, 0);
+    mod_timer(throttle_timer, jiffies + throttle_interval);
+#else
+    init_timer(throttle_timer);
+    throttle_timer->function = throttle_Governor;
+    throttle_timer->expires  = jiffies + throttle_interval;
+    add_timer(throttle_timer);
+#endif
+
+    SEP_DRV_LOG_FLOW_OUT("Governor started, %u reload values saved.", throttle_nb_saved);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          VOID THROTTLE_Stop(VOID)
+ *
+ * @brief       Stops the governor timer and restores the original reload values
+ *
+ * @param       none
+ *
+ * @return      none
+ *
+ * <I>Special Notes:</I>
+ *              Called from the stop path once the PMIs are paused.
+ */
+extern VOID
+THROTTLE_Stop (
+    VOID
+)
+{
+    SEP_DRV_LOG_FLOW_IN("");
+
+    if (throttle_timer == NULL) {
+        SEP_DRV_LOG_FLOW_OUT("Governor not running.");
+        return;
+    }
+
+    del_timer_sync(throttle_timer);
+    throttle_timer = CONTROL_Free_Memory(throttle_timer);
+
+    if (throttle_factor != 1) {
+        throttle_Walk_ECBs(1);
+    }
+    SEP_DRV_LOG_FLOW_OUT("Final factor: %u, epoch: %llu.", throttle_factor, throttle_epoch);
+
+    throttle_factor = 1;
+    throttle_saved  = CONTROL_Free_Memory(throttle_saved);
+    throttle_cpus   = CONTROL_Free_Memory(throttle_cpus);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          VOID THROTTLE_Write_Record(BUFFER_DESC bd, U32 this_cpu, U64 tsc)
+ *
+ * @brief       Writes a throttle record with the current factor in a CPU's sample stream
+ *
+ * @param       bd       - output buffer of the CPU
+ * @param       this_cpu - current CPU
+ * @param       tsc      - time stamp of the record
+ *
+ * <I>Special Notes:</I>
+ *              Called from the PMI handler when THROTTLE_Record_Pending is true,
+ *              after the samples of that interrupt: those samples still cover a
+ *              period loaded before the factor changed. If the record cannot be
+ *              written, the CPU retries at its next PMI.
+ */
+extern VOID
+THROTTLE_Write_Record (
+    BUFFER_DESC bd,
+    U32         this_cpu,
+    U64         tsc
+)
+{
+    DRV_THROTTLE_RECORD rec;
+    U64                 epoch = throttle_epoch;
+
+    rec = (DRV_THROTTLE_RECORD)OUTPUT_Reserve_Buffer_Space(bd, sizeof(DRV_THROTTLE_RECORD_NODE), (NMI_mode)? TRUE:FALSE, !SEP_IN_NOTIFICATION);
+    if (!rec) {
+        return;
+    }
+
+    DRV_THROTTLE_RECORD_descriptor_id(rec) = DRV_THROTTLE_DESCRIPTOR_ID;
+    DRV_THROTTLE_RECORD_osid(rec)          = OS_ID_NATIVE;
+    DRV_THROTTLE_RECORD_cpu_num(rec)       = this_cpu;
+    DRV_THROTTLE_RECORD_factor(rec)        = throttle_factor;
+    DRV_THROTTLE_RECORD_epoch(rec)         = epoch;
+    DRV_THROTTLE_RECORD_tsc(rec)           = tsc;
+
+    per_cpu(throttle_cpu_epoch, this_cpu) = epoch;
+}
@@ -0,0 +1,363 @@
+/*COPYRIGHT**
+    Copyright (C) 2005-2020 Intel Corporation.  All Rights Reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+
+
+
+
+**COPYRIGHT*/
+
+
+
+
+
+/*
+ *  CVS_Id="$Id$"
+ */
+
+
+#include "lwpmudrv_defines.h"
+#include <linux/version.h>
+#include <linux/percpu.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+
+#include "lwpmudrv_types.h"
+#include "rise_errors.h"
+#include "lwpmudrv_ecb.h"
+#include "lwpmudrv_struct.h"
+#include "lwpmudrv.h"
+#include "control.h"
+#include "utility.h"
+#include "output.h"
+#include "pebs.h"
+#include "overhead.h"
+#include "marker.h"
+#include "timesync.h"
+
+extern DRV_CONFIG          drv_cfg;
+extern DRV_BOOL            multi_pebs_enabled;
+extern BUFFER_DESC         cpu_sideband_buf;
+
+DEFINE_PER_CPU(U32, timesync_writing);
+static DEFINE_PER_CPU(struct hrtimer, timesync_timer);
+static DEFINE_PER_CPU(U64, timesync_sequence);
+static DEFINE_PER_CPU(DRV_BOOL, timesync_started);    // timer initialised and armed on this CPU
+
+static DRV_TIME_SYNC_CONFIG_NODE  timesync_cfg;
+static ktime_t                    timesync_interval;
+static DRV_BOOL                   timesync_running = FALSE;
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          OS_STATUS TIMESYNC_Configure(DRV_TIME_SYNC_CONFIG cfg)
+ *
+ * @brief       Stores the period of the time synchronisation records
+ *
+ * @param       cfg - settings requested by the collector
+ *
+ * @return      OS_STATUS
+ *
+ * <I>Special Notes:</I>
+ *              The settings take effect at the next collection start.
+ */
+extern OS_STATUS
+TIMESYNC_Configure (
+    DRV_TIME_SYNC_CONFIG cfg
+)
+{
+    SEP_DRV_LOG_TRACE_IN("Cfg: %p.", cfg);
+
+    if (!cfg) {
+        SEP_DRV_LOG_ERROR_TRACE_OUT("Invalid configuration!");
+        return OS_INVALID;
+    }
+
+    memcpy(&timesync_cfg, cfg, sizeof(DRV_TIME_SYNC_CONFIG_NODE));
+
+    SEP_DRV_LOG_TRACE_OUT("Interval: %u ms.", DRV_TIME_SYNC_CONFIG_interval_ms(&timesync_cfg));
+    return OS_SUCCESS;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          static VOID timesync_Write_Records(U32 this_cpu, U32 flags)
+ *
+ * @brief       Writes the time synchronisation records of the current CPU
+ *
+ * @param       this_cpu - current CPU
+ * @param       flags    - DRV_TIME_SYNC_FLAG_* of the record
+ *
+ * @return      None
+ *
+ * <I>Special Notes:</I>
+ *              Runs with interrupts disabled, from the CPU's timer or from an
+ *              IPI, so the sched_switch sideband writer cannot interleave.
+ *              The PMI handler can, and drops its samples while
+ *              timesync_writing is set. PEBS records still held for this
+ *              CPU are written first so the watermark also covers them.
+ *              Staged markers are written first too, but keep their own
+ *              TSC and are not covered.
+ */
+static VOID
+timesync_Write_Records (
+    U32 this_cpu,
+    U32 flags
+)
+{
+    BUFFER_DESC           bd = &cpu_buf[this_cpu];
+    DRV_TIME_SYNC_RECORD  rec;
+    SIDEBAND_INFO         sideband_info;
+    U64                   tsc;
+
+    per_cpu(timesync_writing, this_cpu) = 1;
+    barrier();
+
+    if (multi_pebs_enabled) {
+        PEBS_Flush_Buffer(NULL);
+    }
+    MARKER_Write_Records(bd, this_cpu);
+
+    UTILITY_Read_TSC(&tsc);
+    rec = (DRV_TIME_SYNC_RECORD)OUTPUT_Reserve_Buffer_Space(bd, sizeof(DRV_TIME_SYNC_RECORD_NODE), TRUE, !SEP_IN_NOTIFICATION);
+    if (rec) {
+        DRV_TIME_SYNC_RECORD_descriptor_id(rec) = DRV_TIME_SYNC_DESCRIPTOR_ID;
+        DRV_TIME_SYNC_RECORD_osid(rec)          = OS_ID_NATIVE;
+        DRV_TIME_SYNC_RECORD_cpu_num(rec)       = this_cpu;
+        DRV_TIME_SYNC_RECORD_flags(rec)         = flags;
+        DRV_TIME_SYNC_RECORD_sequence(rec)      = per_cpu(timesync_sequence, this_cpu)++;
+        DRV_TIME_SYNC_RECORD_watermark_tsc(rec) = tsc;
+        DRV_TIME_SYNC_RECORD_monotonic_ns(rec)  = ktime_get_ns();
+        DRV_TIME_SYNC_RECORD_load_tsc_skew(rec) = TSC_SKEW(this_cpu);
+    }
+
+    barrier();
+    per_cpu(timesync_writing, this_cpu) = 0;
+
+    if (multi_pebs_enabled && cpu_sideband_buf) {
+        sideband_info = (SIDEBAND_INFO)OUTPUT_Reserve_Buffer_Space(&cpu_sideband_buf[this_cpu], sizeof(SIDEBAND_INFO_NODE), TRUE, !SEP_IN_NOTIFICATION);
+        if (sideband_info) {
+            SIDEBAND_INFO_pid(sideband_info) = DRV_TIME_SYNC_SIDEBAND_ID;
+            SIDEBAND_INFO_tid(sideband_info) = DRV_TIME_SYNC_SIDEBAND_ID;
+            SIDEBAND_INFO_tsc(sideband_info) = tsc;
+        }
+    }
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          static enum hrtimer_restart timesync_Timer(struct hrtimer *timer)
+ *
+ * @brief       Per-CPU timer writing the periodic records
+ *
+ * @param       timer - timer of the current CPU
+ *
+ * @return      HRTIMER_RESTART while the collection is running or paused
+ *
+ * <I>Special Notes:</I>
+ */
+static enum hrtimer_restart
+timesync_Timer (
+    struct hrtimer *timer
+)
+{
+    U64 start_tsc;
+
+    if (!timesync_running ||
+        !DRIVER_STATE_IN(GET_DRIVER_STATE(), STATE_BIT_RUNNING | STATE_BIT_PAUSED)) {
+        return HRTIMER_NORESTART;
+    }
+
+    UTILITY_Read_TSC(&start_tsc);
+    timesync_Write_Records(CONTROL_THIS_CPU(), 0);
+    hrtimer_forward_now(timer, timesync_interval);
+    OVERHEAD_Record(DRV_OVERHEAD_PATH_TIME_SYNC, start_tsc);
+
+    return HRTIMER_RESTART;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          static VOID timesync_Start_Cpu_Timer(PVOID arg)
+ *
+ * @brief       Arms the timer of the current CPU
+ *
+ * @param       arg - pointer to the ktime_t of the first expiry, common to all CPUs
+ *
+ * @return      None
+ *
+ * <I>Special Notes:</I>
+ *              Called via the parallel control mechanism so that the timer
+ *              is pinned to the CPU whose streams it writes.
+ */
+static VOID
+timesync_Start_Cpu_Timer (
+    PVOID arg
+)
+{
+    U32             this_cpu = CONTROL_THIS_CPU();
+    struct hrtimer *timer    = &per_cpu(timesync_timer, this_cpu);
+
+    per_cpu(timesync_sequence, this_cpu) = 0;
+    per_cpu(timesync_writing, this_cpu)  = 0;
+
+    hrtimer_init(timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+    timer->function = timesync_Timer;
+    hrtimer_start(timer, *(ktime_t *)arg, HRTIMER_MODE_ABS_PINNED);
+    per_cpu(timesync_started, this_cpu) = TRUE;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          static VOID timesync_Final_Op(PVOID arg)
+ *
+ * @brief       Writes the last record of the current CPU
+ *
+ * @param       arg - unused
+ *
+ * @return      None
+ *
+ * <I>Special Notes:</I>
+ */
+static VOID
+timesync_Final_Op (
+    PVOID arg
+)
+{
+    timesync_Write_Records(CONTROL_THIS_CPU(), DRV_TIME_SYNC_FLAG_FINAL);
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          VOID TIMESYNC_Start(VOID)
+ *
+ * @brief       Starts the per-CPU timers if records were requested
+ *
+ * @param       None
+ *
+ * @return      None
+ *
+ * <I>Special Notes:</I>
+ *              Sampling collections only. All timers fire on the same
+ *              CLOCK_MONOTONIC boundaries.
+ */
+extern VOID
+TIMESYNC_Start (
+    VOID
+)
+{
+    ktime_t first;
+
+    SEP_DRV_LOG_FLOW_IN("");
+
+    if (!DRV_TIME_SYNC_CONFIG_interval_ms(&timesync_cfg) ||
+        !drv_cfg || DRV_CONFIG_emon_mode(drv_cfg) || !cpu_buf) {
+        SEP_DRV_LOG_FLOW_OUT("Time synchronisation records disabled.");
+        return;
+    }
+
+    timesync_interval = ms_to_ktime(DRV_TIME_SYNC_CONFIG_interval_ms(&timesync_cfg));
+    first             = ktime_add_ns(ktime_get(), ktime_to_ns(timesync_interval));
+    timesync_running  = TRUE;
+    CONTROL_Invoke_Parallel(timesync_Start_Cpu_Timer, &first);
+
+    SEP_DRV_LOG_FLOW_OUT("Per-CPU timers started (%u ms).", DRV_TIME_SYNC_CONFIG_interval_ms(&timesync_cfg));
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          VOID TIMESYNC_Stop(VOID)
+ *
+ * @brief       Cancels the per-CPU timers
+ *
+ * @param       None
+ *
+ * @return      None
+ *
+ * <I>Special Notes:</I>
+ *              The final records are written by TIMESYNC_Flush once the
+ *              remaining PEBS records are out. Only the timers of CPUs that
+ *              were online at start were initialised.
+ */
+extern VOID
+TIMESYNC_Stop (
+    VOID
+)
+{
+    U32 i;
+
+    SEP_DRV_LOG_FLOW_IN("");
+
+    if (!timesync_running) {
+        SEP_DRV_LOG_FLOW_OUT("Nothing to do.");
+        return;
+    }
+
+    for (i = 0; i < GLOBAL_STATE_num_cpus(driver_state); i++) {
+        if (per_cpu(timesync_started, i)) {
+            hrtimer_cancel(&per_cpu(timesync_timer, i));
+            per_cpu(timesync_started, i) = FALSE;
+        }
+    }
+
+    SEP_DRV_LOG_FLOW_OUT("");
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn          VOID TIMESYNC_Flush(VOID)
+ *
+ * @brief       Writes the final record of every CPU
+ *
+ * @param       None
+ *
+ * @return      None
+ *
+ * <I>Special Notes:</I>
+ *              Called at the end of the stop sequence, before the output
+ *              buffers are flushed to the readers.
+ */
+extern VOID
+TIMESYNC_Flush (
+    VOID
+)
+{
+    SEP_DRV_LOG_FLOW_IN("");
+
+    if (!timesync_running) {
+        SEP_DRV_LOG_FLOW_OUT("Nothing to do.");
+        return;
+    }
+
+    CONTROL_Invoke_Parallel(timesync_Final_Op, NULL);
+    timesync_running = FALSE;
+
+    SEP_DRV_LOG_FLOW_OUT("");
+}
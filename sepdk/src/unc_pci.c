@@ -48,6 +48,153 @@ extern EMON_BUFFER_DRIVER_HELPER   emon_buffer_driver_helper;
 extern DRV_CONFIG                  drv_cfg;
 
 
+/*!
+ * @fn          static VOID unc_pci_Initialize(PVOID)
+ *
+ * @brief       Map the memory-mapped (ECAM) configuration space of the
+ *              device bus on every package, so that counters can be read
+ *              with plain loads instead of serialized config cycles.
+ *              Packages without an ECAM window keep using config cycles.
+ *
+ * @param       param - device index
+ *
+ * @return      None
+ *
+ * <I>Special Notes:</I>
+ *              Runs in process context, before the PMU is first written to.
+ */
+static VOID
+unc_pci_Initialize (
+    PVOID  param
+)
+{
+    U32   dev_idx;
+    U32   dev_node;
+    U32   entries;
+    U32   i;
+    U64   physical_address;
+
+    SEP_DRV_LOG_TRACE_IN("Param: %p.", param);
+
+    dev_idx  = *((U32*)param);
+    dev_node = LWPMU_DEVICE_pci_dev_node_index(&devices[dev_idx]);
+    entries  = GET_NUM_MAP_ENTRIES(dev_node);
+
+    if (!entries || UNC_PCIDEV_mmio_map(&(unc_pcidev_map[dev_node]))) {
+        SEP_DRV_LOG_TRACE_OUT("Early exit (no bus map or device node %u already mapped).", dev_node);
+        return;
+    }
+
+    UNC_PCIDEV_mmio_map(&(unc_pcidev_map[dev_node])) = CONTROL_Allocate_Memory(entries * sizeof(SEP_MMIO_NODE));
+    if (UNC_PCIDEV_mmio_map(&(unc_pcidev_map[dev_node])) == NULL) {
+        SEP_DRV_LOG_ERROR_TRACE_OUT("Early exit (No Memory).");
+        return;
+    }
+    SEP_DRV_MEMSET(UNC_PCIDEV_mmio_map(&(unc_pcidev_map[dev_node])), 0, entries * sizeof(SEP_MMIO_NODE));
+    UNC_PCIDEV_num_mmio_main_bar_per_entry(&(unc_pcidev_map[dev_node]))      = 1;
+    UNC_PCIDEV_num_mmio_secondary_bar_per_entry(&(unc_pcidev_map[dev_node])) = 1;
+    UNC_PCIDEV_ecam_mapped(&(unc_pcidev_map[dev_node]))                      = 1;
+
+    for (i = 0; i < entries; i++) {
+        if (!IS_BUS_MAP_VALID(dev_node, i)) {
+            continue;
+        }
+        physical_address = PCI_Get_ECAM_Address(GET_BUS_MAP(dev_node, i));
+        if (!physical_address) {
+            SEP_DRV_LOG_TRACE("No ECAM window for bus 0x%x.", GET_BUS_MAP(dev_node, i));
+            continue;
+        }
+        PCI_Map_Memory(&UNC_PCIDEV_mmio_map_entry(&(unc_pcidev_map[dev_node]), i),
+                       physical_address, PCI_ECAM_BUS_SIZE);
+    }
+
+    SEP_DRV_LOG_TRACE_OUT("");
+    return;
+}
+
+
+/*!
+ * @fn          static VOID unc_pci_Destroy(PVOID)
+ *
+ * @brief       Unmap the configuration space windows set up by unc_pci_Initialize
+ *              and release the map, so the next collection maps them again
+ *
+ * @param       param - device index
+ *
+ * @return      None
+ *
+ * <I>Special Notes:</I>
+ */
+static VOID
+unc_pci_Destroy (
+    PVOID  param
+)
+{
+    U32   dev_idx;
+    U32   dev_node;
+    U32   i;
+
+    SEP_DRV_LOG_TRACE_IN("Param: %p.", param);
+
+    dev_idx  = *((U32*)param);
+    dev_node = LWPMU_DEVICE_pci_dev_node_index(&devices[dev_idx]);
+
+    if (!UNC_PCIDEV_ecam_mapped(&(unc_pcidev_map[dev_node]))) {
+        SEP_DRV_LOG_TRACE_OUT("Early exit (no mapping).");
+        return;
+    }
+
+    for (i = 0; i < GET_NUM_MAP_ENTRIES(dev_node); i++) {
+        if (IS_ECAM_MAP_VALID(dev_node, i)) {
+            PCI_Unmap_Memory(&UNC_PCIDEV_mmio_map_entry(&(unc_pcidev_map[dev_node]), i));
+        }
+    }
+    UNC_PCIDEV_mmio_map(&(unc_pcidev_map[dev_node])) = CONTROL_Free_Memory(UNC_PCIDEV_mmio_map(&(unc_pcidev_map[dev_node])));
+    UNC_PCIDEV_ecam_mapped(&(unc_pcidev_map[dev_node])) = 0;
+
+    SEP_DRV_LOG_TRACE_OUT("");
+    return;
+}
+
+
+/*!
+ * @fn          static U64 unc_pci_Read_Counter(ecam_base, busno, dev, func, reg)
+ *
+ * @brief       Read a 64-bit counter as two 32-bit halves, through the mapped
+ *              configuration space when available, config cycles otherwise.
+ *
+ * @param       ecam_base - virtual address of the bus ECAM window, 0 if none
+ * @param       busno     - target bus
+ * @param       dev       - target device
+ * @param       func      - target function
+ * @param       reg       - register offset of the low half
+ *
+ * @return      counter value
+ *
+ * <I>Special Notes:</I>
+ */
+static U64
+unc_pci_Read_Counter (
+    U64    ecam_base,
+    U32    busno,
+    U32    dev,
+    U32    func,
+    U32    reg
+)
+{
+    U64   value;
+
+    if (!ecam_base) {
+        return PCI_Read_U64(busno, dev, func, reg);
+    }
+
+    value  = PCI_MMIO_Read_U32(ecam_base, PCI_ECAM_OFFSET(dev, func, reg));
+    value |= (U64)PCI_MMIO_Read_U32(ecam_base, PCI_ECAM_OFFSET(dev, func, reg + NEXT_ADDR_OFFSET)) << NEXT_ADDR_SHIFT;
+
+    return value;
+}
+
+
 /*!
  * @fn          static VOID unc_pci_Write_PMU(VOID*)
  *
@@ -331,12 +478,11 @@ unc_pci_Trigger_Read (
     U32             cur_grp       = 0;
     ECB             pecb          = NULL;
     U32             index         = 0;
-    U64             value_low     = 0;
-    U64             value_high    = 0;
     U64             diff          = 0;
     U64             value;
     U64            *data;
     U32             busno;
+    U64             ecam_base     = 0;
 
     SEP_DRV_LOG_TRACE_IN("Param: %p, id: %u.", param, id);
 
@@ -352,6 +498,9 @@ unc_pci_Trigger_Read (
     }
 
     busno = GET_BUS_MAP(dev_node, package_num);
+    if (IS_ECAM_MAP_VALID(dev_node, package_num)) {
+        ecam_base = virtual_address_table(dev_node, package_num);
+    }
 
     // Read the counts into uncore buffer
     FOR_EACH_REG_UNC_OPERATION(pecb, id, idx, PMU_OPERATION_READ) {
@@ -374,19 +523,11 @@ unc_pci_Trigger_Read (
         }
         *data = cur_grp + 1;
 
-        // read lower 4 bytes
-        value_low = PCI_Read_U32(busno,
-                             ECB_entries_dev_no(pecb,idx),
-                             ECB_entries_func_no(pecb,idx),
-                             ECB_entries_reg_id(pecb,idx));
-        value = LOWER_4_BYTES_MASK & value_low;
-
-        // read upper 4 bytes
-        value_high = PCI_Read_U32(busno,
-                              ECB_entries_dev_no(pecb,idx),
-                              ECB_entries_func_no(pecb,idx),
-                              (ECB_entries_reg_id(pecb,idx) + NEXT_ADDR_OFFSET));
-        value |= value_high << NEXT_ADDR_SHIFT;
+        value = unc_pci_Read_Counter(ecam_base,
+                                     busno,
+                                     ECB_entries_dev_no(pecb,idx),
+                                     ECB_entries_func_no(pecb,idx),
+                                     ECB_entries_reg_id(pecb,idx));
         //check for overflow
         if (value < LWPMU_DEVICE_prev_value(&devices[id])[package_num][index]) {
             diff = LWPMU_DEVICE_counter_mask(&devices[id]) - LWPMU_DEVICE_prev_value(&devices[id])[package_num][index];
@@ -430,6 +571,7 @@ unc_pci_Read_PMU_Data(
     U32             dev_node;
     U32             package_num         = 0;
     U32             busno;
+    U64             ecam_base           = 0;
 
     SEP_DRV_LOG_TRACE_IN("Param: %p.", param);
 
@@ -460,6 +602,9 @@ unc_pci_Read_PMU_Data(
     }
 
     busno = GET_BUS_MAP(dev_node, package_num);
+    if (IS_ECAM_MAP_VALID(dev_node, package_num)) {
+        ecam_base = virtual_address_table(dev_node, package_num);
+    }
 
     //Read in the counts into temporary buffer
     FOR_EACH_REG_UNC_OPERATION(pecb, dev_idx, idx, PMU_OPERATION_READ) {
@@ -472,10 +617,11 @@ unc_pci_Read_PMU_Data(
                                                         ECB_entries_uncore_buffer_offset_in_package(pecb,idx));
         }
 
-        buffer[j] = PCI_Read_U64(busno,
-                                 ECB_entries_dev_no(pecb,idx),
-                                 ECB_entries_func_no(pecb,idx),
-                                 ECB_entries_reg_id(pecb,idx));
+        buffer[j] = unc_pci_Read_Counter(ecam_base,
+                                         busno,
+                                         ECB_entries_dev_no(pecb,idx),
+                                         ECB_entries_func_no(pecb,idx),
+                                         ECB_entries_reg_id(pecb,idx));
 
         SEP_DRV_LOG_TRACE("j=%u, value=%llu, cpu=%u", j, buffer[j], this_cpu);
 
@@ -490,8 +636,8 @@ unc_pci_Read_PMU_Data(
  */
 DISPATCH_NODE  unc_pci_dispatch =
 {
-    NULL,                                // initialize
-    NULL,                                // destroy
+    unc_pci_Initialize,                  // initialize
+    unc_pci_Destroy,                     // destroy
     unc_pci_Write_PMU,                   // write
     unc_pci_Disable_PMU,                 // freeze
     unc_pci_Enable_PMU,                  // restart
@@ -66,6 +66,10 @@ extern  DISPATCH_NODE   unc_rdt_dispatch;
 extern  DISPATCH_NODE   hswunc_sa_dispatch;
 extern  U32             drv_type;
 
+#define SYS_MAX_GP_PMC          8           // GP counters reachable through RDPMC
+#define SYS_MAX_FIXED_PMC       4           // fixed counters reachable through RDPMC
+#define SYS_RDPMC_FIXED_FLAG    (1U << 30)  // RDPMC index selects the fixed counters
+
 
 extern VOID
 UTILITY_down_read_mm (
@@ -306,6 +310,48 @@ SYS_Read_MSR (
 }
 
 
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn       U64 SYS_Read_PMC(U32 msr)
+ *
+ * @brief    Reads a performance counter given its MSR address
+ *
+ * @param    msr - MSR address of the counter
+ *
+ * @return   counter value
+ *
+ * <I>Special Notes:</I>
+ *           GP (legacy and full-width aliases) and fixed counters are read
+ *           with RDPMC, which is much cheaper than RDMSR and always allowed
+ *           at CPL 0. Any other MSR is read with SYS_Read_MSR. Building with
+ *           NO_RDPMC=YES reads everything with RDMSR.
+ */
+extern U64
+SYS_Read_PMC (
+    U32   msr
+)
+{
+#if !defined(DRV_NO_RDPMC) && (defined(DRV_IA32) || defined(DRV_EM64T))
+    U64 val;
+
+    if (msr >= IA32_PMC0 && msr < IA32_PMC0 + SYS_MAX_GP_PMC) {
+        rdpmcl(msr - IA32_PMC0, val);
+        return val;
+    }
+    if (msr >= IA32_FULL_PMC0 && msr < IA32_FULL_PMC0 + SYS_MAX_GP_PMC) {
+        rdpmcl(msr - IA32_FULL_PMC0, val);
+        return val;
+    }
+    if (msr >= IA32_FIXED_CTR0 && msr < IA32_FIXED_CTR0 + SYS_MAX_FIXED_PMC) {
+        rdpmcl(SYS_RDPMC_FIXED_FLAG | (msr - IA32_FIXED_CTR0), val);
+        return val;
+    }
+#endif
+
+    return SYS_Read_MSR(msr);
+}
+
+
 extern void
 SYS_Write_MSR (
     U32   msr,
@@ -334,6 +380,77 @@ SYS_Write_MSR (
 #endif // !DRV_SAFE_MSR
 }
 
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn       DRV_BOOL SYS_Write_MSR_Shadowed(U32 this_cpu, U32 msr, U64 val)
+ *
+ * @brief    Writes an MSR unless the current CPU's shadow shows it already holds val
+ *
+ * @param    this_cpu - current CPU
+ * @param    msr      - MSR address
+ * @param    val      - value to write
+ *
+ * @return   TRUE if the MSR was written, FALSE if the write was skipped
+ *
+ * <I>Special Notes:</I>
+ *           Only valid for MSRs that are always written through this function
+ *           while the shadow is in use. Code writing them by other means must
+ *           call SYS_Reset_MSR_Shadow afterwards. Must be called with
+ *           preemption disabled, on this_cpu.
+ */
+extern DRV_BOOL
+SYS_Write_MSR_Shadowed (
+    U32   this_cpu,
+    U32   msr,
+    U64   val
+)
+{
+    CPU_STATE pcpu = &pcb[this_cpu];
+    U32       i;
+
+    for (i = 0; i < CPU_STATE_msr_shadow_count(pcpu); i++) {
+        if (CPU_STATE_msr_shadow_id(pcpu)[i] == msr) {
+            if (CPU_STATE_msr_shadow_value(pcpu)[i] == val) {
+                return FALSE;
+            }
+            break;
+        }
+    }
+
+    SYS_Write_MSR(msr, val);
+
+    if (i < CPU_MSR_SHADOW_SIZE) {
+        if (i == CPU_STATE_msr_shadow_count(pcpu)) {
+            CPU_STATE_msr_shadow_count(pcpu)++;
+        }
+        CPU_STATE_msr_shadow_id(pcpu)[i]    = msr;
+        CPU_STATE_msr_shadow_value(pcpu)[i] = val;
+    }
+
+    return TRUE;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn       void SYS_Reset_MSR_Shadow(U32 this_cpu)
+ *
+ * @brief    Forgets the MSR values recorded by SYS_Write_MSR_Shadowed on a CPU
+ *
+ * @param    this_cpu - CPU whose shadow is reset
+ *
+ * @return   none
+ *
+ * <I>Special Notes:</I>
+ *           The next shadowed write of each MSR goes to the hardware.
+ */
+extern void
+SYS_Reset_MSR_Shadow (
+    U32   this_cpu
+)
+{
+    CPU_STATE_msr_shadow_count(&pcb[this_cpu]) = 0;
+}
+
 
 #if LINUX_VERSION_CODE == KERNEL_VERSION(2,6,32)
 static unsigned long utility_Compare_Symbol_Names_Return_Value = 0;
@@ -554,6 +671,260 @@ utility_Driver_Log_Kprint_Helper (
     return;
 }
 
+#define DRV_LOG_ARG_NONE        0   // "%%": no argument consumed
+#define DRV_LOG_ARG_INT         1   // int and narrower (promoted)
+#define DRV_LOG_ARG_LONG        2
+#define DRV_LOG_ARG_LONG_LONG   3
+#define DRV_LOG_ARG_SIZE_T      4   // 'z', 't' and 'j' length modifiers
+#define DRV_LOG_ARG_POINTER     5
+
+#define DRV_LOG_MAX_SPEC_LENGTH 16
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn       static const char* utility_Log_Parse_Spec (const char* spec, U32* arg_class)
+ *
+ * @brief    Parses one conversion specification of a printf-like format string.
+ *
+ * @param    const char* spec      - pointer to the character following the '%'
+ *           U32*        arg_class - where to store the DRV_LOG_ARG_* class of the argument
+ *
+ * @return   pointer to the character following the conversion specifier,
+ *           or NULL if the specification cannot be deferred
+ *
+ * <I>Special Notes:</I>
+ *           Only conversions whose argument can be captured by value are accepted:
+ *           strings ("%s"), kernel pointer extensions ("%pS", "%pV"...), '*' widths
+ *           and floating point conversions make the caller fall back to text logging.
+ */
+static const char*
+utility_Log_Parse_Spec (
+    const char* spec,
+    U32*        arg_class
+)
+{
+    U32 length = 0; // 0: none, 1: 'l', 2: 'll', 3: 'z'/'t'/'j'
+
+    while (*spec == '-' || *spec == '+' || *spec == ' ' || *spec == '#' || *spec == '0') {
+        spec++;
+    }
+    while (*spec >= '0' && *spec <= '9') {
+        spec++;
+    }
+    if (*spec == '.') {
+        spec++;
+        while (*spec >= '0' && *spec <= '9') {
+            spec++;
+        }
+    }
+
+    switch (*spec) {
+        case 'h':
+            spec++;
+            if (*spec == 'h') {
+                spec++;
+            }
+            break;
+        case 'l':
+            spec++;
+            length = 1;
+            if (*spec == 'l') {
+                spec++;
+                length = 2;
+            }
+            break;
+        case 'z':
+        case 't':
+        case 'j':
+            spec++;
+            length = 3;
+            break;
+        default:
+            break;
+    }
+
+    switch (*spec) {
+        case 'd':
+        case 'i':
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+        case 'c':
+            *arg_class = length == 0 ? DRV_LOG_ARG_INT       :
+                         length == 1 ? DRV_LOG_ARG_LONG      :
+                         length == 2 ? DRV_LOG_ARG_LONG_LONG :
+                                       DRV_LOG_ARG_SIZE_T;
+            return spec + 1;
+        case 'p':
+            if ((spec[1] >= 'a' && spec[1] <= 'z') ||
+                (spec[1] >= 'A' && spec[1] <= 'Z') ||
+                (spec[1] >= '0' && spec[1] <= '9')) {
+                return NULL;
+            }
+            *arg_class = DRV_LOG_ARG_POINTER;
+            return spec + 1;
+        case '%':
+            *arg_class = DRV_LOG_ARG_NONE;
+            return spec + 1;
+        default:
+            return NULL;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn       static U32 utility_Log_Capture_Args (const char* format_string, va_list args, U64* words)
+ *
+ * @brief    Captures the raw argument words of a log call without formatting them.
+ *
+ * @param    const char* format_string - classical format string for printf-like functions
+ *           va_list     args          - arguments matching the format string
+ *           U64*        words         - array of DRV_LOG_BINARY_MAX_NB_ARGS elements
+ *
+ * @return   number of captured arguments, or DRV_LOG_BINARY_MAX_NB_ARGS + 1 if the
+ *           message has to be formatted immediately
+ *
+ * <I>Special Notes:</I>
+ *           This is a single pass over the format string with no output, which is
+ *           considerably cheaper than vsnprintf for the short formats used on the
+ *           interrupt and notification paths.
+ */
+static U32
+utility_Log_Capture_Args (
+    const char* format_string,
+    va_list     args,
+    U64*        words
+)
+{
+    const char* p         = format_string;
+    U32         nb_args   = 0;
+    U32         arg_class = DRV_LOG_ARG_NONE;
+
+    while (*p) {
+        if (*p++ != '%') {
+            continue;
+        }
+        p = utility_Log_Parse_Spec(p, &arg_class);
+        if (!p) {
+            return DRV_LOG_BINARY_MAX_NB_ARGS + 1;
+        }
+        if (arg_class == DRV_LOG_ARG_NONE) {
+            continue;
+        }
+        if (nb_args == DRV_LOG_BINARY_MAX_NB_ARGS) {
+            return DRV_LOG_BINARY_MAX_NB_ARGS + 1;
+        }
+        switch (arg_class) {
+            case DRV_LOG_ARG_INT:
+                words[nb_args++] = (U64)va_arg(args, unsigned int);
+                break;
+            case DRV_LOG_ARG_LONG:
+                words[nb_args++] = (U64)va_arg(args, unsigned long);
+                break;
+            case DRV_LOG_ARG_LONG_LONG:
+                words[nb_args++] = (U64)va_arg(args, unsigned long long);
+                break;
+            case DRV_LOG_ARG_SIZE_T:
+                words[nb_args++] = (U64)va_arg(args, size_t);
+                break;
+            default:
+                words[nb_args++] = (U64)(size_t)va_arg(args, void*);
+                break;
+        }
+    }
+
+    return nb_args;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn       static VOID utility_Log_Render_Binary (const char* format_string, U64* words,
+ *                                                  U32 nb_args, char* buffer, U32 buffer_size)
+ *
+ * @brief    Formats a message previously captured by utility_Log_Capture_Args.
+ *
+ * @param    const char* format_string - format string recorded in the entry
+ *           U64*        words         - argument words recorded in the entry
+ *           U32         nb_args       - number of valid argument words
+ *           char*       buffer        - output buffer
+ *           U32         buffer_size   - size of the output buffer
+ *
+ * @return   none
+ *
+ * <I>Special Notes:</I>
+ *           Each conversion is replayed through snprintf with its original specification
+ *           and argument type, so the output matches what vsnprintf would have produced
+ *           (up to truncation).
+ */
+static VOID
+utility_Log_Render_Binary (
+    const char* format_string,
+    U64*        words,
+    U32         nb_args,
+    char*       buffer,
+    U32         buffer_size
+)
+{
+    const char* p         = format_string;
+    const char* spec_end;
+    char        spec[DRV_LOG_MAX_SPEC_LENGTH];
+    U32         pos       = 0;
+    U32         arg_index = 0;
+    U32         arg_class = DRV_LOG_ARG_NONE;
+    U32         spec_length;
+    int         written;
+
+    while (*p && pos < buffer_size - 1) {
+        if (*p != '%') {
+            buffer[pos++] = *p++;
+            continue;
+        }
+        spec_end = utility_Log_Parse_Spec(p + 1, &arg_class);
+        if (!spec_end) {
+            break;
+        }
+        spec_length = (U32)(spec_end - p);
+        if (spec_length >= DRV_LOG_MAX_SPEC_LENGTH ||
+            (arg_class != DRV_LOG_ARG_NONE && arg_index >= nb_args)) {
+            break;
+        }
+        memcpy(spec, p, spec_length);
+        spec[spec_length] = 0;
+        p = spec_end;
+
+        switch (arg_class) {
+            case DRV_LOG_ARG_NONE:
+                written = snprintf(buffer + pos, buffer_size - pos, "%%");
+                break;
+            case DRV_LOG_ARG_INT:
+                written = snprintf(buffer + pos, buffer_size - pos, spec, (unsigned int)words[arg_index++]);
+                break;
+            case DRV_LOG_ARG_LONG:
+                written = snprintf(buffer + pos, buffer_size - pos, spec, (unsigned long)words[arg_index++]);
+                break;
+            case DRV_LOG_ARG_LONG_LONG:
+                written = snprintf(buffer + pos, buffer_size - pos, spec, (unsigned long long)words[arg_index++]);
+                break;
+            case DRV_LOG_ARG_SIZE_T:
+                written = snprintf(buffer + pos, buffer_size - pos, spec, (size_t)words[arg_index++]);
+                break;
+            default:
+                written = snprintf(buffer + pos, buffer_size - pos, spec, (void*)(size_t)words[arg_index++]);
+                break;
+        }
+        if (written < 0) {
+            break;
+        }
+        pos += (U32)written;
+    }
+
+    if (pos > buffer_size - 1) {
+        pos = buffer_size - 1;
+    }
+    buffer[pos] = 0;
+}
+
 /* ------------------------------------------------------------------------- */
 /*!
  * @fn       static inline VOID utility_Log_Write (
@@ -636,6 +1007,24 @@ utility_Log_Write (
     DRV_LOG_ENTRY_integrity_tag(entry) = overflow_tag;
     DRV_LOG_COMPILER_MEM_BARRIER();
 
+    if (DRV_LOG_BUFFER_binary_mode(DRV_LOG()) && format_string) {
+        va_list capture_args;
+        U32     nb_args;
+
+        va_copy(capture_args, args);
+        nb_args = utility_Log_Capture_Args(format_string, capture_args, DRV_LOG_ENTRY_bin_args(entry));
+        va_end(capture_args);
+
+        if (nb_args <= DRV_LOG_BINARY_MAX_NB_ARGS) {
+            DRV_LOG_ENTRY_bin_function_name(entry) = (U64)(size_t)function_name;
+            DRV_LOG_ENTRY_bin_format_string(entry) = (U64)(size_t)format_string;
+            DRV_LOG_ENTRY_bin_nb_args(entry)       = nb_args;
+            DRV_LOG_ENTRY_entry_format(entry)      = DRV_LOG_ENTRY_FORMAT_BINARY;
+            goto write_attributes;
+        }
+    }
+    DRV_LOG_ENTRY_entry_format(entry) = DRV_LOG_ENTRY_FORMAT_TEXT;
+
     if (format_string && *format_string) {          // setting this one first to try to increase MLP
         vsnprintf(DRV_LOG_ENTRY_message(entry),
                           DRV_LOG_MESSAGE_LENGTH,
@@ -654,6 +1043,7 @@ utility_Log_Write (
     }
     target_func_buffer[i] = 0;
 
+write_attributes:
     DRV_LOG_ENTRY_category(entry)                = category;
     DRV_LOG_ENTRY_secondary_info(entry)          = secondary;
     DRV_LOG_ENTRY_line_number(entry)             = line_number;
@@ -839,6 +1229,64 @@ UTILITY_Log (
     return;
 }
 
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn       extern VOID UTILITY_Driver_Log_Render_Entry (DRV_LOG_ENTRY entry)
+ *
+ * @brief    Converts a binary (deferred-format) log entry into a text entry.
+ *
+ * @param    DRV_LOG_ENTRY entry - copy of a log entry (never an entry of the live log)
+ *
+ * @return   none
+ *
+ * <I>Special Notes:</I>
+ *           The format string and function name pointers refer to this driver's
+ *           read-only data, which lives as long as the log buffer itself.
+ *           Entries whose integrity and temporal tags disagree were being written
+ *           concurrently: their payload is discarded rather than dereferenced.
+ */
+extern VOID
+UTILITY_Driver_Log_Render_Entry (
+    DRV_LOG_ENTRY entry
+)
+{
+    const char* format_string;
+    const char* function_name;
+    U64         words[DRV_LOG_BINARY_MAX_NB_ARGS];
+    U32         nb_args;
+    U32         i;
+
+    if (DRV_LOG_ENTRY_entry_format(entry) != DRV_LOG_ENTRY_FORMAT_BINARY) {
+        return;
+    }
+
+    format_string = (const char*)(size_t)DRV_LOG_ENTRY_bin_format_string(entry);
+    function_name = (const char*)(size_t)DRV_LOG_ENTRY_bin_function_name(entry);
+    nb_args       = DRV_LOG_ENTRY_bin_nb_args(entry);
+    DRV_LOG_ENTRY_entry_format(entry) = DRV_LOG_ENTRY_FORMAT_TEXT;
+
+    if (DRV_LOG_ENTRY_integrity_tag(entry) != DRV_LOG_ENTRY_temporal_tag(entry) ||
+        nb_args > DRV_LOG_BINARY_MAX_NB_ARGS                                    ||
+        !format_string || !function_name) {
+        DRV_LOG_ENTRY_function_name(entry)[0] = 0;
+        DRV_LOG_ENTRY_message(entry)[0]       = 0;
+        return;
+    }
+
+    memcpy(words, DRV_LOG_ENTRY_bin_args(entry), nb_args * sizeof(U64));
+
+    for (i = 0; i < DRV_LOG_FUNCTION_NAME_LENGTH - 1 && function_name[i]; i++) {
+        DRV_LOG_ENTRY_function_name(entry)[i] = function_name[i];
+    }
+    DRV_LOG_ENTRY_function_name(entry)[i] = 0;
+
+    utility_Log_Render_Binary(format_string,
+                              words,
+                              nb_args,
+                              DRV_LOG_ENTRY_message(entry),
+                              DRV_LOG_MESSAGE_LENGTH);
+}
+
 /* ------------------------------------------------------------------------- */
 /*!
  * @fn       extern DRV_STATUS UTILITY_Driver_Log_Init (void)
@@ -968,6 +1416,7 @@ UTILITY_Driver_Log_Init (
     DRV_LOG_VERBOSITY(DRV_LOG_CATEGORY_WARNING)         = DRV_LOG_DEFAULT_WARNING_VERBOSITY;
 
     DRV_LOG_BUFFER_contiguous_physical_memory(driver_log_buffer) = using_contiguous_physical_memory;
+    DRV_LOG_BUFFER_binary_mode(driver_log_buffer)                = 0;
 
     SEP_DRV_LOG_LOAD("Initialized driver log using %scontiguous physical memory.",
         DRV_LOG_BUFFER_contiguous_physical_memory(driver_log_buffer) ? "" : "non-");
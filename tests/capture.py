@@ -0,0 +1,167 @@
+#
+#    Copyright (C) 2019-2020 Intel Corporation.  All Rights Reserved.
+#
+#Permission is hereby granted, free of charge, to any person obtaining a copy
+#of this software and associated documentation files (the "Software"), to deal
+#in the Software without restriction, including without limitation the rights
+#to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+#copies of the Software, and to permit persons to whom the Software is
+#furnished to do so, subject to the following conditions:
+#
+#The above copyright notice and this permission notice shall be included in all
+#copies or substantial portions of the Software.
+#
+#THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+#IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+#FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+#AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+#LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+#OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+#SOFTWARE.
+#
+#
+#
+#
+#
+#
+#
+
+# Bindings for the agent's capture container, build it first with 'make' in ./decoder
+
+import os
+import ctypes
+
+SECTION_CORE       = 0
+SECTION_MODULE     = 1
+SECTION_UNCORE     = 2
+SECTION_SIDEBAND   = 3
+SECTION_DESCRIPTOR = 4
+SECTION_TOPOLOGY   = 5
+SECTION_SKEW       = 6
+SECTION_INDEX      = 7
+SECTION_START      = 8
+
+UNKNOWN_SOURCE     = 0xffff
+
+LIBRARY_PATH = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'decoder', 'libsepcapture.so')
+
+
+class CaptureException(Exception): pass
+
+class Header(ctypes.Structure): # CAPTURE_HEADER_NODE_S
+    _fields_ = [
+        ('magic',        ctypes.c_char * 8),
+        ('version',      ctypes.c_uint),
+        ('header_size',  ctypes.c_uint),
+        ('tsc_freq',     ctypes.c_ulonglong),
+        ('create_tsc',   ctypes.c_ulonglong),
+        ('num_cpus',     ctypes.c_uint),
+        ('num_packages', ctypes.c_uint),
+        ('osid',         ctypes.c_uint),
+        ('agent_mode',   ctypes.c_uint),
+        ('reserved',     ctypes.c_ulonglong * 2),
+    ]
+
+class IndexEntry(ctypes.Structure): # CAPTURE_INDEX_ENTRY_NODE_S
+    _fields_ = [
+        ('offset',    ctypes.c_ulonglong),
+        ('first_tsc', ctypes.c_ulonglong),
+        ('last_tsc',  ctypes.c_ulonglong),
+        ('size',      ctypes.c_uint),
+        ('section',   ctypes.c_ushort),
+        ('source',    ctypes.c_ushort),
+    ]
+
+
+_library = None
+
+def library():
+    global _library
+    if _library is None and os.path.exists(LIBRARY_PATH):
+        lib = ctypes.CDLL(LIBRARY_PATH)
+        lib.CAPTURE_Set_Tsc_Frequency.argtypes = [ctypes.c_ulonglong]
+        lib.CAPTURE_Set_Tsc_Frequency.restype = None
+        lib.CAPTURE_Create.argtypes = [ctypes.c_char_p, ctypes.c_uint, ctypes.c_uint, ctypes.c_uint, ctypes.c_uint,
+                                       ctypes.POINTER(ctypes.c_void_p)]
+        lib.CAPTURE_Append.argtypes = [ctypes.c_void_p, ctypes.c_uint, ctypes.c_uint, ctypes.c_void_p, ctypes.c_uint]
+        lib.CAPTURE_Open.argtypes = [ctypes.c_char_p, ctypes.POINTER(ctypes.c_void_p)]
+        lib.CAPTURE_Header.argtypes = [ctypes.c_void_p]
+        lib.CAPTURE_Header.restype = ctypes.POINTER(Header)
+        lib.CAPTURE_Seconds_To_Tsc.argtypes = [ctypes.c_void_p, ctypes.c_double]
+        lib.CAPTURE_Seconds_To_Tsc.restype = ctypes.c_ulonglong
+        lib.CAPTURE_Find.argtypes = [ctypes.c_void_p, ctypes.c_uint, ctypes.c_uint, ctypes.c_ulonglong, ctypes.c_ulonglong,
+                                     ctypes.c_longlong, ctypes.POINTER(IndexEntry)]
+        lib.CAPTURE_Find.restype = ctypes.c_longlong
+        lib.CAPTURE_Next.argtypes = [ctypes.c_void_p, ctypes.c_uint, ctypes.c_uint, ctypes.c_longlong, ctypes.POINTER(IndexEntry)]
+        lib.CAPTURE_Next.restype = ctypes.c_longlong
+        lib.CAPTURE_Payload.argtypes = [ctypes.c_void_p, ctypes.POINTER(IndexEntry)]
+        lib.CAPTURE_Payload.restype = ctypes.c_void_p
+        lib.CAPTURE_Close.argtypes = [ctypes.c_void_p]
+        _library = lib
+    return _library
+
+def available():
+    return library() is not None
+
+
+class Capture(object):
+    # A capture written as the agent does, or an existing one opened for random access
+    def __init__(self, path, num_cpus=None, num_packages=1, tsc_freq=None):
+        self._lib = library()
+        if self._lib is None:
+            raise CaptureException("ERROR: {} is not built".format(LIBRARY_PATH))
+        self._handle = ctypes.c_void_p()
+        if num_cpus is None:
+            status = self._lib.CAPTURE_Open(path.encode(), ctypes.byref(self._handle))
+        else:
+            if tsc_freq is not None:
+                self._lib.CAPTURE_Set_Tsc_Frequency(tsc_freq)
+            status = self._lib.CAPTURE_Create(path.encode(), num_cpus, num_packages, 0, 0, ctypes.byref(self._handle))
+        if status != 0:
+            raise CaptureException("ERROR: Cannot open {} - status {}".format(path, status))
+
+    def append(self, section, source, data):
+        data = bytearray(data)
+        buffer = (ctypes.c_char * len(data)).from_buffer(data)
+        status = self._lib.CAPTURE_Append(self._handle, section, source, buffer, len(data))
+        if status != 0:
+            raise CaptureException("ERROR: Cannot append {} bytes - status {}".format(len(data), status))
+
+    def header(self):
+        return self._lib.CAPTURE_Header(self._handle).contents
+
+    def seconds_to_tsc(self, seconds):
+        return int(self._lib.CAPTURE_Seconds_To_Tsc(self._handle, seconds))
+
+    def find(self, section, source, first_tsc, last_tsc):
+        # Index entries of the chunks overlapping the window, in TSC order
+        entries = []
+        entry = IndexEntry()
+        position = self._lib.CAPTURE_Find(self._handle, section, source, first_tsc, last_tsc, -1, ctypes.byref(entry))
+        while position >= 0:
+            entries.append(IndexEntry.from_buffer_copy(entry))
+            position = self._lib.CAPTURE_Find(self._handle, section, source, first_tsc, last_tsc, position, ctypes.byref(entry))
+        return entries
+
+    def next(self, section, source):
+        # Index entries of the chunks of a source, in the order they were appended
+        entries = []
+        entry = IndexEntry()
+        position = self._lib.CAPTURE_Next(self._handle, section, source, -1, ctypes.byref(entry))
+        while position >= 0:
+            entries.append(IndexEntry.from_buffer_copy(entry))
+            position = self._lib.CAPTURE_Next(self._handle, section, source, position, ctypes.byref(entry))
+        return entries
+
+    def payload(self, entry):
+        address = self._lib.CAPTURE_Payload(self._handle, ctypes.byref(entry))
+        if not address:
+            raise CaptureException("ERROR: The capture is not mapped")
+        return bytearray(ctypes.string_at(address, entry.size))
+
+    def close(self):
+        if self._handle.value:
+            status = self._lib.CAPTURE_Close(self._handle)
+            self._handle = ctypes.c_void_p()
+            if status != 0:
+                raise CaptureException("ERROR: Cannot close the capture - status {}".format(status))
@@ -51,6 +51,7 @@ class ChannelType(object):
     CORE    = __type('CORE', 0)
     MODULE  = __type('MODULE', 1)
     UNCORE  = __type('UNCORE', 2)
+    SIDEBAND = __type('SIDEBAND', 3)
 
 
 class ChannelException(Exception): pass
@@ -66,6 +67,8 @@ class Channel(object):
         self.__socket = None
         self.__connected = False
         self.__listener = None
+        self.__arrivals = []
+        self.__chunk_header = None
         self.__clean()
 
     def __clean(self):
@@ -121,6 +124,14 @@ class Channel(object):
     def set_type(self, type):
         self.__channel_type = type
 
+    @property
+    def file_name(self):
+        return self.__file_name
+
+    @property
+    def framed(self):
+        return self.__chunk_header is not None
+
     def is_created(self):
         return self.__created
 
@@ -145,6 +156,23 @@ class Channel(object):
             raise ChannelException("ERROR: Cannot connect to target socket")
         self.__connected = True
 
+    def reconnect(self, ip, port, attempts=1):
+        # A new connection for the same channel, its data keeps going to the same file
+        self.__socket = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.connect(ip, port, attempts)
+
+    def drop(self):
+        # Cut the connection the way a network outage would, keeping what was received
+        self.__log.debug('{} - Dropping'.format(self.info))
+        if self.__socket is not None:
+            try:
+                self.__socket.shutdown(socket.SHUT_RDWR)
+            except socket.error:
+                pass
+        self.stop_receive_thread()
+        self.__close_socket()
+        self.__socket = None
+
     def send(self, data):
         self.__check_socket()
         self.__log.debug('{0} - Sending message: {data}'.format(self.info, **locals()))
@@ -167,13 +195,18 @@ class Channel(object):
         self.__log.debug('{0} - Received structure: {1}'.format(self.info, structure.to_string()))
         return structure
 
-    def start_receive_thread(self, to_file=False):
+    def start_receive_thread(self, to_file=False, append=False):
         def listen_to_file():
             self.__is_file_busy = True
-            with open(self.__file_name, 'wb') as file_obj:
+            if not append:
+                self.__arrivals = []
+            received = self.__arrivals[-1][1] if self.__arrivals else 0
+            with open(self.__file_name, 'ab' if append else 'wb') as file_obj:
                 try:
                     packet = self.__socket.recv(1024)
                     while packet:
+                        received += len(packet)
+                        self.__arrivals.append((time.time(), received))
                         file_obj.write(packet)
                         packet = self.__socket.recv(1024)
                 except IOError as err:
@@ -194,10 +227,52 @@ class Channel(object):
             self.__listener.join()
             self.__listener = None
 
-    def data_from_file(self):
+    def set_framing(self, header_type):
+        # Data of a resumable session arrives in chunks, each behind a header with its sequence
+        self.__chunk_header = header_type
+
+    def __chunks(self, data):
+        header_size = ctypes.sizeof(self.__chunk_header)
+        chunks = []
+        point = 0
+        while point + header_size <= len(data):
+            header = self.__chunk_header.from_buffer(data[point : point + header_size])
+            if point + header_size + header.size > len(data):
+                break
+            chunks.append((int(header.seq), data[point + header_size : point + header_size + header.size]))
+            point += header_size + header.size
+        return chunks, point
+
+    def __read_file(self):
         with open(self.__file_name, 'rb') as file_obj:
             return bytearray(file_obj.read())
 
+    def last_sequence(self):
+        # A chunk torn by the lost connection is cut off, the target sends it again
+        try:
+            chunks, complete = self.__chunks(self.__read_file())
+        except IOError:
+            return 0
+        with open(self.__file_name, 'r+b') as file_obj:
+            file_obj.truncate(complete)
+        return chunks[-1][0] if chunks else 0
+
+    def sequences(self):
+        return [seq for seq, chunk in self.__chunks(self.__read_file())[0]]
+
+    def data_from_file(self):
+        data = self.__read_file()
+        if self.__chunk_header is None:
+            return data
+        payload = bytearray()
+        for seq, chunk in self.__chunks(data)[0]:
+            payload += chunk
+        return payload
+
+    def arrivals(self):
+        # (host time, bytes received so far) for every packet of the last collection
+        return self.__arrivals
+
     def close(self):
         self.__log.debug('{} - Closing'.format(self.info))
         self.stop_receive_thread()
@@ -28,10 +28,14 @@
 
 import ctypes
 import operator
+import bisect
+import time
 
 import operation
+import decoder
+import metrics
 
-from structures import structures
+from structures import structures, CONTROL_MSG_FLAG_CACHED_REPLY, DRV_METRIC_MAX_METRICS, DRV_METRIC_MAX_SAMPLES
 from channel import Channel, ChannelList, ChannelType
 
 
@@ -57,6 +61,7 @@ def create_channels(protocol_version, log):
             self.cpu_data_channels = ChannelList(length=self.MAX_CORE_CHANNELS, log=self._log)
             self.module_data_channel = Channel(index=self.MAX_CORE_CHANNELS, log=self._log)
             self.uncore_data_channel = Channel(index=self.MAX_CORE_CHANNELS + 1, log=self._log)
+            self.sideband_data_channels = []
 
             self.data_channels = ChannelList(length=self.MAX_CORE_CHANNELS + 2, log=self._log)
             self.data_channels.includes(*self.cpu_data_channels.reserved)
@@ -80,6 +85,7 @@ def create_channels(protocol_version, log):
 
             self.module_data_channel = None
             self.uncore_data_channel = None
+            self.sideband_data_channels = []
 
             self.data_channels = ChannelList(length=self.MAX_CORE_CHANNELS + 2, log=self._log)
             self.data_channels.includes(*self.cpu_data_channels.reserved)
@@ -91,8 +97,16 @@ def create_channels(protocol_version, log):
             self.control_channel.close()
             self._init_channels()
 
-    return {3: v3, 6: v6}[protocol_version](log)
+    class v7(v6):
+        pass
 
+    return {3: v3, 6: v6, 7: v7}[protocol_version](log)
+
+
+# session flags of the first control message and the target status
+COMM_FLAG_RESUMABLE = 0x1
+COMM_FLAG_RESUME    = 0x2
+COMM_FLAG_RESUMED   = 0x4
 
 class CommunicationException(Exception): pass
 
@@ -107,6 +121,11 @@ class Communication(object):
         self.struct = structures(self._protocol_version)
         self.channels = create_channels(self._protocol_version, self.log)
         self.num_cpus = None
+        self.tsc_freq = None
+        self.start_clock = None
+        self.session_id = None
+        self.last_reply_flags = 0
+        self.last_reply_status = 0
 
     def check_status(self, status):
         if status.status != 0:
@@ -117,7 +136,7 @@ class Communication(object):
             raise CommunicationException("ERROR: protocol version id is different request={}, response={}".format(
                             self._protocol_version, message.proto_version))
 
-    def init(self):
+    def init(self, resumable=False):
         self.log.info('COMMUNICATION Establishing connection to remote target')
         self.log.info('COMMUNICATION Creation of control communication channel')
         self.channels.control_channel.create(ChannelType.CONTROL)
@@ -125,12 +144,19 @@ class Communication(object):
 
         self.log.info('COMMUNICATION Sending handshake message to remote target')
         init_msg = self.struct.FirstCommunicationMsg()
+        if resumable:
+            init_msg.flags = COMM_FLAG_RESUMABLE
         self.channels.control_channel.send_structure(init_msg)
 
         status_msg = self.channels.control_channel.receive_structure(self.struct.TargetStatusMsg)
         self.check_status(status_msg)
         self.check_protocol(status_msg)
+        if resumable:
+            if not status_msg.flags & COMM_FLAG_RESUMABLE:
+                raise CommunicationException("ERROR: Target does not support resumable sessions")
+            self.session_id = status_msg.session_id
         self.num_cpus = status_msg.remote_hardware_info.num_cpus
+        self.tsc_freq = status_msg.remote_hardware_info.tsc_freq
 
         self.log.info('COMMUNICATION Creation of data communication channels')
         self.channels.cpu_data_channels.create(
@@ -143,6 +169,26 @@ class Communication(object):
         self.tmp = Channel(index=self.channels.data_channels.length - 1, log=self.log)
         self.tmp.create(ChannelType.NONE)
         self.channels.data_channels.includes(self.tmp)
+
+        # from protocol 7 on, every package after the first has its own uncore channel,
+        # placed in the unused core slots after the last CPU
+        if self._protocol_version >= 7:
+            for package in range(1, status_msg.remote_hardware_info.num_packages):
+                self.tmp = Channel(index=self.num_cpus + package - 1, log=self.log)
+                self.tmp.create(ChannelType.NONE)
+                self.channels.data_channels.includes(self.tmp)
+
+        # the context switches of every CPU, in the core slots after the uncore ones
+        if status_msg.remote_switch.sched_switch_enable:
+            first = self.num_cpus
+            if self._protocol_version >= 7:
+                first += status_msg.remote_hardware_info.num_packages - 1
+            if first + self.num_cpus > self.channels.data_channels.length - 2:
+                raise CommunicationException("ERROR: Not possible to create sideband channels. Max count is reached")
+            for cpu in range(self.num_cpus):
+                self.tmp = Channel(index=first + cpu, log=self.log)
+                self.tmp.create(ChannelType.NONE)
+                self.channels.data_channels.includes(self.tmp)
         
         self.channels.data_channels.connect(self._ip, self._port)
 
@@ -157,6 +203,43 @@ class Communication(object):
             if data_msg.data_type == ChannelType.UNCORE:
                 channel.set_type(ChannelType.UNCORE)
                 self.channels.uncore_data_channel = channel
+            if data_msg.data_type == ChannelType.SIDEBAND:
+                # the target opens them in CPU order
+                channel.set_type(ChannelType.SIDEBAND)
+                self.channels.sideband_data_channels.append(channel)
+            if resumable:
+                channel.set_framing(self.struct.DataChunkHeader)
+
+    def resume(self, outage=0):
+        # Lose every connection mid-collection, then come back for the same session
+        self.log.info('COMMUNICATION Dropping the connections to remote target')
+        self.channels.control_channel.drop()
+        for channel in self.channels.data_channels:
+            channel.drop()
+        time.sleep(outage)
+
+        self.log.info('COMMUNICATION Resuming session {:x}'.format(self.session_id))
+        self.channels.control_channel.reconnect(self._ip, self._port, attempts=10)
+        init_msg = self.struct.FirstCommunicationMsg(flags=COMM_FLAG_RESUMABLE | COMM_FLAG_RESUME,
+                                                     resume_id=self.session_id)
+        self.channels.control_channel.send_structure(init_msg)
+
+        status_msg = self.channels.control_channel.receive_structure(self.struct.TargetStatusMsg)
+        self.check_status(status_msg)
+        self.check_protocol(status_msg)
+        if not status_msg.flags & COMM_FLAG_RESUMED:
+            raise CommunicationException("ERROR: Target did not resume session {:x}".format(self.session_id))
+
+        for channel in self.channels.data_channels:
+            channel.reconnect(self._ip, self._port)
+
+        for channel in self.channels.data_channels:
+            last_seq = channel.last_sequence()
+            channel.send_structure(self.struct.FirstCommunicationMsg(flags=COMM_FLAG_RESUMABLE | COMM_FLAG_RESUME,
+                                                                     resume_id=last_seq))
+            data_msg = channel.receive_structure(self.struct.FirstDataMsg)
+            self.check_protocol(data_msg)
+            channel.start_receive_thread(to_file=True, append=True)
 
     def run_operation(self, cmd_id, send_data="", rcv_data_size=0):
         control_message = self.struct.ControlMsg(
@@ -173,11 +256,16 @@ class Communication(object):
 
         if received_msg.command_id != control_message.command_id:
             raise CommunicationException("ERROR: Got incorret echo response from target")
+        self.last_reply_flags = getattr(received_msg, 'flags', 0)
+        self.last_reply_status = getattr(received_msg, 'status', 0)
 
         if (control_message.from_target_data_size == 0):
             return
         if (received_msg.status == 159 and (received_msg.command_id == 88 or received_msg.command_id == 85)):
             return
+        # a failed operation sends no data, whatever was asked for
+        if self.last_reply_status != 0 and received_msg.from_target_data_size == 0:
+            return
         return self.channels.control_channel.receive(control_message.from_target_data_size)
 
     def terminate(self):
@@ -215,6 +303,10 @@ class Communication(object):
             self.log.debug('COMMAND: GET_SYS_CONFIG')
             received_data = self.run_operation(cmd_id=operation.GET_SYS_CONFIG,
                 rcv_data_size = buf_size)
+            return received_data
+
+    def reply_cached(self):
+        return bool(self.last_reply_flags & CONTROL_MSG_FLAG_CACHED_REPLY)
 
     def platform_info(self):
         self.log.debug('Collecting platform configuration')
@@ -258,10 +350,11 @@ class Communication(object):
         received_data = self.run_operation(cmd_id=operation.CONTROL_DRIVER_LOG,
             send_data = bytearray(config))
 
-    def driver_init_driver(self):
+    def driver_init_driver(self, counting_mode=False):
         self.log.debug('COMMAND: INIT_DRIVER')
         # hardcoded configuration
         config = self.struct.DrvConfig()
+        config.counting_mode = counting_mode
         config.size = 120
         config.version = 1
         config.num_events = 1
@@ -417,7 +510,8 @@ class Communication(object):
 
         bin_ecb_switcher = {
                 3: bin_ecb_v3,
-                6: bin_ecb_v6
+                6: bin_ecb_v6,
+                7: bin_ecb_v6
             }
 
         bin_ecb_switcher[self._protocol_version]()
@@ -440,7 +534,8 @@ class Communication(object):
 
         bin_unc_ecb_switcher = {
                 3: bin_unc_ecb_v3,
-                6: bin_unc_ecb_v6
+                6: bin_unc_ecb_v6,
+                7: bin_unc_ecb_v6
             }
 
         bin_unc_ecb_switcher[self._protocol_version]()
@@ -561,10 +656,48 @@ class Communication(object):
         self.log.debug(structure.to_string())
         return structure
 
+    def read_and_reset(self, num_counts):
+        if self.num_cpus is None:
+            raise CommunicationException("ERROR: Cpu number is undefined")
+
+        self.log.debug('COMMAND: READ_AND_RESET')
+        # the per-CPU TSC deltas of the interval, then the counts
+        num_entries = self.num_cpus + num_counts
+        received_data = self.run_operation(cmd_id=operation.READ_AND_RESET,
+            rcv_data_size = num_entries * ctypes.sizeof(ctypes.c_ulonglong))
+        if received_data is None:
+            raise CommunicationException("ERROR: READ_AND_RESET failed - status {}".format(self.last_reply_status))
+        return list((ctypes.c_ulonglong * num_entries).from_buffer(received_data))
+
+    def set_metrics(self, definitions):
+        # [(name, tokens)] as built with the metrics module, an empty list disables them
+        self.log.debug('COMMAND: SET_METRICS')
+        self.run_operation(cmd_id=operation.SET_METRICS,
+            send_data = metrics.definitions(self.struct, definitions))
+        self.log.debug('Set metrics status: {}'.format(self.last_reply_status))
+        return self.last_reply_status
+
+    def get_metrics(self, since=None, num_metrics=DRV_METRIC_MAX_METRICS, max_rows=DRV_METRIC_MAX_SAMPLES):
+        self.log.debug('COMMAND: GET_METRICS')
+        send_data = bytearray(ctypes.c_ulonglong(since)) if since is not None else ""
+        received_data = self.run_operation(cmd_id=operation.GET_METRICS,
+            send_data = send_data,
+            rcv_data_size = ctypes.sizeof(self.struct.MetricSeries) +
+                            max_rows * num_metrics * ctypes.sizeof(ctypes.c_float))
+        if received_data is None:
+            raise CommunicationException("ERROR: GET_METRICS failed - status {}".format(self.last_reply_status))
+        header, rows = metrics.series(self.struct, received_data)
+        self.log.debug(header.to_string())
+        return header, rows
+
     def driver_start(self):
         self.log.debug('COMMAND: START')
         for channel in self.channels.data_channels:
             channel.start_receive_thread(to_file=True)
+        # pair a target TSC with the host time in the middle of its round trip
+        request_time = time.time()
+        tsc = self.get_tsc()
+        self.start_clock = ((request_time + time.time()) / 2, tsc)
         self.run_operation(cmd_id=operation.START)
 
     def driver_stop(self):
@@ -574,6 +707,8 @@ class Communication(object):
             channel.stop_receive_thread()
 
     def check_core_data(self, module_of_interest, hotspot_instruction_adrress, threshold=100):
+        if decoder.available():
+            return self.check_core_data_native(module_of_interest, hotspot_instruction_adrress, threshold)
         total_by_iip = {}
         total_by_pid = {}
         total_samples = 0
@@ -633,6 +768,99 @@ class Communication(object):
             raise CommunicationException("ERROR: Too small samples are on {} module of interset".format(module_of_interest))
 
 
+    def check_core_data_native(self, module_of_interest, hotspot_instruction_adrress, threshold=100):
+        # The checks of check_core_data, counted by the native decoder over the mapped captures
+        streams = [decoder.Stream(channel.file_name, decoder.STREAM_CORE, framed=channel.framed)
+                   for channel in self.channels.cpu_data_channels]
+        try:
+            total_samples = sum(len(stream) for stream in streams)
+            samples_on_cpus = sum(1 for stream in streams if len(stream))
+            self.log.debug('Count of samples: {}'.format(total_samples))
+
+            if samples_on_cpus == 0:
+                raise CommunicationException("ERROR: There are no samples")
+            elif samples_on_cpus == 1:
+                raise CommunicationException("ERROR: All Samples on one cpu only")
+
+            number_samples_on_hotspot = sum(stream.count_ip_range(hotspot_instruction_adrress - threshold,
+                                                                  hotspot_instruction_adrress + threshold)
+                                            for stream in streams)
+            if float(number_samples_on_hotspot) / float(total_samples) <= 0.95:
+                raise CommunicationException("ERROR: Number of samples on expected hotspot is low.")
+
+            modules = self.check_module_data()
+            if not module_of_interest in modules.keys():
+                raise CommunicationException("ERROR: There are no {} module in module map".format(module_of_interest))
+            # a sample counts once even if the module was mapped more than once over the same range
+            load_ranges = []
+            for low, high in sorted(modules[module_of_interest]):
+                if load_ranges and low <= load_ranges[-1][1]:
+                    load_ranges[-1][1] = max(load_ranges[-1][1], high)
+                else:
+                    load_ranges.append([low, high])
+            samples_on_module_of_interest = sum(stream.count_ip_range(low, high)
+                                                for stream in streams for low, high in load_ranges)
+            self.log.debug('Samples by {} module of interest: {} from {}'.format(module_of_interest, samples_on_module_of_interest, total_samples))
+
+            if samples_on_module_of_interest < 0.9 * total_samples:
+                raise CommunicationException("ERROR: Too small samples are on {} module of interset".format(module_of_interest))
+        finally:
+            for stream in streams:
+                stream.close()
+
+    def emon_cpu_intervals(self, num_entries):
+        # Shared EMON records of a per-CPU EMON collection, rebuilt from the records of every cpu channel
+        if self.num_cpus is None:
+            raise CommunicationException("ERROR: Cpu number is undefined")
+        records = []
+        for channel in self.channels.cpu_data_channels:
+            stream = decoder.Stream(channel.file_name, decoder.STREAM_CORE, framed=channel.framed)
+            try:
+                records.extend(stream.driver_records())
+            finally:
+                stream.close()
+        return decoder.emon_cpu_merge(records, self.num_cpus, num_entries)
+
+    def sample_latencies(self):
+        # Seconds from the TSC of each sample to the arrival of its last byte on the host
+        if self.start_clock is None or not self.tsc_freq:
+            raise CommunicationException("ERROR: No clock reference for the collection")
+        start_time, start_tsc = self.start_clock
+        record_size = ctypes.sizeof(self.struct.SampleRecordPC)
+        latencies = []
+        for channel in self.channels.cpu_data_channels:
+            data = channel.data_from_file()
+            arrivals = channel.arrivals()
+            received = [size for arrival_time, size in arrivals]
+            samples_number = len(data) // record_size
+            if not samples_number:
+                continue
+            array = (self.struct.SampleRecordPC * samples_number).from_buffer(data)
+            for index, sample in enumerate(array):
+                packet = bisect.bisect_left(received, (index + 1) * record_size)
+                if packet == len(arrivals):
+                    continue
+                sample_time = start_time + float(int(sample.tsc) - start_tsc) / self.tsc_freq
+                latencies.append(arrivals[packet][0] - sample_time)
+        return latencies
+
+    def check_sideband_data(self):
+        # Context switches of every CPU: (tsc, pid, tid) in the order the CPU switched
+        record_size = ctypes.sizeof(self.struct.SidebandInfo)
+        switches = {}
+        for cpu, channel in enumerate(self.channels.sideband_data_channels):
+            data = channel.data_from_file()
+            if len(data) % record_size:
+                raise CommunicationException("ERROR: Torn sideband record on {}".format(channel.info))
+            records = (self.struct.SidebandInfo * (len(data) // record_size)).from_buffer(data)
+            switches[cpu] = [(int(record.tsc), int(record.pid), int(record.tid)) for record in records]
+            tscs = [tsc for tsc, pid, tid in switches[cpu]]
+            if tscs != sorted(tscs):
+                raise CommunicationException("ERROR: Context switches of cpu {} are out of time order".format(cpu))
+        if not any(switches.values()):
+            raise CommunicationException("ERROR: There are no context switches")
+        return switches
+
     def check_module_data(self):
         data = self.channels.module_data_channel.data_from_file()
         counter = 0
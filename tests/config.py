@@ -42,6 +42,9 @@ class Config(object):
         self.target_port = args.target_port
         self.cores_number = None
         self.uncore_supported = False
+        self.stop_latency_limit = 0.1
+        self.delivery_latency_limit = 1.0
+        self.resume_outage = 2.0
 
         try:
             getattr(self, args.config_type)()
@@ -53,12 +56,12 @@ class Config(object):
         self.testapp = '/usr/user/test'
         self.testapp_hotspot_ip = 0x804900F
         self.uncore_supported = False
-        self.protocol_version = 6
+        self.protocol_version = 7
 
     def Xeon(self):
         self.cores_number = 88
         self.testapp = '/home/vtune/workspace/sampling/ref_tests/apps/one_test/test'
         self.testapp_hotspot_ip = 0x400B0D
         self.uncore_supported = False
-        self.protocol_version = 6
+        self.protocol_version = 7
 
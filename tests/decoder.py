@@ -0,0 +1,294 @@
+#
+#    Copyright (C) 2019-2020 Intel Corporation.  All Rights Reserved.
+#
+#Permission is hereby granted, free of charge, to any person obtaining a copy
+#of this software and associated documentation files (the "Software"), to deal
+#in the Software without restriction, including without limitation the rights
+#to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+#copies of the Software, and to permit persons to whom the Software is
+#furnished to do so, subject to the following conditions:
+#
+#The above copyright notice and this permission notice shall be included in all
+#copies or substantial portions of the Software.
+#
+#THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+#IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+#FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+#AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+#LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+#OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+#SOFTWARE.
+#
+#
+#
+#
+#
+#
+#
+
+# Bindings for the native capture decoder, build it first with 'make' in ./decoder
+
+import os
+import ctypes
+
+STREAM_CORE     = 0
+STREAM_MODULE   = 1
+STREAM_UNCORE   = 2
+STREAM_SIDEBAND = 3
+
+FLAG_FRAMED     = 0x1
+
+TAIL_PEBS       = 0
+TAIL_LBR        = 1
+TAIL_EBC        = 2
+TAIL_UNCORE_EBC = 3
+TAIL_CALLSTACK  = 4
+
+LIBRARY_PATH = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'decoder', 'libsepdecoder.so')
+
+
+class DecoderException(Exception): pass
+
+class Batch(ctypes.Structure): # DECODER_BATCH_NODE_S
+    _fields_ = [
+        ('tsc',           ctypes.POINTER(ctypes.c_ulonglong)),
+        ('ip',            ctypes.POINTER(ctypes.c_ulonglong)),
+        ('pid',           ctypes.POINTER(ctypes.c_uint)),
+        ('tid',           ctypes.POINTER(ctypes.c_uint)),
+        ('cpu',           ctypes.POINTER(ctypes.c_uint)),
+        ('descriptor_id', ctypes.POINTER(ctypes.c_uint)),
+    ]
+
+
+_library = None
+
+def library():
+    global _library
+    if _library is None and os.path.exists(LIBRARY_PATH):
+        lib = ctypes.CDLL(LIBRARY_PATH)
+        lib.DECODER_Open.argtypes = [ctypes.c_char_p, ctypes.c_uint, ctypes.c_uint, ctypes.POINTER(ctypes.c_void_p)]
+        lib.DECODER_Set_Descriptor.argtypes = [ctypes.c_void_p, ctypes.c_uint, ctypes.c_void_p]
+        lib.DECODER_Index.argtypes = [ctypes.c_void_p]
+        lib.DECODER_Num_Records.argtypes = [ctypes.c_void_p]
+        lib.DECODER_Num_Records.restype = ctypes.c_ulonglong
+        lib.DECODER_Record.argtypes = [ctypes.c_void_p, ctypes.c_ulonglong, ctypes.POINTER(ctypes.c_uint)]
+        lib.DECODER_Record.restype = ctypes.c_void_p
+        lib.DECODER_Num_Driver_Records.argtypes = [ctypes.c_void_p]
+        lib.DECODER_Num_Driver_Records.restype = ctypes.c_ulonglong
+        lib.DECODER_Driver_Record.argtypes = [ctypes.c_void_p, ctypes.c_ulonglong, ctypes.POINTER(ctypes.c_uint)]
+        lib.DECODER_Driver_Record.restype = ctypes.c_void_p
+        lib.DECODER_Read_Batch.argtypes = [ctypes.c_void_p, ctypes.c_ulonglong, ctypes.c_uint, ctypes.POINTER(Batch)]
+        lib.DECODER_Read_Batch.restype = ctypes.c_uint
+        lib.DECODER_Tail.argtypes = [ctypes.c_void_p, ctypes.c_ulonglong, ctypes.c_uint,
+                                     ctypes.POINTER(ctypes.c_void_p), ctypes.POINTER(ctypes.c_uint)]
+        lib.DECODER_Find_Tsc.argtypes = [ctypes.c_void_p, ctypes.c_ulonglong]
+        lib.DECODER_Find_Tsc.restype = ctypes.c_ulonglong
+        lib.DECODER_Time_Order.argtypes = [ctypes.c_void_p, ctypes.c_ulonglong]
+        lib.DECODER_Time_Order.restype = ctypes.c_ulonglong
+        lib.DECODER_Pid_Records.argtypes = [ctypes.c_void_p, ctypes.c_uint, ctypes.POINTER(ctypes.c_ulonglong), ctypes.c_ulonglong]
+        lib.DECODER_Pid_Records.restype = ctypes.c_ulonglong
+        lib.DECODER_Count_Ip_Range.argtypes = [ctypes.c_void_p, ctypes.c_ulonglong, ctypes.c_ulonglong]
+        lib.DECODER_Count_Ip_Range.restype = ctypes.c_ulonglong
+        lib.DECODER_Emon_Delta.argtypes = [ctypes.c_void_p, ctypes.c_uint, ctypes.POINTER(ctypes.c_ulonglong),
+                                           ctypes.POINTER(ctypes.c_ulonglong)]
+        lib.DECODER_Close.argtypes = [ctypes.c_void_p]
+        lib.DECODER_Close.restype = None
+        _library = lib
+    return _library
+
+def available():
+    return library() is not None
+
+
+class EmonDeltaHeader(ctypes.Structure): # DRV_EMON_DELTA_RECORD_NODE_S
+    _fields_ = [
+        ('descriptor_id', ctypes.c_uint),
+        ('flags',         ctypes.c_uint),
+        ('interval_id',   ctypes.c_ulonglong),
+        ('num_intervals', ctypes.c_uint),
+        ('num_entries',   ctypes.c_uint),
+        ('size',          ctypes.c_uint),
+        ('reserved1',     ctypes.c_uint),
+    ]
+
+def emon_delta_records(data):
+    # Decode the EMON device output of a delta-encoded collection into
+    # (interval_id, num_intervals, entries) per record, starting at the first keyframe
+    lib = library()
+    if lib is None:
+        raise DecoderException("ERROR: {} is not built".format(LIBRARY_PATH))
+    data = bytearray(data)
+    records = []
+    previous = None
+    offset = 0
+    while offset + ctypes.sizeof(EmonDeltaHeader) <= len(data):
+        header = EmonDeltaHeader.from_buffer(data, offset)
+        if header.size < ctypes.sizeof(EmonDeltaHeader) or offset + header.size > len(data):
+            raise DecoderException("ERROR: Malformed EMON delta record at offset {}".format(offset))
+        keyframe = bool(header.flags & 0x1)
+        if previous is None and not keyframe:
+            offset += header.size
+            continue
+        if previous is not None and not keyframe and \
+                (len(previous) != header.num_entries or header.interval_id != records[-1][0] + records[-1][1]):
+            raise DecoderException("ERROR: EMON delta record of interval {} does not follow the one before".format(header.interval_id))
+        entries = (ctypes.c_ulonglong * header.num_entries)()
+        record = (ctypes.c_char * header.size).from_buffer(data, offset)
+        status = lib.DECODER_Emon_Delta(record, header.size, None if keyframe else previous, entries)
+        if status != 0:
+            raise DecoderException("ERROR: Cannot decode the EMON delta record at offset {} - status {}".format(offset, status))
+        records.append((int(header.interval_id), int(header.num_intervals), [int(value) for value in entries]))
+        previous = entries
+        offset += header.size
+    return records
+
+
+class EmonCpuHeader(ctypes.Structure): # DRV_EMON_CPU_RECORD_NODE_S
+    _fields_ = [
+        ('descriptor_id', ctypes.c_uint),
+        ('cpu_num',       ctypes.c_uint),
+        ('interval_id',   ctypes.c_ulonglong),
+        ('tsc',           ctypes.c_ulonglong),
+        ('tsc_delta',     ctypes.c_ulonglong),
+        ('time_sec',      ctypes.c_ulonglong),
+        ('time_usec',     ctypes.c_ulonglong),
+        ('group_id',      ctypes.c_uint),
+        ('num_windows',   ctypes.c_uint),
+        ('size',          ctypes.c_uint),
+        ('reserved1',     ctypes.c_uint),
+    ]
+
+class EmonCpuWindowHeader(ctypes.Structure): # DRV_EMON_CPU_WINDOW_NODE_S
+    _fields_ = [
+        ('window_type',   ctypes.c_uint),
+        ('count',         ctypes.c_uint),
+        ('offset',        ctypes.c_ulonglong),
+    ]
+
+EMON_CPU_DESCRIPTOR_ID  = 0xFFFFFFEE
+EMON_CPU_WINDOW_THREAD  = 0
+EMON_CPU_WINDOW_PACKAGE = 1
+
+def emon_cpu_merge(records, num_cpus, num_entries):
+    # Rebuild the shared EMON records of a per-CPU EMON collection from the driver
+    # records of the cpu streams, as (interval_id, cpus, entries) in interval order.
+    # Entries of cpus without a record for an interval are left at zero.
+    intervals = {}
+    for data in records:
+        data = bytearray(data)
+        if len(data) < ctypes.sizeof(EmonCpuHeader):
+            continue
+        header = EmonCpuHeader.from_buffer(data)
+        if header.descriptor_id != EMON_CPU_DESCRIPTOR_ID:
+            continue
+        if header.size > len(data) or header.cpu_num >= num_cpus:
+            raise DecoderException("ERROR: Malformed EMON record of interval {}".format(header.interval_id))
+        windows = []
+        offset = ctypes.sizeof(header)
+        for _ in range(header.num_windows):
+            if offset + ctypes.sizeof(EmonCpuWindowHeader) > header.size:
+                raise DecoderException("ERROR: Malformed EMON record of interval {}".format(header.interval_id))
+            window = EmonCpuWindowHeader.from_buffer(data, offset)
+            offset += ctypes.sizeof(window)
+            first = 2 * num_cpus + window.offset
+            if offset + window.count * 8 > header.size or first + window.count > num_entries:
+                raise DecoderException("ERROR: EMON window of cpu {} out of the record".format(header.cpu_num))
+            values = (ctypes.c_ulonglong * window.count).from_buffer(data, offset)
+            windows.append((int(window.window_type), int(first), [int(value) for value in values]))
+            offset += window.count * 8
+        cpus = intervals.setdefault(int(header.interval_id), {})
+        if header.cpu_num in cpus:
+            raise DecoderException("ERROR: Two EMON records of cpu {} in interval {}".format(header.cpu_num, header.interval_id))
+        cpus[header.cpu_num] = (int(header.tsc_delta), int(header.time_sec), int(header.time_usec), windows)
+
+    merged = []
+    for interval_id in sorted(intervals):
+        cpus = intervals[interval_id]
+        entries = [0] * num_entries
+        # the header of the shared record: wall clock, then the TSC delta of every cpu
+        entries[0], entries[1] = cpus[min(cpus)][1:3]
+        for cpu, (tsc_delta, _, _, _) in cpus.items():
+            entries[num_cpus + cpu] = tsc_delta
+        # package windows hold stale thread entries, which the thread windows supersede
+        for window_type in (EMON_CPU_WINDOW_PACKAGE, EMON_CPU_WINDOW_THREAD):
+            for cpu in sorted(cpus):
+                for kind, first, values in cpus[cpu][3]:
+                    if kind == window_type:
+                        entries[first:first + len(values)] = values
+        merged.append((interval_id, sorted(cpus), entries))
+    return merged
+
+
+class Stream(object):
+    # One mapped capture; descriptors maps descriptor ids to EventDesc structures
+    def __init__(self, path, stream_type, framed=False, descriptors=None):
+        self._lib = library()
+        if self._lib is None:
+            raise DecoderException("ERROR: {} is not built".format(LIBRARY_PATH))
+        self._handle = ctypes.c_void_p()
+        status = self._lib.DECODER_Open(path.encode(), stream_type, FLAG_FRAMED if framed else 0, ctypes.byref(self._handle))
+        if status != 0:
+            raise DecoderException("ERROR: Cannot open {} - status {}".format(path, status))
+        for descriptor_id, desc in (descriptors or {}).items():
+            self._lib.DECODER_Set_Descriptor(self._handle, descriptor_id, ctypes.byref(desc))
+        status = self._lib.DECODER_Index(self._handle)
+        if status != 0:
+            self.close()
+            raise DecoderException("ERROR: Cannot index {} - status {}".format(path, status))
+
+    def __len__(self):
+        return int(self._lib.DECODER_Num_Records(self._handle))
+
+    def record(self, index, structure_type):
+        # The structure lives in the mapping, it is valid until the stream is closed
+        address = self._lib.DECODER_Record(self._handle, index, None)
+        if not address:
+            raise IndexError(index)
+        return structure_type.from_address(address)
+
+    def driver_records(self):
+        # Copies of the throttle, EM time, EMON, marker, time sync and config epoch records, in stream order
+        records = []
+        size = ctypes.c_uint()
+        for index in range(int(self._lib.DECODER_Num_Driver_Records(self._handle))):
+            address = self._lib.DECODER_Driver_Record(self._handle, index, ctypes.byref(size))
+            records.append(bytearray(ctypes.string_at(address, size.value)))
+        return records
+
+    def batch(self, first, count):
+        # One array per field, of which the first 'decoded' entries are filled
+        arrays = {}
+        batch = Batch()
+        for name, field_type in Batch._fields_:
+            arrays[name] = (field_type._type_ * count)()
+            setattr(batch, name, ctypes.cast(arrays[name], field_type))
+        decoded = self._lib.DECODER_Read_Batch(self._handle, first, count, ctypes.byref(batch))
+        return decoded, arrays
+
+    def tail(self, index, tail):
+        data = ctypes.c_void_p()
+        size = ctypes.c_uint()
+        status = self._lib.DECODER_Tail(self._handle, index, tail, ctypes.byref(data), ctypes.byref(size))
+        if status != 0:
+            raise DecoderException("ERROR: Cannot locate tail {} of record {} - status {}".format(tail, index, status))
+        return bytearray(ctypes.string_at(data, size.value)) if data else bytearray()
+
+    def find_tsc(self, tsc):
+        return int(self._lib.DECODER_Find_Tsc(self._handle, tsc))
+
+    def time_order(self, position):
+        return int(self._lib.DECODER_Time_Order(self._handle, position))
+
+    def pid_records(self, pid):
+        count = self._lib.DECODER_Pid_Records(self._handle, pid, None, 0)
+        indexes = (ctypes.c_ulonglong * count)()
+        self._lib.DECODER_Pid_Records(self._handle, pid, indexes, count)
+        return list(indexes)
+
+    def count_ip_range(self, low, high):
+        return int(self._lib.DECODER_Count_Ip_Range(self._handle, low, high))
+
+    def close(self):
+        if self._handle.value:
+            self._lib.DECODER_Close(self._handle)
+            self._handle = ctypes.c_void_p()
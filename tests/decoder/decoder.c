@@ -0,0 +1,1316 @@
+/****
+    Copyright (C) 2019-2020 Intel Corporation.  All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+
+
+
+
+
+****/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "lwpmudrv_defines.h"
+#include "lwpmudrv_types.h"
+#include "rise_errors.h"
+#include "lwpmudrv_ioctl.h"
+#include "lwpmudrv_ecb.h"
+#include "lwpmudrv_struct.h"
+#include "lwpmudrv_version.h"
+#include "communication.h"
+#include "decoder.h"
+
+struct DECODER_STREAM_NODE_S {
+    U32              type;
+    U32              flags;
+    S8              *base;
+    U64              length;
+    EVENT_DESC_NODE  descs[DECODER_MAX_DESCRIPTORS];
+    DRV_BOOL         indexed;
+    U64              num_records;
+    U32              stride;        // size of every record of an unframed stream of equal records, 0 otherwise
+    U64             *offsets;       // start of every record when there is no stride
+    U64              capacity;
+    U64             *time_order;    // record indexes by tsc, NULL when the stream is in order already
+    U64             *pid_order;     // record indexes by pid, then by position
+    U64              num_driver_records;
+    U64             *driver_offsets;    // start of every DRV_*_DESCRIPTOR_ID record, in stream order
+    U64              driver_capacity;
+};
+
+#define DECODER_STREAM_type(s)            (s)->type
+#define DECODER_STREAM_flags(s)           (s)->flags
+#define DECODER_STREAM_base(s)            (s)->base
+#define DECODER_STREAM_length(s)          (s)->length
+#define DECODER_STREAM_desc(s, id)        (&(s)->descs[id])
+#define DECODER_STREAM_indexed(s)         (s)->indexed
+#define DECODER_STREAM_num_records(s)     (s)->num_records
+#define DECODER_STREAM_stride(s)          (s)->stride
+#define DECODER_STREAM_offsets(s)         (s)->offsets
+#define DECODER_STREAM_capacity(s)        (s)->capacity
+#define DECODER_STREAM_time_order(s)      (s)->time_order
+#define DECODER_STREAM_pid_order(s)       (s)->pid_order
+#define DECODER_STREAM_num_driver_records(s)  (s)->num_driver_records
+#define DECODER_STREAM_driver_offsets(s)      (s)->driver_offsets
+#define DECODER_STREAM_driver_capacity(s)     (s)->driver_capacity
+
+typedef struct DECODER_KEY_NODE_S  DECODER_KEY_NODE;
+typedef        DECODER_KEY_NODE   *DECODER_KEY;
+
+struct DECODER_KEY_NODE_S {
+    U64  key;
+    U64  index;
+};
+
+typedef struct DECODER_PID_SLOT_NODE_S  DECODER_PID_SLOT_NODE;
+typedef        DECODER_PID_SLOT_NODE   *DECODER_PID_SLOT;
+
+struct DECODER_PID_SLOT_NODE_S {
+    U32  pid;
+    U32  used;
+    U64  next;          // records counted, then the next position of the pid in the order
+};
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        decoder_Record_At (stream, index)
+ *
+ * @brief     Locate a record of an indexed stream
+ *
+ * @return    pointer into the mapping
+ *
+ */
+static S8 *
+decoder_Record_At (
+    DECODER_STREAM  stream,
+    U64             index
+)
+{
+    if (DECODER_STREAM_stride(stream)) {
+        return DECODER_STREAM_base(stream) + index * DECODER_STREAM_stride(stream);
+    }
+    return DECODER_STREAM_base(stream) + DECODER_STREAM_offsets(stream)[index];
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        decoder_Is_Driver_Record (stream, record)
+ *
+ * @brief     Tell a throttle, EM time, EMON, marker, time sync or config epoch
+ *            record of a core stream from a sample
+ *
+ * @return    TRUE for a driver record
+ *
+ */
+static DRV_BOOL
+decoder_Is_Driver_Record (
+    DECODER_STREAM  stream,
+    S8             *record
+)
+{
+    return DECODER_STREAM_type(stream) == DECODER_STREAM_CORE && DRV_RECORD_Size(record, sizeof(U32)) != 0;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        decoder_Record_Size (stream, record, available)
+ *
+ * @param     record    - start of the record
+ * @param     available - bytes left in the segment holding the record
+ *
+ * @brief     Size of the record from its descriptor, its type or its length field
+ *
+ * @return    record size, 0 for a malformed record
+ *
+ * <I>Special Notes:</I>
+ *            The size may exceed the available bytes for a record cut short
+ *            by the end of the capture.
+ */
+static U32
+decoder_Record_Size (
+    DECODER_STREAM  stream,
+    S8             *record,
+    U64             available
+)
+{
+    U32  size = 0;
+    U32  header_size;
+    U32  id;
+
+    if (available < sizeof(U32)) {
+        return sizeof(U32);
+    }
+
+    switch (DECODER_STREAM_type(stream)) {
+        case DECODER_STREAM_CORE:
+        case DECODER_STREAM_UNCORE:
+            header_size = DECODER_STREAM_type(stream) == DECODER_STREAM_CORE ? sizeof(SampleRecordPC) : sizeof(UncoreSampleRecordPC);
+            id          = *(U32 *)record;
+            size        = header_size;
+            if (decoder_Is_Driver_Record(stream, record)) {
+                return DRV_RECORD_Size(record, available);
+            }
+            if (id < DECODER_MAX_DESCRIPTORS && EVENT_DESC_sample_size(DECODER_STREAM_desc(stream, id))) {
+                size = EVENT_DESC_sample_size(DECODER_STREAM_desc(stream, id));
+            }
+            if (size < header_size) {
+                size = 0;
+            }
+            break;
+        case DECODER_STREAM_MODULE:
+            size = MODULE_RECORD_rec_length((ModuleRecord *)record);
+            if (size < sizeof(ModuleRecord)) {
+                size = 0;
+            }
+            break;
+        case DECODER_STREAM_SIDEBAND:
+            size = sizeof(SIDEBAND_INFO_NODE);
+            break;
+    }
+
+    return size;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        decoder_Fields (stream, record, tsc, ip, pid, tid, cpu, descriptor_id)
+ *
+ * @brief     Pull the common fields out of a record of any stream type
+ *
+ * @return    NONE
+ *
+ */
+static VOID
+decoder_Fields (
+    DECODER_STREAM  stream,
+    S8             *record,
+    U64            *tsc,
+    U64            *ip,
+    U32            *pid,
+    U32            *tid,
+    U32            *cpu,
+    U32            *descriptor_id
+)
+{
+    *tsc = *ip = 0;
+    *pid = *tid = *cpu = *descriptor_id = 0;
+
+    switch (DECODER_STREAM_type(stream)) {
+        case DECODER_STREAM_CORE:
+            *tsc           = SAMPLE_RECORD_tsc((SampleRecordPC *)record);
+            *ip            = SAMPLE_RECORD_iip((SampleRecordPC *)record);
+            *pid           = SAMPLE_RECORD_pid_rec_index((SampleRecordPC *)record);
+            *tid           = SAMPLE_RECORD_tid((SampleRecordPC *)record);
+            *cpu           = SAMPLE_RECORD_cpu_num((SampleRecordPC *)record);
+            *descriptor_id = SAMPLE_RECORD_descriptor_id((SampleRecordPC *)record);
+            break;
+        case DECODER_STREAM_UNCORE:
+            *tsc           = UNCORE_SAMPLE_RECORD_tsc((UncoreSampleRecordPC *)record);
+            *cpu           = UNCORE_SAMPLE_RECORD_pkg_num((UncoreSampleRecordPC *)record);
+            *descriptor_id = UNCORE_SAMPLE_RECORD_descriptor_id((UncoreSampleRecordPC *)record);
+            break;
+        case DECODER_STREAM_MODULE:
+            *tsc           = MODULE_RECORD_tsc((ModuleRecord *)record);
+            *ip            = MODULE_RECORD_load_addr64((ModuleRecord *)record);
+            *pid           = MODULE_RECORD_pid_rec_index((ModuleRecord *)record);
+            break;
+        case DECODER_STREAM_SIDEBAND:
+            *tsc           = SIDEBAND_INFO_tsc((SIDEBAND_INFO)record);
+            *pid           = SIDEBAND_INFO_pid((SIDEBAND_INFO)record);
+            *tid           = SIDEBAND_INFO_tid((SIDEBAND_INFO)record);
+            break;
+    }
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        decoder_Add_Record (stream, offset, size)
+ *
+ * @brief     Append a record to the index, keeping a stride while all records are alike
+ *
+ * @return    DRV_STATUS
+ *
+ */
+static DRV_STATUS
+decoder_Add_Record (
+    DECODER_STREAM  stream,
+    U64             offset,
+    U32             size
+)
+{
+    U64   count = DECODER_STREAM_num_records(stream);
+    U64  *offsets;
+    U64   i;
+
+    if (!count && !(DECODER_STREAM_flags(stream) & DECODER_FLAG_FRAMED)) {
+        DECODER_STREAM_stride(stream) = size;
+    }
+    if (DECODER_STREAM_stride(stream) == size && offset == count * size) {
+        DECODER_STREAM_num_records(stream)++;
+        return VT_SUCCESS;
+    }
+
+    if (count >= DECODER_STREAM_capacity(stream)) {
+        DECODER_STREAM_capacity(stream) = count < 2048 ? 4096 : count * 2;
+        offsets = (U64 *)realloc(DECODER_STREAM_offsets(stream), DECODER_STREAM_capacity(stream) * sizeof(U64));
+        if (!offsets) {
+            return VT_NO_MEMORY;
+        }
+        DECODER_STREAM_offsets(stream) = offsets;
+    }
+    // the stride no longer holds: spell out the records covered by it so far
+    if (DECODER_STREAM_stride(stream)) {
+        for (i = 0; i < count; i++) {
+            DECODER_STREAM_offsets(stream)[i] = i * DECODER_STREAM_stride(stream);
+        }
+        DECODER_STREAM_stride(stream) = 0;
+    }
+    DECODER_STREAM_offsets(stream)[count] = offset;
+    DECODER_STREAM_num_records(stream)++;
+
+    return VT_SUCCESS;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        decoder_Add_Driver_Record (stream, offset)
+ *
+ * @brief     Append a driver record to its own index, apart from the samples
+ *
+ * @return    DRV_STATUS
+ *
+ */
+static DRV_STATUS
+decoder_Add_Driver_Record (
+    DECODER_STREAM  stream,
+    U64             offset
+)
+{
+    U64   count = DECODER_STREAM_num_driver_records(stream);
+    U64  *offsets;
+
+    if (count >= DECODER_STREAM_driver_capacity(stream)) {
+        DECODER_STREAM_driver_capacity(stream) = count < 512 ? 1024 : count * 2;
+        offsets = (U64 *)realloc(DECODER_STREAM_driver_offsets(stream), DECODER_STREAM_driver_capacity(stream) * sizeof(U64));
+        if (!offsets) {
+            return VT_NO_MEMORY;
+        }
+        DECODER_STREAM_driver_offsets(stream) = offsets;
+    }
+    DECODER_STREAM_driver_offsets(stream)[count] = offset;
+    DECODER_STREAM_num_driver_records(stream)++;
+
+    return VT_SUCCESS;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        decoder_Scan (stream, start, end, last)
+ *
+ * @param     start, end - bytes of the mapping holding whole records
+ * @param     last       - the segment ends the capture
+ *
+ * @brief     Index the records of one segment of the capture
+ *
+ * @return    DRV_STATUS
+ *
+ * <I>Special Notes:</I>
+ *            A record cut short at the end of the capture is left out; the
+ *            connection that carried it was lost. Driver records go to their
+ *            own index, so the record indexes, orders and counts only cover
+ *            samples.
+ */
+static DRV_STATUS
+decoder_Scan (
+    DECODER_STREAM  stream,
+    U64             start,
+    U64             end,
+    DRV_BOOL        last
+)
+{
+    U64         offset = start;
+    U32         size;
+    DRV_STATUS  status;
+
+    while (offset < end) {
+        size = decoder_Record_Size(stream, DECODER_STREAM_base(stream) + offset, end - offset);
+        if (!size) {
+            fprintf(stderr, "decoder: malformed record at offset %llu\n", offset);
+            return VT_INVALID_SAMPLE_FILE;
+        }
+        if (offset + size > end) {
+            if (last) {
+                break;
+            }
+            fprintf(stderr, "decoder: record at offset %llu crosses a chunk boundary\n", offset);
+            return VT_INVALID_SAMPLE_FILE;
+        }
+        if (decoder_Is_Driver_Record(stream, DECODER_STREAM_base(stream) + offset)) {
+            status = decoder_Add_Driver_Record(stream, offset);
+        }
+        else {
+            status = decoder_Add_Record(stream, offset, size);
+        }
+        if (status != VT_SUCCESS) {
+            return status;
+        }
+        offset += size;
+    }
+
+    return VT_SUCCESS;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        decoder_Radix_Sort (keys, spare, count)
+ *
+ * @param     spare - room for count more keys
+ *
+ * @brief     Stable sort of the keys, a byte at a time from the lowest one
+ *
+ * @return    the array holding the sorted keys, keys or spare
+ *
+ * <I>Special Notes:</I>
+ *            Bytes equal in all keys are skipped, so pids cost one or two passes.
+ */
+static DECODER_KEY
+decoder_Radix_Sort (
+    DECODER_KEY  keys,
+    DECODER_KEY  spare,
+    U64          count
+)
+{
+    U64          buckets[256];
+    U64          i, sum, n;
+    U32          shift;
+    DECODER_KEY  swap;
+
+    for (shift = 0; shift < 64; shift += 8) {
+        memset(buckets, 0, sizeof(buckets));
+        for (i = 0; i < count; i++) {
+            buckets[(keys[i].key >> shift) & 0xff]++;
+        }
+        if (buckets[(keys[0].key >> shift) & 0xff] == count) {
+            continue;
+        }
+        for (i = 0, sum = 0; i < 256; i++) {
+            n          = buckets[i];
+            buckets[i] = sum;
+            sum       += n;
+        }
+        for (i = 0; i < count; i++) {
+            spare[buckets[(keys[i].key >> shift) & 0xff]++] = keys[i];
+        }
+        swap  = keys;
+        keys  = spare;
+        spare = swap;
+    }
+
+    return keys;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        decoder_Time_Sort (stream)
+ *
+ * @brief     Order the records by tsc, for a stream not written in time order
+ *
+ * @return    DRV_STATUS
+ *
+ */
+static DRV_STATUS
+decoder_Time_Sort (
+    DECODER_STREAM  stream
+)
+{
+    DECODER_KEY  keys;
+    DECODER_KEY  spare;
+    DECODER_KEY  sorted;
+    U64         *order;
+    U64          i;
+    U64          tsc, ip;
+    U32          pid, tid, cpu, id;
+
+    if (!DECODER_STREAM_num_records(stream)) {
+        return VT_SUCCESS;
+    }
+    keys  = (DECODER_KEY)malloc(DECODER_STREAM_num_records(stream) * sizeof(DECODER_KEY_NODE));
+    spare = (DECODER_KEY)malloc(DECODER_STREAM_num_records(stream) * sizeof(DECODER_KEY_NODE));
+    order = (U64 *)malloc(DECODER_STREAM_num_records(stream) * sizeof(U64));
+    if (!keys || !spare || !order) {
+        free(keys);
+        free(spare);
+        free(order);
+        return VT_NO_MEMORY;
+    }
+
+    for (i = 0; i < DECODER_STREAM_num_records(stream); i++) {
+        decoder_Fields(stream, decoder_Record_At(stream, i), &tsc, &ip, &pid, &tid, &cpu, &id);
+        keys[i].key   = tsc;
+        keys[i].index = i;
+    }
+    sorted = decoder_Radix_Sort(keys, spare, DECODER_STREAM_num_records(stream));
+    for (i = 0; i < DECODER_STREAM_num_records(stream); i++) {
+        order[i] = sorted[i].index;
+    }
+    free(keys);
+    free(spare);
+    DECODER_STREAM_time_order(stream) = order;
+
+    return VT_SUCCESS;
+}
+
+
+static int
+decoder_Compare_Slots (
+    const void *a,
+    const void *b
+)
+{
+    U32  x = ((DECODER_PID_SLOT)a)->pid;
+    U32  y = ((DECODER_PID_SLOT)b)->pid;
+
+    return x < y ? -1 : x > y;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        decoder_Pid_Order (stream)
+ *
+ * @brief     Order the records by pid, keeping stream order within a pid
+ *
+ * @return    DRV_STATUS
+ *
+ * <I>Special Notes:</I>
+ *            A capture has few distinct pids: they are counted in a hash
+ *            table, then every record is placed in a second pass.
+ */
+static DRV_STATUS
+decoder_Pid_Order (
+    DECODER_STREAM  stream
+)
+{
+    DECODER_PID_SLOT  slots    = NULL;
+    DECODER_PID_SLOT  grown;
+    U32               capacity = 0;
+    U32               used     = 0;
+    U32               mask, h, j;
+    U64               i, position;
+    U64               tsc, ip;
+    U32               pid, tid, cpu, id;
+    U64              *order;
+
+    if (!DECODER_STREAM_num_records(stream)) {
+        return VT_SUCCESS;
+    }
+    order = (U64 *)malloc(DECODER_STREAM_num_records(stream) * sizeof(U64));
+    if (!order) {
+        return VT_NO_MEMORY;
+    }
+
+    for (i = 0; i < DECODER_STREAM_num_records(stream); i++) {
+        if (used * 2 >= capacity) {
+            // rehash into a table twice the size
+            grown = (DECODER_PID_SLOT)calloc(capacity ? capacity * 2 : 1024, sizeof(DECODER_PID_SLOT_NODE));
+            if (!grown) {
+                free(slots);
+                free(order);
+                return VT_NO_MEMORY;
+            }
+            mask = (capacity ? capacity * 2 : 1024) - 1;
+            for (j = 0; j < capacity; j++) {
+                if (slots[j].used) {
+                    for (h = (slots[j].pid * 2654435761U) & mask; grown[h].used; h = (h + 1) & mask);
+                    grown[h] = slots[j];
+                }
+            }
+            free(slots);
+            slots    = grown;
+            capacity = mask + 1;
+        }
+        decoder_Fields(stream, decoder_Record_At(stream, i), &tsc, &ip, &pid, &tid, &cpu, &id);
+        for (h = (pid * 2654435761U) & (capacity - 1); slots[h].used && slots[h].pid != pid; h = (h + 1) & (capacity - 1));
+        if (!slots[h].used) {
+            slots[h].used = 1;
+            slots[h].pid  = pid;
+            used++;
+        }
+        slots[h].next++;
+    }
+
+    // pids in increasing order, each starting where the previous one ends
+    grown = (DECODER_PID_SLOT)malloc(used * sizeof(DECODER_PID_SLOT_NODE));
+    if (!grown) {
+        free(slots);
+        free(order);
+        return VT_NO_MEMORY;
+    }
+    for (j = 0, h = 0; j < capacity; j++) {
+        if (slots[j].used) {
+            grown[h++] = slots[j];
+        }
+    }
+    qsort(grown, used, sizeof(DECODER_PID_SLOT_NODE), decoder_Compare_Slots);
+    memset(slots, 0, capacity * sizeof(DECODER_PID_SLOT_NODE));
+    for (j = 0, position = 0; j < used; j++) {
+        for (h = (grown[j].pid * 2654435761U) & (capacity - 1); slots[h].used; h = (h + 1) & (capacity - 1));
+        slots[h].used = 1;
+        slots[h].pid  = grown[j].pid;
+        slots[h].next = position;
+        position     += grown[j].next;
+    }
+    free(grown);
+
+    for (i = 0; i < DECODER_STREAM_num_records(stream); i++) {
+        decoder_Fields(stream, decoder_Record_At(stream, i), &tsc, &ip, &pid, &tid, &cpu, &id);
+        for (h = (pid * 2654435761U) & (capacity - 1); slots[h].pid != pid; h = (h + 1) & (capacity - 1));
+        order[slots[h].next++] = i;
+    }
+    free(slots);
+    DECODER_STREAM_pid_order(stream) = order;
+
+    return VT_SUCCESS;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        DECODER_Open (path, type, flags, stream)
+ *
+ * @param     path   - capture of one data channel
+ * @param     type   - DECODER_STREAM_* of the channel
+ * @param     flags  - DECODER_FLAG_*
+ * @param     stream - receives the new stream
+ *
+ * @brief     Map a capture file. Descriptors may be set before it is indexed.
+ *
+ * @return    DRV_STATUS
+ *
+ */
+DRV_STATUS
+DECODER_Open (
+    const char      *path,
+    U32              type,
+    U32              flags,
+    DECODER_STREAM  *stream
+)
+{
+    DECODER_STREAM  s;
+    struct stat     st;
+    int             fd;
+
+    if (!path || !stream || type > DECODER_STREAM_SIDEBAND) {
+        return VT_BAD_PARAMETER;
+    }
+    *stream = NULL;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return VT_FILE_OPEN_FAILED;
+    }
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return VT_FILE_OPEN_FAILED;
+    }
+
+    s = (DECODER_STREAM)calloc(1, sizeof(DECODER_STREAM_NODE));
+    if (!s) {
+        close(fd);
+        return VT_NO_MEMORY;
+    }
+    DECODER_STREAM_type(s)   = type;
+    DECODER_STREAM_flags(s)  = flags;
+    DECODER_STREAM_length(s) = st.st_size;
+
+    if (st.st_size) {
+        DECODER_STREAM_base(s) = (S8 *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (DECODER_STREAM_base(s) == MAP_FAILED) {
+            close(fd);
+            free(s);
+            return VT_SAMPLE_FILE_MAPPING_ERROR;
+        }
+    }
+    // the mapping stays valid without the descriptor
+    close(fd);
+
+    *stream = s;
+
+    return VT_SUCCESS;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        DECODER_Set_Descriptor (stream, descriptor_id, desc)
+ *
+ * @param     desc - event descriptor as sent with DRV_OPERATION_DESC_NEXT
+ *
+ * @brief     Give the size and layout of the samples tagged with a descriptor id.
+ *            Samples of unknown descriptors are taken to be bare records.
+ *
+ * @return    DRV_STATUS
+ *
+ */
+DRV_STATUS
+DECODER_Set_Descriptor (
+    DECODER_STREAM  stream,
+    U32             descriptor_id,
+    EVENT_DESC      desc
+)
+{
+    if (!stream || !desc || descriptor_id >= DECODER_MAX_DESCRIPTORS) {
+        return VT_BAD_PARAMETER;
+    }
+    if (DECODER_STREAM_indexed(stream)) {
+        return VT_INVALID_STATE_TRANS;
+    }
+    memcpy(DECODER_STREAM_desc(stream, descriptor_id), desc, sizeof(EVENT_DESC_NODE));
+
+    return VT_SUCCESS;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        DECODER_Index (stream)
+ *
+ * @brief     Walk the capture once to find every record, then order the records
+ *            by time and by pid
+ *
+ * @return    DRV_STATUS
+ *
+ */
+DRV_STATUS
+DECODER_Index (
+    DECODER_STREAM  stream
+)
+{
+    COMM_DATA_CHUNK_HEADER  header;
+    U64                     offset   = 0;
+    U64                     last_seq = 0;
+    U64                     length;
+    U64                     i;
+    U64                     prev_tsc = 0;
+    U64                     tsc, ip;
+    U32                     pid, tid, cpu, id;
+    DRV_BOOL                in_order = TRUE;
+    DRV_STATUS              status   = VT_SUCCESS;
+
+    if (!stream) {
+        return VT_BAD_PARAMETER;
+    }
+    if (DECODER_STREAM_indexed(stream)) {
+        return VT_SUCCESS;
+    }
+    length = DECODER_STREAM_length(stream);
+    if (length) {
+        madvise(DECODER_STREAM_base(stream), length, MADV_SEQUENTIAL);
+    }
+
+    if (DECODER_STREAM_flags(stream) & DECODER_FLAG_FRAMED) {
+        while (status == VT_SUCCESS && offset + sizeof(COMM_DATA_CHUNK_HEADER_NODE) <= length) {
+            header  = (COMM_DATA_CHUNK_HEADER)(DECODER_STREAM_base(stream) + offset);
+            offset += sizeof(COMM_DATA_CHUNK_HEADER_NODE);
+            // a chunk sent again after a resume that was already received
+            if (COMM_DATA_CHUNK_HEADER_seq(header) > last_seq) {
+                last_seq = COMM_DATA_CHUNK_HEADER_seq(header);
+                if (offset + COMM_DATA_CHUNK_HEADER_size(header) >= length) {
+                    status = decoder_Scan(stream, offset, length, TRUE);
+                }
+                else {
+                    status = decoder_Scan(stream, offset, offset + COMM_DATA_CHUNK_HEADER_size(header), FALSE);
+                }
+            }
+            offset += COMM_DATA_CHUNK_HEADER_size(header);
+        }
+    }
+    else {
+        status = decoder_Scan(stream, 0, length, TRUE);
+    }
+    if (status != VT_SUCCESS) {
+        return status;
+    }
+
+    for (i = 0; i < DECODER_STREAM_num_records(stream); i++) {
+        decoder_Fields(stream, decoder_Record_At(stream, i), &tsc, &ip, &pid, &tid, &cpu, &id);
+        if (tsc < prev_tsc) {
+            in_order = FALSE;
+            break;
+        }
+        prev_tsc = tsc;
+    }
+    if (!in_order) {
+        status = decoder_Time_Sort(stream);
+    }
+    if (status == VT_SUCCESS && DECODER_STREAM_type(stream) != DECODER_STREAM_UNCORE) {
+        status = decoder_Pid_Order(stream);
+    }
+    if (status == VT_SUCCESS) {
+        DECODER_STREAM_indexed(stream) = TRUE;
+    }
+
+    return status;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        DECODER_Num_Records (stream)
+ *
+ * @return    number of records of an indexed stream
+ *
+ */
+U64
+DECODER_Num_Records (
+    DECODER_STREAM  stream
+)
+{
+    if (!stream || !DECODER_STREAM_indexed(stream)) {
+        return 0;
+    }
+    return DECODER_STREAM_num_records(stream);
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        DECODER_Record (stream, index, size)
+ *
+ * @param     size - receives the size of the record, may be NULL
+ *
+ * @brief     Read a record in place
+ *
+ * @return    the record, NULL past the end of the stream
+ *
+ */
+VOID *
+DECODER_Record (
+    DECODER_STREAM  stream,
+    U64             index,
+    U32            *size
+)
+{
+    S8  *record;
+
+    if (!stream || !DECODER_STREAM_indexed(stream) || index >= DECODER_STREAM_num_records(stream)) {
+        return NULL;
+    }
+    record = decoder_Record_At(stream, index);
+    if (size) {
+        *size = decoder_Record_Size(stream, record, DECODER_STREAM_base(stream) + DECODER_STREAM_length(stream) - record);
+    }
+
+    return record;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        DECODER_Num_Driver_Records (stream)
+ *
+ * @return    number of driver records of an indexed core stream
+ *
+ */
+U64
+DECODER_Num_Driver_Records (
+    DECODER_STREAM  stream
+)
+{
+    if (!stream || !DECODER_STREAM_indexed(stream)) {
+        return 0;
+    }
+    return DECODER_STREAM_num_driver_records(stream);
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        DECODER_Driver_Record (stream, index, size)
+ *
+ * @param     size - receives the size of the record, may be NULL
+ *
+ * @brief     Read a DRV_*_DESCRIPTOR_ID record in place, in stream order
+ *
+ * @return    the record, NULL past the last driver record
+ *
+ */
+VOID *
+DECODER_Driver_Record (
+    DECODER_STREAM  stream,
+    U64             index,
+    U32            *size
+)
+{
+    S8  *record;
+
+    if (!stream || !DECODER_STREAM_indexed(stream) || index >= DECODER_STREAM_num_driver_records(stream)) {
+        return NULL;
+    }
+    record = DECODER_STREAM_base(stream) + DECODER_STREAM_driver_offsets(stream)[index];
+    if (size) {
+        *size = DRV_RECORD_Size(record, DECODER_STREAM_base(stream) + DECODER_STREAM_length(stream) - record);
+    }
+
+    return record;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        DECODER_Read_Batch (stream, first, count, batch)
+ *
+ * @param     first - index of the first record
+ * @param     count - records wanted
+ * @param     batch - field arrays to fill
+ *
+ * @brief     Decode a run of records into one array per field
+ *
+ * @return    number of records decoded
+ *
+ */
+U32
+DECODER_Read_Batch (
+    DECODER_STREAM  stream,
+    U64             first,
+    U32             count,
+    DECODER_BATCH   batch
+)
+{
+    U32  i;
+    U64  tsc, ip;
+    U32  pid, tid, cpu, id;
+
+    if (!stream || !batch || !DECODER_STREAM_indexed(stream) || first >= DECODER_STREAM_num_records(stream)) {
+        return 0;
+    }
+    if (count > DECODER_STREAM_num_records(stream) - first) {
+        count = (U32)(DECODER_STREAM_num_records(stream) - first);
+    }
+
+    for (i = 0; i < count; i++) {
+        decoder_Fields(stream, decoder_Record_At(stream, first + i), &tsc, &ip, &pid, &tid, &cpu, &id);
+        if (DECODER_BATCH_tsc(batch)) {
+            DECODER_BATCH_tsc(batch)[i] = tsc;
+        }
+        if (DECODER_BATCH_ip(batch)) {
+            DECODER_BATCH_ip(batch)[i] = ip;
+        }
+        if (DECODER_BATCH_pid(batch)) {
+            DECODER_BATCH_pid(batch)[i] = pid;
+        }
+        if (DECODER_BATCH_tid(batch)) {
+            DECODER_BATCH_tid(batch)[i] = tid;
+        }
+        if (DECODER_BATCH_cpu(batch)) {
+            DECODER_BATCH_cpu(batch)[i] = cpu;
+        }
+        if (DECODER_BATCH_descriptor_id(batch)) {
+            DECODER_BATCH_descriptor_id(batch)[i] = id;
+        }
+    }
+
+    return count;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        DECODER_Tail (stream, index, tail, data, size)
+ *
+ * @param     tail - DECODER_TAIL_*
+ * @param     data - receives the start of the tail, NULL when the sample has none
+ * @param     size - receives the size of the tail
+ *
+ * @brief     Locate the PEBS, LBR, counter or call stack part of a sample
+ *
+ * @return    DRV_STATUS
+ *
+ * <I>Special Notes:</I>
+ *            A tail without a size in the descriptor runs up to the next part
+ *            of the sample, or to its end.
+ */
+DRV_STATUS
+DECODER_Tail (
+    DECODER_STREAM   stream,
+    U64              index,
+    U32              tail,
+    VOID           **data,
+    U32             *size
+)
+{
+    S8          *record;
+    EVENT_DESC   desc;
+    U32          id;
+    U32          offset = 0;
+    U32          length = 0;
+    U32          end;
+    U32          parts[13];
+    U32          i;
+
+    if (!data || !size || !stream || !DECODER_STREAM_indexed(stream) || index >= DECODER_STREAM_num_records(stream) ||
+        (DECODER_STREAM_type(stream) != DECODER_STREAM_CORE && DECODER_STREAM_type(stream) != DECODER_STREAM_UNCORE)) {
+        return VT_BAD_PARAMETER;
+    }
+    *data = NULL;
+    *size = 0;
+
+    record = decoder_Record_At(stream, index);
+    id     = *(U32 *)record;
+    if (id >= DECODER_MAX_DESCRIPTORS || !EVENT_DESC_sample_size(DECODER_STREAM_desc(stream, id))) {
+        return VT_SUCCESS;
+    }
+    desc = DECODER_STREAM_desc(stream, id);
+
+    switch (tail) {
+        case DECODER_TAIL_PEBS:
+            offset = EVENT_DESC_pebs_offset(desc);
+            length = EVENT_DESC_pebs_size(desc);
+            break;
+        case DECODER_TAIL_LBR:
+            offset = EVENT_DESC_lbr_offset(desc);
+            length = EVENT_DESC_lbr_info_size(desc);
+            break;
+        case DECODER_TAIL_EBC:
+            offset = EVENT_DESC_ebc_offset(desc);
+            break;
+        case DECODER_TAIL_UNCORE_EBC:
+            offset = EVENT_DESC_uncore_ebc_offset(desc);
+            break;
+        case DECODER_TAIL_CALLSTACK:
+            offset = EVENT_DESC_callstack_offset(desc);
+            length = EVENT_DESC_callstack_size(desc);
+            break;
+        default:
+            return VT_BAD_PARAMETER;
+    }
+    if (!offset || offset >= EVENT_DESC_sample_size(desc)) {
+        return VT_SUCCESS;
+    }
+
+    if (!length) {
+        parts[0]  = EVENT_DESC_pebs_offset(desc);
+        parts[1]  = EVENT_DESC_lbr_offset(desc);
+        parts[2]  = EVENT_DESC_latency_offset_in_sample(desc);
+        parts[3]  = EVENT_DESC_power_offset_in_sample(desc);
+        parts[4]  = EVENT_DESC_ebc_offset(desc);
+        parts[5]  = EVENT_DESC_uncore_ebc_offset(desc);
+        parts[6]  = EVENT_DESC_eventing_ip_offset(desc);
+        parts[7]  = EVENT_DESC_hle_offset(desc);
+        parts[8]  = EVENT_DESC_pwr_offset(desc);
+        parts[9]  = EVENT_DESC_callstack_offset(desc);
+        parts[10] = EVENT_DESC_p_state_offset(desc);
+        parts[11] = EVENT_DESC_pebs_tsc_offset(desc);
+        parts[12] = EVENT_DESC_perfmetrics_offset(desc);
+        end       = EVENT_DESC_sample_size(desc);
+        for (i = 0; i < sizeof(parts) / sizeof(parts[0]); i++) {
+            if (parts[i] > offset && parts[i] < end) {
+                end = parts[i];
+            }
+        }
+        length = end - offset;
+    }
+    if (offset + length > EVENT_DESC_sample_size(desc)) {
+        length = EVENT_DESC_sample_size(desc) - offset;
+    }
+
+    *data = record + offset;
+    *size = length;
+
+    return VT_SUCCESS;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        DECODER_Time_Order (stream, position)
+ *
+ * @brief     Record at a position of the stream ordered by tsc
+ *
+ * @return    record index
+ *
+ */
+U64
+DECODER_Time_Order (
+    DECODER_STREAM  stream,
+    U64             position
+)
+{
+    if (!stream || !DECODER_STREAM_time_order(stream) || position >= DECODER_STREAM_num_records(stream)) {
+        return position;
+    }
+    return DECODER_STREAM_time_order(stream)[position];
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        DECODER_Find_Tsc (stream, tsc)
+ *
+ * @brief     First position in time order of a record taken at or after a tsc
+ *
+ * @return    position for DECODER_Time_Order, the number of records if none
+ *
+ */
+U64
+DECODER_Find_Tsc (
+    DECODER_STREAM  stream,
+    U64             tsc
+)
+{
+    U64  low  = 0;
+    U64  high = DECODER_Num_Records(stream);
+    U64  mid;
+    U64  value, ip;
+    U32  pid, tid, cpu, id;
+
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        decoder_Fields(stream, decoder_Record_At(stream, DECODER_Time_Order(stream, mid)), &value, &ip, &pid, &tid, &cpu, &id);
+        if (value < tsc) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        DECODER_Pid_Records (stream, pid, indexes, max_indexes)
+ *
+ * @param     indexes     - receives the record indexes in stream order, may be NULL
+ * @param     max_indexes - room in indexes
+ *
+ * @brief     Records of one process
+ *
+ * @return    number of records of the process
+ *
+ */
+U64
+DECODER_Pid_Records (
+    DECODER_STREAM  stream,
+    U32             pid,
+    U64            *indexes,
+    U64             max_indexes
+)
+{
+    U64  low  = 0;
+    U64  high = DECODER_Num_Records(stream);
+    U64  first, mid;
+    U64  tsc, ip;
+    U32  value, tid, cpu, id;
+
+    if (!high || !DECODER_STREAM_pid_order(stream)) {
+        return 0;
+    }
+
+    // bounds of the run of the pid, found by comparing against pid and pid + 1
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        decoder_Fields(stream, decoder_Record_At(stream, DECODER_STREAM_pid_order(stream)[mid]), &tsc, &ip, &value, &tid, &cpu, &id);
+        if (value < pid) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+    first = low;
+    high  = DECODER_STREAM_num_records(stream);
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        decoder_Fields(stream, decoder_Record_At(stream, DECODER_STREAM_pid_order(stream)[mid]), &tsc, &ip, &value, &tid, &cpu, &id);
+        if (value <= pid) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+
+    if (indexes) {
+        memcpy(indexes, DECODER_STREAM_pid_order(stream) + first, (low - first < max_indexes ? low - first : max_indexes) * sizeof(U64));
+    }
+
+    return low - first;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        DECODER_Count_Ip_Range (stream, low, high)
+ *
+ * @brief     Count the samples with an ip in [low, high]
+ *
+ * @return    number of samples
+ *
+ */
+U64
+DECODER_Count_Ip_Range (
+    DECODER_STREAM  stream,
+    U64             low,
+    U64             high
+)
+{
+    U64  count = 0;
+    U64  i, n;
+    U64  ip;
+    U32  stride;
+    S8  *base;
+
+    n = DECODER_Num_Records(stream);
+    if (!n || DECODER_STREAM_type(stream) != DECODER_STREAM_CORE) {
+        return 0;
+    }
+
+    stride = DECODER_STREAM_stride(stream);
+    base   = DECODER_STREAM_base(stream);
+    if (stride) {
+        // the common case of a plain capture with a single descriptor
+        for (i = 0; i < n; i++) {
+            ip     = SAMPLE_RECORD_iip((SampleRecordPC *)(base + i * stride));
+            count += (ip >= low && ip <= high);
+        }
+    }
+    else {
+        for (i = 0; i < n; i++) {
+            ip     = SAMPLE_RECORD_iip((SampleRecordPC *)(base + DECODER_STREAM_offsets(stream)[i]));
+            count += (ip >= low && ip <= high);
+        }
+    }
+
+    return count;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        DECODER_Emon_Delta (record, available, previous, entries)
+ *
+ * @param     record    - DRV_EMON_DELTA_RECORD read from the EMON device
+ * @param     available - bytes readable from record
+ * @param     previous  - entries decoded from the record before, NULL if none
+ * @param     entries   - receives the num_entries entries of the classic EMON
+ *                        record, may be previous
+ *
+ * @brief     Decode one delta-encoded EMON record
+ *
+ * @return    DRV_STATUS
+ *
+ * <I>Special Notes:</I>
+ *            A record that is not a keyframe needs the entries of the record
+ *            before it. The driver writes a keyframe after a record it had
+ *            to drop, so decoding resumes there.
+ */
+DRV_STATUS
+DECODER_Emon_Delta (
+    VOID        *record,
+    U32          available,
+    U64         *previous,
+    U64         *entries
+)
+{
+    DRV_EMON_DELTA_RECORD  rec = (DRV_EMON_DELTA_RECORD)record;
+    U8                    *p;
+    U8                    *end;
+    U64                    zz;
+    U64                    delta;
+    U32                    shift;
+    U32                    i;
+    DRV_BOOL               keyframe;
+
+    if (!record || !entries || available < sizeof(DRV_EMON_DELTA_RECORD_NODE) ||
+        DRV_EMON_DELTA_RECORD_descriptor_id(rec) != DRV_EMON_DELTA_DESCRIPTOR_ID) {
+        return VT_BAD_PARAMETER;
+    }
+    if (DRV_EMON_DELTA_RECORD_size(rec) < sizeof(DRV_EMON_DELTA_RECORD_NODE) || DRV_EMON_DELTA_RECORD_size(rec) > available) {
+        return VT_INVALID_SAMPLE_FILE;
+    }
+    keyframe = (DRV_EMON_DELTA_RECORD_flags(rec) & DRV_EMON_DELTA_FLAG_KEYFRAME) ? TRUE : FALSE;
+    if (!keyframe && !previous) {
+        return VT_INVALID_STATE_TRANS;
+    }
+
+    p   = (U8 *)(rec + 1);
+    end = (U8 *)rec + DRV_EMON_DELTA_RECORD_size(rec);
+    for (i = 0; i < DRV_EMON_DELTA_RECORD_num_entries(rec); i++) {
+        zz    = 0;
+        shift = 0;
+        do {
+            if (p >= end || shift > 63) {
+                return VT_INVALID_SAMPLE_FILE;
+            }
+            zz    |= (U64)(*p & 0x7f) << shift;
+            shift += 7;
+        } while (*p++ & 0x80);
+        delta      = (zz >> 1) ^ (U64)(-(S64)(zz & 1));
+        entries[i] = ((keyframe) ? 0 : previous[i]) + delta;
+    }
+
+    return VT_SUCCESS;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * @fn        DECODER_Close (stream)
+ *
+ * @brief     Unmap the capture and free the indexes
+ *
+ * @return    NONE
+ *
+ */
+VOID
+DECODER_Close (
+    DECODER_STREAM  stream
+)
+{
+    if (!stream) {
+        return;
+    }
+    if (DECODER_STREAM_base(stream)) {
+        munmap(DECODER_STREAM_base(stream), DECODER_STREAM_length(stream));
+    }
+    free(DECODER_STREAM_offsets(stream));
+    free(DECODER_STREAM_time_order(stream));
+    free(DECODER_STREAM_pid_order(stream));
+    free(DECODER_STREAM_driver_offsets(stream));
+    free(stream);
+}
@@ -0,0 +1,111 @@
+/****
+    Copyright (C) 2019-2020 Intel Corporation.  All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+
+
+
+
+
+****/
+
+#ifndef _DECODER_H_
+#define _DECODER_H_
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/*
+ * Host-side decoder for the data channel captures of the test harness.
+ * A stream memory-maps one capture file; DECODER_Index walks it once and
+ * records where every record starts, in which order the records go by time,
+ * and which records belong to each pid. The records are then read in place,
+ * one at a time or in batches of field arrays. The records the driver
+ * writes among the samples of a core stream (DRV_*_DESCRIPTOR_ID) are
+ * indexed apart and read with DECODER_Driver_Record. DECODER_Emon_Delta
+ * decodes the records of the EMON device in delta-encoded mode.
+ */
+
+// stream types, numbered like COMM_DATA_TYPE
+#define DECODER_STREAM_CORE          0
+#define DECODER_STREAM_MODULE        1
+#define DECODER_STREAM_UNCORE        2
+#define DECODER_STREAM_SIDEBAND      3
+
+// the file holds the chunks of a resumable session (see COMM_FLAG_RESUMABLE)
+#define DECODER_FLAG_FRAMED          0x1
+
+#define DECODER_MAX_DESCRIPTORS      256
+
+// parts of a sample located by its event descriptor
+#define DECODER_TAIL_PEBS            0
+#define DECODER_TAIL_LBR             1
+#define DECODER_TAIL_EBC             2
+#define DECODER_TAIL_UNCORE_EBC      3
+#define DECODER_TAIL_CALLSTACK       4
+
+typedef struct DECODER_STREAM_NODE_S  DECODER_STREAM_NODE;
+typedef        DECODER_STREAM_NODE   *DECODER_STREAM;
+
+/*
+ * Field arrays filled by DECODER_Read_Batch, one entry per record.
+ * Every array holds at least the requested count; NULL arrays are skipped.
+ */
+typedef struct DECODER_BATCH_NODE_S  DECODER_BATCH_NODE;
+typedef        DECODER_BATCH_NODE   *DECODER_BATCH;
+
+struct DECODER_BATCH_NODE_S {
+    U64  *tsc;
+    U64  *ip;               // sample ip, load address of a module record
+    U32  *pid;
+    U32  *tid;
+    U32  *cpu;              // package of an uncore sample
+    U32  *descriptor_id;
+};
+
+#define DECODER_BATCH_tsc(b)              (b)->tsc
+#define DECODER_BATCH_ip(b)               (b)->ip
+#define DECODER_BATCH_pid(b)              (b)->pid
+#define DECODER_BATCH_tid(b)              (b)->tid
+#define DECODER_BATCH_cpu(b)              (b)->cpu
+#define DECODER_BATCH_descriptor_id(b)    (b)->descriptor_id
+
+extern DRV_STATUS DECODER_Open(const char *path, U32 type, U32 flags, DECODER_STREAM *stream);
+extern DRV_STATUS DECODER_Set_Descriptor(DECODER_STREAM stream, U32 descriptor_id, EVENT_DESC desc);
+extern DRV_STATUS DECODER_Index(DECODER_STREAM stream);
+extern U64        DECODER_Num_Records(DECODER_STREAM stream);
+extern VOID      *DECODER_Record(DECODER_STREAM stream, U64 index, U32 *size);
+extern U64        DECODER_Num_Driver_Records(DECODER_STREAM stream);
+extern VOID      *DECODER_Driver_Record(DECODER_STREAM stream, U64 index, U32 *size);
+extern U32        DECODER_Read_Batch(DECODER_STREAM stream, U64 first, U32 count, DECODER_BATCH batch);
+extern DRV_STATUS DECODER_Tail(DECODER_STREAM stream, U64 index, U32 tail, VOID **data, U32 *size);
+extern U64        DECODER_Find_Tsc(DECODER_STREAM stream, U64 tsc);
+extern U64        DECODER_Time_Order(DECODER_STREAM stream, U64 position);
+extern U64        DECODER_Pid_Records(DECODER_STREAM stream, U32 pid, U64 *indexes, U64 max_indexes);
+extern U64        DECODER_Count_Ip_Range(DECODER_STREAM stream, U64 low, U64 high);
+extern DRV_STATUS DECODER_Emon_Delta(VOID *record, U32 available, U64 *previous, U64 *entries);
+extern VOID       DECODER_Close(DECODER_STREAM stream);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,181 @@
+#
+#    Copyright (C) 2019-2020 Intel Corporation.  All Rights Reserved.
+#
+#Permission is hereby granted, free of charge, to any person obtaining a copy
+#of this software and associated documentation files (the "Software"), to deal
+#in the Software without restriction, including without limitation the rights
+#to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+#copies of the Software, and to permit persons to whom the Software is
+#furnished to do so, subject to the following conditions:
+#
+#The above copyright notice and this permission notice shall be included in all
+#copies or substantial portions of the Software.
+#
+#THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+#IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+#FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+#AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+#LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+#OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+#SOFTWARE.
+#
+#
+#
+#
+#
+#
+#
+
+
+# Bindings for the agent's derived metrics, build them first with 'make' in ./decoder,
+# and the evaluation of agentdk/metrics.c redone in python on raw READ_AND_RESET buffers
+
+import os
+import ctypes
+
+import structures as drv
+
+VT_SUCCESS       = 0
+VT_BAD_PARAMETER = 63
+
+LIBRARY_PATH = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'decoder', 'libsepmetrics.so')
+
+
+class MetricsException(Exception): pass
+
+class IoctlArgs(ctypes.Structure): # IOCTL_ARGS_NODE_S, DRV_EM64T
+    _fields_ = [
+        ('len_drv_to_usr', ctypes.c_ulonglong),
+        ('buf_drv_to_usr', ctypes.c_void_p),
+        ('len_usr_to_drv', ctypes.c_ulonglong),
+        ('buf_usr_to_drv', ctypes.c_void_p),
+        ('command',        ctypes.c_uint),
+    ]
+
+
+# formula tokens, in reverse Polish notation
+def event(index):
+    return (drv.DRV_METRIC_TOKEN_EVENT, index, 0)
+
+def tsc():
+    return (drv.DRV_METRIC_TOKEN_TSC, 0, 0)
+
+def interval():
+    return (drv.DRV_METRIC_TOKEN_INTERVAL, 0, 0)
+
+def const(value):
+    return (drv.DRV_METRIC_TOKEN_CONST, 0, value)
+
+def op(operator):
+    return (drv.DRV_METRIC_TOKEN_OP, operator, 0)
+
+
+def definitions(struct, metrics):
+    # DRV_METRIC_DEF_NODE array of [(name, tokens)]
+    defs = (struct.MetricDef * len(metrics))()
+    for metric, (name, tokens) in zip(defs, metrics):
+        metric.name = name.encode()
+        metric.num_tokens = len(tokens)
+        for token, (token_type, arg, value) in zip(metric.tokens, tokens):
+            token.type, token.arg, token.value = token_type, arg, value
+    return bytearray(defs)
+
+def series(struct, data):
+    # DRV_METRIC_SERIES header and its rows of float values
+    header = struct.MetricSeries.from_buffer_copy(data[:ctypes.sizeof(struct.MetricSeries)])
+    values = (ctypes.c_float * (header.num_metrics * header.num_samples)).from_buffer_copy(
+        data[ctypes.sizeof(header):ctypes.sizeof(header) + 4 * header.num_metrics * header.num_samples])
+    rows = [list(values[row * header.num_metrics:(row + 1) * header.num_metrics]) for row in range(header.num_samples)]
+    return header, rows
+
+def evaluate(metrics, buffer, num_cpus, interval_number):
+    # METRICS_Evaluate on one interval: doubles on the stack, float in the series
+    counts = buffer[num_cpus:]
+    row = []
+    for name, tokens in metrics:
+        stack = []
+        for token_type, arg, value in tokens:
+            if token_type == drv.DRV_METRIC_TOKEN_EVENT:
+                stack.append(float(counts[arg]) if arg < len(counts) else 0.0)
+            elif token_type == drv.DRV_METRIC_TOKEN_TSC:
+                stack.append(float(buffer[0]))
+            elif token_type == drv.DRV_METRIC_TOKEN_INTERVAL:
+                stack.append(float(interval_number))
+            elif token_type == drv.DRV_METRIC_TOKEN_CONST:
+                stack.append(float(value))
+            else:
+                right = stack.pop()
+                left = stack.pop()
+                if arg == drv.DRV_METRIC_OP_ADD:
+                    stack.append(left + right)
+                elif arg == drv.DRV_METRIC_OP_SUB:
+                    stack.append(left - right)
+                elif arg == drv.DRV_METRIC_OP_MUL:
+                    stack.append(left * right)
+                else:
+                    stack.append(left / right if right != 0 else 0.0)
+        row.append(ctypes.c_float(stack[0]).value)
+    return row
+
+
+_library = None
+
+def library():
+    global _library
+    if _library is None and os.path.exists(LIBRARY_PATH):
+        lib = ctypes.CDLL(LIBRARY_PATH)
+        lib.METRICS_Set_Definitions.argtypes = [ctypes.POINTER(IoctlArgs)]
+        lib.METRICS_Set_Definitions.restype = ctypes.c_int
+        lib.METRICS_Get_Series.argtypes = [ctypes.POINTER(IoctlArgs)]
+        lib.METRICS_Get_Series.restype = ctypes.c_int
+        lib.METRICS_Evaluate.argtypes = [ctypes.POINTER(ctypes.c_ulonglong), ctypes.c_ulonglong, ctypes.c_uint]
+        lib.METRICS_Evaluate.restype = None
+        lib.METRICS_Clear.argtypes = []
+        lib.METRICS_Clear.restype = None
+        _library = lib
+    return _library
+
+def available():
+    return library() is not None
+
+
+class Metrics(object):
+    # The agent's metric engine in the host process; it keeps one set of definitions, as the agent does
+    def __init__(self, struct):
+        self._lib = library()
+        if self._lib is None:
+            raise MetricsException("ERROR: {} is not built".format(LIBRARY_PATH))
+        self._struct = struct
+        self._num_metrics = 0
+        self._lib.METRICS_Clear()
+
+    def set_definitions(self, metrics):
+        data = definitions(self._struct, metrics)
+        args = IoctlArgs(len_usr_to_drv=len(data))
+        if data:
+            args.buf_usr_to_drv = ctypes.addressof((ctypes.c_char * len(data)).from_buffer(data))
+        status = self._lib.METRICS_Set_Definitions(ctypes.byref(args))
+        self._num_metrics = len(metrics) if status == VT_SUCCESS else 0
+        return status
+
+    def evaluate(self, buffer, num_cpus):
+        values = (ctypes.c_ulonglong * len(buffer))(*buffer)
+        self._lib.METRICS_Evaluate(values, ctypes.sizeof(values), num_cpus)
+
+    def series(self, since=None, max_rows=drv.DRV_METRIC_MAX_SAMPLES):
+        # room for max_rows rows, as the host sizes its GET_METRICS reply
+        output = bytearray(ctypes.sizeof(self._struct.MetricSeries) +
+                           max_rows * max(self._num_metrics, 1) * ctypes.sizeof(ctypes.c_float))
+        args = IoctlArgs(len_drv_to_usr=len(output),
+                         buf_drv_to_usr=ctypes.addressof((ctypes.c_char * len(output)).from_buffer(output)))
+        if since is not None:
+            start = ctypes.c_ulonglong(since)
+            args.len_usr_to_drv = ctypes.sizeof(start)
+            args.buf_usr_to_drv = ctypes.addressof(start)
+        status = self._lib.METRICS_Get_Series(ctypes.byref(args))
+        if status != VT_SUCCESS:
+            raise MetricsException("ERROR: Cannot read the metric series - status {}".format(status))
+        return series(self._struct, output)
+
+    def close(self):
+        self._lib.METRICS_Clear()
@@ -102,3 +102,18 @@ SET_OSID                      = 92
 GET_AGENT_MODE                = 93
 INIT_DRIVER                   = 94
 SET_EMON_BUFFER_DRIVER_HELPER = 95
+GET_NUM_VM                    = 96
+GET_VCPU_MAP                  = 97
+GET_PERF_CAPAB                = 98
+GET_DRIVER_OVERHEAD           = 99
+SET_THROTTLE                  = 100
+SET_WAKEUP                    = 101
+SET_EM_TIMING                 = 102
+SET_EMON_DELTA                = 103
+SET_METRICS                   = 104 # covered
+GET_METRICS                   = 105 # covered
+GET_NUM_PACKAGES              = 106
+SET_TASK_FILTER               = 107
+SET_TIME_SYNC                 = 108
+GET_SYS_INFO_GENERATION       = 109
+RECONFIGURE                   = 110
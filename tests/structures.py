@@ -142,8 +142,8 @@ class FirstCommunicationMsg(object): # CONTROL_FIRST_MSG_NODE_S
             ('msg_size',            ctypes.c_uint),
             ('proto_version',       ctypes.c_uint),
             ('per_cpu_buffer_size', ctypes.c_uint),
-            ('reserved1',           ctypes.c_uint),
-            ('reserved2',           ctypes.c_ulonglong),
+            ('flags',               ctypes.c_uint),
+            ('resume_id',           ctypes.c_ulonglong),
         ]
         _defaults_ = [
             ('proto_version', 6),
@@ -174,6 +174,18 @@ class FirstDataMsg(object): # DATA_FIRST_MSG_NODE_S
         ]
 
 
+class DataChunkHeader(object): # COMM_DATA_CHUNK_HEADER_NODE_S
+    class v7(_Structure):
+        _full_name_ = 'DataChunkHeader_v7'
+        _fields_ = [
+            ('size',     ctypes.c_uint),
+            ('reserved', ctypes.c_uint),
+            ('seq',      ctypes.c_ulonglong),
+        ]
+
+
+CONTROL_MSG_FLAG_CACHED_REPLY            = 0x1
+
 class ControlMsg(object): # CONTROL_MSG_HEADER_NODE_S
     class v3(_Structure):
         _full_name_ = 'ControlMsg_v3'
@@ -197,7 +209,7 @@ class ControlMsg(object): # CONTROL_MSG_HEADER_NODE_S
             ('from_target_data_size', ctypes.c_ulonglong),
 #            ('device_type',           ctypes.c_uint),
 #            ('reserved1',             ctypes.c_uint),
-            ('reserved1',             ctypes.c_ulonglong),
+            ('flags',                 ctypes.c_ulonglong),
             ('reserved2',             ctypes.c_ulonglong),
         ]
         _defaults_ = [
@@ -230,6 +242,18 @@ class RemoteHardwareInfo(object): # REMOTE_HARDWARE_INFO_NODE
             ('reserved2', ctypes.c_ulonglong),
             ('reserved3', ctypes.c_ulonglong),
         ]
+    class v7(_Structure):
+        _full_name_ = 'RemoteHardwareInfo_v7'
+        _fields_ = [
+            ('num_cpus',     ctypes.c_uint),
+            ('family',       ctypes.c_uint),
+            ('model',        ctypes.c_uint),
+            ('stepping',     ctypes.c_uint),
+            ('tsc_freq',     ctypes.c_ulonglong),
+            ('num_packages', ctypes.c_uint),
+            ('reserved2',    ctypes.c_uint),
+            ('reserved3',    ctypes.c_ulonglong),
+        ]
 
 
 class DriverVersionInfo(object): # SEP_VERSION_NODE_S
@@ -298,6 +322,27 @@ class TargetStatusMsg(object): # TARGET_STATUS_MSG_NODE_S
         _defaults_ = [
             ('proto_version', 6),
         ]
+    class v7(_Structure):
+        _full_name_ = 'TargetStatusMsg_v7'
+        _fields_ = [
+            ('msg_size',               ctypes.c_uint),
+            ('proto_version',          ctypes.c_uint),
+            ('status',                 ctypes.c_int),
+            ('flags',                  ctypes.c_uint),
+            ('session_id',             ctypes.c_ulonglong),
+            ('os_info_offset',         ctypes.c_uint),
+            ('os_info_size',           ctypes.c_uint),
+            ('collect_switch_offset',  ctypes.c_uint),
+            ('collect_switch_size',    ctypes.c_uint),
+            ('hardware_info_offset',   ctypes.c_uint),
+            ('hardware_info_size',     ctypes.c_uint),
+            ('remote_os_info',       RemoteOsInfo.v3),
+            ('remote_switch',        RemoteSwitch.v3),
+            ('remote_hardware_info', RemoteHardwareInfo.v7)
+        ]
+        _defaults_ = [
+            ('proto_version', 7),
+        ]
 
 
 MAX_NUM_OS_ALLOWED                       = 6
@@ -901,6 +946,199 @@ class UncoreSampleRecordPC(object): # UncoreSampleRecordPC_s
     ]
 
 
+# records the driver writes among the samples of the per-CPU sample streams
+DRV_THROTTLE_DESCRIPTOR_ID               = 0xFFFFFFF0
+DRV_EM_TIME_DESCRIPTOR_ID                = 0xFFFFFFEF
+DRV_EMON_CPU_DESCRIPTOR_ID               = 0xFFFFFFEE
+DRV_EMON_DELTA_DESCRIPTOR_ID             = 0xFFFFFFED
+DRV_USER_MARKER_DESCRIPTOR_ID            = 0xFFFFFFEC
+DRV_TIME_SYNC_DESCRIPTOR_ID              = 0xFFFFFFEB
+DRV_CONFIG_EPOCH_DESCRIPTOR_ID           = 0xFFFFFFEA
+DRV_EMON_CPU_WINDOW_THREAD               = 0
+DRV_EMON_CPU_WINDOW_PACKAGE              = 1
+DRV_EMON_DELTA_FLAG_KEYFRAME             = 0x1
+DRV_TIME_SYNC_FLAG_FINAL                 = 0x1
+
+class ThrottleRecord(object): # DRV_THROTTLE_RECORD_NODE_S
+    class v3(_Structure):
+        _full_name_ = 'ThrottleRecord_v3'
+        _fields_ = [
+            ('descriptor_id', ctypes.c_uint),
+            ('osid',          ctypes.c_uint),
+            ('cpu_num',       ctypes.c_uint),
+            ('factor',        ctypes.c_uint),
+            ('epoch',         ctypes.c_ulonglong),
+            ('tsc',           ctypes.c_ulonglong),
+        ]
+        _defaults_ = [
+            ('descriptor_id', DRV_THROTTLE_DESCRIPTOR_ID),
+        ]
+
+
+class EmTimeRecord(object): # DRV_EM_TIME_RECORD_NODE_S
+    class v3(_Structure):
+        _full_name_ = 'EmTimeRecord_v3'
+        _fields_ = [
+            ('descriptor_id', ctypes.c_uint),
+            ('osid',          ctypes.c_uint),
+            ('cpu_num',       ctypes.c_uint),
+            ('group_id',      ctypes.c_uint),
+            ('time_enabled',  ctypes.c_ulonglong),
+            ('time_running',  ctypes.c_ulonglong),
+            ('tsc',           ctypes.c_ulonglong),
+        ]
+        _defaults_ = [
+            ('descriptor_id', DRV_EM_TIME_DESCRIPTOR_ID),
+        ]
+
+
+class EmonCpuRecord(object): # DRV_EMON_CPU_RECORD_NODE_S
+    class v3(_Structure):
+        _full_name_ = 'EmonCpuRecord_v3'
+        _fields_ = [
+            ('descriptor_id', ctypes.c_uint),
+            ('cpu_num',       ctypes.c_uint),
+            ('interval_id',   ctypes.c_ulonglong),
+            ('tsc',           ctypes.c_ulonglong),
+            ('tsc_delta',     ctypes.c_ulonglong),
+            ('time_sec',      ctypes.c_ulonglong),
+            ('time_usec',     ctypes.c_ulonglong),
+            ('group_id',      ctypes.c_uint),
+            ('num_windows',   ctypes.c_uint),
+            ('size',          ctypes.c_uint),
+            ('reserved1',     ctypes.c_uint),
+        ]
+        _defaults_ = [
+            ('descriptor_id', DRV_EMON_CPU_DESCRIPTOR_ID),
+        ]
+
+
+class EmonCpuWindow(object): # DRV_EMON_CPU_WINDOW_NODE_S
+    class v3(_Structure):
+        _full_name_ = 'EmonCpuWindow_v3'
+        _fields_ = [
+            ('window_type',   ctypes.c_uint),
+            ('count',         ctypes.c_uint),
+            ('offset',        ctypes.c_ulonglong),
+        ]
+
+
+class EmonDeltaRecord(object): # DRV_EMON_DELTA_RECORD_NODE_S
+    class v3(_Structure):
+        _full_name_ = 'EmonDeltaRecord_v3'
+        _fields_ = [
+            ('descriptor_id', ctypes.c_uint),
+            ('flags',         ctypes.c_uint),
+            ('interval_id',   ctypes.c_ulonglong),
+            ('num_intervals', ctypes.c_uint),
+            ('num_entries',   ctypes.c_uint),
+            ('size',          ctypes.c_uint),
+            ('reserved1',     ctypes.c_uint),
+        ]
+        _defaults_ = [
+            ('descriptor_id', DRV_EMON_DELTA_DESCRIPTOR_ID),
+        ]
+
+
+class UserMarkerRecord(object): # DRV_USER_MARKER_RECORD_NODE_S
+    class v3(_Structure):
+        _full_name_ = 'UserMarkerRecord_v3'
+        _fields_ = [
+            ('descriptor_id', ctypes.c_uint),
+            ('osid',          ctypes.c_uint),
+            ('cpu_num',       ctypes.c_uint),
+            ('marker_id',     ctypes.c_uint),
+            ('pid',           ctypes.c_uint),
+            ('tid',           ctypes.c_uint),
+            ('tsc',           ctypes.c_ulonglong),
+            ('payload',       ctypes.c_ulonglong),
+        ]
+        _defaults_ = [
+            ('descriptor_id', DRV_USER_MARKER_DESCRIPTOR_ID),
+        ]
+
+
+class TimeSyncRecord(object): # DRV_TIME_SYNC_RECORD_NODE_S
+    class v3(_Structure):
+        _full_name_ = 'TimeSyncRecord_v3'
+        _fields_ = [
+            ('descriptor_id', ctypes.c_uint),
+            ('osid',          ctypes.c_uint),
+            ('cpu_num',       ctypes.c_uint),
+            ('flags',         ctypes.c_uint),
+            ('sequence',      ctypes.c_ulonglong),
+            ('watermark_tsc', ctypes.c_ulonglong),
+            ('monotonic_ns',  ctypes.c_ulonglong),
+            ('load_tsc_skew', ctypes.c_ulonglong),
+        ]
+        _defaults_ = [
+            ('descriptor_id', DRV_TIME_SYNC_DESCRIPTOR_ID),
+        ]
+
+
+class ConfigEpochRecord(object): # DRV_CONFIG_EPOCH_RECORD_NODE_S
+    class v3(_Structure):
+        _full_name_ = 'ConfigEpochRecord_v3'
+        _fields_ = [
+            ('descriptor_id', ctypes.c_uint),
+            ('osid',          ctypes.c_uint),
+            ('cpu_num',       ctypes.c_uint),
+            ('group',         ctypes.c_uint),
+            ('epoch',         ctypes.c_ulonglong),
+            ('tsc',           ctypes.c_ulonglong),
+        ]
+        _defaults_ = [
+            ('descriptor_id', DRV_CONFIG_EPOCH_DESCRIPTOR_ID),
+        ]
+
+
+# on-target derived metrics, formulas in reverse Polish notation
+DRV_METRIC_MAX_METRICS                   = 32
+DRV_METRIC_MAX_TOKENS                    = 16
+DRV_METRIC_MAX_SAMPLES                   = 1024
+DRV_METRIC_NAME_SIZE                     = 32
+DRV_METRIC_TOKEN_EVENT                   = 0
+DRV_METRIC_TOKEN_TSC                     = 1
+DRV_METRIC_TOKEN_INTERVAL                = 2
+DRV_METRIC_TOKEN_CONST                   = 3
+DRV_METRIC_TOKEN_OP                      = 4
+DRV_METRIC_OP_ADD                        = 0
+DRV_METRIC_OP_SUB                        = 1
+DRV_METRIC_OP_MUL                        = 2
+DRV_METRIC_OP_DIV                        = 3
+
+class MetricToken(object): # DRV_METRIC_TOKEN_NODE_S
+    class v3(_Structure):
+        _full_name_ = 'MetricToken_v3'
+        _fields_ = [
+            ('type',          ctypes.c_uint),
+            ('arg',           ctypes.c_uint),
+            ('value',         ctypes.c_ulonglong),
+        ]
+
+
+class MetricDef(object): # DRV_METRIC_DEF_NODE_S
+    class v3(_Structure):
+        _full_name_ = 'MetricDef_v3'
+        _fields_ = [
+            ('name',          ctypes.c_char * DRV_METRIC_NAME_SIZE),
+            ('num_tokens',    ctypes.c_uint),
+            ('reserved1',     ctypes.c_uint),
+            ('tokens',        MetricToken.v3 * DRV_METRIC_MAX_TOKENS),
+        ]
+
+
+class MetricSeries(object): # DRV_METRIC_SERIES_NODE_S
+    class v3(_Structure):
+        _full_name_ = 'MetricSeries_v3'
+        _fields_ = [
+            ('num_metrics',    ctypes.c_uint),
+            ('num_samples',    ctypes.c_uint),
+            ('first_interval', ctypes.c_ulonglong),
+            ('num_intervals',  ctypes.c_ulonglong),
+        ]
+
+
 KVM_SIGNATURE                            = "KVMKVMKVM\0\0\0"
 XEN_SIGNATURE                            = "XenVMMXenVMM"
 VMWARE_SIGNATURE                         = "VMwareVMware"
@@ -1632,6 +1870,18 @@ def structures(version):
         ModuleRecord          = ModuleRecord.v3
         UncoreSampleRecordPC  = UncoreSampleRecordPC.v3
         DriverControlLog      = DriverControlLog.v3
+        ThrottleRecord        = ThrottleRecord.v3
+        EmTimeRecord          = EmTimeRecord.v3
+        EmonCpuRecord         = EmonCpuRecord.v3
+        EmonCpuWindow         = EmonCpuWindow.v3
+        EmonDeltaRecord       = EmonDeltaRecord.v3
+        UserMarkerRecord      = UserMarkerRecord.v3
+        TimeSyncRecord        = TimeSyncRecord.v3
+        ConfigEpochRecord     = ConfigEpochRecord.v3
+        MetricToken           = MetricToken.v3
+        MetricDef             = MetricDef.v3
+        MetricSeries          = MetricSeries.v3
+        SidebandInfo          = SIDEBAND_INFO_NODE_S.v3
     class v6(object):
         FirstCommunicationMsg = FirstCommunicationMsg.v6
         FirstDataMsg          = FirstDataMsg.v6
@@ -1661,5 +1911,21 @@ def structures(version):
         ModuleRecord          = ModuleRecord.v3
         UncoreSampleRecordPC  = UncoreSampleRecordPC.v3
         DriverControlLog      = DriverControlLog.v3
-
-    return { 3: v3, 6: v6 }[version]
+        ThrottleRecord        = ThrottleRecord.v3
+        EmTimeRecord          = EmTimeRecord.v3
+        EmonCpuRecord         = EmonCpuRecord.v3
+        EmonCpuWindow         = EmonCpuWindow.v3
+        EmonDeltaRecord       = EmonDeltaRecord.v3
+        UserMarkerRecord      = UserMarkerRecord.v3
+        TimeSyncRecord        = TimeSyncRecord.v3
+        ConfigEpochRecord     = ConfigEpochRecord.v3
+        MetricToken           = MetricToken.v3
+        MetricDef             = MetricDef.v3
+        MetricSeries          = MetricSeries.v3
+        SidebandInfo          = SIDEBAND_INFO_NODE_S.v3
+    class v7(v6):
+        RemoteHardwareInfo    = RemoteHardwareInfo.v7
+        TargetStatusMsg       = TargetStatusMsg.v7
+        DataChunkHeader       = DataChunkHeader.v7
+
+    return { 3: v3, 6: v6, 7: v7 }[version]
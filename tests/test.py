@@ -28,11 +28,44 @@
 
 import unittest
 import time
+import os
+import ctypes
+import random
+import shutil
+import tempfile
+
+import decoder
+import capture
+import metrics
+import structures as drv
 
 from config import Config
 from communication import Communication
+from structures import structures
 from log import log
 
+# formulas the agent accepts; a division by zero and an unknown event index evaluate to 0
+METRIC_FORMULAS = [
+    ('count',          [metrics.event(0)]),
+    ('count_per_mtsc', [metrics.event(0), metrics.const(1000000), metrics.op(drv.DRV_METRIC_OP_MUL),
+                        metrics.tsc(), metrics.op(drv.DRV_METRIC_OP_DIV)]),
+    ('ratio',          [metrics.event(1), metrics.event(0), metrics.op(drv.DRV_METRIC_OP_DIV)]),
+    ('div_by_zero',    [metrics.event(0), metrics.const(0), metrics.op(drv.DRV_METRIC_OP_DIV)]),
+    ('unknown_event',  [metrics.event(4096), metrics.const(3), metrics.op(drv.DRV_METRIC_OP_ADD)]),
+    ('interval',       [metrics.interval(), metrics.const(2), metrics.op(drv.DRV_METRIC_OP_SUB)]),
+]
+
+# formulas the agent refuses
+METRIC_REJECTED = [
+    ('stack_underflow',  [metrics.event(0), metrics.op(drv.DRV_METRIC_OP_ADD)]),
+    ('operator_first',   [metrics.op(drv.DRV_METRIC_OP_MUL), metrics.event(0), metrics.event(1)]),
+    ('two_results',      [metrics.event(0), metrics.event(1)]),
+    ('unknown_operator', [metrics.event(0), metrics.event(1), metrics.op(drv.DRV_METRIC_OP_DIV + 1)]),
+    ('unknown_token',    [(drv.DRV_METRIC_TOKEN_OP + 1, 0, 0)]),
+    ('no_token',         []),
+    ('too_many_tokens',  [metrics.const(1)] + [metrics.const(1), metrics.op(drv.DRV_METRIC_OP_ADD)] * 8),
+]
+
 
 class Test(unittest.TestCase):
     def __init__(self, config):
@@ -80,6 +113,16 @@ class SysConfigTest(Test):
         self.communication.sys_config()
         self.communication.terminate()
 
+class SysConfigCacheTest(Test):
+    # The agent keeps sys config replies while the driver's sys info is unchanged
+    def runTest(self):
+        self.communication.init()
+        first = self.communication.sys_config()
+        second = self.communication.sys_config()
+        self.assertTrue(self.communication.reply_cached(), 'GET_SYS_CONFIG was not served from the cache')
+        self.assertEqual(first, second, 'Cached sys config differs from the driver reply')
+        self.communication.terminate()
+
 class PlatformInfoTest(Test):
     def runTest(self):
         self.communication.init()
@@ -127,15 +170,43 @@ class GetNumCoresTest(Test):
         self.assertEqual(num_cores, self.config.cores_number, "Number of cores is incorrect.")
         self.communication.terminate()
 
+class SetMetricsTest(Test):
+    # The agent checks the formulas; a refused set leaves no metric behind
+    def setUp(self):
+        if self.config.protocol_version < 6:
+            raise unittest.SkipTest('Control replies carry no status before protocol 6.')
+        Test.setUp(self)
+
+    def runTest(self):
+        self.communication.init()
+        self.assertEqual(self.communication.set_metrics(METRIC_FORMULAS), metrics.VT_SUCCESS)
+        header, rows = self.communication.get_metrics(num_metrics=len(METRIC_FORMULAS))
+        self.assertEqual((header.num_metrics, header.num_samples, header.num_intervals), (len(METRIC_FORMULAS), 0, 0))
+
+        for name, tokens in METRIC_REJECTED:
+            self.assertEqual(self.communication.set_metrics(METRIC_FORMULAS + [(name, tokens)]),
+                             metrics.VT_BAD_PARAMETER, 'Formula {} was accepted'.format(name))
+            header, rows = self.communication.get_metrics(num_metrics=len(METRIC_FORMULAS) + 1)
+            self.assertEqual(header.num_metrics, 0, 'Formula {} left the previous metrics set'.format(name))
+
+        self.assertEqual(self.communication.set_metrics([]), metrics.VT_SUCCESS)
+        self.communication.terminate()
+
 class CollectionTest(Test):
     def __init__(self, config):
         self.enable_uncore = False
         self.collection_time = 5
+        self.stop_latency = None
+        self.resumable = False
+        self.counting_mode = False
         Test.__init__(self, config)
 
+    def collect(self):
+        time.sleep(self.collection_time)
+
     def runTest(self):
         application = None
-        self.communication.init()
+        self.communication.init(resumable=self.resumable)
         self.communication.set_osid()
         self.communication.version()
         self.communication.setup_info()
@@ -155,7 +226,7 @@ class CollectionTest(Test):
         self.communication.control_driver_log()
         self.communication.init_num_devices()
         self.communication.busy_driver()
-        self.communication.driver_init_driver()
+        self.communication.driver_init_driver(counting_mode=self.counting_mode)
 
         self.communication.set_driver_topology()
         self.communication.setup_descriptors()
@@ -182,8 +253,13 @@ class CollectionTest(Test):
 
         time.sleep(3)
         self.communication.driver_start()
-        time.sleep(5)
+        self.collect()
+        # Stop-to-last-byte: the stop operation plus draining every data channel
+        stop_begin = time.time()
         self.communication.driver_stop()
+        self.stop_latency = time.time() - stop_begin
+        log.info('Stop-to-last-byte latency on {} cores: {:.1f} ms'.format(
+            self.config.cores_number, self.stop_latency * 1000))
 
         if self.enable_uncore:
             self.communication.get_tsc()
@@ -198,6 +274,8 @@ class CollectionTest(Test):
         self.communication.terminate()
 
         #check results
+        if self.counting_mode:
+            return
         if not self.enable_uncore:
             self.communication.check_core_data(self.config.testapp, self.config.testapp_hotspot_ip, threshold=5)
         else:
@@ -214,6 +292,548 @@ class UncoreCollectionTest(CollectionTest):
             raise unittest.SkipTest('SKU does not support uncore events.')
         CollectionTest.setUp(self)
 
+class StopLatencyTest(CollectionTest):
+    def runTest(self):
+        CollectionTest.runTest(self)
+        self.assertLess(self.stop_latency, self.config.stop_latency_limit,
+                        'Stop took {:.1f} ms on {} cores'.format(self.stop_latency * 1000,
+                                                                 self.config.cores_number))
+
+class DeliveryLatencyTest(CollectionTest):
+    # Start the agent with '-ml <ms>' to bound how long records may wait in the driver
+    def runTest(self):
+        CollectionTest.runTest(self)
+        latencies = sorted(self.communication.sample_latencies())
+        self.assertTrue(latencies, 'No samples were delivered')
+
+        def percentile(rank):
+            return latencies[min(len(latencies) - 1, int(rank * len(latencies)))]
+
+        log.info('Sample-to-host latency over {} samples: p50 {:.1f} ms, p90 {:.1f} ms, p99 {:.1f} ms, max {:.1f} ms'.format(
+            len(latencies), percentile(0.5) * 1000, percentile(0.9) * 1000,
+            percentile(0.99) * 1000, latencies[-1] * 1000))
+        self.assertLess(percentile(0.99), self.config.delivery_latency_limit,
+                        'p99 sample-to-host latency is {:.1f} ms'.format(percentile(0.99) * 1000))
+
+class SidebandCollectionTest(CollectionTest):
+    # Context switches on the sideband channels, sent by VM agents and by the perf_event_open backend
+    def runTest(self):
+        CollectionTest.runTest(self)
+        if not self.communication.channels.sideband_data_channels:
+            raise unittest.SkipTest('The target sends no sideband.')
+        switches = self.communication.check_sideband_data()
+        start_tsc = self.communication.start_clock[1]
+        self.assertTrue(all(tsc >= start_tsc for records in switches.values() for tsc, pid, tid in records),
+                        'Context switches are older than the collection')
+        self.assertGreater(len([cpu for cpu, records in switches.items() if records]), 1,
+                           'Context switches were seen on one cpu only')
+
+class MetricsCollectionTest(CollectionTest):
+    # Counting collection read through the agent; its metric series must match the raw READ_AND_RESET buffers
+    def __init__(self, config):
+        CollectionTest.__init__(self, config)
+        self.counting_mode = True
+        self.read_period = 0.1
+        self.buffers = []
+        self.rows = []
+
+    def collect(self):
+        self.assertEqual(self.communication.set_metrics(METRIC_FORMULAS), metrics.VT_SUCCESS)
+        # the counter buffer INIT_PMU sized, 7 counters per cpu
+        num_counts = self.communication.num_cpus * 7
+        end = time.time() + self.collection_time
+        while time.time() < end:
+            time.sleep(self.read_period)
+            self.buffers.append(self.communication.read_and_reset(num_counts))
+            # poll from the first interval not seen yet, as a live view does
+            header, rows = self.communication.get_metrics(since=len(self.rows), num_metrics=len(METRIC_FORMULAS))
+            self.assertEqual(header.first_interval, len(self.rows), 'The series skipped intervals')
+            self.rows.extend(rows)
+
+    def runTest(self):
+        CollectionTest.runTest(self)
+        self.assertEqual(len(self.rows), len(self.buffers), 'Intervals read and metric rows differ')
+        self.assertTrue(any(buffer[self.communication.num_cpus] for buffer in self.buffers), 'Nothing was counted')
+        for interval, (buffer, row) in enumerate(zip(self.buffers, self.rows)):
+            self.assertEqual(row, metrics.evaluate(METRIC_FORMULAS, buffer, self.communication.num_cpus, interval),
+                             'Metrics of interval {} differ from the raw counts'.format(interval))
+
+class OfflineTest(unittest.TestCase):
+    # Checks of the host-side tools on synthetic data, no target is involved
+    def __init__(self, config):
+        unittest.TestCase.__init__(self)
+        self.config = config
+        self.directory = None
+        self.struct = structures(7)
+
+    def setUp(self):
+        self.directory = tempfile.mkdtemp()
+
+    def tearDown(self):
+        shutil.rmtree(self.directory)
+
+    def write_framed(self, name, chunks):
+        # chunks of (seq, [records]) as the resumable channels store them
+        path = os.path.join(self.directory, name)
+        with open(path, 'wb') as capture:
+            for seq, records in chunks:
+                payload = bytearray().join(records)
+                capture.write(bytearray(self.struct.DataChunkHeader(size=len(payload), seq=seq)) + payload)
+        return path
+
+class DecoderStreamTest(OfflineTest):
+    # Samples mixed with every driver record, a chunk received twice and samples out of time order
+    def setUp(self):
+        if not decoder.available():
+            raise unittest.SkipTest('The native decoder is not built.')
+        OfflineTest.setUp(self)
+
+    def runTest(self):
+        def sample(tsc, ip, pid):
+            return bytearray(self.struct.SampleRecordPC(iip=ip, pidRecIndex=pid, tid=pid, tsc=tsc))
+
+        window = self.struct.EmonCpuWindow(window_type=drv.DRV_EMON_CPU_WINDOW_THREAD, count=3, offset=4)
+        emon = self.struct.EmonCpuRecord(cpu_num=1, interval_id=5, tsc=150, num_windows=1)
+        emon.size = ctypes.sizeof(emon) + ctypes.sizeof(window) + 3 * ctypes.sizeof(ctypes.c_ulonglong)
+        emon_record = bytearray(emon) + bytearray(window) + bytearray((ctypes.c_ulonglong * 3)(7, 8, 9))
+        second = [emon_record, sample(200, 0x2000, 20),
+                  bytearray(self.struct.UserMarkerRecord(marker_id=1, pid=20, tid=20, tsc=90))]
+        path = self.write_framed('data_CORE.0.bin', [
+            (1, [sample(100, 0x1000, 10), bytearray(self.struct.ThrottleRecord(factor=2, epoch=1, tsc=120)),
+                 sample(300, 0x1010, 10), bytearray(self.struct.EmTimeRecord(time_enabled=5, time_running=4, tsc=310))]),
+            (2, second),
+            (2, second),  # sent again after a resume
+            (3, [bytearray(self.struct.TimeSyncRecord(flags=drv.DRV_TIME_SYNC_FLAG_FINAL, watermark_tsc=320)),
+                 bytearray(self.struct.ConfigEpochRecord(epoch=1, tsc=330)), sample(250, 0x1008, 10)]),
+        ])
+
+        stream = decoder.Stream(path, decoder.STREAM_CORE, framed=True)
+        try:
+            self.assertEqual(len(stream), 4, 'Driver records or the repeated chunk were taken for samples')
+            self.assertEqual(stream.count_ip_range(0, 0xFFFFFFFFFFFFFFFF), 4, 'Driver records were counted as samples')
+            self.assertEqual(stream.count_ip_range(0x1000, 0x100F), 2)
+
+            decoded, arrays = stream.batch(0, 8)
+            self.assertEqual(decoded, 4)
+            self.assertEqual(list(arrays['tsc'][:decoded]), [100, 300, 200, 250])
+            self.assertEqual(list(arrays['ip'][:decoded]), [0x1000, 0x1010, 0x2000, 0x1008])
+            self.assertEqual([arrays['tsc'][stream.time_order(position)] for position in range(decoded)],
+                             [100, 200, 250, 300], 'Samples are not in time order')
+            self.assertEqual(stream.find_tsc(201), 2)
+            self.assertEqual(stream.pid_records(20), [2])
+            self.assertEqual(stream.pid_records(10), [0, 1, 3])
+
+            records = stream.driver_records()
+            self.assertEqual([int(ctypes.c_uint.from_buffer(record).value) for record in records],
+                             [drv.DRV_THROTTLE_DESCRIPTOR_ID, drv.DRV_EM_TIME_DESCRIPTOR_ID,
+                              drv.DRV_EMON_CPU_DESCRIPTOR_ID, drv.DRV_USER_MARKER_DESCRIPTOR_ID,
+                              drv.DRV_TIME_SYNC_DESCRIPTOR_ID, drv.DRV_CONFIG_EPOCH_DESCRIPTOR_ID])
+            self.assertEqual([len(record) for record in records],
+                             [ctypes.sizeof(self.struct.ThrottleRecord), ctypes.sizeof(self.struct.EmTimeRecord),
+                              emon.size, ctypes.sizeof(self.struct.UserMarkerRecord),
+                              ctypes.sizeof(self.struct.TimeSyncRecord), ctypes.sizeof(self.struct.ConfigEpochRecord)])
+            self.assertEqual(records[2], emon_record)
+        finally:
+            stream.close()
+
+class CaptureTest(OfflineTest):
+    # Chunks of several CPUs read back by time window, from the index and again from a capture without one
+    def setUp(self):
+        if not capture.available():
+            raise unittest.SkipTest('The capture library is not built.')
+        OfflineTest.setUp(self)
+
+    def runTest(self):
+        sample_size = 64
+
+        def samples(cpu, tscs):
+            data = bytearray()
+            for tsc in tscs:
+                record = bytearray(self.struct.SampleRecordPC(cpuNum=cpu, tsc=tsc))
+                data += record + bytearray(sample_size - len(record))
+            return data
+
+        window = self.struct.EmonCpuWindow(window_type=drv.DRV_EMON_CPU_WINDOW_THREAD, count=1, offset=0)
+        emon = self.struct.EmonCpuRecord(cpu_num=1, interval_id=1, tsc=1800, num_windows=1)
+        emon.size = ctypes.sizeof(emon) + ctypes.sizeof(window) + ctypes.sizeof(ctypes.c_ulonglong)
+        # the driver records widen the TSC range of their chunk
+        chunks = {
+            0: [samples(0, [1000, 1400]) + bytearray(self.struct.TimeSyncRecord(cpu_num=0, watermark_tsc=1500)),
+                samples(0, [2100, 2600]) + bytearray(self.struct.ThrottleRecord(cpu_num=0, factor=2, tsc=2700))],
+            1: [samples(1, [1200]) + bytearray(emon) + bytearray(window) + bytearray(ctypes.c_ulonglong(42)),
+                samples(1, [3000, 3500])],
+        }
+        ranges = {0: [(1000, 1500), (2100, 2700)], 1: [(1200, 1800), (3000, 3500)]}
+
+        path = os.path.join(self.directory, 'collection.cap')
+        written = capture.Capture(path, num_cpus=2, tsc_freq=2000)
+        try:
+            written.append(capture.SECTION_DESCRIPTOR, capture.UNKNOWN_SOURCE, self.struct.EventDesc(sample_size=sample_size))
+            written.append(capture.SECTION_START, capture.UNKNOWN_SOURCE, ctypes.c_ulonglong(1000))
+            for cpu in (0, 1):
+                written.append(capture.SECTION_CORE, cpu, chunks[cpu][0])
+            written.append(capture.SECTION_SIDEBAND, 1, self.struct.SidebandInfo(tid=7, pid=7, tsc=1300))
+            for cpu in (0, 1):
+                written.append(capture.SECTION_CORE, cpu, chunks[cpu][1])
+        finally:
+            written.close()
+
+        def check(path, lost):
+            opened = capture.Capture(path)
+            try:
+                self.assertEqual(opened.header().num_cpus, 2)
+                self.assertEqual(opened.header().tsc_freq, 2000)
+                # collection time counts from the start chunk, not from the creation of the capture
+                self.assertEqual(opened.seconds_to_tsc(0.5), 2000)
+                for cpu in (0, 1):
+                    kept = len(chunks[cpu]) - lost.get(cpu, 0)
+                    found = opened.find(capture.SECTION_CORE, cpu, 0, 0xFFFFFFFFFFFFFFFF)
+                    self.assertEqual([(entry.first_tsc, entry.last_tsc) for entry in found], ranges[cpu][:kept])
+                    self.assertEqual([opened.payload(entry) for entry in found], chunks[cpu][:kept])
+                    self.assertEqual([opened.payload(entry) for entry in opened.next(capture.SECTION_CORE, cpu)],
+                                     chunks[cpu][:kept])
+                found = opened.find(capture.SECTION_CORE, 0, opened.seconds_to_tsc(0.5), opened.seconds_to_tsc(1.0))
+                self.assertEqual([opened.payload(entry) for entry in found], chunks[0][1:])
+                found = opened.find(capture.SECTION_CORE, 1, opened.seconds_to_tsc(0.25), opened.seconds_to_tsc(0.5))
+                self.assertEqual([opened.payload(entry) for entry in found], chunks[1][:1])
+                found = opened.find(capture.SECTION_SIDEBAND, 1, 0, 0xFFFFFFFFFFFFFFFF)
+                self.assertEqual([(entry.first_tsc, entry.last_tsc) for entry in found], [(1300, 1300)])
+            finally:
+                opened.close()
+
+        check(path, {})
+
+        # an agent killed during the collection leaves no index, and the chunk being written torn
+        with open(path, 'rb') as closed:
+            data = closed.read()
+        index_offset = ctypes.c_ulonglong.from_buffer_copy(data[-ctypes.sizeof(ctypes.c_ulonglong):]).value
+        torn = os.path.join(self.directory, 'torn.cap')
+        with open(torn, 'wb') as killed:
+            killed.write(data[:index_offset - 8])
+        check(torn, {1: 1})
+
+class EmonDeltaEncoder(object):
+    # The encoder of sepdk/src/emondelta.c, writing the records as the EMON device returns them
+    MASK = 0xFFFFFFFFFFFFFFFF
+
+    def __init__(self, struct, num_entries, header_entries, keyframe_interval, downsample_factor):
+        self.struct = struct
+        self.num_entries = num_entries
+        self.header_entries = header_entries
+        self.keyframe_interval = keyframe_interval
+        self.downsample_factor = downsample_factor
+        self.accumulated = [0] * num_entries
+        self.previous = [0] * num_entries
+        self.pending = 0
+        self.since_keyframe = 0
+        self.need_keyframe = True
+        self.interval = 0
+        self.first = 0
+        self.output = bytearray()
+        self.written = []   # (interval_id, num_intervals, entries) of every record in output
+        self.keyframes = []
+
+    def snapshot(self, entries, drop=False):
+        if not self.pending:
+            self.accumulated = list(entries)
+            self.first = self.interval
+        else:
+            self.accumulated[:self.header_entries] = entries[:self.header_entries]
+            for i in range(self.header_entries, self.num_entries):
+                self.accumulated[i] = (self.accumulated[i] + entries[i]) & self.MASK
+        self.pending += 1
+        self.interval += 1
+        if self.pending >= self.downsample_factor:
+            self.write(drop)
+
+    def stop(self):
+        if self.pending:
+            self.write()
+
+    def write(self, drop=False):
+        keyframe = self.need_keyframe or self.since_keyframe >= self.keyframe_interval
+        payload = bytearray()
+        for value, previous in zip(self.accumulated, self.previous):
+            delta = (value - (0 if keyframe else previous)) & self.MASK
+            zigzag = ((delta << 1) & self.MASK) ^ (self.MASK if delta >> 63 else 0)
+            while True:
+                byte = zigzag & 0x7F
+                zigzag >>= 7
+                payload.append(byte | (0x80 if zigzag else 0))
+                if not zigzag:
+                    break
+        header = self.struct.EmonDeltaRecord(flags=drv.DRV_EMON_DELTA_FLAG_KEYFRAME if keyframe else 0,
+                                             interval_id=self.first, num_intervals=self.pending,
+                                             num_entries=self.num_entries)
+        payload += bytearray(-(ctypes.sizeof(header) + len(payload)) % 8)
+        header.size = ctypes.sizeof(header) + len(payload)
+        intervals = self.pending
+        self.pending = 0
+        if drop:
+            # the EMON buffer was full
+            self.need_keyframe = True
+            return
+        self.output += bytearray(header) + payload
+        self.previous = list(self.accumulated)
+        self.need_keyframe = False
+        self.since_keyframe = 1 if keyframe else self.since_keyframe + 1
+        self.written.append((self.first, intervals, list(self.accumulated)))
+        self.keyframes.append(keyframe)
+
+class EmonDeltaTest(OfflineTest):
+    # Classic EMON records through the driver's delta encoding and back, bit for bit
+    num_cpus = 4
+    num_intervals = 100
+
+    def setUp(self):
+        if not decoder.available():
+            raise unittest.SkipTest('The native decoder is not built.')
+        OfflineTest.setUp(self)
+
+    def emon_records(self):
+        # time_sec and time_usec, the TSC delta of each CPU, then 3 counters per CPU and 2 package counters
+        generator = random.Random(35)
+        records = []
+        for interval in range(self.num_intervals):
+            header = [1600000000 + interval // 10, (interval % 10) * 100000] + [0] * (self.num_cpus - 2)
+            tsc_deltas = [24000000 + generator.randint(-5000, 5000) for _ in range(self.num_cpus)]
+            counters = []
+            for cpu in range(self.num_cpus):
+                counters += [generator.randint(0, 1 << 40), generator.randint(0, 1 << 20), 0]
+            # a 48-bit counter and a 64-bit one, both wrapping during the collection
+            counters += [((1 << 48) - 30 * 7919 + interval * 7919) % (1 << 48),
+                         ((1 << 64) - 50 * 104729 + interval * 104729) % (1 << 64)]
+            records.append(header + tsc_deltas + counters)
+        return records
+
+    def packed(self, entries):
+        return bytearray((ctypes.c_ulonglong * len(entries))(*entries))
+
+    def check(self, keyframe_interval, downsample_factor, dropped=()):
+        records = self.emon_records()
+        encoder = EmonDeltaEncoder(self.struct, len(records[0]), self.num_cpus, keyframe_interval, downsample_factor)
+        for interval, record in enumerate(records):
+            encoder.snapshot(record, drop=interval in dropped)
+        encoder.stop()
+        self.assertTrue(any(encoder.keyframes) and not all(encoder.keyframes))
+
+        decoded = decoder.emon_delta_records(encoder.output)
+        self.assertEqual([(interval_id, num_intervals) for interval_id, num_intervals, entries in decoded],
+                         [(interval_id, num_intervals) for interval_id, num_intervals, entries in encoder.written])
+        for (interval_id, num_intervals, entries), (_, _, expected) in zip(decoded, encoder.written):
+            self.assertEqual(self.packed(entries), self.packed(expected),
+                             'EMON record of interval {} differs'.format(interval_id))
+
+        # the record of a set of intervals: their counts summed modulo 2^64, the time of the last one
+        for interval_id, num_intervals, entries in decoded:
+            covered = records[interval_id:interval_id + num_intervals]
+            expected = covered[-1][:self.num_cpus] + \
+                       [sum(values) & EmonDeltaEncoder.MASK for values in zip(*covered)][self.num_cpus:]
+            self.assertEqual(self.packed(entries), self.packed(expected))
+        return encoder, decoded
+
+    def runTest(self):
+        encoder, decoded = self.check(keyframe_interval=8, downsample_factor=1, dropped=(37,))
+        self.assertEqual([entries for _, _, entries in decoded],
+                         [record for interval, record in enumerate(self.emon_records()) if interval != 37])
+
+        encoder, decoded = self.check(keyframe_interval=4, downsample_factor=3)
+        self.assertEqual(decoded[-1][1], self.num_intervals % 3, 'The last partial record is missing')
+
+        # decoding starts at the first keyframe of a stream joined mid-way
+        offsets = [0]
+        for _ in encoder.written[:-1]:
+            offsets.append(offsets[-1] + self.struct.EmonDeltaRecord.from_buffer_copy(encoder.output[offsets[-1]:]).size)
+        self.assertFalse(encoder.keyframes[1])
+        keyframe = encoder.keyframes.index(True, 1)
+        self.assertEqual(decoder.emon_delta_records(encoder.output[offsets[1]:]), decoded[keyframe:])
+
+class EmonCpuMergeTest(OfflineTest):
+    # Classic EMON records split into per-CPU records as the driver writes them, read back and merged
+    num_cpus = 4
+    num_intervals = 40
+    threads_per_package = 2
+    thread_entries = 3
+    entries_per_package = 8     # 3 counters of each thread, then 2 package counters
+    dropped = (20, 3)           # interval and cpu of a record lost to a full buffer
+
+    def setUp(self):
+        if not decoder.available():
+            raise unittest.SkipTest('The native decoder is not built.')
+        OfflineTest.setUp(self)
+
+    def emon_records(self):
+        generator = random.Random(34)
+        num_packages = self.num_cpus // self.threads_per_package
+        records = []
+        for interval in range(self.num_intervals):
+            header = [1600000000 + interval // 10, (interval % 10) * 100000] + [0] * (self.num_cpus - 2)
+            tsc_deltas = [24000000 + generator.randint(-5000, 5000) for _ in range(self.num_cpus)]
+            data = [generator.randint(0, 1 << 48) for _ in range(num_packages * self.entries_per_package)]
+            records.append(header + tsc_deltas + data)
+        return records
+
+    def cpu_record(self, cpu, interval_id, record, previous):
+        # lwpmudrv_Emon_Write_Cpu_Record: the package window of a socket master, then the thread window
+        package_offset = (cpu // self.threads_per_package) * self.entries_per_package
+        thread_offset = package_offset + (cpu % self.threads_per_package) * self.thread_entries
+        data = record[2 * self.num_cpus:]
+        windows = []
+        if cpu % self.threads_per_package == 0:
+            # the sibling threads have not read this interval yet
+            package = data[package_offset:package_offset + self.entries_per_package]
+            if previous is not None:
+                stale = previous[2 * self.num_cpus:]
+                sibling = thread_offset + self.thread_entries
+                package[sibling - package_offset:self.thread_entries * self.threads_per_package] = \
+                    stale[sibling:package_offset + self.thread_entries * self.threads_per_package]
+            windows.append((drv.DRV_EMON_CPU_WINDOW_PACKAGE, package_offset, package))
+        windows.append((drv.DRV_EMON_CPU_WINDOW_THREAD, thread_offset,
+                        data[thread_offset:thread_offset + self.thread_entries]))
+
+        header = self.struct.EmonCpuRecord(cpu_num=cpu, interval_id=interval_id, tsc=1000 + interval_id * 100,
+                                           tsc_delta=record[self.num_cpus + cpu], time_sec=record[0],
+                                           time_usec=record[1], num_windows=len(windows))
+        body = bytearray()
+        for window_type, offset, values in windows:
+            body += bytearray(self.struct.EmonCpuWindow(window_type=window_type, count=len(values), offset=offset))
+            body += bytearray((ctypes.c_ulonglong * len(values))(*values))
+        header.size = ctypes.sizeof(header) + len(body)
+        return bytearray(header) + body
+
+    def runTest(self):
+        records = self.emon_records()
+        num_entries = len(records[0])
+        channels = []
+        for cpu in range(self.num_cpus):
+            chunks = [(1, [bytearray(self.struct.TimeSyncRecord(cpu_num=cpu, watermark_tsc=900))])]
+            for interval, record in enumerate(records):
+                if (interval, cpu) == self.dropped:
+                    continue
+                previous = records[interval - 1] if interval else None
+                chunks.append((len(chunks) + 1, [self.cpu_record(cpu, interval, record, previous)]))
+            channels.append(self.write_framed('data_CORE.{}.bin'.format(cpu), chunks))
+
+        driver_records = []
+        for path in channels:
+            stream = decoder.Stream(path, decoder.STREAM_CORE, framed=True)
+            try:
+                self.assertEqual(len(stream), 0, 'EMON records were taken for samples')
+                driver_records.extend(stream.driver_records())
+            finally:
+                stream.close()
+        merged = decoder.emon_cpu_merge(driver_records, self.num_cpus, num_entries)
+
+        self.assertEqual([interval_id for interval_id, _, _ in merged], list(range(self.num_intervals)))
+        for interval_id, cpus, entries in merged:
+            if interval_id == self.dropped[0]:
+                self.assertEqual(cpus, [cpu for cpu in range(self.num_cpus) if cpu != self.dropped[1]])
+                continue
+            self.assertEqual(cpus, list(range(self.num_cpus)))
+            self.assertEqual(entries, records[interval_id],
+                             'Merged EMON record of interval {} differs from the classic one'.format(interval_id))
+
+        # only the entries of the lost cpu are missing from its interval
+        interval_id, cpus, entries = merged[self.dropped[0]]
+        missing = [index for index, (value, expected) in enumerate(zip(entries, records[interval_id])) if value != expected]
+        cpu = self.dropped[1]
+        thread_offset = 2 * self.num_cpus + (cpu // self.threads_per_package) * self.entries_per_package + \
+                        (cpu % self.threads_per_package) * self.thread_entries
+        self.assertEqual(missing, [self.num_cpus + cpu] + list(range(thread_offset, thread_offset + self.thread_entries)))
+
+class MetricsEvaluateTest(OfflineTest):
+    # The agent's metric engine fed with READ_AND_RESET buffers, its series checked against the raw counts
+    num_cpus = 4
+    num_counts = 8
+    num_intervals = 1100        # more than the ring keeps
+    idle = (5, 6)               # intervals with nothing counted, and the TSC not moving in the second
+
+    def setUp(self):
+        if not metrics.available():
+            raise unittest.SkipTest('The metrics library is not built.')
+        OfflineTest.setUp(self)
+
+    def buffers(self):
+        generator = random.Random(36)
+        buffers = []
+        for interval in range(self.num_intervals):
+            tsc_deltas = [24000000 + generator.randint(-5000, 5000) for _ in range(self.num_cpus)]
+            counts = [generator.randint(0, 1 << 40) for _ in range(self.num_counts)]
+            if interval in self.idle:
+                counts = [0] * self.num_counts
+            if interval == self.idle[1]:
+                tsc_deltas = [0] * self.num_cpus
+            buffers.append(tsc_deltas + counts)
+        return buffers
+
+    def runTest(self):
+        engine = metrics.Metrics(self.struct)
+        try:
+            for name, tokens in METRIC_REJECTED:
+                self.assertEqual(engine.set_definitions(METRIC_FORMULAS + [(name, tokens)]), metrics.VT_BAD_PARAMETER,
+                                 'Formula {} was accepted'.format(name))
+                self.assertEqual(engine.series()[0].num_metrics, 0, 'Formula {} left metrics set'.format(name))
+
+            self.assertEqual(engine.set_definitions(METRIC_FORMULAS), metrics.VT_SUCCESS)
+            buffers = self.buffers()
+            expected = [metrics.evaluate(METRIC_FORMULAS, buffer, self.num_cpus, interval)
+                        for interval, buffer in enumerate(buffers)]
+            names = [name for name, _ in METRIC_FORMULAS]
+            for interval in self.idle:
+                self.assertEqual(expected[interval][names.index('ratio')], 0)
+            self.assertEqual(expected[self.idle[1]][names.index('count_per_mtsc')], 0)
+            self.assertTrue(all(row[names.index('div_by_zero')] == 0 for row in expected))
+            self.assertTrue(all(row[names.index('unknown_event')] == 3 for row in expected))
+
+            # polled while counting, a few rows per reply
+            rows = []
+            for interval, buffer in enumerate(buffers[:300]):
+                engine.evaluate(buffer, self.num_cpus)
+                if interval % 50 == 49:
+                    while True:
+                        header, polled = engine.series(since=len(rows), max_rows=16)
+                        self.assertEqual(header.first_interval, len(rows))
+                        self.assertEqual(header.num_intervals, interval + 1)
+                        if not polled:
+                            break
+                        rows.extend(polled)
+            self.assertEqual(rows, expected[:300])
+
+            # past the ring only the last intervals are kept
+            for buffer in buffers[300:]:
+                engine.evaluate(buffer, self.num_cpus)
+            header, rows = engine.series()
+            first = self.num_intervals - drv.DRV_METRIC_MAX_SAMPLES
+            self.assertEqual((header.first_interval, header.num_samples, header.num_intervals),
+                             (first, drv.DRV_METRIC_MAX_SAMPLES, self.num_intervals))
+            self.assertEqual(rows, expected[first:])
+            header, rows = engine.series(since=1)
+            self.assertEqual(header.first_interval, first, 'Intervals dropped from the ring were served')
+
+            # new definitions restart the series
+            self.assertEqual(engine.set_definitions(METRIC_FORMULAS[:1]), metrics.VT_SUCCESS)
+            self.assertEqual(engine.series()[0].num_intervals, 0)
+        finally:
+            engine.close()
+
+class ResumeTest(CollectionTest):
+    # Every connection drops mid-collection; the resumed session must miss no data chunk
+    def __init__(self, config):
+        CollectionTest.__init__(self, config)
+        self.resumable = True
+
+    def collect(self):
+        time.sleep(self.collection_time / 2.0)
+        self.communication.resume(outage=self.config.resume_outage)
+        time.sleep(self.collection_time / 2.0)
+
+    def runTest(self):
+        CollectionTest.runTest(self)
+        for channel in self.communication.channels.data_channels:
+            sequences = channel.sequences()
+            self.assertEqual(sequences, list(range(1, len(sequences) + 1)),
+                             '{} has missing or repeated chunks'.format(channel.info))
+
 
 if __name__ == '__main__':
     test_config = Config()
@@ -224,6 +844,7 @@ if __name__ == '__main__':
     test_suite.addTest(SetupInfoTest(test_config))
     test_suite.addTest(SysConfigSizeTest(test_config))
     test_suite.addTest(SysConfigTest(test_config))
+    test_suite.addTest(SysConfigCacheTest(test_config))
     test_suite.addTest(PlatformInfoTest(test_config))
     test_suite.addTest(InitNumDeviceTest(test_config))
     test_suite.addTest(BusyDriverTest(test_config))
@@ -231,8 +852,19 @@ if __name__ == '__main__':
     test_suite.addTest(GetTscTest(test_config))
     # test_suite.addTest(GetThreadInfoTest(test_config)) #status 159. blocking
     test_suite.addTest(GetNumCoresTest(test_config))
+    test_suite.addTest(SetMetricsTest(test_config))
     # test_suite.addTest(CollectionTest(test_config))
     # test_suite.addTest(UncoreCollectionTest(test_config))
+    # test_suite.addTest(StopLatencyTest(test_config))
+    # test_suite.addTest(DeliveryLatencyTest(test_config))
+    # test_suite.addTest(SidebandCollectionTest(test_config))
+    # test_suite.addTest(MetricsCollectionTest(test_config))
+    # test_suite.addTest(ResumeTest(test_config))
+    test_suite.addTest(DecoderStreamTest(test_config))
+    test_suite.addTest(CaptureTest(test_config))
+    test_suite.addTest(EmonDeltaTest(test_config))
+    test_suite.addTest(EmonCpuMergeTest(test_config))
+    test_suite.addTest(MetricsEvaluateTest(test_config))
 
     runner=unittest.TextTestRunner(verbosity=2)
     runner.run(test_suite)